@@ -4,27 +4,62 @@
 #include <tusb.h>
 
 #include <pico/stdlib.h>
+#include <pico/stdio_usb.h>
 #include <pico/usb_reset_interface.h>
 
 #include <pico/bootrom.h>
 #include <boot/picobin.h>
 
+#include <picovd_config.h>
+#include "vd_idle.h"
+#include "vd_mount_ready.h"
+#include "vd_boot.h"
+#include "vd_stats.h"
+#include "vd_uf2_drop.h"
+#include "vd_inbox.h"
+#include "vd_stdio.h"
+#include "vd_log.h"
+#include "vd_profile.h"
+
+#if PICOVD_INBOX_ENABLED
+// An upload file for the host to copy e.g. a configuration into, see vd_inbox.h
+static uint8_t inbox_data[0x8000];
+
+// Logged, so that tests/test_inbox.py can tell each completion and its length
+static void inbox_complete(uint32_t inbox __unused, uint32_t length, void *context __unused) {
+    VD_LOG("INBOX.BIN: %lu bytes received", (unsigned long)length);
+}
+#endif
+
 int main()
 {
+    vd_boot_mark(VD_BOOT_MAIN);
+    vd_stats_init();
+    // Capture everything printed from here on into STDOUT.TXT and STDERR.TXT
+    vd_stdio_init();
+    // Sample this core into GMON.OUT
+    vd_profile_init();
+
     // Initialize XIP and flash, necessary when running as a no_flash binary
+    // This takes only microseconds, so we do it before USB
     rom_connect_internal_flash(); // Ensure the flash is connected
     rom_flash_exit_xip();         // ensure we're starting from SPI-command mode
     rom_flash_enter_cmd_xip();    // send 0xEB + dummy cycles
     rom_flash_flush_cache();
+    vd_boot_mark(VD_BOOT_FLASH_READY);
+
+    // The partition table, also necessary when running as a no_flash binary,
+    // is loaded later, in the background; see PICOVD_BOOTROM_PARTITIONS_LOAD.
+    // Meanwhile, the disk reports "not ready" to the host.
 
-    // Load the partition table from the BootROM,
-    // also necessary when running as a no_flash binary
-    static uint8_t work_area[4 * 1024]; // XXX FIXME
-    int rc = rom_load_partition_table(work_area, sizeof(work_area), false);
+#if PICOVD_INBOX_ENABLED
+    vd_inbox_declare("INBOX.BIN", inbox_data, sizeof(inbox_data), inbox_complete, NULL);
+#endif
 
     // Initialize TinyUSB stack
     board_init();
     tusb_init();
+    vd_boot_mark(VD_BOOT_USB_INIT);
 
     // TinyUSB board init callback after init
     if (board_init_after_tusb) {
@@ -33,11 +68,52 @@ int main()
 
     // let pico sdk use the first cdc interface for std io
     stdio_init_all();
+#if PICOVD_STDIO_ENABLED
+    // printf() goes to STDOUT.TXT only: the CDC driver would block it
+    // while a terminal is open and not reading
+    stdio_set_driver_enabled(&stdio_usb, false);
+#endif
+    vd_boot_mark(VD_BOOT_STDIO_INIT);
+
+#if PICOVD_MOUNT_READY_ENABLED
+    // Precompute and pin everything a host reads when mounting
+    vd_mount_ready_prepare();
+#endif
 
     // main run loop
     while (true) {
         // TinyUSB device task, must be called regurlarly
         tud_task();
+        // Precompute checksums etc. while the bus is idle
+        vd_idle_task();
+        vd_mount_ready_task();
+#if PICOVD_UF2_DROP_ENABLED
+        // Program the UF2 blocks the host has written, a page at a time
+        vd_uf2_drop_task();
+#endif
+#if PICOVD_INBOX_ENABLED
+        // Tell the application about completed uploads
+        vd_inbox_task();
+#endif
+        // Index the new LOG.TXT records in idle time
+        vd_log_task();
+
+        static bool was_mounted = false;
+        if (tud_mounted() != was_mounted) {
+            was_mounted = tud_mounted();
+            VD_LOG("USB %s", was_mounted ? "mounted" : "unmounted");
+        }
+
+        if (tud_mounted()) {
+            vd_boot_mark(VD_BOOT_MOUNTED);
+        }
+        // Print the boot phases once, when somebody is listening, or into STDOUT.TXT
+        static bool boot_reported = false;
+        if (!boot_reported && (PICOVD_STDIO_ENABLED || stdio_usb_connected()) && vd_boot_timestamp(VD_BOOT_MOUNTED)
+            && (!PICOVD_BOOTROM_PARTITIONS_LOAD || vd_boot_timestamp(VD_BOOT_PARTITIONS_LOADED))) {
+            vd_boot_print();
+            boot_reported = true;
+        }
 #if 0
         if (tud_cdc_n_connected(0)) {
             // print on CDC 0 some debug message
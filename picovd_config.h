@@ -39,18 +39,192 @@
 #define PICOVD_FLASH_START_CLUSTER      (0xF000) // See ExFAT-design.md
 #define PICOVD_FLASH_START_LBA          EXFAT_CLUSTER_TO_LBA(PICOVD_FLASH_START_CLUSTER)
 
+// Erased-page map of the flash, see vd_flash_map.h
+// Reads of erased 4 kB pages of FLASH.BIN, the partition files and the raw
+// LUNs are served without XIP.  Costs 2 bits of SRAM per page.
+#define PICOVD_FLASH_ERASED_MAP_ENABLED (1)
+
 // Add support for the RP2350 BootROM flash partitions
 #define PICOVD_BOOTROM_PARTITIONS_ENABLED (1)
 #define PICOVD_BOOTROM_PARTITIONS_FILE_BASE u"PARTx.BIN"
 #define PICOVD_BOOTROM_PARTITIONS_FILE_NAME_LEN 8u
+// Load the partition table in the background after enumeration.
+// Necessary when running as a no_flash binary, like the PicoVD tool.
+#define PICOVD_BOOTROM_PARTITIONS_LOAD  (1)
+// Trim each partition file to the image in the partition: to the end of
+// its picobin block loop, or else to its last page that is not erased.
+// Computed in idle time, once per content change; 0 exposes whole partitions.
+#define PICOVD_BOOTROM_PARTITIONS_TRIM  (1)
+
+// LZ4-compressed views of the flash, see vd_lz4.h: "<partition>.lz4" next to
+// each partition file, and FLASH.BIN.LZ4 with FLASH.BIN.  Costs 2 bytes and a
+// bit of SRAM per 4 kB flash page for the size index, about 1.1 kB for a 2 MB
+// flash, and grows the shared arena from 4 kB to 10 kB (VD_ARENA_LZ4_SIZE).
+#define PICOVD_LZ4_ENABLED              (1)
+#define PICOVD_LZ4_FLASH_FILE_NAME      u"FLASH.BIN.LZ4"
+#define PICOVD_LZ4_FLASH_FILE_NAME_LEN  13u
+#define PICOVD_LZ4_START_CLUSTER        (0x24000) // See ExFAT-design.md
+#define PICOVD_LZ4_START_LBA            EXFAT_CLUSTER_TO_LBA(PICOVD_LZ4_START_CLUSTER)
+
+// UF2 views of the flash, see vd_uf2.h: "<partition>.uf2" next to each partition file,
+// and FLASH.UF2 with FLASH.BIN, to drop onto another board in BOOTSEL mode.
+#define PICOVD_UF2_ENABLED              (1)
+#define PICOVD_UF2_FLASH_FILE_NAME      u"FLASH.UF2"
+#define PICOVD_UF2_FLASH_FILE_NAME_LEN  9u
+#define PICOVD_UF2_START_CLUSTER        (0x20000) // See ExFAT-design.md
+#define PICOVD_UF2_START_LBA            EXFAT_CLUSTER_TO_LBA(PICOVD_UF2_START_CLUSTER)
+
+// Every other file in one archive, see vd_tar.h: ALL.TAR, for a host to collect
+// them all with one sequential read.  Costs 16 bytes of SRAM per file.
+#define PICOVD_TAR_ENABLED              (1)
+#define PICOVD_TAR_FILE_NAME            u"ALL.TAR"
+#define PICOVD_TAR_FILE_NAME_LEN        7u
+#define PICOVD_TAR_FILES_MAX            (32)
+#define PICOVD_TAR_LENGTH_CLUSTERS      (0x4000)  // 64 MiB at most; files past it are left out
+#define PICOVD_TAR_START_CLUSTER        (0x28000) // See ExFAT-design.md
+#define PICOVD_TAR_START_LBA            EXFAT_CLUSTER_TO_LBA(PICOVD_TAR_START_CLUSTER)
+
+// Writable UF2 drop zone, see vd_uf2_drop.h: free clusters for the host to copy
+// a .uf2 file into, programmed into the flash as its blocks stream in.
+// Makes the exFAT LUN writable; costs a 4 kB SRAM staging page per buffer.
+#define PICOVD_UF2_DROP_ENABLED         (0)
+#define PICOVD_UF2_DROP_START_CLUSTER   (0x8000) // See ExFAT-design.md
+#define PICOVD_UF2_DROP_LENGTH_CLUSTERS (0x2000) // 32 MiB, the UF2 of a 16 MB flash
+#define PICOVD_UF2_DROP_BUFFERS         (3)
+
+// RAM-backed upload files, see vd_inbox.h: the application declares files such as
+// INBOX.BIN with vd_inbox_declare(), and the host copies data into their buffers.
+// Makes the exFAT LUN writable.
+#define PICOVD_INBOX_ENABLED            (0)
+#define PICOVD_INBOX_FILES_MAX          (4)        // Share a root directory slot
+#define PICOVD_INBOX_FILE_SIZE_MAX      (0x100000) // 1 MiB of clusters per file
+#define PICOVD_INBOX_IDLE_TIMEOUT_MS    (1000)     // Complete without a directory update
+#define PICOVD_INBOX_START_CLUSTER      (0x5000)   // Within the free cluster range
+#define PICOVD_INBOX_START_LBA          EXFAT_CLUSTER_TO_LBA(PICOVD_INBOX_START_CLUSTER)
+
+// Console output as files, see vd_stdio.h: STDOUT.TXT and STDERR.TXT hold the last
+// PICOVD_STDIO_RING_SIZE bytes printed to stdout and to stderr.  Costs the two rings of SRAM.
+#define PICOVD_STDIO_ENABLED            (1)
+#define PICOVD_STDIO_NOINIT             (1)      // Keep the output over a watchdog reboot
+#define PICOVD_STDIO_RING_SIZE          (0x2000) // Per stream; a power of two, whole clusters
+#define PICOVD_STDIO_STDOUT_FILE_NAME   u"STDOUT.TXT"
+#define PICOVD_STDIO_STDOUT_FILE_NAME_LEN 10u
+#define PICOVD_STDIO_STDERR_FILE_NAME   u"STDERR.TXT"
+#define PICOVD_STDIO_STDERR_FILE_NAME_LEN 10u
+#define PICOVD_STDIO_START_CLUSTER      (0x6000) // Within the free cluster range
+#define PICOVD_STDIO_START_LBA          EXFAT_CLUSTER_TO_LBA(PICOVD_STDIO_START_CLUSTER)
+
+// Deferred-format log, see vd_log.h: VD_LOG() stores a format string pointer, a timestamp
+// and up to four argument words, and LOG.TXT formats them only when the host reads it.
+// Costs 32 bytes of SRAM per record, with its index entry.
+#define PICOVD_LOG_ENABLED              (1)
+#define PICOVD_LOG_RECORDS              (256)    // Power of two
+#define PICOVD_LOG_LINE_MAX             (128)    // Characters, with the timestamp and the newline
+#define PICOVD_LOG_FILE_NAME            u"LOG.TXT"
+#define PICOVD_LOG_FILE_NAME_LEN        7u
+#define PICOVD_LOG_START_CLUSTER        (0x7000) // Within the free cluster range
+#define PICOVD_LOG_START_LBA            EXFAT_CLUSTER_TO_LBA(PICOVD_LOG_START_CLUSTER)
+
+// PC-sampling profiler, see vd_profile.h: a timer interrupt samples the core that calls
+// vd_profile_init(), and GMON.OUT serves the histogram, for gprof with the ELF file.
+// Costs a hardware alarm, and twice the bins and the arcs of SRAM, about 20 kB.
+#define PICOVD_PROFILE_ENABLED          (1)
+#define PICOVD_PROFILE_RATE_HZ          (1000)
+#define PICOVD_PROFILE_BINS             (4096)   // 16-bit counters over the text of the binary
+#define PICOVD_PROFILE_CALLERS          (1)      // Count the interrupted LR as a call arc
+#define PICOVD_PROFILE_ARCS             (128)    // Power of two
+#define PICOVD_PROFILE_FILE_NAME        u"GMON.OUT"
+#define PICOVD_PROFILE_FILE_NAME_LEN    8u
+#define PICOVD_PROFILE_START_CLUSTER    (0xA000) // Within the free cluster range
+#define PICOVD_PROFILE_START_LBA        EXFAT_CLUSTER_TO_LBA(PICOVD_PROFILE_START_CLUSTER)
+
+// gcov counters, see vd_gcov.h: a GCOV directory of .gcda files, encoded as they are read,
+// for gcov or -fprofile-use.  Set by configuring with -DPICOVD_GCOV=ON, which instruments the build.
+#ifndef PICOVD_GCOV_ENABLED
+#define PICOVD_GCOV_ENABLED             (0)
+#endif
+#define PICOVD_GCOV_DIR_NAME            u"GCOV"
+#define PICOVD_GCOV_DIR_NAME_LEN        4u
+#define PICOVD_GCOV_DIR_CLUSTERS        (4)      // 512 entries, about 80 files of 60-character names
+#define PICOVD_GCOV_FILES_MAX           (64)
+#define PICOVD_GCOV_FILE_CLUSTERS       (16)     // 64 kB at most per file
+#define PICOVD_GCOV_START_CLUSTER       (0xB000) // Within the free cluster range
+#define PICOVD_GCOV_START_LBA           EXFAT_CLUSTER_TO_LBA(PICOVD_GCOV_START_CLUSTER)
 
 // Add support for a constantly changing file, to test the host's ability to re-read the disk contents
 // This will enable the generation of a file named "CHANGING.TXt" in the exFAT filesystem.
 #define PICOVD_CHANGING_FILE_ENABLED    (1)
 #define PICOVD_CHANGING_FILE_NAME       u"CHANGING.TXT"
 #define PICOVD_CHANGING_FILE_NAME_LEN   12u
-#define PICOVD_CHANGING_FILE_SIZE_BYTES 512 // XXX FIXME
+#define PICOVD_CHANGING_FILE_LINES      (256)    // Of 14 characters; up to 292, a cluster
 #define PICOVD_CHANGING_FILE_START_CLUSTER (0xD000) // Within the free cluster range
 #define PICOVD_CHANGING_FILE_START_LBA  EXFAT_CLUSTER_TO_LBA(PICOVD_CHANGING_FILE_START_CLUSTER)
 
+// Per-region read counters and latency histograms, and per-SCSI-command
+// latencies, see vd_stats.h, rendered on demand as STATS.TXT.  Set to 0 to remove the collection entirely.
+#define PICOVD_STATS_ENABLED            (1)
+#define PICOVD_STATS_USE_CYCLE_COUNTER  (1) // DWT cycle counter, else time_us_32()
+#define PICOVD_STATS_FILE_NAME          u"STATS.TXT"
+#define PICOVD_STATS_FILE_NAME_LEN      9u
+#define PICOVD_STATS_FILE_SIZE_BYTES    (8192) // Upper bound, two clusters
+#define PICOVD_STATS_START_CLUSTER      (0x1000) // Within the free cluster range
+#define PICOVD_STATS_START_LBA          EXFAT_CLUSTER_TO_LBA(PICOVD_STATS_START_CLUSTER)
+
+// SCSI command trace ring, see vd_trace.h, exported as TRACE.BIN.
+// Costs 16 bytes of SRAM per record.  Set to 0 to remove the tracing entirely.
+#define PICOVD_TRACE_ENABLED            (1)
+#define PICOVD_TRACE_RECORDS            (256) // Power of two
+#define PICOVD_TRACE_FILE_NAME          u"TRACE.BIN"
+#define PICOVD_TRACE_FILE_NAME_LEN      9u
+#define PICOVD_TRACE_FILE_SIZE_BYTES    (0x10000) // Upper bound, 16 clusters
+#define PICOVD_TRACE_START_CLUSTER      (0x2000) // Within the free cluster range
+#define PICOVD_TRACE_START_LBA          EXFAT_CLUSTER_TO_LBA(PICOVD_TRACE_START_CLUSTER)
+
+// Page maps for delta synchronisation by host tools, see vd_page_map.h:
+// FLASHMAP.BIN and SRAMMAP.BIN, a CRC32 record per 4 kB page of the flash and of SRAM.BIN.
+// The flash records cost 5 bytes of SRAM per page.
+#define PICOVD_PAGEMAP_ENABLED          (1)
+#define PICOVD_PAGEMAP_CRC_DMA          (1) // DMA sniffer, else software; the application must not use the sniffer
+#define PICOVD_PAGEMAP_FLASH_FILE_NAME  u"FLASHMAP.BIN"
+#define PICOVD_PAGEMAP_FLASH_FILE_NAME_LEN 12u
+#define PICOVD_PAGEMAP_SRAM_FILE_NAME   u"SRAMMAP.BIN"
+#define PICOVD_PAGEMAP_SRAM_FILE_NAME_LEN 11u
+#define PICOVD_PAGEMAP_START_CLUSTER    (0x3000) // Within the free cluster range
+#define PICOVD_PAGEMAP_START_LBA        EXFAT_CLUSTER_TO_LBA(PICOVD_PAGEMAP_START_CLUSTER)
+
+// File manifest, see vd_manifest.h: MANIFEST.TXT lists each file with the SHA-256 of
+// its contents, if stable, hashed in idle time.  Costs 48 bytes of SRAM per file.
+#define PICOVD_MANIFEST_ENABLED         (1)
+#define PICOVD_MANIFEST_SHA256_HW       (1) // RP2350 SHA-256 accelerator when free, else software
+#define PICOVD_MANIFEST_FILES_MAX       (32)
+#define PICOVD_MANIFEST_FILE_NAME       u"MANIFEST.TXT"
+#define PICOVD_MANIFEST_FILE_NAME_LEN   12u
+#define PICOVD_MANIFEST_START_CLUSTER   (0x4000) // Within the free cluster range
+#define PICOVD_MANIFEST_START_LBA       EXFAT_CLUSTER_TO_LBA(PICOVD_MANIFEST_START_CLUSTER)
+
+// SCSI transfer length hints, reported in VPD page B0h (Block Limits).
+// Hosts that honour them issue cluster-aligned reads of the optimal length.
+#define PICOVD_MSC_OPTIMAL_TRANSFER_BYTES (0x8000)  // 32 KiB, 8 clusters
+#define PICOVD_MSC_MAX_TRANSFER_BYTES     (0x20000) // 128 KiB
+
+// Additional logical units, raw read-only block devices next to the exFAT
+// volume on LUN 0: the whole flash, then one LUN per BootROM partition.
+// A partition LUN reports "medium not present" if there is no such partition.
+#define PICOVD_MSC_FLASH_LUN_ENABLED      (1)
+#define PICOVD_MSC_PARTITION_LUNS         (4) // Up to 14 with the flash LUN
+
+// Idle-time background work, see vd_idle.h
+// Expensive results (checksums etc.) are precomputed only after the bus
+// has been quiet for this long since the last MSC command.
+#define PICOVD_IDLE_QUIET_US            (1000)
+
+// Eager "mount-ready" mode, see vd_mount_ready.h
+// Precomputes and pins in RAM the sectors hosts read when mounting,
+// before the first READ10.  Costs up to the RAM budget of SRAM;
+// leave disabled for minimum-SRAM builds, where everything is lazy.
+#define PICOVD_MOUNT_READY_ENABLED      (0)
+#define PICOVD_MOUNT_READY_RAM_BUDGET   (4096) // Bytes, 8 sectors
+// Report the time from connect to the end of the mount-burst reads over stdio
+#define PICOVD_MOUNT_TIMING_ENABLED     (1)
+
 #endif
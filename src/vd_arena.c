@@ -0,0 +1,55 @@
+/**
+ * @file src/vd_arena.c
+ * @brief Shared scratch arena, leased by the PicoVD generators one at a time.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <picovd_config.h>
+#include "vd_arena.h"
+
+// The arena overlays all lease slots, so it is as large as the largest of them
+typedef union {
+#if PICOVD_BOOTROM_PARTITIONS_LOAD
+    uint32_t partition_table_load[VD_ARENA_PARTITION_TABLE_LOAD_SIZE / sizeof(uint32_t)];
+#endif
+#if PICOVD_BOOTROM_PARTITIONS_ENABLED
+    uint32_t partition_info[VD_ARENA_PARTITION_INFO_SIZE / sizeof(uint32_t)];
+#endif
+    uint32_t vbr_sector[VD_ARENA_VBR_SECTOR_SIZE / sizeof(uint32_t)];
+#if PICOVD_LZ4_ENABLED
+    uint32_t lz4[VD_ARENA_LZ4_SIZE / sizeof(uint32_t)];
+#endif
+} vd_arena_t;
+
+static vd_arena_t vd_arena;
+
+static vd_arena_lease_t vd_arena_holder = VD_ARENA_LEASE_COUNT; ///< No lease
+static vd_arena_lease_t vd_arena_last   = VD_ARENA_LEASE_COUNT; ///< Whose contents the arena holds
+
+void *vd_arena_lease(vd_arena_lease_t lease) {
+    assert(lease < VD_ARENA_LEASE_COUNT);
+    if (vd_arena_holder != VD_ARENA_LEASE_COUNT) {
+        assert(false); // Leases are never nested; a missing release?
+        return NULL;
+    }
+    vd_arena_holder = lease;
+    vd_arena_last   = lease;
+    return &vd_arena;
+}
+
+void vd_arena_release(vd_arena_lease_t lease) {
+    assert(vd_arena_holder == lease);
+    vd_arena_holder = VD_ARENA_LEASE_COUNT;
+}
+
+size_t vd_arena_size(void) {
+    return sizeof(vd_arena);
+}
+
+bool vd_arena_kept(vd_arena_lease_t lease) {
+    return vd_arena_last == lease;
+}
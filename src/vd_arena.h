@@ -0,0 +1,54 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+
+// ---------------------------------------------------------------
+// Shared scratch arena
+//
+// The generators need sizeable scratch buffers only transiently,
+// and never at the same time.  Instead of each keeping a static
+// buffer of its own, they lease the single arena, sized for the
+// largest lease slot, and release it before returning.
+//
+// Leases are exclusive and must not be held across calls,
+// e.g. from one idle step or MSC callback to the next.  What a lease
+// leaves in the arena may be reused by the next lease for the same
+// slot, if no other has come in between.
+// ---------------------------------------------------------------
+
+typedef enum {
+#if PICOVD_BOOTROM_PARTITIONS_LOAD
+    VD_ARENA_PARTITION_TABLE_LOAD, ///< rom_load_partition_table() work area
+#endif
+#if PICOVD_BOOTROM_PARTITIONS_ENABLED
+    VD_ARENA_PARTITION_INFO,       ///< rom_get_partition_table_info() reply
+#endif
+    VD_ARENA_VBR_SECTOR,           ///< Sector being folded into the VBR checksum
+#if PICOVD_LZ4_ENABLED
+    VD_ARENA_LZ4,                  ///< LZ4 encoder, see vd_lz4.c
+#endif
+    VD_ARENA_LEASE_COUNT,
+} vd_arena_lease_t;
+
+// Lease slot sizes, in bytes
+#define VD_ARENA_PARTITION_TABLE_LOAD_SIZE (4 * 1024)
+#define VD_ARENA_PARTITION_INFO_SIZE       ((3 + 32) * sizeof(uint32_t)) // location/flags + 127-char name
+#define VD_ARENA_VBR_SECTOR_SIZE           512
+#define VD_ARENA_LZ4_SIZE                  (4096 + 2048 + 4096) // Copy of a page, 1024-entry hash table, its block
+
+// Lease the arena for `lease`; the returned buffer is word aligned and
+// VD_ARENA_<lease>_SIZE bytes long.  Returns NULL if the arena is leased.
+extern void *vd_arena_lease(vd_arena_lease_t lease);
+
+// Give the arena back
+extern void vd_arena_release(vd_arena_lease_t lease);
+
+// True if the arena was last leased for `lease`, i.e. what was left in it
+// then is still there; check before leasing it again
+extern bool vd_arena_kept(vd_arena_lease_t lease);
+
+// Size of the arena, i.e. of its largest lease slot
+extern size_t vd_arena_size(void);
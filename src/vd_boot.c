@@ -0,0 +1,46 @@
+/**
+ * @file src/vd_boot.c
+ * @brief Boot-phase timestamps for profiling the startup of PicoVD.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <pico/time.h>
+
+#include "vd_boot.h"
+
+static const char * const vd_boot_phase_names[VD_BOOT_PHASE_COUNT] = {
+    [VD_BOOT_MAIN]              = "main",
+    [VD_BOOT_FLASH_READY]       = "flash ready",
+    [VD_BOOT_USB_INIT]          = "usb init",
+    [VD_BOOT_STDIO_INIT]        = "stdio init",
+    [VD_BOOT_MOUNTED]           = "mounted",
+    [VD_BOOT_PARTITIONS_LOADED] = "partitions loaded",
+};
+
+// The timer starts counting at reset, so these are microseconds since reset
+static uint32_t vd_boot_timestamps[VD_BOOT_PHASE_COUNT];
+
+void vd_boot_mark(vd_boot_phase_t phase) {
+    if (vd_boot_timestamps[phase] == 0) { // Only the first time
+        const uint32_t now = time_us_32();
+        vd_boot_timestamps[phase] = now? now: 1;
+    }
+}
+
+uint32_t vd_boot_timestamp(vd_boot_phase_t phase) {
+    return vd_boot_timestamps[phase];
+}
+
+void vd_boot_print(void) {
+    printf("PicoVD boot phases (us since reset):\n");
+    for (int i = 0; i < VD_BOOT_PHASE_COUNT; i++) {
+        if (vd_boot_timestamps[i]) {
+            printf("  %-18s %8lu\n", vd_boot_phase_names[i], (unsigned long)vd_boot_timestamps[i]);
+        } else {
+            printf("  %-18s %8s\n", vd_boot_phase_names[i], "-");
+        }
+    }
+}
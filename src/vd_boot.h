@@ -0,0 +1,26 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// ---------------------------------------------------------------
+// Boot-phase timestamps, from reset to a usable virtual disk
+// ---------------------------------------------------------------
+
+typedef enum {
+    VD_BOOT_MAIN = 0,          ///< Entered main()
+    VD_BOOT_FLASH_READY,       ///< XIP re-initialised
+    VD_BOOT_USB_INIT,          ///< tusb_init() done, enumeration may start
+    VD_BOOT_STDIO_INIT,        ///< stdio initialised
+    VD_BOOT_MOUNTED,           ///< Host configured the device
+    VD_BOOT_PARTITIONS_LOADED, ///< Partition table loaded, disk ready
+    VD_BOOT_PHASE_COUNT,
+} vd_boot_phase_t;
+
+// Record the time_us_32() of a phase, i.e. microseconds since reset
+extern void vd_boot_mark(vd_boot_phase_t phase);
+
+// Timestamp of a phase, or 0 if not reached yet
+extern uint32_t vd_boot_timestamp(vd_boot_phase_t phase);
+
+// Print the boot phases over stdio
+extern void vd_boot_print(void);
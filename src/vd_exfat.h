@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 #include <assert.h>
 
 #ifdef __cplusplus
@@ -54,6 +55,15 @@ extern const uint32_t exfat_upcase_table_checksum; ///< Checksum of the up-case
 // This function generates the root directory sector data for exFAT.
 extern  void exfat_generate_root_dir_fixed_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
 extern  void exfat_generate_root_dir_dynamic_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+// True if a root directory sector stays the same until the contents change
+extern  bool exfat_root_dir_sector_is_stable(uint32_t lba);
+
+// The files of the root directory, for listings such as MANIFEST.TXT, in groups:
+// the compile-time entry sets, one file each, then the dynamic slots.
+// Describe file `file_idx` of group `group_idx`; false if there is no such file.
+struct exfat_dir_file_desc;
+extern  uint32_t exfat_root_dir_group_count(void);
+extern  bool exfat_root_dir_file_describe(uint32_t group_idx, uint32_t file_idx, struct exfat_dir_file_desc *desc);
 
 // ---------------------------------------------------------------
 // Macro to compute an LBA from a cluster number
@@ -5,6 +5,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
 #include <string.h>
 #include "pico/bootrom.h"    // get_partition_table_info()
@@ -16,6 +17,21 @@
 #include "vd_exfat_params.h"
 #include "vd_exfat.h"
 #include "vd_exfat_dirs.h"
+#include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_arena.h"
+#include "vd_stats.h"
+#include "vd_trace.h"
+#include "vd_lz4.h"
+#include "vd_uf2.h"
+#include "vd_page_map.h"
+#include "vd_manifest.h"
+#include "vd_inbox.h"
+#include "vd_tar.h"
+#include "vd_stdio.h"
+#include "vd_log.h"
+#include "vd_profile.h"
+#include "vd_gcov.h"
 
 #include "tusb_config.h"     // for CFG_TUD_MSC_EP_BUFSIZE
 
@@ -36,7 +52,8 @@ uint16_t exfat_dirs_compute_setchecksum(const uint8_t *entries, size_t len) {
 // ---------------------------------------------------------------------------
 // Directory entry sets for the root directory.
 //
-// The SetChecksums computed lazily the first time an entry set
+// The SetChecksums are computed in idle time by the root directory job below,
+// or lazily the first time an entry set is needed, whichever comes first.
 //
 // To minimise runtime SRAM use, we don't store the root directory as a single
 // runtime buffer but as a series of entry sets, pointed by this table.
@@ -79,6 +96,19 @@ static_assert(sizeof(exfat_root_dir_first_entries_data)
             <= EXFAT_BYTES_PER_SECTOR,
               "Compile time root directory entries must fit into a single sector");
 
+#define FIXED_ENTRIES_COUNT (sizeof(exfat_root_dir_entries) / sizeof(exfat_root_dir_entries[0]))
+
+static void fixed_entries_prepare(size_t i) {
+    if (!exfat_root_dir_entries[i].checksum_computed) {
+        // Compute checksum for the current entry
+        exfat_root_dir_entries[i].checksum
+          = exfat_dirs_compute_setchecksum(exfat_root_dir_entries[i].entries,
+                                           exfat_root_dir_entries[i].entries_length);
+        __compiler_memory_barrier();
+        exfat_root_dir_entries[i].checksum_computed = true;
+    }
+}
+
 // ---------------------------------------------------------------------------
 // Generate a slice of a root directory sector, as requested by the MSC layer.
 // ---------------------------------------------------------------------------
@@ -90,17 +120,12 @@ void exfat_generate_root_dir_fixed_sector(uint32_t __unused lba, void* buffer, u
     size_t   len = bufsize;           // Remaining bytes to copy
     size_t   idx = 0;                 // Current index within the sector
 
-    for (size_t i = 0; i < sizeof(exfat_root_dir_entries) / sizeof(exfat_root_dir_entries[0]); i++) {
+    for (size_t i = 0; i < FIXED_ENTRIES_COUNT; i++) {
         const uint8_t * entries_data = exfat_root_dir_entries[i].entries;
         const size_t    entries_len  = exfat_root_dir_entries[i].entries_length;
 
         // Step 1: Entries preparation, if not already prepared
-        if (!exfat_root_dir_entries[i].checksum_computed) {
-            // Compute checksum for the current entry
-            exfat_root_dir_entries[i].checksum
-              = exfat_dirs_compute_setchecksum(entries_data, entries_len);
-            exfat_root_dir_entries[i].checksum_computed = true;
-        }
+        fixed_entries_prepare(i);
         const uint16_t checksum = exfat_root_dir_entries[i].checksum;
 
         // Step 2: If the requested slice is after the current entries, skip to next ones
@@ -156,22 +181,148 @@ void exfat_generate_root_dir_fixed_sector(uint32_t __unused lba, void* buffer, u
 }
 
 // ---------------------------------------------------------------------------
-// Generate a slice of a root directory sector, as requested by the MSC layer.
-// This function is used for dynamically generated entries, mainly partitions.
+// Streaming generation of the dynamic entry sets.
+//
+// A dynamic entry set is never assembled into a buffer.  Each file is
+// described by a compact exfat_dir_file_desc_t, and each 32-byte entry of its
+// set is computed directly into the requested slice, so that a 64-byte slice
+// costs only the two entries in it.  The SetChecksum is computed by streaming
+// over the same entries, and cached per file for the stable slots.
 // ---------------------------------------------------------------------------
 
-// Buffer for a dynamically generated entry set. Cleared on each call.
-static exfat_root_dir_entries_dynamic_file_t directory_entry_set_buffer;
-
 #ifndef __INTELLISENSE__
-_Static_assert(sizeof(exfat_root_dir_entries_dynamic_file_t) % CFG_TUD_MSC_EP_BUFSIZE == 0,
-              "Dynamic entry-set must be a multiple of MSC EP buffer size");
+_Static_assert(CFG_TUD_MSC_EP_BUFSIZE % 32 == 0,
+              "MSC EP buffer size must be a multiple of the directory entry size");
 #endif
 
+#define ENTRIES_PER_SECTOR (EXFAT_BYTES_PER_SECTOR / 32u)
+
+// Only ASCII letters are mapped by our up-case table
+static inline uint8_t exfat_dir_upcase(uint8_t c) {
+    return (c >= 'a' && c <= 'z') ? (uint8_t)(c - 'a' + 'A') : c;
+}
+
+// NameHash over the up-cased name; see Microsoft spec §7.6.4
+static uint16_t exfat_dir_desc_name_hash(const exfat_dir_file_desc_t *desc) {
+    uint16_t hash = 0;
+    for (uint32_t i = 0; i < desc->name_length; i++) {
+        hash = (uint16_t)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + exfat_dir_upcase(desc->name[i]));
+        hash = (uint16_t)(((hash & 1) ? 0x8000 : 0) + (hash >> 1)); // High byte is always zero
+    }
+    return hash;
+}
+
+void exfat_dir_generate_entry(const exfat_dir_file_desc_t *desc, uint32_t entry_idx,
+                              uint16_t set_checksum, void *entry) {
+    assert(entry_idx < exfat_dir_desc_entry_count(desc));
+    memset(entry, 0, 32);
+
+    if (entry_idx == 0) {
+        exfat_file_directory_dir_entry_t *fd = (exfat_file_directory_dir_entry_t *)entry;
+        fd->entry_type        = exfat_entry_type_file_directory;
+        fd->secondary_count   = (uint8_t)(exfat_dir_desc_entry_count(desc) - 1);
+        fd->set_checksum      = set_checksum;
+        fd->file_attributes   = desc->attributes;
+        fd->creat_time        = desc->timestamp;
+        fd->last_mod_time     = desc->timestamp;
+        fd->last_acc_time     = desc->timestamp;
+        fd->creat_time_off    = exfat_utc_offset_UTC;
+        fd->last_mod_time_off = exfat_utc_offset_UTC;
+        fd->last_acc_time_off = exfat_utc_offset_UTC;
+    } else if (entry_idx == 1) {
+        exfat_stream_extension_dir_entry_t *se = (exfat_stream_extension_dir_entry_t *)entry;
+        se->entry_type        = exfat_entry_type_stream_extension;
+        se->secondary_flags   = 0x03;   // always 'valid data length' + 'no FAT'
+        se->name_length       = desc->name_length;
+        se->name_hash         = exfat_dir_desc_name_hash(desc);
+        se->valid_data_length = desc->data_length;
+        se->data_length       = desc->data_length;
+        se->first_cluster     = desc->first_cluster;
+    } else {
+        exfat_file_name_dir_entry_t *fn = (exfat_file_name_dir_entry_t *)entry;
+        fn->entry_type = exfat_entry_type_file_name;
+        const uint32_t first = (entry_idx - 2) * EXFAT_DIR_NAME_CHARS_PER_ENTRY;
+        for (uint32_t j = 0; j < EXFAT_DIR_NAME_CHARS_PER_ENTRY && first + j < desc->name_length; j++) {
+            fn->file_name[j] = desc->name[first + j]; // 8-bit to UTF-16LE, padded with 0x0000
+        }
+    }
+}
+
+// SetChecksum over bytes [from, to) of the entry set, continuing from `sum`
+static uint16_t exfat_dir_desc_setchecksum_range(const exfat_dir_file_desc_t *desc, uint16_t sum,
+                                                 uint32_t from, uint32_t to) {
+    uint8_t entry[32];
+    for (uint32_t e = from / 32u; e * 32u < to; e++) {
+        exfat_dir_generate_entry(desc, e, 0, entry);
+        const uint32_t lo = from > e * 32u ? from - e * 32u : 0;
+        const uint32_t hi = to - e * 32u < 32u ? to - e * 32u : 32u;
+        for (uint32_t i = lo; i < hi; i++) {
+            if (e == 0 && (i == 2 || i == 3))
+                continue;
+            sum = ((sum & 0x0001)? 0x8000 : 0) + (sum >> 1) + (uint16_t)(entry[i]);
+        }
+    }
+    return sum;
+}
+
+uint16_t exfat_dir_desc_setchecksum(const exfat_dir_file_desc_t *desc) {
+    return exfat_dir_desc_setchecksum_range(desc, 0, 0, exfat_dir_desc_entry_count(desc) * 32u);
+}
+
 // ---------------------------------------------------------------------------
-// Helper: assemble a 512‑byte root‑dir slot for partition `part_idx`
+// Describe the file of partition `part_idx`, as reported by the BootROM,
+// then its views, if any, each named after it
 // ---------------------------------------------------------------------------
-static bool build_rp2350_partition_entry_set(uint32_t part_idx, exfat_root_dir_entries_dynamic_file_t *des) {
+enum {
+    PARTITION_FILE_BIN = 0,
+#if PICOVD_LZ4_ENABLED
+    PARTITION_FILE_LZ4,                 ///< "<name>.lz4", see vd_lz4.h
+#endif
+#if PICOVD_UF2_ENABLED
+    PARTITION_FILE_UF2,                 ///< "<name>.uf2", see vd_uf2.h
+#endif
+    PARTITION_FILE_COUNT,
+};
+
+static bool describe_rp2350_partition(uint32_t part_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+#if PICOVD_LZ4_ENABLED || PICOVD_UF2_ENABLED
+    if (file_idx != PARTITION_FILE_BIN && file_idx < PARTITION_FILE_COUNT) {
+        // The file is described first, for the name of the view
+        if (!describe_rp2350_partition(part_idx, PARTITION_FILE_BIN, desc)) {
+            return false;
+        }
+        const uint32_t file_entries = exfat_dir_desc_entry_count(desc);
+        const char *extension = NULL;
+        uint32_t first_cluster = 0, size = 0;
+        switch (file_idx) {
+#if PICOVD_LZ4_ENABLED
+        case PARTITION_FILE_LZ4:
+            extension = ".lz4";
+            size = vd_lz4_partition_view(part_idx, &first_cluster);
+            break;
+#endif
+#if PICOVD_UF2_ENABLED
+        case PARTITION_FILE_UF2:
+            extension = ".uf2";
+            size = vd_uf2_partition_view(part_idx, &first_cluster);
+            break;
+#endif
+        }
+        if (size == 0 || desc->name_length > EXFAT_DIR_FILE_NAME_MAX - 4u) {
+            return false;
+        }
+        memcpy(desc->name + desc->name_length, extension, 4);
+        desc->name_length  += 4u;
+        desc->first_cluster = first_cluster;
+        desc->data_length   = size;
+        // The entry sets of the file and of the views so far, all alike, must fit the slot's sector
+        return file_entries + file_idx * exfat_dir_desc_entry_count(desc) <= ENTRIES_PER_SECTOR;
+    }
+#endif
+    if (file_idx != 0) {
+        return false;
+    }
+
     // 1. Query BootROM for LOCATION/FLAGS and NAME of this single partition.
     enum {
         PT_LOCATION_AND_FLAGS = 0x0010,
@@ -179,7 +330,11 @@ static bool build_rp2350_partition_entry_set(uint32_t part_idx, exfat_root_dir_e
         PT_SINGLE_PARTITION   = 0x8000,
     };
 
-    static uint32_t pt_buf[34]; // plenty for location/flags + long name (max 32 words)
+    // Leased, as it is only needed while describing
+    uint32_t *pt_buf = vd_arena_lease(VD_ARENA_PARTITION_INFO);
+    if (pt_buf == NULL) {
+        return false;
+    }
     uint32_t flags = PT_SINGLE_PARTITION |
                      PT_LOCATION_AND_FLAGS |
                      PT_NAME |
@@ -187,91 +342,268 @@ static bool build_rp2350_partition_entry_set(uint32_t part_idx, exfat_root_dir_e
 
     int words
     = rom_get_partition_table_info(pt_buf,
-        (uint32_t)(sizeof(pt_buf)/sizeof(pt_buf[0])),
+        (uint32_t)(VD_ARENA_PARTITION_INFO_SIZE/sizeof(pt_buf[0])),
         flags);
     if (words < 3 /* XXX FIXME */) {
+        vd_arena_release(VD_ARENA_PARTITION_INFO);
         return false; // BootROM error (invalid idx, hash mismatch, ...)
     }
 
     uint32_t *p   = pt_buf + 1;          // skip supported‑flags word
     uint32_t loc  = *p++;                // permissions_and_location
-    uint32_t flg  = *p++;                // permissions_and_flags
-
-    // Extract start address and length (see §5.9.4.2 of the datasheet)
-    uint32_t flash_page  =  (loc & 0x0001FFFFu);   // 4‑kB units, matching cluster size
-    uint32_t flash_size  = ((loc & 0x03ffe000u) >> 17) * 4096u;
+    uint32_t flg __unused = *p++;        // permissions_and_flags
+
+    // Extract start address and length, in 4‑kB units matching the cluster size
+    uint32_t flash_page, flash_pages;
+    vd_partition_location_decode(loc, &flash_page, &flash_pages);
+    uint32_t flash_size  = flash_pages * 4096u;
+#if PICOVD_BOOTROM_PARTITIONS_TRIM
+    // Only the image, rather than the whole partition
+    flash_size = vd_partition_image_length(part_idx);
+#endif
 
     // NAME field
-    uint8_t  name_len   = (*(uint8_t *)p) & 0x7F;
-    const uint8_t *name_bytes = ((const uint8_t *)p) + 1;     // ASCII/UTF‑8
-    uint8_t n_fname = (uint8_t)((name_len + 14) / 15);        // ceil(len/15) XXX FIXME
-
-    memset(des, 0, sizeof(*des));
-
-    des->file_directory.entry_type  = exfat_entry_type_file_directory;
-    des->file_directory.file_attributes = EXFAT_FILE_ATTR_READ_ONLY;
-    des->file_directory.secondary_count = 1 /* XXX FIXME */ + n_fname;
-
-    des->stream_extension.entry_type    = exfat_entry_type_stream_extension;
-    des->stream_extension.secondary_flags = 0x03;   // always 'valid data length' + 'no FAT'
-    des->stream_extension.name_length       = name_len;
-    des->stream_extension.valid_data_length = (uint64_t)flash_size;
-    des->stream_extension.data_length       = (uint64_t)flash_size;
-    // First cluster calculation: clusters start at 2
-    des->stream_extension.first_cluster = flash_size? flash_page + PICOVD_FLASH_START_CLUSTER : 0;
-
-    // Expand the name to UTF‑16LE
-    assert(name_len <= 127);
-    static char16_t file_name[127/*XXX FIXME*/];
-    for (size_t i = 0; i < name_len; i++) {
-        file_name[i] = name_bytes[i]; // UTF-8 to UTF-16LE
+    const uint8_t name_len = (*(uint8_t *)p) & 0x7F;
+
+    desc->first_cluster = flash_size? flash_page + PICOVD_FLASH_START_CLUSTER : 0;
+    desc->data_length   = flash_size;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    if (name_len != 0) {
+        desc->name_length = name_len;
+        memcpy(desc->name, ((const uint8_t *)p) + 1, name_len); // ASCII/UTF‑8
+    } else {
+        // exFAT requires a name; unnamed partitions are named after their index
+        memcpy(desc->name, "PART0.BIN", 9);
+        desc->name[4]     = (uint8_t)('0' + part_idx);
+        desc->name_length = 9;
     }
+    vd_arena_release(VD_ARENA_PARTITION_INFO);
+    return true;
+}
 
-    des->stream_extension.name_hash
-        = exfat_dirs_compute_name_hash(file_name, name_len);
+// Each slot is described by its function.  If the resulting entry sets stay the same
+// until the next vd_virtual_disk_contents_changed(), their SetChecksums can be cached.
+// If only the sizes change, the checksums are cached up to the sizes, and finished
+// from there when a size changes; the sizes are refreshed once per read of the
+// slot's sector, and stay the same for all other describes until the next one.
+static const struct {
+    exfat_dir_describe_fn_t describe;
+    bool                    cacheable; ///< Entry sets are stable between content changes
+    bool                    sized;     ///< Only the sizes change between content changes
+    exfat_dir_refresh_fn_t  refresh;   ///< Sized slots: take the sizes
+} describe_slot_table[] = {
+#if PICOVD_BOOTROM_PARTITIONS_ENABLED
+    { describe_rp2350_partition, true }, // Slot 0
+    { describe_rp2350_partition, true }, // Slot 1
+    { describe_rp2350_partition, true }, // Slot 2
+    { describe_rp2350_partition, true }, // Slot 3
+    { describe_rp2350_partition, true }, // Slot 4
+    { describe_rp2350_partition, true }, // Slot 5
+    { describe_rp2350_partition, true }, // Slot 6
+    { describe_rp2350_partition, true }, // Slot 7
+#endif
+#if PICOVD_CHANGING_FILE_ENABLED
+    { files_changing_describe, false }, // Slot agnostic, timestamps change
+#endif
+#if PICOVD_STATS_ENABLED
+    { vd_stats_describe, true },
+#endif
+#if PICOVD_TRACE_ENABLED
+    { vd_trace_describe, true },
+#endif
+#if PICOVD_LZ4_ENABLED && PICOVD_FLASH_ENABLED
+    { vd_lz4_describe, true },
+#endif
+#if PICOVD_UF2_ENABLED && PICOVD_FLASH_ENABLED
+    { vd_uf2_describe, true },
+#endif
+#if PICOVD_PAGEMAP_ENABLED
+    { vd_page_map_describe, true },
+#endif
+#if PICOVD_MANIFEST_ENABLED
+    { vd_manifest_describe, true },
+#endif
+#if PICOVD_INBOX_ENABLED
+    { vd_inbox_describe, true },        // Declarations change the contents
+#endif
+#if PICOVD_STDIO_ENABLED
+    { vd_stdio_describe, false, true, vd_stdio_refresh }, // Grow with the output
+#endif
+#if PICOVD_LOG_ENABLED
+    { vd_log_describe, false, true, vd_log_refresh },
+#endif
+#if PICOVD_PROFILE_ENABLED
+    { vd_profile_describe, true },
+#endif
+#if PICOVD_GCOV_ENABLED
+    { vd_gcov_describe, true },
+#endif
+#if PICOVD_TAR_ENABLED
+    { vd_tar_describe, true },          // Sized after all the others
+#endif
+    // Add more slots here if needed, e.g. for other partitions
+};
 
-    // (3) File‑Name secondary entries (UTF‑16LE, padded with 0x0000)
-    for (uint8_t i = 0; i < n_fname; i++) {
-        exfat_file_name_dir_entry_t *fn = &des->file_name[i];
-        fn->entry_type = exfat_entry_type_file_name;
-        uint8_t copy = (uint8_t)((name_len > 15) ? 15 : name_len);
-        for (uint8_t j = 0; j < copy; ++j) {
-            fn->file_name[j] = name_bytes[i * 15 + j];
+#define DYNAMIC_SLOT_COUNT (sizeof(describe_slot_table)/sizeof(describe_slot_table[0]))
+_Static_assert(DYNAMIC_SLOT_COUNT <= 32, "Slot cache state is kept in 32-bit masks");
+_Static_assert(DYNAMIC_SLOT_COUNT < EXFAT_ROOT_DIR_LENGTH_SECTORS, "Each slot takes a root directory sector");
+
+// Per-slot cache for the cacheable and sized slots, published by setting the slot_known bit last
+static uint32_t slot_known;             ///< Bit set: slot_files and slot_checksum are valid
+static uint8_t  slot_files[DYNAMIC_SLOT_COUNT];
+static uint16_t slot_checksum[DYNAMIC_SLOT_COUNT][EXFAT_DIR_FILES_PER_SLOT_MAX];
+
+// Sized slots only: the size the checksum is for, and the checksum up to the size
+#define SIZED_COUNT_MAX     2u
+#define SIZED_LENGTH_OFFSET (32u + offsetof(exfat_stream_extension_dir_entry_t, valid_data_length))
+static struct {
+    uint32_t data_length;
+    uint16_t prefix;
+} slot_sized[SIZED_COUNT_MAX][EXFAT_DIR_FILES_PER_SLOT_MAX];
+
+// Index of a sized slot into slot_sized
+static uint32_t slot_sized_idx(uint32_t slot_idx) {
+    uint32_t s = 0;
+    for (uint32_t i = 0; i < slot_idx; i++) {
+        s += describe_slot_table[i].sized;
+    }
+    assert(s < SIZED_COUNT_MAX);
+    return s;
+}
+
+// Finish the SetChecksum of a file of a sized slot from the cached prefix,
+// over the rest of the stream extension and the names
+static void slot_sized_update(uint32_t slot_idx, uint32_t f, const exfat_dir_file_desc_t *desc) {
+    const uint32_t s = slot_sized_idx(slot_idx);
+    slot_sized[s][f].data_length = desc->data_length;
+    slot_checksum[slot_idx][f]   = exfat_dir_desc_setchecksum_range(desc, slot_sized[s][f].prefix, SIZED_LENGTH_OFFSET,
+                                                                    exfat_dir_desc_entry_count(desc) * 32u);
+}
+
+// Take the sizes of all files of a sized slot, at the start of its sector, so that
+// the checksums and the sizes of all slices of the sector agree
+static void slot_sized_refresh(uint32_t slot_idx) {
+    exfat_dir_file_desc_t desc;
+    const uint32_t s = slot_sized_idx(slot_idx);
+    assert(describe_slot_table[slot_idx].refresh != NULL);
+    describe_slot_table[slot_idx].refresh(slot_idx);
+    for (uint32_t f = 0; f < slot_files[slot_idx]; f++) {
+        if (describe_slot_table[slot_idx].describe(slot_idx, f, &desc)
+            && desc.data_length != slot_sized[s][f].data_length) {
+            slot_sized_update(slot_idx, f, &desc);
         }
-        name_len -= copy;
     }
+}
 
-    // Mark extra entries as unused
-    for (uint8_t i = n_fname; i < sizeof(des->file_name)/sizeof(des->file_name[0]); i++) {
-        des->file_name[i].entry_type = exfat_entry_type_unused;
+// ---------------------------------------------------------------------------
+// Compute and publish the SetChecksums of all files in a cacheable or sized slot
+// ---------------------------------------------------------------------------
+static void slot_prepare(uint32_t slot_idx) {
+    const uint32_t bit = 1u << slot_idx;
+    if (slot_known & bit) {
+        return;
     }
 
-    return true;
+    exfat_dir_file_desc_t desc;
+    uint32_t f;
+    for (f = 0; f < EXFAT_DIR_FILES_PER_SLOT_MAX; f++) {
+        if (!describe_slot_table[slot_idx].describe(slot_idx, f, &desc)) {
+            break;
+        }
+        if (describe_slot_table[slot_idx].sized) {
+            slot_sized[slot_sized_idx(slot_idx)][f].prefix = exfat_dir_desc_setchecksum_range(&desc, 0, 0, SIZED_LENGTH_OFFSET);
+            slot_sized_update(slot_idx, f, &desc);
+        } else {
+            slot_checksum[slot_idx][f] = exfat_dir_desc_setchecksum(&desc);
+        }
+    }
+    slot_files[slot_idx] = (uint8_t)f;
+    __compiler_memory_barrier();
+    slot_known |= bit;
 }
 
-typedef bool (*build_partition_entry_set_t)(uint32_t slot_idx, exfat_root_dir_entries_dynamic_file_t  *des);
+// ---------------------------------------------------------------------------
+// Idle job: compute the SetChecksums of the fixed entry sets and
+// the cacheable and sized dynamic slots, one entry set or slot per step.
+// ---------------------------------------------------------------------------
+static uint32_t root_dir_job_idx;
 
-static build_partition_entry_set_t build_partition_entry_set_table[] = {
-#if PICOVD_BOOTROM_PARTITIONS_ENABLED
-    build_rp2350_partition_entry_set, // Slot 0
-    build_rp2350_partition_entry_set, // Slot 1
-    build_rp2350_partition_entry_set, // Slot 2
-    build_rp2350_partition_entry_set, // Slot 3
-    build_rp2350_partition_entry_set, // Slot 4
-    build_rp2350_partition_entry_set, // Slot 5
-    build_rp2350_partition_entry_set, // Slot 6
-    build_rp2350_partition_entry_set, // Slot 7
-#endif
-#if PICOVD_CHANGING_FILE_ENABLED
-    files_changing_build_file_partition_entry_set, // Slot agnostic
-#endif
-    // Add more slots here if needed, e.g. for other partitions
-};
+void exfat_root_dir_checksums_job_reset(void) {
+    // The fixed entry sets are compile-time constants; only the slots may change
+    slot_known = 0;
+    root_dir_job_idx = 0;
+}
+
+bool exfat_root_dir_checksums_job_step(void) {
+    const uint32_t i = root_dir_job_idx;
+    if (i < FIXED_ENTRIES_COUNT) {
+        fixed_entries_prepare(i);
+    } else if (i < FIXED_ENTRIES_COUNT + DYNAMIC_SLOT_COUNT) {
+        const uint32_t slot_idx = i - FIXED_ENTRIES_COUNT;
+        if (describe_slot_table[slot_idx].cacheable || describe_slot_table[slot_idx].sized) {
+            slot_prepare(slot_idx);
+        }
+    } else {
+        return true;
+    }
+    root_dir_job_idx = i + 1;
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// True if the contents of a root directory sector stay the same
+// until the next vd_virtual_disk_contents_changed()
+// ---------------------------------------------------------------------------
+bool exfat_root_dir_sector_is_stable(uint32_t lba) {
+    assert(lba >= EXFAT_ROOT_DIR_START_LBA &&
+           lba < EXFAT_ROOT_DIR_START_LBA + EXFAT_ROOT_DIR_LENGTH_SECTORS);
 
-static int32_t  current_slot_idx = -1;  ///< partition index currently in slot_buf
+    if (lba == EXFAT_ROOT_DIR_START_LBA) {
+        return true; // Compile-time entry sets only
+    }
+    const uint32_t slot_idx = lba - EXFAT_ROOT_DIR_START_LBA - 1u;
+    return slot_idx >= DYNAMIC_SLOT_COUNT || describe_slot_table[slot_idx].cacheable;
+}
 
 // ---------------------------------------------------------------------------
-// Generate a slice of a *dynamic* root-directory sector
+// Enumerate the files of the root directory, the fixed ones first
+// ---------------------------------------------------------------------------
+uint32_t exfat_root_dir_group_count(void) {
+    return FIXED_ENTRIES_COUNT + DYNAMIC_SLOT_COUNT;
+}
+
+bool exfat_root_dir_file_describe(uint32_t group_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (group_idx >= FIXED_ENTRIES_COUNT) {
+        const uint32_t slot_idx = group_idx - FIXED_ENTRIES_COUNT;
+        return slot_idx < DYNAMIC_SLOT_COUNT && describe_slot_table[slot_idx].describe(slot_idx, file_idx, desc);
+    }
+
+    // A compile-time entry set; the first one holds the label, bitmap and up-case table
+    const uint8_t *entries = exfat_root_dir_entries[group_idx].entries;
+    if (file_idx != 0 || entries[0] != exfat_entry_type_file_directory) {
+        return false;
+    }
+    const exfat_root_dir_entries_fixed_file_t *set = (const exfat_root_dir_entries_fixed_file_t *)entries;
+    const exfat_file_name_dir_entry_t *names = (const exfat_file_name_dir_entry_t *)(entries + 64);
+    assert(set->stream_extension.name_length <= EXFAT_DIR_FILE_NAME_MAX);
+
+    desc->first_cluster = set->stream_extension.first_cluster;
+    desc->data_length   = (uint32_t)set->stream_extension.data_length;
+    desc->timestamp     = set->file_directory.last_mod_time;
+    desc->attributes    = set->file_directory.file_attributes;
+    desc->name_length   = set->stream_extension.name_length;
+    for (uint32_t i = 0; i < desc->name_length; i++) {
+        desc->name[i] = (uint8_t)names[i / EXFAT_DIR_NAME_CHARS_PER_ENTRY].file_name[i % EXFAT_DIR_NAME_CHARS_PER_ENTRY];
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Generate a slice of a *dynamic* root-directory sector.
+//
+// The files of a slot are laid out back to back from the start of its
+// sector; only the entries overlapping the slice are generated.
 // ---------------------------------------------------------------------------
 void exfat_generate_root_dir_dynamic_sector(uint32_t lba, void* buffer,
                                             uint32_t offset, uint32_t bufsize) {
@@ -280,35 +612,65 @@ void exfat_generate_root_dir_dynamic_sector(uint32_t lba, void* buffer,
            lba < EXFAT_ROOT_DIR_START_LBA + EXFAT_ROOT_DIR_LENGTH_SECTORS);
     assert(bufsize <= EXFAT_BYTES_PER_SECTOR);
     assert(offset  < EXFAT_BYTES_PER_SECTOR);
+    assert(offset % 32 == 0 && bufsize % 32 == 0);
+
+    uint8_t *buf = (uint8_t *)buffer;
+    const uint32_t first = offset / 32;           // First requested entry
+    const uint32_t last  = first + bufsize / 32;  // One past the last requested entry
+    uint32_t       e     = 0;                     // First entry of the current file
 
     // slot 0 starts at (EXFAT_ROOT_DIR_START_LBA + 1)
-    uint32_t slot_idx = lba - EXFAT_ROOT_DIR_START_LBA - 1u;
-
-    // (1) build / fetch cached slot
-    if (slot_idx < sizeof(build_partition_entry_set_table)/sizeof(build_partition_entry_set_table[0])) {
-        if (slot_idx != current_slot_idx) {
-            bool ok = build_partition_entry_set_table[slot_idx](slot_idx, &directory_entry_set_buffer);
-            if (ok) {
-                //  Compute SetChecksum and store it (bytes 2–3 of primary entry)
-                // XXX FUTURE: Considern caching these and recomputing only when needed.
-                const uint16_t checksum = exfat_dirs_compute_setchecksum(
-                    (const uint8_t *)&directory_entry_set_buffer,
-                    (size_t)((1 + directory_entry_set_buffer.file_directory.secondary_count) * 32));
-                directory_entry_set_buffer.file_directory.set_checksum = checksum;
-                current_slot_idx = slot_idx;
-            } else {
-                current_slot_idx = -1;
+    const uint32_t slot_idx = lba - EXFAT_ROOT_DIR_START_LBA - 1u;
+
+    if (slot_idx < DYNAMIC_SLOT_COUNT) {
+        const bool cacheable = describe_slot_table[slot_idx].cacheable;
+        const bool sized     = describe_slot_table[slot_idx].sized;
+        uint32_t n_files = EXFAT_DIR_FILES_PER_SLOT_MAX;
+        if (cacheable || sized) {
+            slot_prepare(slot_idx);
+            n_files = slot_files[slot_idx];
+        }
+        if (sized && offset == 0) {
+            slot_sized_refresh(slot_idx);
+        }
+
+        exfat_dir_file_desc_t desc;
+        for (uint32_t f = 0; f < n_files && e < last; f++) {
+            if (!describe_slot_table[slot_idx].describe(slot_idx, f, &desc)) {
+                break;
+            }
+            const uint32_t n = exfat_dir_desc_entry_count(&desc);
+            if (e + n > ENTRIES_PER_SECTOR) {
+                assert(false); // The slot's files must fit into its sector
+                break;
+            }
+            if (sized) {
+                // As taken at the start of the sector
+                desc.data_length = slot_sized[slot_sized_idx(slot_idx)][f].data_length;
+                if (desc.data_length == 0) {
+                    desc.first_cluster = 0;
+                }
+            }
+            if (e + n > first) {
+                uint16_t checksum = 0;
+                if (cacheable || sized) {
+                    checksum = slot_checksum[slot_idx][f];
+                } else if (first <= e) {
+                    checksum = exfat_dir_desc_setchecksum(&desc); // Only the primary entry needs it
+                }
+                const uint32_t from = (e > first) ? e : first;
+                const uint32_t to   = (e + n < last) ? e + n : last;
+                for (uint32_t k = from; k < to; k++) {
+                    exfat_dir_generate_entry(&desc, k - e, checksum, buf + (k - first) * 32);
+                }
             }
+            e += n;
         }
-    } else {
-        current_slot_idx = -1; // No valid partition entry
     }
 
-    // (2) copy the requested slice. XXX HACK: We assume maybe too much,
-    // but we do static_assert that the entry set is a multiple of CFG_TUD_MSC_EP_BUFSIZE bytes.
-    if (current_slot_idx >= 0 && offset < sizeof(directory_entry_set_buffer)) {
-        memcpy(buffer, ((uint8_t *)&directory_entry_set_buffer) + offset, bufsize);
-    } else {
-        memset(buffer, exfat_entry_type_unused, bufsize); // Fill with unused entries
+    // Mark the rest of the buffer as unused
+    if (e < last) {
+        const uint32_t from = (e > first) ? e : first;
+        memset(buf + (from - first) * 32, exfat_entry_type_unused, (last - from) * 32);
     }
 }
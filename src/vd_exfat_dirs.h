@@ -1,4 +1,4 @@
-
+#pragma once
 #include "vd_exfat.h"
 
 #ifndef __INTELLISENSE__
@@ -96,6 +96,7 @@ typedef enum  {
     EXFAT_FILE_ATTR_READ_ONLY  = 0x0001,  ///< read-only file
     EXFAT_FILE_ATTR_HIDDEN     = 0x0002,  ///< hidden file
     EXFAT_FILE_ATTR_SYSTEM     = 0x0004,  ///< system file
+    EXFAT_FILE_ATTR_DIRECTORY  = 0x0010,  ///< directory
     EXFAT_FILE_ATTR_ARCHIVE    = 0x0020,  ///< archive bit
     EXFAT_FILE_ATTR_MAX        = 0xFFFF,  ///< force 2 byte value
 } exfat_file_attr_t;
@@ -170,16 +171,36 @@ typedef struct __packed exfat_root_dir_entries_fixed_file {
 STATIC_ASSERT_PACKED(sizeof(exfat_root_dir_entries_fixed_file_t) == 3 * 32,
     "Fixed exFAT file/directory entry set length must be == 3 * 32 bytes");
 
-/// Dynamically generated exFAT root directory entry sets
-typedef struct __packed exfat_root_dir_entries_dynamic_file {
-    exfat_file_directory_dir_entry_t      file_directory;    // 32 bytes
-    exfat_stream_extension_dir_entry_t    stream_extension;  // 32 bytes
-    exfat_file_name_dir_entry_t           file_name[10];      // 10 * 32 bytes, 9 * 15 chars > 127 chars
-} exfat_root_dir_entries_dynamic_file_t;
-STATIC_ASSERT_PACKED(sizeof(exfat_root_dir_entries_dynamic_file_t) == 12 * 32,
-    "Dynamic exFAT file/directory entry set length must be == 12 * 32 bytes");
-STATIC_ASSERT_PACKED(sizeof(exfat_root_dir_entries_dynamic_file_t) % CFG_TUD_MSC_EP_BUFSIZE == 0,
-    "Dynamic exFAT file/directory entry set length must be a multiple of MSC EP buffer size");
+/// Longest name of a dynamically generated file, in characters
+#define EXFAT_DIR_FILE_NAME_MAX         127u
+/// Name characters per File Name entry, see §7.7.3
+#define EXFAT_DIR_NAME_CHARS_PER_ENTRY  15u
+/// Most files sharing a dynamic root directory slot
+#define EXFAT_DIR_FILES_PER_SLOT_MAX    4u
+
+/// Compact description of a dynamically generated file.
+/// Its entry set is generated from this one 32-byte entry at a time.
+typedef struct exfat_dir_file_desc {
+    uint32_t          first_cluster; ///< 0 for an empty file
+    uint32_t          data_length;   ///< Also used as the valid data length
+    exfat_timestamp_t timestamp;     ///< Used for all three timestamps
+    uint16_t          attributes;    ///< exfat_file_attr_t bits
+    uint8_t           name_length;   ///< In characters, 1 to EXFAT_DIR_FILE_NAME_MAX
+    uint8_t           name[EXFAT_DIR_FILE_NAME_MAX]; ///< 8-bit characters, widened to UTF-16
+} exfat_dir_file_desc_t;
+
+/// Describe file `file_idx` of a dynamic root directory slot.
+/// Returns false if there is no such file.
+typedef bool (*exfat_dir_describe_fn_t)(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+/// Take the sizes that the files of a sized slot are described with from
+/// now on.  Called once per read of the slot's directory sector, at its start.
+typedef void (*exfat_dir_refresh_fn_t)(uint32_t slot_idx);
+
+/// Number of 32-byte entries in the entry set of a described file
+static inline uint32_t exfat_dir_desc_entry_count(const exfat_dir_file_desc_t *desc) {
+    return 2u + (desc->name_length + EXFAT_DIR_NAME_CHARS_PER_ENTRY - 1u) / EXFAT_DIR_NAME_CHARS_PER_ENTRY;
+}
 
 #ifdef __cplusplus
 #define static_cast(type) static_cast<type>
@@ -240,7 +261,14 @@ extern const exfat_root_dir_entries_fixed_file_t exfat_root_dir_flash_file_data;
 
 extern uint16_t exfat_dirs_compute_setchecksum(const uint8_t *entries, size_t len);
 
-extern bool files_changing_build_file_partition_entry_set(uint32_t slot_idx, exfat_root_dir_entries_dynamic_file_t *des);
+// Generate entry `entry_idx` of the entry set of a described file
+extern void exfat_dir_generate_entry(const exfat_dir_file_desc_t *desc, uint32_t entry_idx,
+                                     uint16_t set_checksum, void *entry);
+
+// SetChecksum of the entry set of a described file, streamed entry by entry
+extern uint16_t exfat_dir_desc_setchecksum(const exfat_dir_file_desc_t *desc);
+
+extern bool files_changing_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
 
 #ifdef __cplusplus
 }
@@ -1,3 +1,8 @@
+/**
+ * @file src/vd_files_changing.c
+ * @brief CHANGING.TXT, numbered lines with the uptime as they are read, through the text engine.
+ */
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <assert.h>
@@ -9,34 +14,44 @@
 #include "vd_virtual_disk.h"
 #include "vd_exfat.h"
 #include "vd_exfat_dirs.h"
+#include "vd_text.h"
 #include "pico/time.h"
 
-static const char* FORMAT_STRING = "%02d:%02d:%02d: LBA=%u, off=%u, len=%u\n";
+#define CHANGING_LINE_LENGTH  14u // "%4lu %02lu:%02lu:%02lu\n", until 100 hours of uptime
+#define CHANGING_FILE_SECTORS EXFAT_SECTORS_PER_CLUSTER
 
-void vd_return_changing_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
-    assert(lba == PICOVD_CHANGING_FILE_START_LBA);
+_Static_assert(PICOVD_CHANGING_FILE_LINES <= 9999u, "Line numbers have four digits");
+_Static_assert(PICOVD_CHANGING_FILE_LINES * CHANGING_LINE_LENGTH <= CHANGING_FILE_SECTORS * EXFAT_BYTES_PER_SECTOR,
+               "CHANGING.TXT must fit a cluster");
 
-    absolute_time_t now = get_absolute_time();
+// One line per call: its number, and the uptime when rendered
+static uint32_t changing_generate(vd_text_state_t *state, char *out) {
+    if (state->item >= PICOVD_CHANGING_FILE_LINES) {
+        return 0;
+    }
+    const uint32_t total_s = (uint32_t)(to_us_since_boot(get_absolute_time()) / 1000000u);
+    const int len = snprintf(out, VD_TEXT_CHUNK_MAX + 1u, "%4lu %02lu:%02lu:%02lu\n",
+                             (unsigned long)state->item, (unsigned long)(total_s / 3600u),
+                             (unsigned long)((total_s / 60u) % 60u), (unsigned long)(total_s % 60u));
+    state->item++;
+    return len > 0 ? (uint32_t)len : 0;
+}
 
-    uint64_t us = to_us_since_boot(now);
-    uint32_t total_s = us / 1000000;
-    uint32_t hours = total_s / 3600;
-    uint32_t mins  = (total_s / 60) % 60;
-    uint32_t secs  = total_s % 60;
+VD_TEXT_FILE(changing_text, changing_generate, CHANGING_FILE_SECTORS);
 
-    int len = sprintf((char*)buffer, FORMAT_STRING,
-                      hours, mins, secs,
-                      lba, offset, bufsize);
-}
+void vd_return_changing_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_CHANGING_FILE_START_LBA);
+    assert(lba  < PICOVD_CHANGING_FILE_START_LBA + CHANGING_FILE_SECTORS);
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
 
-bool files_changing_build_file_partition_entry_set(uint32_t slot_idx __unused, exfat_root_dir_entries_dynamic_file_t *des) {
-    // This function builds a dynamic entry set for the changing file.
-    memset(des, 0x00, sizeof(*des));
+    vd_text_read(&changing_text, (lba - PICOVD_CHANGING_FILE_START_LBA) * EXFAT_BYTES_PER_SECTOR + offset,
+                 buffer, bufsize);
+}
 
-    // (1) Prepare the file directory entry
-    des->file_directory.entry_type = exfat_entry_type_file_directory;
-    des->file_directory.secondary_count = 2 /* XXX FIXME */;
-    des->file_directory.file_attributes = EXFAT_FILE_ATTR_READ_ONLY;
+bool files_changing_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0) {
+        return false;
+    }
 
     // XXX FIXME: Not RTC, as it should be
     absolute_time_t now = get_absolute_time();
@@ -48,36 +63,16 @@ bool files_changing_build_file_partition_entry_set(uint32_t slot_idx __unused, e
     uint32_t secs  = total_s % 60;
 
     // Set all timestamps to Jan 1, 2025 at current uptime time-of-day
-    uint32_t timestamp = exfat_make_timestamp(2025, 1, 1, hours, mins, secs);
-    des->file_directory.creat_time       = timestamp;
-    des->file_directory.last_mod_time    = timestamp;
-    des->file_directory.last_acc_time    = timestamp;
+    const uint32_t length = vd_text_length(&changing_text);
+    desc->timestamp     = exfat_make_timestamp(2025, 1, 1, hours, mins, secs);
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->data_length   = length;
+    desc->first_cluster = length ? PICOVD_CHANGING_FILE_START_CLUSTER : 0;
 
-    // No 10 ms increments
-    des->file_directory.creat_time_ms    = 0;
-    des->file_directory.last_mod_time_ms = 0;
-    // Mark UTC offset valid (0 minutes)
-    des->file_directory.creat_time_off    = exfat_utc_offset_UTC;
-    des->file_directory.last_mod_time_off = exfat_utc_offset_UTC;
-    des->file_directory.last_acc_time_off = exfat_utc_offset_UTC;
-
-    // (2) Prepare the stream extension entry
-    des->stream_extension.entry_type = exfat_entry_type_stream_extension;
-    des->stream_extension.secondary_flags = 0x03;   // always 'valid data length' + 'no FAT'
-    des->stream_extension.name_length       = PICOVD_CHANGING_FILE_NAME_LEN;
-    des->stream_extension.valid_data_length = PICOVD_CHANGING_FILE_SIZE_BYTES;
-    des->stream_extension.data_length       = PICOVD_CHANGING_FILE_SIZE_BYTES;
-    des->stream_extension.first_cluster     = PICOVD_CHANGING_FILE_START_CLUSTER;
-
-    // (3) Prepare the file name entries
     const char16_t name[] = PICOVD_CHANGING_FILE_NAME;
-
-    des->file_name[0].entry_type = exfat_entry_type_file_name;
-    memcpy(des->file_name[0].file_name, name, PICOVD_CHANGING_FILE_NAME_LEN * sizeof(char16_t));
-
-    // Mark extra entries as unused
-    for (size_t i = 1; i < sizeof(des->file_name) / sizeof(des->file_name[0]); ++i) {
-        des->file_name[i].entry_type = exfat_entry_type_unused;
+    desc->name_length = PICOVD_CHANGING_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_CHANGING_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
     }
 
     return true;
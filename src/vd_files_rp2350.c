@@ -5,10 +5,53 @@
 #include <string.h>
 
 #include <tusb.h>
+#include <pico/bootrom.h>
+#include <pico/flash.h>
+#include <hardware/flash.h>
+#include <hardware/structs/qmi.h>
 #include <picovd_config.h>
 #include "vd_virtual_disk.h"
 #include "vd_exfat.h"
 #include "vd_exfat_params.h"
+#include "vd_idle.h"
+#include "vd_boot.h"
+#include "vd_arena.h"
+#include "vd_flash_map.h"
+
+#if PICOVD_BOOTROM_PARTITIONS_LOAD
+// ---------------------------------------------------------------------------
+// Load the partition table in the background, after USB has enumerated.
+// Necessary when running as a no_flash binary.  Until the table is loaded,
+// the disk reports "not ready" to the host.
+// ---------------------------------------------------------------------------
+static bool partition_table_loaded = false;
+
+void vd_partition_table_job_reset(void) {
+    // The table stays loaded over content changes; nothing to do
+}
+
+bool vd_partition_table_job_step(void) {
+    if (partition_table_loaded) {
+        return true;
+    }
+    // The work area is needed only during the load; give it back afterwards
+    uint8_t *work_area = vd_arena_lease(VD_ARENA_PARTITION_TABLE_LOAD);
+    if (work_area == NULL) {
+        return false; // Try again later
+    }
+    rom_load_partition_table(work_area, VD_ARENA_PARTITION_TABLE_LOAD_SIZE, false);
+    vd_arena_release(VD_ARENA_PARTITION_TABLE_LOAD);
+
+    partition_table_loaded = true;
+    vd_boot_mark(VD_BOOT_PARTITIONS_LOADED);
+
+    // Tell the host that the medium is now there; this also restarts the idle jobs,
+    // so that the directory is recomputed with the partitions
+    vd_virtual_disk_set_ready(true);
+    vd_virtual_disk_contents_changed(false);
+    return true;
+}
+#endif // PICOVD_BOOTROM_PARTITIONS_LOAD
 
 
 
@@ -16,7 +59,7 @@ void vd_return_bootrom_sector(uint32_t lba, void* buffer, uint32_t offset, uint3
     assert(lba >= PICOVD_BOOTROM_START_LBA);
     assert(lba  < PICOVD_BOOTROM_START_LBA + PICOVD_BOOTROM_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR);
 
-    const uint32_t address = ((lba - PICOVD_BOOTROM_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT); // Bootrom is mapped at address 0x0
+    const uint32_t address = ((lba - PICOVD_BOOTROM_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset; // Bootrom is mapped at address 0x0
     memcpy(buffer, (const void*)address, bufsize);
 }
 
@@ -24,7 +67,7 @@ void vd_return_sram_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t
     assert(lba >= PICOVD_SRAM_START_LBA);
     assert(lba  < PICOVD_SRAM_START_LBA + PICOVD_SRAM_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR);
 
-    const uint32_t address = ((lba - PICOVD_SRAM_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + SRAM0_BASE;
+    const uint32_t address = ((lba - PICOVD_SRAM_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset + SRAM0_BASE;
     memcpy(buffer, (const void*)address, bufsize);
 }
 
@@ -32,15 +75,273 @@ void vd_return_flash_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_
     assert(lba >= PICOVD_FLASH_START_LBA);
     assert(lba  < PICOVD_FLASH_START_LBA + PICOVD_FLASH_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR);
 
-    uint32_t flash_address;
+    // Also serves the partition files, which start within FLASH.BIN's clusters
+    vd_read_flash(((lba - PICOVD_FLASH_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset, buffer, bufsize);
+}
+
+void vd_read_flash(uint32_t flash_offset, void* buffer, uint32_t bufsize) {
+    assert(flash_offset + bufsize <= PICOVD_FLASH_SIZE_BYTES);
+    if (vd_flash_map_is_erased(flash_offset, bufsize)) {
+        memset(buffer, 0xFF, bufsize); // Spares the XIP cache and the QSPI bus
+        return;
+    }
+    memcpy(buffer, (const void*)(XIP_BASE + flash_offset), bufsize);
+}
+
+// Supported flags, permissions_and_location and permissions_and_flags of a partition
+static bool partition_location_and_flags(uint32_t part_idx, uint32_t pt_buf[3]) {
+    enum {
+        PT_LOCATION_AND_FLAGS = 0x0010,
+        PT_SINGLE_PARTITION   = 0x8000,
+    };
+    const int words = rom_get_partition_table_info(pt_buf, 3,
+                                                   PT_SINGLE_PARTITION | PT_LOCATION_AND_FLAGS | (part_idx << 24));
+    return words >= 3; // Else no such partition, or the table is not loaded
+}
+
+bool vd_partition_location(uint32_t part_idx, uint32_t *first_sector, uint32_t *sectors) {
+    uint32_t pt_buf[3];
+    if (!partition_location_and_flags(part_idx, pt_buf)) {
+        return false;
+    }
+    vd_partition_location_decode(pt_buf[1], first_sector, sectors);
+    return true;
+}
+
+bool vd_partition_flags(uint32_t part_idx, uint32_t *flags) {
+    uint32_t pt_buf[3];
+    if (!partition_location_and_flags(part_idx, pt_buf)) {
+        return false;
+    }
+    *flags = pt_buf[2];
+    return true;
+}
+
+#if PICOVD_UF2_DROP_ENABLED
+// ---------------------------------------------------------------------------
+// Flash erase and program, for the UF2 drop zone.  XIP is off meanwhile, so
+// flash_safe_execute() keeps the interrupts and the other core off the flash.
+// ---------------------------------------------------------------------------
+#if !PICO_NO_FLASH
+extern char __flash_binary_start;
+extern char __flash_binary_end;
+#endif
+
+bool vd_flash_is_writable(uint32_t flash_offset, uint32_t len) {
+    if (len == 0 || flash_offset >= PICOVD_FLASH_SIZE_BYTES || len > PICOVD_FLASH_SIZE_BYTES - flash_offset) {
+        return false;
+    }
+#if !PICO_NO_FLASH
+    // The running binary, where the address translation puts it
+    const uint32_t window = ((qmi_hw->atrans[0] & QMI_ATRANS0_BASE_BITS) >> QMI_ATRANS0_BASE_LSB) << VD_FLASH_PAGE_SHIFT;
+    const uint32_t start  = window + (uint32_t)(&__flash_binary_start - (char *)XIP_BASE);
+    const uint32_t end    = window + (uint32_t)(&__flash_binary_end - (char *)XIP_BASE);
+    if (flash_offset < end && start < flash_offset + len) {
+        return false;
+    }
+#endif
+    return true;
+}
 
-    if ((PICOVD_FLASH_START_LBA << EXFAT_BYTES_PER_SECTOR_SHIFT) == XIP_BASE) {
-        // Optimized version for the RP2350, with a directly mapped flash pages
-        flash_address = lba << EXFAT_BYTES_PER_SECTOR_SHIFT;
+typedef struct {
+    uint32_t       flash_offset;
+    const uint8_t *data; ///< NULL to erase
+    uint32_t       len;
+} flash_op_t;
+
+static void flash_op_run(void *param) {
+    const flash_op_t *op = (const flash_op_t *)param;
+    if (op->data == NULL) {
+        flash_range_erase(op->flash_offset, op->len);
     } else {
-        // Generic version, with a flash address offset
-        flash_address = ((lba - PICOVD_FLASH_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + XIP_BASE;
+        flash_range_program(op->flash_offset, op->data, op->len);
+    }
+}
+
+bool vd_flash_erase(uint32_t flash_offset, uint32_t len) {
+    assert(flash_offset % FLASH_SECTOR_SIZE == 0 && len % FLASH_SECTOR_SIZE == 0);
+    if (!vd_flash_is_writable(flash_offset, len)) {
+        return false;
     }
+    flash_op_t op = { flash_offset, NULL, len };
+    return flash_safe_execute(flash_op_run, &op, UINT32_MAX) == PICO_OK;
+}
 
-    memcpy(buffer, (const void*)flash_address, bufsize);
+bool vd_flash_program(uint32_t flash_offset, const void *data, uint32_t len) {
+    assert(flash_offset % FLASH_PAGE_SIZE == 0 && len % FLASH_PAGE_SIZE == 0);
+    if (!vd_flash_is_writable(flash_offset, len)) {
+        return false;
+    }
+    flash_op_t op = { flash_offset, (const uint8_t *)data, len };
+    return flash_safe_execute(flash_op_run, &op, UINT32_MAX) == PICO_OK;
+}
+#endif // PICOVD_UF2_DROP_ENABLED
+
+#if PICOVD_BOOTROM_PARTITIONS_TRIM
+// ---------------------------------------------------------------------------
+// Image length of each partition, for trimming the partition files.
+//
+// The image ends with the furthest block of its block loop, see §5.9.3 of
+// the RP2350 datasheet; the first block is within the first 4 kB, and the
+// linker or picotool puts the last one past the end of the binary.  Without
+// a loop of several blocks, the image ends with the last page that is not
+// erased, found scanning down from the end of the partition, a few pages
+// per step.  Computed in idle time, and kept until the contents change;
+// until then, the whole partition is reported, and if the host was given
+// that, the directory is changed once the job is done.
+// ---------------------------------------------------------------------------
+#define TRIM_PARTITIONS       8u  // One per partition slot of the directory
+#define TRIM_BLOCK_SEARCH     4096u
+#define TRIM_MAX_BLOCKS       8u
+#define TRIM_PAGES_PER_STEP   4u
+
+static uint32_t trim_length[TRIM_PARTITIONS];
+static uint32_t trim_known;      ///< Bit set: trim_length is valid
+static uint32_t trim_estimated;  ///< Bit set: the whole partition was reported instead
+static uint32_t trim_part;       ///< Partition in progress
+static uint32_t trim_first_page; ///< Its first flash page
+static uint32_t trim_scan_pages; ///< Pages left to scan, downwards; 0 before the block loop
+
+static inline uint32_t trim_word(uint32_t flash_offset) {
+    return *(const volatile uint32_t *)(XIP_NOCACHE_NOALLOC_BASE + flash_offset);
+}
+
+// Offset past the end marker of the block at `block`, 0 if there is no
+// well-formed block; `*link` is the offset of the next block, relative to this one
+static uint32_t trim_block_end(uint32_t base, uint32_t size, uint32_t block, int32_t *link) {
+    if (block > size - 16u || trim_word(base + block) != PICOBIN_BLOCK_MARKER_START) {
+        return 0;
+    }
+    uint32_t pos   = block + 4u;
+    uint32_t words = 0; // Of the items so far
+    while (words < PICOBIN_MAX_BLOCK_SIZE / 4u && pos <= size - 12u) {
+        const uint32_t item = trim_word(base + pos);
+        if ((item & 0xFFu) == PICOBIN_BLOCK_ITEM_2BS_LAST) {
+            if (((item >> 8) & 0xFFFFu) != words || trim_word(base + pos + 8u) != PICOBIN_BLOCK_MARKER_END) {
+                return 0;
+            }
+            *link = (int32_t)trim_word(base + pos + 4u);
+            return pos + 12u;
+        }
+        // Items with bit 7 of the type set have a 2-byte size, in words
+        const uint32_t item_words = (item & 0x80u) ? (item >> 8) & 0xFFFFu : (item >> 8) & 0xFFu;
+        if (item_words == 0) {
+            return 0;
+        }
+        words += item_words;
+        pos   += 4u * item_words;
+    }
+    return 0;
+}
+
+// End of the furthest block of the block loop at the start of the partition,
+// 0 if there is no loop, or a loop of a single block
+static uint32_t trim_block_loop_end(uint32_t base, uint32_t size) {
+    const uint32_t search = size < TRIM_BLOCK_SEARCH ? size : TRIM_BLOCK_SEARCH;
+    for (uint32_t first = 0; first + 16u <= search; first += 4u) {
+        if (trim_word(base + first) != PICOBIN_BLOCK_MARKER_START) {
+            continue;
+        }
+        uint32_t block = first, end = 0;
+        for (uint32_t n = 0; n < TRIM_MAX_BLOCKS; n++) {
+            int32_t link;
+            const uint32_t block_end = trim_block_end(base, size, block, &link);
+            if (block_end == 0) {
+                break;
+            }
+            if (block_end > end) {
+                end = block_end;
+            }
+            block += (uint32_t)link; // Wraps below 0 to beyond the partition
+            if (block == first) {
+                return n > 0 ? end : 0; // Closed the loop
+            }
+        }
+    }
+    return 0;
+}
+
+static void trim_publish(uint32_t length) {
+    trim_length[trim_part] = length;
+    trim_known |= 1u << trim_part; // Published last
+    trim_part++;
+    trim_scan_pages = 0;
+}
+
+void vd_partition_trim_job_reset(void) {
+    trim_known      = 0;
+    trim_estimated  = 0;
+    trim_part       = 0;
+    trim_scan_pages = 0;
+}
+
+static bool trim_done(void) {
+    if (trim_part < TRIM_PARTITIONS) {
+        return false;
+    }
+    if (trim_estimated) {
+        trim_estimated = 0;
+        vd_virtual_disk_estimate_changed(vd_partition_trim_job_step);
+    }
+    return true;
+}
+
+bool vd_partition_trim_job_step(void) {
+    if (trim_part >= TRIM_PARTITIONS) {
+        return true;
+    }
+    if (trim_scan_pages == 0) {
+        uint32_t first_sector, sectors;
+        if (!vd_partition_location(trim_part, &first_sector, &sectors)
+            || first_sector >= VD_FLASH_PAGES || sectors == 0) {
+            trim_publish(0);
+        } else {
+            if (sectors > VD_FLASH_PAGES - first_sector) {
+                sectors = VD_FLASH_PAGES - first_sector;
+            }
+            const uint32_t end = trim_block_loop_end(first_sector << VD_FLASH_PAGE_SHIFT,
+                                                     sectors << VD_FLASH_PAGE_SHIFT);
+            if (end) {
+                trim_publish(end);
+            } else {
+                trim_first_page = first_sector;
+                trim_scan_pages = sectors; // Scan from the next step on
+            }
+        }
+        return trim_done();
+    }
+
+    // No block loop: the last page that is not erased
+    for (uint32_t n = 0; n < TRIM_PAGES_PER_STEP; n++) {
+        if (!vd_flash_page_erased(trim_first_page + trim_scan_pages - 1u)) {
+            trim_publish(trim_scan_pages << VD_FLASH_PAGE_SHIFT);
+            break;
+        }
+        if (--trim_scan_pages == 0) {
+            trim_publish(0); // All erased
+            break;
+        }
+    }
+    return trim_done();
+}
+
+uint32_t vd_partition_image_length(uint32_t part_idx) {
+    if (part_idx >= TRIM_PARTITIONS) {
+        return 0;
+    }
+    const uint32_t bit = 1u << part_idx;
+    if (trim_known & bit) {
+        return trim_length[part_idx];
+    }
+    // The host came first: the whole partition, rather than scan it here
+    uint32_t first_sector, sectors;
+    if (!vd_partition_location(part_idx, &first_sector, &sectors) || first_sector >= VD_FLASH_PAGES) {
+        return 0;
+    }
+    if (sectors > VD_FLASH_PAGES - first_sector) {
+        sectors = VD_FLASH_PAGES - first_sector;
+    }
+    trim_estimated |= bit;
+    return sectors << VD_FLASH_PAGE_SHIFT;
 }
+#endif // PICOVD_BOOTROM_PARTITIONS_TRIM
@@ -0,0 +1,164 @@
+/**
+ * @file src/vd_flash_map.c
+ * @brief Erased-page map of the flash, built in idle time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#include <hardware/regs/addressmap.h>
+
+#include <picovd_config.h>
+#include "vd_idle.h"
+#include "vd_flash_map.h"
+#include "vd_page_map.h"
+#include "vd_manifest.h"
+
+// Read a page through the non-allocating XIP alias, so that the
+// XIP cache of the running application is left alone
+static bool vd_flash_page_scan(uint32_t page) {
+    const volatile uint32_t *p = (const volatile uint32_t *)(XIP_NOCACHE_NOALLOC_BASE + (page << VD_FLASH_PAGE_SHIFT));
+    for (uint32_t i = 0; i < VD_FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (p[i] != 0xFFFFFFFFu) {
+            return false; // Most programmed pages differ in the first word
+        }
+    }
+    return true;
+}
+
+#if !PICOVD_FLASH_ERASED_MAP_ENABLED
+
+bool vd_flash_page_erased(uint32_t page) {
+    assert(page < VD_FLASH_PAGES);
+    return vd_flash_page_scan(page);
+}
+
+#else
+
+#define MAP_WORDS ((VD_FLASH_PAGES + 31u) / 32u)
+
+static uint32_t vd_flash_map_checked[MAP_WORDS]; ///< Page has been checked since the last change
+static uint32_t vd_flash_map_erased[MAP_WORDS];  ///< Page was erased when checked
+static uint32_t vd_flash_map_next_page;          ///< Where the job goes on
+static vd_flash_map_counters_t vd_flash_map_stats;
+
+static inline bool map_test(const uint32_t *map, uint32_t page) {
+    return (map[page / 32u] >> (page % 32u)) & 1u;
+}
+
+static inline void map_set(uint32_t *map, uint32_t page) {
+    map[page / 32u] |= 1u << (page % 32u);
+}
+
+static inline void map_clear(uint32_t *map, uint32_t page) {
+    map[page / 32u] &= ~(1u << (page % 32u));
+}
+
+bool vd_flash_map_is_erased(uint32_t flash_offset, uint32_t len) {
+    assert(len > 0 && flash_offset + len <= PICOVD_FLASH_SIZE_BYTES);
+
+    const uint32_t first = flash_offset >> VD_FLASH_PAGE_SHIFT;
+    const uint32_t last  = (flash_offset + len - 1) >> VD_FLASH_PAGE_SHIFT;
+    for (uint32_t page = first; page <= last; page++) {
+        if (!map_test(vd_flash_map_checked, page) || !map_test(vd_flash_map_erased, page)) {
+            vd_flash_map_stats.xip_bytes += len;
+            return false;
+        }
+    }
+    vd_flash_map_stats.skipped_bytes += len;
+    return true;
+}
+
+static void map_forget(uint32_t first, uint32_t last) {
+    for (uint32_t page = first; page <= last; page++) {
+        if (map_test(vd_flash_map_checked, page)) {
+            vd_flash_map_stats.pages_checked--;
+            if (map_test(vd_flash_map_erased, page)) {
+                vd_flash_map_stats.pages_erased--;
+            }
+            map_clear(vd_flash_map_checked, page);
+            map_clear(vd_flash_map_erased, page);
+        }
+    }
+
+    // Check the pages again
+    if (first < vd_flash_map_next_page) {
+        vd_flash_map_next_page = first;
+    }
+    vd_idle_rerun(vd_flash_map_job_step);
+}
+
+const vd_flash_map_counters_t *vd_flash_map_counters(void) {
+    return &vd_flash_map_stats;
+}
+
+static void map_record(uint32_t page, bool erased) {
+    if (erased) {
+        map_set(vd_flash_map_erased, page);
+        vd_flash_map_stats.pages_erased++;
+    }
+    // Published last, see vd_flash_map_is_erased()
+    map_set(vd_flash_map_checked, page);
+    vd_flash_map_stats.pages_checked++;
+}
+
+bool vd_flash_page_erased(uint32_t page) {
+    assert(page < VD_FLASH_PAGES);
+    if (map_test(vd_flash_map_checked, page)) {
+        return map_test(vd_flash_map_erased, page);
+    }
+    const bool erased = vd_flash_page_scan(page);
+    map_record(page, erased);
+    return erased;
+}
+
+// ---------------------------------------------------------------------------
+// Idle job: check one page per step
+// ---------------------------------------------------------------------------
+
+void vd_flash_map_job_reset(void) {
+    memset(vd_flash_map_checked, 0, sizeof(vd_flash_map_checked));
+    memset(vd_flash_map_erased,  0, sizeof(vd_flash_map_erased));
+    vd_flash_map_next_page           = 0;
+    vd_flash_map_stats.pages_checked = 0;
+    vd_flash_map_stats.pages_erased  = 0;
+}
+
+bool vd_flash_map_job_step(void) {
+    // Skip the pages checked already, e.g. those left after an invalidation
+    while (vd_flash_map_next_page < VD_FLASH_PAGES
+           && map_test(vd_flash_map_checked, vd_flash_map_next_page)) {
+        vd_flash_map_next_page++;
+    }
+    if (vd_flash_map_next_page >= VD_FLASH_PAGES) {
+        return true;
+    }
+
+    const uint32_t page = vd_flash_map_next_page++;
+    map_record(page, vd_flash_page_scan(page));
+    return vd_flash_map_next_page >= VD_FLASH_PAGES;
+}
+
+#endif // PICOVD_FLASH_ERASED_MAP_ENABLED
+
+void vd_flash_map_invalidate(uint32_t flash_offset, uint32_t len) {
+    if (len == 0 || flash_offset >= PICOVD_FLASH_SIZE_BYTES) {
+        return;
+    }
+    if (len > PICOVD_FLASH_SIZE_BYTES - flash_offset) {
+        len = PICOVD_FLASH_SIZE_BYTES - flash_offset;
+    }
+    const uint32_t first = flash_offset >> VD_FLASH_PAGE_SHIFT;
+    const uint32_t last  = (flash_offset + len - 1) >> VD_FLASH_PAGE_SHIFT;
+#if PICOVD_FLASH_ERASED_MAP_ENABLED
+    map_forget(first, last);
+#endif
+#if PICOVD_PAGEMAP_ENABLED
+    vd_page_map_flash_invalidate(first, last);
+#endif
+#if PICOVD_MANIFEST_ENABLED
+    vd_manifest_flash_invalidate(first, last);
+#endif
+}
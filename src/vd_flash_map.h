@@ -0,0 +1,60 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+
+// ---------------------------------------------------------------
+// Erased-page map of the flash
+//
+// One bit per 4 kB flash page tells whether the page is erased, i.e.
+// all 0xFF.  The map is built by an idle job, a page per step, reading
+// through the non-allocating XIP alias so that the XIP cache of the
+// running application is left alone.  The flash readers consult the
+// map and serve erased pages with memset(), without touching XIP.
+//
+// A page is known only once the job has checked it; unknown pages are
+// read through XIP as before.  The whole map is dropped with the idle
+// jobs on vd_virtual_disk_contents_changed(); code that programs or
+// erases flash behind PicoVD's back must call vd_flash_map_invalidate(),
+// which also drops the pages' records of FLASHMAP.BIN, see vd_page_map.h,
+// and the digests of the files on them in MANIFEST.TXT, see vd_manifest.h.
+// ---------------------------------------------------------------
+
+#define VD_FLASH_PAGE_SIZE  4096u
+#define VD_FLASH_PAGE_SHIFT 12u
+#define VD_FLASH_PAGES      (PICOVD_FLASH_SIZE_BYTES / VD_FLASH_PAGE_SIZE)
+
+_Static_assert(PICOVD_FLASH_SIZE_BYTES % VD_FLASH_PAGE_SIZE == 0, "Flash size must be whole pages");
+
+typedef struct {
+    uint32_t pages_checked; ///< Pages the map knows about
+    uint32_t pages_erased;  ///< Of those, the erased ones
+    uint64_t xip_bytes;     ///< Bytes read through XIP
+    uint64_t skipped_bytes; ///< Bytes of erased pages served without XIP
+} vd_flash_map_counters_t;
+
+// True if flash page `page` is erased.  Looks the page up in the map,
+// or else reads it through the non-allocating XIP alias, adding it to the map.
+extern bool vd_flash_page_erased(uint32_t page);
+
+// Forget the pages overlapping the range, e.g. after programming them.
+// They are read through XIP until the idle job checks them again.
+extern void vd_flash_map_invalidate(uint32_t flash_offset, uint32_t len);
+
+#if PICOVD_FLASH_ERASED_MAP_ENABLED
+
+// True if the flash from `flash_offset` on, `len` bytes, is known to be
+// erased; counts the bytes as skipped if so, or as read through XIP if not
+extern bool vd_flash_map_is_erased(uint32_t flash_offset, uint32_t len);
+
+extern const vd_flash_map_counters_t *vd_flash_map_counters(void);
+
+#else
+
+static inline bool vd_flash_map_is_erased(uint32_t flash_offset, uint32_t len) {
+    (void)flash_offset; (void)len;
+    return false;
+}
+
+#endif // PICOVD_FLASH_ERASED_MAP_ENABLED
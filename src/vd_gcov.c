@@ -0,0 +1,343 @@
+/**
+ * @file src/vd_gcov.c
+ * @brief GCOV directory: the live gcov counters, encoded as .gcda files as they are read.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+
+#include <gcov.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_idle.h"
+#include "vd_profile.h"
+#include "vd_gcov.h"
+
+#if PICOVD_GCOV_ENABLED
+
+#define GCOV_CLUSTER_BYTES  (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER)
+#define GCOV_DIR_BYTES      (PICOVD_GCOV_DIR_CLUSTERS * GCOV_CLUSTER_BYTES)
+#define GCOV_DIR_ENTRIES    (GCOV_DIR_BYTES / 32u)
+#define GCOV_FILE_BYTES     (PICOVD_GCOV_FILE_CLUSTERS * GCOV_CLUSTER_BYTES)
+#define GCOV_LENGTH_SECTORS (VD_GCOV_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT)
+
+_Static_assert(__GNUC__ >= 12, "__gcov_info_to_gcda() and the gcda format below are those of GCC 12 on");
+_Static_assert(PICOVD_GCOV_FILES_MAX <= 255, "Objects are indexed with a byte");
+#if PICOVD_PROFILE_ENABLED
+_Static_assert(PICOVD_PROFILE_START_CLUSTER + VD_PROFILE_FILE_CLUSTERS <= PICOVD_GCOV_START_CLUSTER,
+               "GMON.OUT overlaps GCOV");
+#endif
+#if PICOVD_CHANGING_FILE_ENABLED
+_Static_assert(PICOVD_GCOV_START_CLUSTER + VD_GCOV_LENGTH_CLUSTERS <= PICOVD_CHANGING_FILE_START_CLUSTER,
+               "GCOV overlaps CHANGING.TXT");
+#endif
+
+// The gcda format, as in gcov-io.h of GCC: a header of words, then
+// records of a tag, a length in bytes, and as many bytes of words
+#define GCOV_HEADER_WORDS      4u          // Magic, version, stamp, checksum
+#define GCOV_TAG_COUNTER_BASE  0x01A10000u // Counter record tags, one per 1 << 17 from it
+#define GCOV_COUNTERS_MAX      16u
+
+// The gcov_info of each object, placed by -fprofile-info-section=gcov_info
+extern const struct gcov_info *const __start_gcov_info[];
+extern const struct gcov_info *const __stop_gcov_info[];
+
+typedef struct {
+    const char *name;     ///< Path of the .gcda file, as compiled in
+    uint32_t    length;   ///< Encoded, with the zero counters expanded
+    uint16_t    entry;    ///< First entry of its set in GCOV
+    uint8_t     info_idx; ///< Into the gcov_info section
+} gcov_file_t;
+
+static gcov_file_t gcov_files[PICOVD_GCOV_FILES_MAX];
+
+static struct {
+    uint32_t count;    ///< Files listed
+    uint32_t entries;  ///< Directory entries they take
+    uint32_t info_idx; ///< Next object to measure
+    bool     listed;   ///< Published last
+} gcov_job;
+
+static inline uint32_t gcov_info_count(void) {
+    return (uint32_t)(__stop_gcov_info - __start_gcov_info);
+}
+
+// ---------------------------------------------------------------------------
+// Encoding a window of a file
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    GCOV_PARSE_HEADER,
+    GCOV_PARSE_TAG,
+    GCOV_PARSE_LENGTH,
+    GCOV_PARSE_PAYLOAD,
+} gcov_parse_t;
+
+typedef struct {
+    uint8_t     *out;     ///< Bytes [from, to) of the file go here; NULL to measure
+    uint32_t     from;
+    uint32_t     to;
+    uint32_t     pos;     ///< Bytes of the file so far
+    const char  *name;
+    gcov_parse_t parse;   ///< Of the records, by the word
+    uint32_t     left;    ///< Header words or payload bytes
+    uint32_t     tag;
+    uint32_t     word;
+    uint32_t     word_bytes;
+} gcov_stream_t;
+
+// `len` bytes of the file, from `data`, or zeros if NULL
+static void gcov_emit(gcov_stream_t *s, const void *data, uint32_t len) {
+    const uint32_t start = s->pos;
+    s->pos += len;
+    if (s->out == NULL || s->pos <= s->from || start >= s->to) {
+        return;
+    }
+    const uint32_t lo = start > s->from ? start : s->from;
+    const uint32_t hi = s->pos < s->to ? s->pos : s->to;
+    if (data) {
+        memcpy(s->out + (lo - s->from), (const uint8_t *)data + (lo - start), hi - lo);
+    } else {
+        memset(s->out + (lo - s->from), 0, hi - lo);
+    }
+}
+
+static inline bool gcov_tag_is_counter(uint32_t tag) {
+    return (tag & 0xFFFFu) == 0 && ((tag - GCOV_TAG_COUNTER_BASE) >> 17) < GCOV_COUNTERS_MAX;
+}
+
+// One word of the encoding, passed on but for the length of zero counters
+static void gcov_word(gcov_stream_t *s, uint32_t word) {
+    switch (s->parse) {
+    case GCOV_PARSE_HEADER:
+        gcov_emit(s, &word, 4);
+        if (--s->left == 0) {
+            s->parse = GCOV_PARSE_TAG;
+        }
+        break;
+    case GCOV_PARSE_TAG:
+        s->tag = word;
+        gcov_emit(s, &word, 4);
+        s->parse = GCOV_PARSE_LENGTH;
+        break;
+    case GCOV_PARSE_LENGTH:
+        if (gcov_tag_is_counter(s->tag) && (int32_t)word < 0) {
+            // All zero, given as minus their length; written out, as GCC 11 did
+            word = (uint32_t)-(int32_t)word;
+            gcov_emit(s, &word, 4);
+            gcov_emit(s, NULL, word);
+            s->parse = GCOV_PARSE_TAG;
+            break;
+        }
+        gcov_emit(s, &word, 4);
+        s->left  = word;
+        s->parse = word ? GCOV_PARSE_PAYLOAD : GCOV_PARSE_TAG;
+        break;
+    case GCOV_PARSE_PAYLOAD:
+        gcov_emit(s, &word, 4);
+        s->left = s->left > 4u ? s->left - 4u : 0;
+        if (s->left == 0) {
+            s->parse = GCOV_PARSE_TAG;
+        }
+        break;
+    }
+}
+
+static void gcov_dump_fn(const void *data, unsigned len, void *arg) {
+    gcov_stream_t *s = arg;
+    const uint8_t *p = data;
+    for (unsigned i = 0; i < len; i++) {
+        s->word |= (uint32_t)p[i] << (8u * s->word_bytes);
+        if (++s->word_bytes == 4u) {
+            gcov_word(s, s->word);
+            s->word       = 0;
+            s->word_bytes = 0;
+        }
+    }
+}
+
+static void gcov_filename_fn(const char *name, void *arg) {
+    ((gcov_stream_t *)arg)->name = name;
+}
+
+// Only the value profiles allocate, and PICOVD_GCOV builds have none
+static void *gcov_allocate_fn(unsigned size __unused, void *arg __unused) {
+    assert(false);
+    return NULL;
+}
+
+// Encode object `info_idx`, copying out bytes [from, to) of it, if `out`
+static void gcov_encode(uint32_t info_idx, gcov_stream_t *s, void *out, uint32_t from, uint32_t to) {
+    memset(s, 0, sizeof(*s));
+    s->out   = out;
+    s->from  = from;
+    s->to    = to;
+    s->parse = GCOV_PARSE_HEADER;
+    s->left  = GCOV_HEADER_WORDS;
+    __gcov_info_to_gcda(__start_gcov_info[info_idx], gcov_filename_fn, gcov_dump_fn, gcov_allocate_fn, s);
+}
+
+// Called only to merge the counters into an existing file, which is
+// never done here; libgcov's would link in its file I/O
+void __gcov_merge_add(int64_t *counters __unused, unsigned n_counters __unused) {
+}
+
+// ---------------------------------------------------------------------------
+// Idle job: measure the files, one per step
+// ---------------------------------------------------------------------------
+
+// The name of a file in GCOV: its path, mangled as for -fprofile-use=<dir>
+static void gcov_describe_file(const gcov_file_t *f, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    const size_t len  = strlen(f->name);
+    const char  *name = len > EXFAT_DIR_FILE_NAME_MAX ? f->name + len - EXFAT_DIR_FILE_NAME_MAX : f->name;
+
+    desc->first_cluster = PICOVD_GCOV_START_CLUSTER + PICOVD_GCOV_DIR_CLUSTERS + file_idx * PICOVD_GCOV_FILE_CLUSTERS;
+    desc->data_length   = f->length;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = (uint8_t)(len > EXFAT_DIR_FILE_NAME_MAX ? EXFAT_DIR_FILE_NAME_MAX : len);
+    for (uint32_t i = 0; i < desc->name_length; i++) {
+        const uint8_t c = (uint8_t)name[i];
+        if (c == '/' || c == '\\') {
+            desc->name[i] = '#';
+        } else if (c == ':') {
+            desc->name[i] = '~'; // As GCC does on Windows
+        } else if (c < 0x20u || c >= 0x7Fu || strchr("\"*<>?|", c)) {
+            desc->name[i] = '_'; // Not in an exFAT name, or not ASCII
+        } else {
+            desc->name[i] = c;
+        }
+    }
+}
+
+void vd_gcov_job_reset(void) {
+    gcov_job.listed   = false;
+    gcov_job.count    = 0;
+    gcov_job.entries  = 0;
+    gcov_job.info_idx = 0;
+}
+
+bool vd_gcov_job_step(void) {
+    if (gcov_job.listed) {
+        return true;
+    }
+    if (gcov_job.info_idx >= gcov_info_count() || gcov_job.count >= PICOVD_GCOV_FILES_MAX) {
+        __compiler_memory_barrier();
+        gcov_job.listed = true;
+        return true;
+    }
+    gcov_stream_t s;
+    gcov_encode(gcov_job.info_idx, &s, NULL, 0, 0);
+    gcov_job.info_idx++;
+
+    // The file if it fits, else the files after it may
+    if (s.name == NULL || s.name[0] == '\0' || s.pos > GCOV_FILE_BYTES) {
+        return false;
+    }
+    gcov_file_t *f = &gcov_files[gcov_job.count];
+    f->name     = s.name;
+    f->length   = s.pos;
+    f->entry    = (uint16_t)gcov_job.entries;
+    f->info_idx = (uint8_t)(gcov_job.info_idx - 1u);
+
+    exfat_dir_file_desc_t desc;
+    gcov_describe_file(f, gcov_job.count, &desc);
+    const uint32_t entries = exfat_dir_desc_entry_count(&desc);
+    if (gcov_job.entries + entries <= GCOV_DIR_ENTRIES) {
+        gcov_job.entries += entries;
+        gcov_job.count++;
+    }
+    return false;
+}
+
+// The table, finishing the job if the host came first
+static void gcov_list(void) {
+    while (!gcov_job.listed) {
+        vd_gcov_job_step();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Serve GCOV and its files
+// ---------------------------------------------------------------------------
+
+// Entries [pos / 32, (pos + bufsize) / 32) of GCOV, the entry sets of the files, then zeros
+static void gcov_dir_read(uint32_t pos, uint8_t *buf, uint32_t bufsize) {
+    assert(pos % 32u == 0 && bufsize % 32u == 0);
+    exfat_dir_file_desc_t desc;
+    uint16_t              set_checksum = 0;
+    uint32_t              f            = gcov_job.count; // Described in desc
+
+    for (uint32_t e = pos / 32u; e < (pos + bufsize) / 32u; e++, buf += 32) {
+        if (e >= gcov_job.entries) {
+            memset(buf, 0, 32);
+            continue;
+        }
+        if (f >= gcov_job.count || e < gcov_files[f].entry || e >= gcov_files[f].entry + exfat_dir_desc_entry_count(&desc)) {
+            for (f = 0; f + 1u < gcov_job.count && gcov_files[f + 1u].entry <= e; f++) {
+                ;
+            }
+            gcov_describe_file(&gcov_files[f], f, &desc);
+            set_checksum = exfat_dir_desc_setchecksum(&desc);
+        }
+        exfat_dir_generate_entry(&desc, e - gcov_files[f].entry, set_checksum, buf);
+    }
+}
+
+// Bytes [pos, pos + bufsize) of file `file_idx`, zeroed past its end
+static void gcov_file_read(uint32_t file_idx, uint32_t pos, uint8_t *buf, uint32_t bufsize) {
+    const gcov_file_t *f = &gcov_files[file_idx];
+    const uint32_t     n = pos < f->length ? (f->length - pos < bufsize ? f->length - pos : bufsize) : 0;
+    uint32_t           done = 0;
+    if (n) {
+        gcov_stream_t s;
+        gcov_encode(f->info_idx, &s, buf, pos, pos + n);
+        done = s.pos > pos ? (s.pos - pos < n ? s.pos - pos : n) : 0; // Shorter only if a file is corrupt
+    }
+    memset(buf + done, 0, bufsize - done);
+}
+
+void vd_gcov_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_GCOV_START_LBA);
+    assert(lba  < PICOVD_GCOV_START_LBA + GCOV_LENGTH_SECTORS);
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    gcov_list();
+    const uint32_t pos = (lba - PICOVD_GCOV_START_LBA) * EXFAT_BYTES_PER_SECTOR + offset;
+    if (pos < GCOV_DIR_BYTES) {
+        gcov_dir_read(pos, buffer, bufsize);
+        return;
+    }
+    const uint32_t file_idx = (pos - GCOV_DIR_BYTES) / GCOV_FILE_BYTES;
+    if (file_idx >= gcov_job.count) {
+        memset(buffer, 0, bufsize);
+        return;
+    }
+    gcov_file_read(file_idx, (pos - GCOV_DIR_BYTES) % GCOV_FILE_BYTES, buffer, bufsize);
+}
+
+bool vd_gcov_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_GCOV_DIR_NAME;
+
+    // A directory is whole clusters, the entries past the last set unused
+    desc->first_cluster = PICOVD_GCOV_START_CLUSTER;
+    desc->data_length   = GCOV_DIR_BYTES;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_DIRECTORY;
+    desc->name_length   = PICOVD_GCOV_DIR_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_GCOV_DIR_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_GCOV_ENABLED
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// gcov arc counters, served as the .gcda files of a GCOV directory
+//
+// Configure with -DPICOVD_GCOV=ON, and the PicoVD sources are built
+// with -fprofile-generate, for a profile-guided build, or for gcov.
+// Each object file then has its arc counters and a gcov_info in RAM,
+// and with -fprofile-info-section, a pointer to it in a linker section,
+// instead of a constructor registering it with libgcov.  libgcov's own
+// runtime, which writes the files through the C library on exit, is
+// not linked; only __gcov_info_to_gcda(), its gcda encoder, is.
+//
+// GCOV holds one .gcda file per object, encoded from the live counters
+// whenever the host reads a slice of it, with nothing staged in RAM:
+// each slice encodes the file from its start, and copies out the bytes
+// of the slice, so that a file read costs its size squared over 64
+// bytes.  Counters that are all zero are encoded as just a record
+// length, so the encoding grows as code is run; it is expanded back,
+// so that the files keep the size the directory gives them.  An idle
+// job measures them once per content generation, one file per step.
+//
+// The files are named after the path of the .gcda file, with each
+// '/' as a '#', the way GCC mangles them into a profile directory, so
+// that after copying GCOV to the host, configuring the same build
+// directory with
+//
+//     -DPICOVD_GCOV=OFF -DPICOVD_GCOV_USE=<copy of GCOV>
+//
+// builds the objects with -fprofile-use.  With the names unmangled,
+// gcov reads them with the .gcno files of the instrumented build, as
+// tests/test_gcov.py does.  Names longer than 127 characters keep
+// their end, and objects past PICOVD_GCOV_FILES_MAX, or larger than
+// PICOVD_GCOV_FILE_CLUSTERS, are left out.  The counters keep counting
+// as the host reads, so that a file may mix two moments.
+// ---------------------------------------------------------------
+
+#if PICOVD_GCOV_ENABLED
+
+#define VD_GCOV_LENGTH_CLUSTERS (PICOVD_GCOV_DIR_CLUSTERS + PICOVD_GCOV_FILES_MAX * PICOVD_GCOV_FILE_CLUSTERS)
+
+// Serve GCOV and the .gcda files in it
+extern void vd_gcov_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe the GCOV directory; it never changes
+extern bool vd_gcov_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+#endif // PICOVD_GCOV_ENABLED
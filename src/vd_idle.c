@@ -0,0 +1,159 @@
+/**
+ * @file src/vd_idle.c
+ * @brief Cooperative idle-time scheduler for PicoVD background jobs.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <tusb.h>
+#include <pico/time.h>
+
+#include <picovd_config.h>
+#include "vd_idle.h"
+#include "vd_mount_ready.h"
+
+/**
+ * --------------------------------------------------------------------------
+ * Job table
+ *
+ * Each job computes a result that would otherwise be computed lazily in
+ * a USB callback.  The job publishes its result only once it is complete,
+ * by setting its own "valid" flag as the very last store, so a callback
+ * never sees a half-computed value.  If a callback needs a result before
+ * the job has finished, it simply runs the remaining steps itself.
+ *
+ * The jobs are run in table order, one bounded step per vd_idle_task() call.
+ * --------------------------------------------------------------------------
+ */
+static const vd_idle_job_t vd_idle_jobs[] = {
+#if PICOVD_BOOTROM_PARTITIONS_LOAD
+    // Must run first, as the directory depends on it
+    { vd_partition_table_job_reset,      vd_partition_table_job_step },
+#endif
+#if PICOVD_BOOTROM_PARTITIONS_TRIM
+    // Before the directory, which depends on it
+    { vd_partition_trim_job_reset,       vd_partition_trim_job_step },
+#endif
+    { vd_vbr_checksum_job_reset,         vd_vbr_checksum_job_step },
+#if PICOVD_UF2_ENABLED
+    // Before the directory, which advertises the UF2 sizes
+    { vd_uf2_views_job_reset,            vd_uf2_views_job_step },
+#endif
+#if PICOVD_LZ4_ENABLED
+    // Before the directory, which advertises the compressed sizes
+    { vd_lz4_index_job_reset,            vd_lz4_index_job_step },
+#endif
+#if PICOVD_TAR_ENABLED
+    // Before the directory, which advertises the size of ALL.TAR
+    { vd_tar_job_reset,                  vd_tar_job_step },
+#endif
+#if PICOVD_LOG_ENABLED
+    // Before the directory, which advertises the size of LOG.TXT
+    { vd_log_index_job_reset,            vd_log_index_job_step },
+#endif
+#if PICOVD_GCOV_ENABLED
+    // Before the GCOV directory, which advertises the .gcda sizes
+    { vd_gcov_job_reset,                 vd_gcov_job_step },
+#endif
+    // Before the directory, which advertises the text sizes
+    { vd_text_job_reset,                 vd_text_job_step },
+    { exfat_root_dir_checksums_job_reset, exfat_root_dir_checksums_job_step },
+#if PICOVD_MOUNT_READY_ENABLED
+    // Must run after the jobs above, as it pins their results
+    { vd_mount_ready_job_reset,          vd_mount_ready_job_step },
+#endif
+#if PICOVD_FLASH_ERASED_MAP_ENABLED
+    // Last, as it is long and nothing depends on it
+    { vd_flash_map_job_reset,            vd_flash_map_job_step },
+#endif
+#if PICOVD_PAGEMAP_ENABLED
+    // After the erased-page map, which spares it reading the erased pages
+    { vd_page_map_job_reset,             vd_page_map_job_step },
+#endif
+#if PICOVD_MANIFEST_ENABLED
+    // After the erased-page map, which spares it reading the erased pages
+    { vd_manifest_job_reset,             vd_manifest_job_step },
+#endif
+};
+
+#define VD_IDLE_JOB_COUNT (sizeof(vd_idle_jobs) / sizeof(vd_idle_jobs[0]))
+_Static_assert(VD_IDLE_JOB_COUNT <= 32, "Pending jobs are tracked in a 32-bit mask");
+
+#define VD_IDLE_ALL_JOBS ((uint32_t)((1ull << VD_IDLE_JOB_COUNT) - 1))
+
+static uint32_t vd_idle_pending = VD_IDLE_ALL_JOBS;
+static uint32_t vd_idle_last_msc_activity_us;
+
+void vd_idle_msc_activity(void) {
+    vd_idle_last_msc_activity_us = time_us_32();
+}
+
+static bool vd_idle_bus_is_quiet(void) {
+    // A queued USB event means that tud_task() has work to do
+    if (tud_task_event_ready()) {
+        return false;
+    }
+    // Leave the bus alone for a moment after each MSC command, as hosts
+    // typically issue their commands back-to-back in bursts
+    return (time_us_32() - vd_idle_last_msc_activity_us) >= PICOVD_IDLE_QUIET_US;
+}
+
+static void vd_idle_step_one(void) {
+    // Lowest pending bit first, i.e. in table order
+    const uint32_t i = (uint32_t)__builtin_ctz(vd_idle_pending);
+    if (vd_idle_jobs[i].step()) {
+        vd_idle_pending &= ~(1u << i);
+    }
+}
+
+void vd_idle_task(void) {
+    if (vd_idle_pending == 0 || !vd_idle_bus_is_quiet()) {
+        return;
+    }
+    vd_idle_step_one();
+}
+
+void vd_idle_restart(void) {
+    for (uint32_t i = 0; i < VD_IDLE_JOB_COUNT; i++) {
+        vd_idle_jobs[i].reset();
+    }
+    vd_idle_pending = VD_IDLE_ALL_JOBS;
+}
+
+void vd_idle_restart_after(bool (*step)(void)) {
+    bool after = false;
+    for (uint32_t i = 0; i < VD_IDLE_JOB_COUNT; i++) {
+        if (after) {
+            vd_idle_jobs[i].reset();
+            vd_idle_pending |= 1u << i;
+        }
+        after = after || vd_idle_jobs[i].step == step;
+    }
+}
+
+void vd_idle_rerun(bool (*step)(void)) {
+    for (uint32_t i = 0; i < VD_IDLE_JOB_COUNT; i++) {
+        if (vd_idle_jobs[i].step == step) {
+            vd_idle_pending |= 1u << i;
+        }
+    }
+}
+
+bool vd_idle_step(void) {
+    if (vd_idle_pending != 0) {
+        vd_idle_step_one();
+    }
+    return vd_idle_pending == 0;
+}
+
+void vd_idle_run_to_completion(void) {
+    while (!vd_idle_step()) {
+        ;
+    }
+}
+
+bool vd_idle_all_done(void) {
+    return vd_idle_pending == 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// ---------------------------------------------------------------
+// Idle-time background work scheduler
+//
+// Expensive, cacheable computations (checksums etc.) are split into
+// bounded steps and run from the PicoVD service loop while the USB
+// bus is idle, so that hosts don't see first-access latency spikes.
+// ---------------------------------------------------------------
+
+typedef struct {
+    void (*reset)(void); ///< Drop the published result and restart from the beginning
+    bool (*step)(void);  ///< Do one bounded step; return true once the result is published
+} vd_idle_job_t;
+
+// Call regularly from the main loop, right after tud_task()
+extern void vd_idle_task(void);
+
+// Note MSC activity; jobs are not stepped until the bus has been quiet for a while
+extern void vd_idle_msc_activity(void);
+
+// Invalidate all results and restart all jobs,
+// e.g. when the virtual disk contents have changed
+extern void vd_idle_restart(void);
+
+// Invalidate the results of the jobs after the one with the given step
+// function, in table order, and restart them, e.g. once it has published
+// a result that they were given an estimate of; its own result stays valid
+extern void vd_idle_restart_after(bool (*step)(void));
+
+// Run the job with the given step function again, e.g. after its input
+// changed in part; its published result stays valid meanwhile
+extern void vd_idle_rerun(bool (*step)(void));
+
+// Run one step of the pending jobs, ignoring the bus state.
+// Returns true once all jobs are done.
+extern bool vd_idle_step(void);
+
+// Run all pending jobs to completion, ignoring the bus state
+extern void vd_idle_run_to_completion(void);
+
+// True if all jobs have published their results
+extern bool vd_idle_all_done(void);
+
+// ---------------------------------------------------------------
+// Jobs provided by the other modules
+// ---------------------------------------------------------------
+
+// Partition table load, in vd_files_rp2350.c
+extern void vd_partition_table_job_reset(void);
+extern bool vd_partition_table_job_step(void);
+
+// Partition image lengths, in vd_files_rp2350.c
+extern void vd_partition_trim_job_reset(void);
+extern bool vd_partition_trim_job_step(void);
+
+// VBR checksum, in vd_virtual_disk.c
+extern void vd_vbr_checksum_job_reset(void);
+extern bool vd_vbr_checksum_job_step(void);
+
+// UF2 views, in vd_uf2.c
+extern void vd_uf2_views_job_reset(void);
+extern bool vd_uf2_views_job_step(void);
+
+// LZ4 block index, in vd_lz4.c
+extern void vd_lz4_index_job_reset(void);
+extern bool vd_lz4_index_job_step(void);
+
+// ALL.TAR file table, in vd_tar.c
+extern void vd_tar_job_reset(void);
+extern bool vd_tar_job_step(void);
+
+// LOG.TXT line index, in vd_log.c; run again by vd_log_task() as records come in
+extern void vd_log_index_job_reset(void);
+extern bool vd_log_index_job_step(void);
+
+// GCOV listing and .gcda lengths, in vd_gcov.c
+extern void vd_gcov_job_reset(void);
+extern bool vd_gcov_job_step(void);
+
+// Generated text lengths and checkpoints, in vd_text.c
+extern void vd_text_job_reset(void);
+extern bool vd_text_job_step(void);
+
+// Root directory SetChecksums, in vd_exfat_directory.c
+extern void exfat_root_dir_checksums_job_reset(void);
+extern bool exfat_root_dir_checksums_job_step(void);
+
+// Erased-page map of the flash, in vd_flash_map.c
+extern void vd_flash_map_job_reset(void);
+extern bool vd_flash_map_job_step(void);
+
+// Flash page CRCs, in vd_page_map.c
+extern void vd_page_map_job_reset(void);
+extern bool vd_page_map_job_step(void);
+
+// File digests, in vd_manifest.c
+extern void vd_manifest_job_reset(void);
+extern bool vd_manifest_job_step(void);
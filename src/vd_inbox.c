@@ -0,0 +1,226 @@
+/**
+ * @file src/vd_inbox.c
+ * @brief RAM-backed upload files: host writes land in application buffers.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+
+#include <pico/time.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_virtual_disk.h"
+#include "vd_inbox.h"
+
+#if PICOVD_INBOX_ENABLED
+
+#define INBOX_FILE_SECTORS     (VD_INBOX_FILE_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT)
+#define INBOX_CLUSTER(i)       (PICOVD_INBOX_START_CLUSTER + (i) * VD_INBOX_FILE_CLUSTERS)
+#define INBOX_ENTRIES_MAX      (EXFAT_BYTES_PER_SECTOR / 32u)
+#define INBOX_NO_LENGTH        UINT32_MAX
+#define INBOX_DIR_ENTRY_SIZE   sizeof(exfat_stream_extension_dir_entry_t)
+
+_Static_assert(PICOVD_INBOX_FILES_MAX <= EXFAT_DIR_FILES_PER_SLOT_MAX, "The inboxes share a root directory slot");
+_Static_assert(PICOVD_INBOX_FILE_SIZE_MAX % (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER) == 0,
+               "Each inbox window must be whole clusters");
+_Static_assert(CFG_TUD_MSC_EP_BUFSIZE % INBOX_DIR_ENTRY_SIZE == 0, "Slices must hold whole directory entries");
+#if PICOVD_UF2_DROP_ENABLED
+_Static_assert(PICOVD_INBOX_START_CLUSTER + VD_INBOX_LENGTH_CLUSTERS <= PICOVD_UF2_DROP_START_CLUSTER,
+               "The inboxes overlap the UF2 drop zone");
+#endif
+#if PICOVD_CHANGING_FILE_ENABLED
+_Static_assert(PICOVD_INBOX_START_CLUSTER + VD_INBOX_LENGTH_CLUSTERS <= PICOVD_CHANGING_FILE_START_CLUSTER,
+               "The inboxes overlap CHANGING.TXT");
+#endif
+
+typedef struct {
+    const char             *name;
+    uint8_t                *data;
+    uint32_t                size;
+    vd_inbox_complete_fn_t  complete;
+    void                   *context;
+    uint32_t                written;   ///< End of the data written since the last completion
+    uint32_t                covered;   ///< Bytes from the start all written since then
+    uint32_t                announced; ///< Size in the host's directory entry, INBOX_NO_LENGTH if none yet
+    uint32_t                last_us;   ///< time_us_32() of the last write to the file or its entry
+    bool                    done;      ///< The callback is due
+} inbox_t;
+
+static inbox_t  inboxes[PICOVD_INBOX_FILES_MAX];
+static uint32_t inbox_sectors[PICOVD_INBOX_FILES_MAX][(INBOX_FILE_SECTORS + 31u) / 32u]; ///< Written since the last completion
+static uint32_t inbox_count;   ///< Declared, published last
+static uint32_t inbox_entries; ///< Directory entries of the declared files
+
+int vd_inbox_declare(const char *name, void *buffer, uint32_t size,
+                     vd_inbox_complete_fn_t complete, void *context) {
+    const size_t name_length = strlen(name);
+    if (inbox_count >= PICOVD_INBOX_FILES_MAX || size == 0 || size > PICOVD_INBOX_FILE_SIZE_MAX
+        || name_length == 0 || name_length > EXFAT_DIR_FILE_NAME_MAX) {
+        return -1;
+    }
+    // The entry sets of all inboxes must fit the slot's sector
+    const uint32_t entries = 2u + (uint32_t)(name_length + EXFAT_DIR_NAME_CHARS_PER_ENTRY - 1u) / EXFAT_DIR_NAME_CHARS_PER_ENTRY;
+    if (inbox_entries + entries > INBOX_ENTRIES_MAX) {
+        return -1;
+    }
+    inbox_t *in = &inboxes[inbox_count];
+    in->name      = name;
+    in->data      = buffer;
+    in->size      = size;
+    in->complete  = complete;
+    in->context   = context;
+    in->written   = 0;
+    in->covered   = 0;
+    in->announced = INBOX_NO_LENGTH;
+    in->done      = false;
+    memset(inbox_sectors[inbox_count], 0, sizeof(inbox_sectors[inbox_count]));
+    inbox_entries += entries;
+    __compiler_memory_barrier();
+    inbox_count++;
+
+    vd_virtual_disk_contents_changed(false);
+    return (int)(inbox_count - 1u);
+}
+
+// ---------------------------------------------------------------------------
+// Host writes
+// ---------------------------------------------------------------------------
+
+// Done once the data written covers the size in the host's directory entry,
+// with no gap, as the host may write the clusters in any order
+static void inbox_check_done(inbox_t *in) {
+    if (in->announced != INBOX_NO_LENGTH && in->covered >= in->announced) {
+        in->done = true;
+    }
+}
+
+// Note that the host has written sector `sector` of inbox `i`, and move the
+// covered watermark past the sectors written from it on
+static void inbox_sector_written(uint32_t i, uint32_t sector) {
+    inbox_t *in = &inboxes[i];
+    inbox_sectors[i][sector / 32u] |= 1u << (sector % 32u);
+    while (in->covered < in->size) {
+        const uint32_t s = in->covered / EXFAT_BYTES_PER_SECTOR;
+        if (!(inbox_sectors[i][s / 32u] & (1u << (s % 32u)))) {
+            break;
+        }
+        in->covered = (s + 1u) * EXFAT_BYTES_PER_SECTOR < in->size ? (s + 1u) * EXFAT_BYTES_PER_SECTOR : in->size;
+    }
+}
+
+// Note the sizes the host gives the inboxes' entry sets; any other entry is ignored
+static void inbox_directory_write(const uint8_t *in, uint32_t bufsize) {
+    for (uint32_t at = 0; at + INBOX_DIR_ENTRY_SIZE <= bufsize; at += INBOX_DIR_ENTRY_SIZE) {
+        if (in[at] != exfat_entry_type_stream_extension) {
+            continue;
+        }
+        exfat_stream_extension_dir_entry_t se;
+        memcpy(&se, in + at, sizeof(se));
+        for (uint32_t i = 0; i < inbox_count; i++) {
+            inbox_t *box = &inboxes[i];
+            if (se.first_cluster == INBOX_CLUSTER(i) && se.data_length > 0) {
+                box->announced = se.data_length < box->size ? (uint32_t)se.data_length : box->size;
+                box->last_us   = time_us_32();
+                inbox_check_done(box);
+            }
+        }
+    }
+}
+
+bool vd_inbox_write(uint32_t lba, uint32_t offset, const void *buffer, uint32_t bufsize) {
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    if (lba >= EXFAT_ROOT_DIR_START_LBA && lba < EXFAT_ROOT_DIR_START_LBA + EXFAT_ROOT_DIR_LENGTH_SECTORS) {
+        inbox_directory_write(buffer, bufsize);
+        return false;
+    }
+    if (lba < PICOVD_INBOX_START_LBA || lba >= PICOVD_INBOX_START_LBA + PICOVD_INBOX_FILES_MAX * INBOX_FILE_SECTORS) {
+        return false;
+    }
+    const uint32_t i = (lba - PICOVD_INBOX_START_LBA) / INBOX_FILE_SECTORS;
+    if (i >= inbox_count) {
+        return true; // Not declared, dropped
+    }
+    inbox_t *in = &inboxes[i];
+    const uint32_t pos = ((lba - PICOVD_INBOX_START_LBA) % INBOX_FILE_SECTORS) * EXFAT_BYTES_PER_SECTOR + offset;
+    if (pos >= in->size) {
+        return true; // The rest of the file's last cluster
+    }
+    const uint32_t len = bufsize < in->size - pos ? bufsize : in->size - pos;
+    memcpy(in->data + pos, buffer, len);
+    if (pos + len > in->written) {
+        in->written = pos + len;
+    }
+    // The slices of a sector come in order; its last one completes it
+    if (offset + bufsize == EXFAT_BYTES_PER_SECTOR || pos + len == in->size) {
+        inbox_sector_written(i, pos / EXFAT_BYTES_PER_SECTOR);
+    }
+    in->last_us = time_us_32();
+    inbox_check_done(in);
+    return true;
+}
+
+void vd_inbox_task(void) {
+    const uint32_t now = time_us_32();
+    for (uint32_t i = 0; i < inbox_count; i++) {
+        inbox_t *in = &inboxes[i];
+        if (!in->done && in->written > 0 && now - in->last_us >= PICOVD_INBOX_IDLE_TIMEOUT_MS * 1000u) {
+            in->done = true; // The host went quiet without a directory update we understood
+        }
+        if (!in->done) {
+            continue;
+        }
+        // The size from the directory if the data covers it, else the data written
+        const uint32_t length = in->announced <= in->covered ? in->announced : in->written;
+        in->done      = false;
+        in->written   = 0;
+        in->covered   = 0;
+        in->announced = INBOX_NO_LENGTH;
+        memset(inbox_sectors[i], 0, sizeof(inbox_sectors[i]));
+        if (in->complete != NULL) {
+            in->complete(i, length, in->context);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Host reads and the directory
+// ---------------------------------------------------------------------------
+
+void vd_inbox_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_INBOX_START_LBA);
+    assert(lba  < PICOVD_INBOX_START_LBA + PICOVD_INBOX_FILES_MAX * INBOX_FILE_SECTORS);
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    const uint32_t i   = (lba - PICOVD_INBOX_START_LBA) / INBOX_FILE_SECTORS;
+    const uint32_t pos = ((lba - PICOVD_INBOX_START_LBA) % INBOX_FILE_SECTORS) * EXFAT_BYTES_PER_SECTOR + offset;
+    uint32_t len = 0;
+    if (i < inbox_count && pos < inboxes[i].size) {
+        len = bufsize < inboxes[i].size - pos ? bufsize : inboxes[i].size - pos;
+        memcpy(buffer, inboxes[i].data + pos, len);
+    }
+    memset((uint8_t *)buffer + len, 0, bufsize - len);
+}
+
+bool vd_inbox_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx >= inbox_count) {
+        return false;
+    }
+    const inbox_t *in = &inboxes[file_idx];
+
+    desc->first_cluster = INBOX_CLUSTER(file_idx);
+    desc->data_length   = in->size;
+    desc->timestamp     = 0;
+    desc->attributes    = 0; // Writable
+    desc->name_length   = (uint8_t)strlen(in->name);
+    memcpy(desc->name, in->name, desc->name_length);
+    return true;
+}
+
+#endif // PICOVD_INBOX_ENABLED
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// RAM-backed upload files, e.g. INBOX.BIN
+//
+// The application declares up to PICOVD_INBOX_FILES_MAX files, each
+// backed by a buffer of its own, and the host copies data into them
+// with its ordinary file copy, at bulk MSC speed.  Each file has a
+// window of PICOVD_INBOX_FILE_SIZE_MAX bytes of clusters; WRITE10s to
+// the clusters of its buffer are copied straight into the buffer, and
+// reads return the buffer.  Everything else the host writes is dropped,
+// and the rest of the volume stays as it was.
+//
+// The host overwrites a file by freeing its clusters and allocating
+// them again: with the rest of the bitmap full, it gets the same ones.
+// Once it has written the data, it updates the file's directory entry
+// with the new size.  The write is complete once the directory entry
+// of the file's first cluster has a size, and the sectors written cover
+// all of it from the start, in whatever order they came, or else
+// PICOVD_INBOX_IDLE_TIMEOUT_MS after the last write to the file.
+// The completion callback is then called from vd_inbox_task(), with the
+// size, or without a directory update, the end of the data written.
+//
+// The host's view of the file may differ from the directory PicoVD
+// serves, in size and timestamp, until it reads the directory again.
+// The buffer belongs to the host from its first write to the callback.
+// ---------------------------------------------------------------
+
+// Called once the host has written `length` bytes from the start of inbox `inbox`
+typedef void (*vd_inbox_complete_fn_t)(uint32_t inbox, uint32_t length, void *context);
+
+#if PICOVD_INBOX_ENABLED
+
+#define VD_INBOX_FILE_CLUSTERS  (PICOVD_INBOX_FILE_SIZE_MAX / (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER))
+#define VD_INBOX_LENGTH_CLUSTERS (PICOVD_INBOX_FILES_MAX * VD_INBOX_FILE_CLUSTERS)
+
+// Declare an upload file named `name`, backed by the `size` bytes of `buffer`;
+// both are kept, not copied.  Returns the inbox number passed to `complete`,
+// or -1 if all inboxes are taken or the file does not fit its window.
+// The host sees the file once it re-reads the directory, see
+// vd_virtual_disk_contents_changed().
+extern int vd_inbox_declare(const char *name, void *buffer, uint32_t size,
+                            vd_inbox_complete_fn_t complete, void *context);
+
+// Consume a slice of a written sector of the exFAT LUN, as tud_msc_write10_cb():
+// true if it fell in the inbox clusters; root directory writes are parsed, but not consumed
+extern bool vd_inbox_write(uint32_t lba, uint32_t offset, const void *buffer, uint32_t bufsize);
+
+// Call regularly from the main loop, right after tud_task(); calls the completion callbacks
+extern void vd_inbox_task(void);
+
+// Serve the inbox clusters, from the buffers
+extern void vd_inbox_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe the declared inboxes, all in one slot
+extern bool vd_inbox_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+#endif // PICOVD_INBOX_ENABLED
@@ -0,0 +1,279 @@
+/**
+ * @file src/vd_log.c
+ * @brief Deferred-format log: records stored raw, formatted when LOG.TXT is read.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <pico/time.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_idle.h"
+#include "vd_stdio.h"
+#include "vd_log.h"
+
+#if PICOVD_LOG_ENABLED
+
+#define LOG_MASK         (PICOVD_LOG_RECORDS - 1u)
+#define LOG_FILE_SECTORS (VD_LOG_FILE_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT)
+
+_Static_assert((PICOVD_LOG_RECORDS & LOG_MASK) == 0, "The log ring size must be a power of two");
+_Static_assert(PICOVD_LOG_LINE_MAX >= 32 && PICOVD_LOG_LINE_MAX <= 255, "Log lines must fit a timestamp, and a byte");
+#if PICOVD_STDIO_ENABLED
+_Static_assert(PICOVD_STDIO_START_CLUSTER + VD_STDIO_LENGTH_CLUSTERS <= PICOVD_LOG_START_CLUSTER,
+               "STDERR.TXT overlaps LOG.TXT");
+#endif
+#if PICOVD_UF2_DROP_ENABLED
+_Static_assert(PICOVD_LOG_START_CLUSTER + VD_LOG_FILE_CLUSTERS <= PICOVD_UF2_DROP_START_CLUSTER,
+               "LOG.TXT overlaps the UF2 drop zone");
+#endif
+#if PICOVD_CHANGING_FILE_ENABLED
+_Static_assert(PICOVD_LOG_START_CLUSTER + VD_LOG_FILE_CLUSTERS <= PICOVD_CHANGING_FILE_START_CLUSTER,
+               "LOG.TXT overlaps CHANGING.TXT");
+#endif
+
+typedef struct {
+    const char *fmt;
+    uint32_t    time_us;
+    uintptr_t   args[VD_LOG_ARGS_MAX];
+    uint32_t    seq;     ///< Record number + 1, stored last; 0 while being written
+} log_record_t;
+
+static log_record_t log_ring[PICOVD_LOG_RECORDS];
+static uint32_t     log_reserved; ///< Records since boot; the next one goes to reserved & mask
+
+// The index: the text position of each record, at its number & mask.
+// Text positions count the bytes of all lines since boot, modulo 2^32.
+static uint32_t log_offsets[PICOVD_LOG_RECORDS];
+static uint32_t log_first;    ///< Oldest record with its offset still in the index
+static uint32_t log_indexed;  ///< Records indexed, published last
+static uint32_t log_text_end; ///< Text position after the last record indexed
+
+// LOG.TXT, as of the last read of its directory sector
+static bool log_window_taken; ///< Else there has been no directory read yet
+static struct {
+    uint32_t first, end;           ///< Records
+    uint32_t text_start, text_end; ///< Text positions
+} log_window;
+
+// The last line rendered; a record, once numbered, always renders the same
+static struct {
+    uint32_t n;    ///< Record number + 1, 0 if none
+    uint32_t len;
+    char     text[PICOVD_LOG_LINE_MAX + 1];
+} log_line;
+
+// ---------------------------------------------------------------------------
+// Producers
+// ---------------------------------------------------------------------------
+
+void __not_in_flash_func(vd_log_write)(const char *fmt, uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3) {
+    const uint32_t n = __atomic_fetch_add(&log_reserved, 1u, __ATOMIC_RELAXED);
+    log_record_t  *r = &log_ring[n & LOG_MASK];
+
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->fmt     = fmt;
+    r->time_us = time_us_32();
+    r->args[0] = a0;
+    r->args[1] = a1;
+    r->args[2] = a2;
+    r->args[3] = a3;
+    __atomic_store_n(&r->seq, n + 1u, __ATOMIC_RELEASE);
+}
+
+// ---------------------------------------------------------------------------
+// Rendering
+// ---------------------------------------------------------------------------
+
+// Copy record `n`; false if it is being written, or has been overwritten
+static bool log_read(uint32_t n, log_record_t *out) {
+    const log_record_t *r = &log_ring[n & LOG_MASK];
+    if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != n + 1u) {
+        return false;
+    }
+    memcpy(out, r, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == n + 1u;
+}
+
+// Render record `n` as a line, ending with a newline, into `line`;
+// returns its length, or 0 if the record is not there
+static uint32_t log_render(uint32_t n, char line[PICOVD_LOG_LINE_MAX + 1]) {
+    log_record_t r;
+    if (!log_read(n, &r)) {
+        return 0;
+    }
+    uint32_t len = (uint32_t)snprintf(line, PICOVD_LOG_LINE_MAX + 1u, "[%5lu.%06lu] ",
+                                      (unsigned long)(r.time_us / 1000000u), (unsigned long)(r.time_us % 1000000u));
+    const int m = snprintf(line + len, PICOVD_LOG_LINE_MAX + 1u - len, r.fmt,
+                           r.args[0], r.args[1], r.args[2], r.args[3]);
+    if (m > 0) {
+        len = len + (uint32_t)m < PICOVD_LOG_LINE_MAX ? len + (uint32_t)m : PICOVD_LOG_LINE_MAX;
+    }
+    while (len > 0 && line[len - 1u] == '\n') {
+        len--;
+    }
+    if (len > PICOVD_LOG_LINE_MAX - 1u) {
+        len = PICOVD_LOG_LINE_MAX - 1u;
+    }
+    line[len++] = '\n';
+    return len;
+}
+
+// The line of record `n`, exactly `len` bytes as indexed: cut short
+// or padded with spaces, and all spaces if the record is gone
+static const char *log_line_get(uint32_t n, uint32_t len) {
+    if (log_line.n != n + 1u || log_line.len != len) {
+        uint32_t got = log_render(n, log_line.text);
+        if (got < len) {
+            memset(log_line.text + (got ? got - 1u : 0), ' ', len - (got ? got - 1u : 0));
+        }
+        log_line.text[len - 1u] = '\n';
+        log_line.n   = n + 1u;
+        log_line.len = len;
+    }
+    return log_line.text;
+}
+
+// ---------------------------------------------------------------------------
+// Index, as an idle job
+// ---------------------------------------------------------------------------
+
+// Index the next record; true if there is none yet
+static bool log_index_one(void) {
+    const uint32_t reserved = __atomic_load_n(&log_reserved, __ATOMIC_ACQUIRE);
+    if (reserved - log_indexed > PICOVD_LOG_RECORDS) {
+        // Lapped: the records not indexed in time are gone
+        log_indexed = reserved - PICOVD_LOG_RECORDS;
+        log_first   = log_indexed;
+    }
+    if (log_indexed == reserved) {
+        return true;
+    }
+    char line[PICOVD_LOG_LINE_MAX + 1];
+    const uint32_t len = log_render(log_indexed, line);
+    if (len == 0) {
+        return true; // Being written, or lapped meanwhile
+    }
+    log_offsets[log_indexed & LOG_MASK] = log_text_end;
+    log_text_end += len;
+    if (log_indexed - log_first >= PICOVD_LOG_RECORDS) {
+        log_first++; // Its offset has just been overwritten
+    }
+    __compiler_memory_barrier();
+    log_indexed++;
+    return false;
+}
+
+void vd_log_index_job_reset(void) {
+    // The index stays valid over content changes
+}
+
+bool vd_log_index_job_step(void) {
+    return log_index_one();
+}
+
+void vd_log_task(void) {
+    if (log_indexed != log_reserved) {
+        vd_idle_rerun(vd_log_index_job_step);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Serve LOG.TXT
+// ---------------------------------------------------------------------------
+
+// The last record of the window that starts at or before text position `at`,
+// by binary search of the index; `at` must not be before the record `lo`
+static uint32_t log_find(uint32_t lo, uint32_t at) {
+    uint32_t hi = log_window.end; // offset(lo) <= at < offset(hi)
+    while (hi - lo > 1u) {
+        const uint32_t mid = lo + (hi - lo) / 2u;
+        if (log_offsets[mid & LOG_MASK] - log_window.text_start <= at - log_window.text_start) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void vd_log_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_LOG_START_LBA);
+    assert(lba  < PICOVD_LOG_START_LBA + LOG_FILE_SECTORS);
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    const uint32_t pos    = (lba - PICOVD_LOG_START_LBA) * EXFAT_BYTES_PER_SECTOR + offset;
+    const uint32_t length = log_window.text_end - log_window.text_start;
+    uint8_t       *buf    = buffer;
+    uint32_t       done   = 0;
+
+    if (pos < length) {
+        const uint32_t len = bufsize < length - pos ? bufsize : length - pos;
+        // The records of the window whose offsets the index still has
+        const uint32_t lo     = log_first > log_window.first ? log_first : log_window.first;
+        const uint32_t lo_pos = lo < log_window.end ? log_offsets[lo & LOG_MASK] - log_window.text_start : length;
+        if (pos < lo_pos) {
+            done = lo_pos - pos < len ? lo_pos - pos : len;
+            memset(buf, ' ', done); // Lost
+        }
+        if (done < len) {
+            uint32_t n = log_find(lo, log_window.text_start + pos + done);
+            while (done < len) {
+                const uint32_t start = log_offsets[n & LOG_MASK] - log_window.text_start;
+                const uint32_t end   = n + 1u < log_window.end ? log_offsets[(n + 1u) & LOG_MASK] - log_window.text_start
+                                                                : length;
+                const char    *line  = log_line_get(n, end - start);
+                const uint32_t from  = pos + done - start;
+                const uint32_t count = end - start - from < len - done ? end - start - from : len - done;
+                memcpy(buf + done, line + from, count);
+                done += count;
+                n++;
+            }
+        }
+    }
+    memset(buf + done, 0, bufsize - done);
+}
+
+void vd_log_refresh(uint32_t slot_idx __unused) {
+    // The records indexed so far; the idle job indexes the others for the next read
+    log_window.end        = log_indexed;
+    log_window.first      = log_first;
+    log_window.text_start = log_window.first < log_window.end ? log_offsets[log_window.first & LOG_MASK] : log_text_end;
+    log_window.text_end   = log_text_end;
+    log_window_taken      = true;
+}
+
+bool vd_log_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_LOG_FILE_NAME;
+
+    // The window of the last directory read, the same for the sector path
+    if (!log_window_taken) {
+        vd_log_refresh(slot_idx);
+    }
+    const uint32_t length = log_window.text_end - log_window.text_start;
+
+    desc->first_cluster = length ? PICOVD_LOG_START_CLUSTER : 0;
+    desc->data_length   = length;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_LOG_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_LOG_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_LOG_ENABLED
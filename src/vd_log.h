@@ -0,0 +1,88 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// Deferred-format log, served as LOG.TXT
+//
+// VD_LOG("fmt", ...) formats nothing: it stores a pointer to the format
+// string, a timestamp and up to VD_LOG_ARGS_MAX argument words into a
+// fixed-size ring, from anywhere, without waiting.  The text is made
+// only when the host reads LOG.TXT, one line per record:
+//
+//     [   12.345678] <the formatted record>
+//
+// An index of the byte offset of each line is built as the records
+// come in, in idle time, so that a sector of LOG.TXT is rendered from
+// just the records it holds.
+//
+// The format string must be a literal, and the arguments words: any
+// integer of up to 32 bits, a character, or a pointer, e.g. for %p.
+// A %s argument must point to a string that stays the same, such as
+// a literal.  Lines are cut to PICOVD_LOG_LINE_MAX characters.
+//
+// LOG.TXT holds the last PICOVD_LOG_RECORDS records indexed, as of the
+// last read of its directory sector; its entry and its sectors are
+// served from that window until the next one.  Records overwritten
+// since are served as lines of spaces of the same length.
+// ---------------------------------------------------------------
+
+#define VD_LOG_ARGS_MAX 4u
+
+#if PICOVD_LOG_ENABLED
+
+#define VD_LOG_FILE_SIZE_MAX  (PICOVD_LOG_RECORDS * PICOVD_LOG_LINE_MAX)
+#define VD_LOG_FILE_CLUSTERS  ((VD_LOG_FILE_SIZE_MAX + EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER - 1u) \
+                               / (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER))
+
+// Store a record; use VD_LOG() instead
+extern void vd_log_write(const char *fmt, uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3);
+
+// Call regularly from the main loop; has new records indexed in idle time
+extern void vd_log_task(void);
+
+// Serve LOG.TXT
+extern void vd_log_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe LOG.TXT; only its size changes
+extern bool vd_log_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+// Take the window of LOG.TXT, as the host reads its directory entry
+extern void vd_log_refresh(uint32_t slot_idx);
+
+#define VD_LOG_STORE_0(fmt)             vd_log_write(fmt, 0, 0, 0, 0)
+#define VD_LOG_STORE_1(fmt, a)          vd_log_write(fmt, (uintptr_t)(a), 0, 0, 0)
+#define VD_LOG_STORE_2(fmt, a, b)       vd_log_write(fmt, (uintptr_t)(a), (uintptr_t)(b), 0, 0)
+#define VD_LOG_STORE_3(fmt, a, b, c)    vd_log_write(fmt, (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c), 0)
+#define VD_LOG_STORE_4(fmt, a, b, c, d) vd_log_write(fmt, (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c), (uintptr_t)(d))
+
+#else
+
+static inline void vd_log_task(void) {}
+
+#define VD_LOG_STORE_0(fmt)             ((void)0)
+#define VD_LOG_STORE_1(fmt, a)          ((void)0)
+#define VD_LOG_STORE_2(fmt, a, b)       ((void)0)
+#define VD_LOG_STORE_3(fmt, a, b, c)    ((void)0)
+#define VD_LOG_STORE_4(fmt, a, b, c, d) ((void)0)
+
+#endif // PICOVD_LOG_ENABLED
+
+// Only checks the format against the arguments, at compile time
+static inline void __attribute__((format(printf, 1, 2))) vd_log_check_format(const char *fmt, ...) { (void)fmt; }
+
+#define VD_LOG_COUNT_(_, a, b, c, d, n, ...) n
+#define VD_LOG_STORE_N_(n)                   VD_LOG_STORE_ ## n
+#define VD_LOG_STORE_N(n)                    VD_LOG_STORE_N_(n)
+
+// Log a record, formatted as printf(fmt, ...) when the host reads LOG.TXT;
+// at most VD_LOG_ARGS_MAX arguments
+#define VD_LOG(fmt, ...) do {                                                             \
+        if (0) {                                                                          \
+            vd_log_check_format(fmt, ##__VA_ARGS__);                                      \
+        }                                                                                 \
+        VD_LOG_STORE_N(VD_LOG_COUNT_(_, ##__VA_ARGS__, 4, 3, 2, 1, 0))("" fmt, ##__VA_ARGS__); \
+    } while (0)
@@ -0,0 +1,528 @@
+/**
+ * @file src/vd_lz4.c
+ * @brief LZ4 frames of the flash and its partitions, compressed block by block on demand.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#include <hardware/regs/addressmap.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_arena.h"
+#include "vd_flash_map.h"
+#include "vd_lz4.h"
+
+#if PICOVD_LZ4_ENABLED
+
+// LZ4 frame format, see lz4_Frame_format.md
+#define LZ4_FRAME_MAGIC        0x184D2204u
+#define LZ4_FRAME_FLG          0x68u // Version 01, independent blocks, content size
+#define LZ4_FRAME_BD           0x40u // Blocks of up to 64 kB
+#define LZ4_FRAME_HEADER_SIZE  15u   // Magic, FLG, BD, content size, header checksum
+#define LZ4_BLOCK_HEADER_SIZE  4u
+#define LZ4_BLOCK_STORED       0x80000000u // Block size flag: not compressed
+#define LZ4_END_MARK_SIZE      4u
+
+// LZ4 block format, see lz4_Block_format.md
+#define LZ4_MIN_MATCH          4u
+#define LZ4_MFLIMIT            12u // The last match starts at least this far from the end
+#define LZ4_LAST_LITERALS      5u  // and ends at least this far from it
+
+// Views: one per partition slot of the directory, then FLASH.BIN
+#define LZ4_VIEW_PARTITIONS    (PICOVD_BOOTROM_PARTITIONS_ENABLED ? 8u : 0u)
+#define LZ4_VIEW_FLASH         LZ4_VIEW_PARTITIONS
+#define LZ4_VIEW_COUNT         (LZ4_VIEW_PARTITIONS + (PICOVD_FLASH_ENABLED ? 1u : 0u))
+
+_Static_assert(LZ4_VIEW_COUNT > 0, "LZ4 views need the partition files or FLASH.BIN");
+_Static_assert(VD_LZ4_BLOCK_SIZE <= 0x10000, "Match offsets and hash entries are 16-bit");
+
+typedef struct {
+    uint32_t first_page;      ///< Source, in flash pages
+    uint32_t length;          ///< Uncompressed bytes, 0 if there is no view
+    uint32_t size;            ///< Frame bytes
+    uint16_t tail_size;       ///< Compressed size of a partial last block, 0 if stored
+    uint8_t  header_checksum; ///< HC byte of the frame descriptor
+} lz4_view_t;
+
+static lz4_view_t lz4_views[LZ4_VIEW_COUNT];
+static uint32_t   lz4_views_known;  ///< Bit set: the view is published
+static uint32_t   lz4_views_missed; ///< Bit set: the view was left out before it was published
+
+// Block index: the compressed size of each flash page, 0 if stored
+#define PAGE_WORDS ((VD_FLASH_PAGES + 31u) / 32u)
+static uint16_t lz4_page_size[VD_FLASH_PAGES];
+static uint32_t lz4_page_known[PAGE_WORDS];
+
+// Encoder state and the last block compressed, leased from the arena; the block
+// is kept there for the 64-byte slices that follow, unless another lease comes in between
+typedef struct {
+    uint8_t  input[VD_LZ4_BLOCK_SIZE];        ///< Copy of the block
+    uint16_t hash[1u << VD_LZ4_HASH_LOG];     ///< Last position of each hashed 4-byte sequence
+    uint8_t  block[VD_LZ4_BLOCK_SIZE - 1];    ///< The block compressed
+} lz4_encoder_t;
+
+static uint32_t lz4_block_offset = UINT32_MAX; ///< Flash offset of enc->block
+static uint32_t lz4_block_length;              ///< Its uncompressed length
+
+_Static_assert(sizeof(lz4_encoder_t) <= VD_ARENA_LZ4_SIZE, "LZ4 encoder must fit its arena lease");
+
+// ---------------------------------------------------------------------------
+// Block encoder: greedy, one hash table probe per position
+// ---------------------------------------------------------------------------
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32u - VD_LZ4_HASH_LOG);
+}
+
+// Bytes of 255, then the rest of a length
+static uint8_t *lz4_put_length(uint8_t *op, uint32_t len) {
+    for (; len >= 255u; len -= 255u) {
+        *op++ = 255u;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Worst-case bytes of a sequence with `literals` literals and a match of `match` + 4 bytes
+static inline uint32_t lz4_sequence_bound(uint32_t literals, uint32_t match) {
+    return 1u + literals / 255u + 1u + literals + 2u + match / 255u + 1u;
+}
+
+// Compress the `len` bytes of enc->input into `dst`.  Returns the compressed
+// size, or 0 if it would not be smaller than `len`, i.e. the block is stored.
+static uint32_t lz4_compress(lz4_encoder_t *enc, uint32_t len, uint8_t *dst) {
+    const uint8_t *src   = enc->input;
+    const uint32_t dst_max = len - 1u;
+    uint32_t       op     = 0;
+    uint32_t       anchor = 0; // First literal not emitted yet
+
+    memset(enc->hash, 0, sizeof(enc->hash));
+
+    if (len > LZ4_MFLIMIT) {
+        const uint32_t match_limit   = len - LZ4_MFLIMIT;
+        const uint32_t match_end_max = len - LZ4_LAST_LITERALS;
+        uint32_t ip = 0;
+        while (ip < match_limit) {
+            const uint32_t sequence = lz4_read32(src + ip);
+            const uint32_t h        = lz4_hash(sequence);
+            const uint32_t ref      = enc->hash[h];
+            enc->hash[h] = (uint16_t)ip;
+            if (ref >= ip || lz4_read32(src + ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            // Extend the match both ways; the offset stays the same
+            const uint32_t offset = ip - ref;
+            uint32_t start = ip;
+            while (start > anchor && start > offset && src[start - 1u] == src[start - 1u - offset]) {
+                start--;
+            }
+            uint32_t end = ip + LZ4_MIN_MATCH;
+            while (end < match_end_max && src[end] == src[end - offset]) {
+                end++;
+            }
+
+            const uint32_t literals = start - anchor;
+            const uint32_t match    = end - start - LZ4_MIN_MATCH;
+            if (op + lz4_sequence_bound(literals, match) > dst_max) {
+                return 0;
+            }
+            uint8_t *token = &dst[op++];
+            *token = (uint8_t)(((literals < 15u ? literals : 15u) << 4) | (match < 15u ? match : 15u));
+            if (literals >= 15u) {
+                op = (uint32_t)(lz4_put_length(&dst[op], literals - 15u) - dst);
+            }
+            memcpy(&dst[op], src + anchor, literals);
+            op += literals;
+            dst[op++] = (uint8_t)offset;
+            dst[op++] = (uint8_t)(offset >> 8);
+            if (match >= 15u) {
+                op = (uint32_t)(lz4_put_length(&dst[op], match - 15u) - dst);
+            }
+            anchor = ip = end;
+        }
+    }
+
+    // The last literals
+    const uint32_t literals = len - anchor;
+    if (op + 1u + literals / 255u + 1u + literals > dst_max) {
+        return 0;
+    }
+    dst[op++] = (uint8_t)((literals < 15u ? literals : 15u) << 4);
+    if (literals >= 15u) {
+        op = (uint32_t)(lz4_put_length(&dst[op], literals - 15u) - dst);
+    }
+    memcpy(&dst[op], src + anchor, literals);
+    return op + literals;
+}
+
+// Compress `len` bytes of flash from `flash_offset` on into enc->block.
+// Returns the compressed size, 0 if stored.
+static uint16_t lz4_block_fill(lz4_encoder_t *enc, uint32_t flash_offset, uint32_t len) {
+    // Through the non-allocating XIP alias, to leave the XIP cache alone
+    if (vd_flash_page_erased(flash_offset >> VD_FLASH_PAGE_SHIFT)) {
+        memset(enc->input, 0xFF, len);
+    } else {
+        memcpy(enc->input, (const void *)(XIP_NOCACHE_NOALLOC_BASE + flash_offset), len);
+    }
+    const uint16_t size = (uint16_t)lz4_compress(enc, len, enc->block);
+    lz4_block_offset = size ? flash_offset : UINT32_MAX;
+    lz4_block_length = len;
+    return size;
+}
+
+// As lz4_block_fill(), leasing the arena; false if it is leased
+static bool lz4_block_index(uint32_t flash_offset, uint32_t len, uint16_t *size) {
+    lz4_encoder_t *enc = vd_arena_lease(VD_ARENA_LZ4);
+    if (enc == NULL) {
+        return false;
+    }
+    *size = lz4_block_fill(enc, flash_offset, len);
+    vd_arena_release(VD_ARENA_LZ4);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Frame layout
+// ---------------------------------------------------------------------------
+
+// XXH32 of a short input, for the frame descriptor's header checksum
+static uint32_t lz4_xxh32_short(const uint8_t *p, uint32_t len) {
+    const uint32_t P1 = 2654435761u, P2 = 2246822519u, P3 = 3266489917u, P4 = 668265263u, P5 = 374761393u;
+    uint32_t h = P5 + len; // Seed 0
+    for (; len >= 4u; len -= 4u, p += 4) {
+        h += lz4_read32(p) * P3;
+        h  = ((h << 17) | (h >> 15)) * P4;
+    }
+    for (; len > 0; len--, p++) {
+        h += *p * P5;
+        h  = ((h << 11) | (h >> 21)) * P1;
+    }
+    h ^= h >> 15;
+    h *= P2;
+    h ^= h >> 13;
+    h *= P3;
+    h ^= h >> 16;
+    return h;
+}
+
+static void lz4_frame_header(const lz4_view_t *view, uint8_t header[LZ4_FRAME_HEADER_SIZE]) {
+    const uint32_t magic = LZ4_FRAME_MAGIC;
+    memcpy(header, &magic, sizeof(magic)); // Little endian, like the target
+    header[4] = LZ4_FRAME_FLG;
+    header[5] = LZ4_FRAME_BD;
+    const uint64_t content_size = view->length;
+    memcpy(header + 6, &content_size, sizeof(content_size));
+    header[14] = view->header_checksum;
+}
+
+typedef struct {
+    uint32_t offset; ///< In flash
+    uint32_t length; ///< Uncompressed
+    uint32_t size;   ///< Compressed, 0 if stored
+} lz4_block_t;
+
+static inline uint32_t lz4_view_blocks(const lz4_view_t *view) {
+    return (view->length + VD_LZ4_BLOCK_SIZE - 1u) / VD_LZ4_BLOCK_SIZE;
+}
+
+static void lz4_view_block(const lz4_view_t *view, uint32_t k, lz4_block_t *block) {
+    const uint32_t page = view->first_page + k;
+    block->offset = page << VD_FLASH_PAGE_SHIFT;
+    if (k < view->length / VD_LZ4_BLOCK_SIZE) {
+        block->length = VD_LZ4_BLOCK_SIZE;
+        block->size   = lz4_page_size[page];
+    } else {
+        block->length = view->length % VD_LZ4_BLOCK_SIZE;
+        block->size   = view->tail_size;
+    }
+}
+
+// Frame bytes of a block, with its header
+static inline uint32_t lz4_block_span(const lz4_block_t *block) {
+    return LZ4_BLOCK_HEADER_SIZE + (block->size ? block->size : block->length);
+}
+
+// ---------------------------------------------------------------------------
+// Idle job: index the pages of each view, one page per step, then publish it
+// ---------------------------------------------------------------------------
+
+static uint32_t lz4_job_view;    ///< View in progress
+static bool     lz4_job_located; ///< Its source is known
+static uint32_t lz4_job_page;    ///< Its next page to index
+
+// Forget the read position of the last view read, see lz4_view_read()
+static void lz4_cursor_reset(void);
+
+static inline bool lz4_page_is_known(uint32_t page) {
+    return (lz4_page_known[page / 32u] >> (page % 32u)) & 1u;
+}
+
+static void lz4_view_locate(uint32_t v, lz4_view_t *view) {
+    view->first_page = 0;
+    view->length     = 0;
+#if PICOVD_FLASH_ENABLED
+    if (v == LZ4_VIEW_FLASH) {
+        view->length = PICOVD_FLASH_SIZE_BYTES;
+        return;
+    }
+#endif
+#if PICOVD_BOOTROM_PARTITIONS_ENABLED
+    uint32_t first_sector, sectors;
+    if (!vd_partition_location(v, &first_sector, &sectors) || first_sector >= VD_FLASH_PAGES) {
+        return;
+    }
+    if (sectors > VD_FLASH_PAGES - first_sector) {
+        sectors = VD_FLASH_PAGES - first_sector;
+    }
+    view->first_page = first_sector;
+    view->length     = sectors << VD_FLASH_PAGE_SHIFT;
+#if PICOVD_BOOTROM_PARTITIONS_TRIM
+    // The same bytes as the partition file
+    const uint32_t image_length = vd_partition_image_length(v);
+    if (image_length < view->length) {
+        view->length = image_length;
+    }
+#endif
+#endif
+}
+
+// Frame size, once all of the view's pages are indexed
+static uint32_t lz4_view_size(const lz4_view_t *view) {
+    const uint32_t blocks = lz4_view_blocks(view);
+    uint32_t size = LZ4_FRAME_HEADER_SIZE + LZ4_END_MARK_SIZE;
+    for (uint32_t k = 0; k < blocks; k++) {
+        lz4_block_t block;
+        lz4_view_block(view, k, &block);
+        size += lz4_block_span(&block);
+    }
+    return size;
+}
+
+void vd_lz4_index_job_reset(void) {
+    lz4_views_known  = 0;
+    lz4_views_missed = 0;
+    memset(lz4_page_known, 0, sizeof(lz4_page_known));
+    lz4_job_view     = 0;
+    lz4_job_located  = false;
+    lz4_block_offset = UINT32_MAX;
+    lz4_cursor_reset();
+}
+
+bool vd_lz4_index_job_step(void) {
+    if (lz4_job_view >= LZ4_VIEW_COUNT) {
+        return true;
+    }
+    lz4_view_t *view = &lz4_views[lz4_job_view];
+    if (!lz4_job_located) {
+        lz4_view_locate(lz4_job_view, view);
+        lz4_job_page    = 0;
+        lz4_job_located = true;
+        return false;
+    }
+
+    // The whole pages, skipping those indexed already for another view
+    const uint32_t pages = view->length / VD_LZ4_BLOCK_SIZE;
+    while (lz4_job_page < pages && lz4_page_is_known(view->first_page + lz4_job_page)) {
+        lz4_job_page++;
+    }
+    if (lz4_job_page < pages) {
+        const uint32_t page = view->first_page + lz4_job_page;
+        uint16_t size;
+        if (lz4_block_index(page << VD_FLASH_PAGE_SHIFT, VD_LZ4_BLOCK_SIZE, &size)) {
+            lz4_page_size[page] = size;
+            lz4_page_known[page / 32u] |= 1u << (page % 32u);
+            lz4_job_page++;
+        }
+        return false; // Else the arena is leased; try again later
+    }
+
+    // The partial last block, if any, then publish
+    const uint32_t tail = view->length % VD_LZ4_BLOCK_SIZE;
+    uint16_t tail_size = 0;
+    if (tail && !lz4_block_index((view->first_page + pages) << VD_FLASH_PAGE_SHIFT, tail, &tail_size)) {
+        return false;
+    }
+    view->tail_size = tail_size;
+    if (view->length) {
+        uint8_t descriptor[LZ4_FRAME_HEADER_SIZE];
+        lz4_frame_header(view, descriptor);
+        view->header_checksum = (uint8_t)(lz4_xxh32_short(descriptor + 4, 10) >> 8);
+        view->size = lz4_view_size(view);
+    } else {
+        view->size = 0;
+    }
+    __compiler_memory_barrier();
+    lz4_views_known |= 1u << lz4_job_view; // Published last
+
+    lz4_job_view++;
+    lz4_job_located = false;
+    if (lz4_job_view < LZ4_VIEW_COUNT) {
+        return false;
+    }
+    // The directory the host has seen lacks views; tell it
+    if (lz4_views_missed) {
+        lz4_views_missed = 0;
+        vd_virtual_disk_estimate_changed(vd_lz4_index_job_step);
+    }
+    return true;
+}
+
+// View `v`, or NULL if the job has not published it yet: the host came
+// first, and the view is left out until it is
+static const lz4_view_t *lz4_view(uint32_t v) {
+    if (!(lz4_views_known & (1u << v))) {
+        lz4_views_missed |= 1u << v;
+        return NULL;
+    }
+    return &lz4_views[v];
+}
+
+// First cluster of view `v`, relative to PICOVD_LZ4_START_CLUSTER
+static inline uint32_t lz4_view_cluster(uint32_t v, const lz4_view_t *view) {
+    return v == LZ4_VIEW_FLASH ? VD_LZ4_VIEW_CLUSTERS(VD_FLASH_PAGES) : VD_LZ4_VIEW_CLUSTERS(view->first_page);
+}
+
+// ---------------------------------------------------------------------------
+// Serve a view, block by block.  Hosts read sequentially, in 64-byte slices,
+// so the block of the last slice is found again without walking the index.
+// ---------------------------------------------------------------------------
+
+static struct {
+    uint32_t view;  ///< LZ4_VIEW_COUNT if none
+    uint32_t block; ///< Last block served
+    uint32_t start; ///< Its frame position
+} lz4_cursor;
+
+static void lz4_cursor_reset(void) {
+    lz4_cursor.view = LZ4_VIEW_COUNT;
+}
+
+static void lz4_view_read(uint32_t v, const lz4_view_t *view, uint32_t pos, uint8_t *buf, uint32_t len) {
+    while (len > 0) {
+        uint32_t n;
+        if (pos >= view->size) {
+            memset(buf, 0, len); // The rest of the cluster
+            return;
+        } else if (pos < LZ4_FRAME_HEADER_SIZE) {
+            uint8_t header[LZ4_FRAME_HEADER_SIZE];
+            lz4_frame_header(view, header);
+            n = LZ4_FRAME_HEADER_SIZE - pos < len ? LZ4_FRAME_HEADER_SIZE - pos : len;
+            memcpy(buf, header + pos, n);
+        } else if (pos >= view->size - LZ4_END_MARK_SIZE) {
+            n = view->size - pos < len ? view->size - pos : len;
+            memset(buf, 0, n); // The end mark is a zero block size
+        } else {
+            if (lz4_cursor.view != v || pos < lz4_cursor.start) {
+                lz4_cursor.view  = v;
+                lz4_cursor.block = 0;
+                lz4_cursor.start = LZ4_FRAME_HEADER_SIZE;
+            }
+            lz4_block_t block;
+            lz4_view_block(view, lz4_cursor.block, &block);
+            while (pos >= lz4_cursor.start + lz4_block_span(&block)) {
+                lz4_cursor.start += lz4_block_span(&block);
+                lz4_view_block(view, ++lz4_cursor.block, &block);
+            }
+            assert(lz4_cursor.block < lz4_view_blocks(view));
+
+            const uint32_t in_block = pos - lz4_cursor.start;
+            const uint32_t left     = lz4_block_span(&block) - in_block;
+            n = left < len ? left : len;
+            if (in_block < LZ4_BLOCK_HEADER_SIZE) {
+                const uint32_t word = block.size ? block.size : block.length | LZ4_BLOCK_STORED;
+                n = LZ4_BLOCK_HEADER_SIZE - in_block < n ? LZ4_BLOCK_HEADER_SIZE - in_block : n;
+                for (uint32_t i = 0; i < n; i++) {
+                    buf[i] = (uint8_t)(word >> (8u * (in_block + i)));
+                }
+            } else if (block.size == 0) {
+                vd_read_flash(block.offset + in_block - LZ4_BLOCK_HEADER_SIZE, buf, n);
+            } else {
+                // Leases are not held across callbacks, so this one cannot fail
+                const bool kept = vd_arena_kept(VD_ARENA_LZ4);
+                lz4_encoder_t *enc = vd_arena_lease(VD_ARENA_LZ4);
+                assert(enc != NULL);
+                if (!kept || lz4_block_offset != block.offset || lz4_block_length != block.length) {
+                    const uint16_t size __unused = lz4_block_fill(enc, block.offset, block.length);
+                    assert(size == block.size); // Else the flash changed behind our back
+                }
+                memcpy(buf, enc->block + in_block - LZ4_BLOCK_HEADER_SIZE, n);
+                vd_arena_release(VD_ARENA_LZ4);
+            }
+        }
+        buf += n;
+        pos += n;
+        len -= n;
+    }
+}
+
+void vd_lz4_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_LZ4_START_LBA);
+    assert(lba  < PICOVD_LZ4_START_LBA + (VD_LZ4_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT));
+
+    // Position within the LZ4 clusters, and the cluster of it
+    const uint32_t pos     = ((lba - PICOVD_LZ4_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset;
+    const uint32_t cluster = pos >> (EXFAT_BYTES_PER_SECTOR_SHIFT + EXFAT_SECTORS_PER_CLUSTER_SHIFT);
+
+    for (uint32_t v = 0; v < LZ4_VIEW_COUNT; v++) {
+        if (!(lz4_views_known & (1u << v))) {
+            continue; // Not in the directory yet
+        }
+        const lz4_view_t *view  = &lz4_views[v];
+        const uint32_t    first = lz4_view_cluster(v, view);
+        if (view->length && cluster >= first && cluster < first + VD_LZ4_VIEW_CLUSTERS(lz4_view_blocks(view))) {
+            const uint32_t view_pos = pos - (first << (EXFAT_BYTES_PER_SECTOR_SHIFT + EXFAT_SECTORS_PER_CLUSTER_SHIFT));
+            lz4_view_read(v, view, view_pos, buffer, bufsize);
+            return;
+        }
+    }
+    memset(buffer, 0, bufsize); // No file
+}
+
+uint32_t vd_lz4_partition_view(uint32_t part_idx, uint32_t *first_cluster) {
+    if (part_idx >= LZ4_VIEW_PARTITIONS) {
+        return 0;
+    }
+    const lz4_view_t *view = lz4_view(part_idx);
+    if (view == NULL) {
+        return 0;
+    }
+    *first_cluster = PICOVD_LZ4_START_CLUSTER + lz4_view_cluster(part_idx, view);
+    return view->size;
+}
+
+#if PICOVD_FLASH_ENABLED
+bool vd_lz4_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    const lz4_view_t *view = lz4_view(LZ4_VIEW_FLASH);
+    if (file_idx != 0 || view == NULL) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_LZ4_FLASH_FILE_NAME;
+
+    desc->first_cluster = VD_LZ4_FLASH_VIEW_CLUSTER;
+    desc->data_length   = view->size;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_LZ4_FLASH_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_LZ4_FLASH_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+#endif
+
+#endif // PICOVD_LZ4_ENABLED
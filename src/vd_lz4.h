@@ -0,0 +1,48 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+#include "vd_flash_map.h"
+
+// ---------------------------------------------------------------
+// Compressed views of the flash, <partition>.lz4 and FLASH.BIN.LZ4
+//
+// Each view is an LZ4 frame (lz4 -d, or any LZ4 frame decoder) of
+// independent blocks, one block per 4 kB flash page.  A block is
+// compressed only when the host reads it; a page that does not
+// compress is stored as is, and read straight from flash.
+//
+// The compressed size of each page is indexed by an idle job, so that
+// the directory can advertise the exact size of each view, and a read
+// at any offset finds its block without compressing the ones before it.
+// The index is dropped with the idle jobs on vd_virtual_disk_contents_changed().
+// A view is left out of the directory until it is indexed, and if the
+// host was shown the directory without it, the directory is changed then.
+//
+// The encoder is a greedy LZ4 with a small hash table; its state, a copy
+// of the page being compressed and the block it compresses to are leased
+// from the shared arena.  Only the index, two bytes per flash page, is
+// kept in RAM of its own.
+// ---------------------------------------------------------------
+
+#define VD_LZ4_BLOCK_SIZE   VD_FLASH_PAGE_SIZE
+#define VD_LZ4_HASH_LOG     10u
+
+// Each view has two clusters per flash page of its source, enough for the
+// frame even if nothing compresses: partition views start at the cluster of
+// their first page, the FLASH.BIN.LZ4 view after all of them
+#define VD_LZ4_VIEW_CLUSTERS(pages) (2u * (pages))
+#define VD_LZ4_FLASH_VIEW_CLUSTER   (PICOVD_LZ4_START_CLUSTER + VD_LZ4_VIEW_CLUSTERS(VD_FLASH_PAGES))
+#define VD_LZ4_LENGTH_CLUSTERS      (2u * VD_LZ4_VIEW_CLUSTERS(VD_FLASH_PAGES))
+
+// Serve the LZ4 views' clusters
+extern void vd_lz4_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Size of the LZ4 view of partition `part_idx`, 0 if none or not indexed yet,
+// and its first cluster
+extern uint32_t vd_lz4_partition_view(uint32_t part_idx, uint32_t *first_cluster);
+
+// Describe FLASH.BIN.LZ4, for its own root directory slot, once it is indexed
+extern bool vd_lz4_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
@@ -0,0 +1,415 @@
+/**
+ * @file src/vd_manifest.c
+ * @brief MANIFEST.TXT, the SHA-256 of each file with stable contents, hashed in idle time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <picovd_config.h>
+#if PICOVD_MANIFEST_SHA256_HW
+#include <pico/sha256.h>
+#endif
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_flash_map.h"
+#include "vd_manifest.h"
+
+#include "tusb_config.h"     // for CFG_TUD_MSC_EP_BUFSIZE
+
+#if PICOVD_MANIFEST_ENABLED
+
+_Static_assert(VD_MANIFEST_FILE_SIZE_BYTES % EXFAT_BYTES_PER_SECTOR == 0, "MANIFEST.TXT must be whole sectors");
+_Static_assert(PICOVD_MANIFEST_FILES_MAX <= 255, "Entries are indexed with a byte");
+
+#define SHA256_SIZE 32u
+
+// ---------------------------------------------------------------------------
+// SHA-256, on the accelerator if enabled and free, else in software.
+// The accelerator is held from the first to the last sector of a file.
+// ---------------------------------------------------------------------------
+
+static const uint32_t sha256_k[64] = {
+    0x428A2F98u, 0x71374491u, 0xB5C0FBCFu, 0xE9B5DBA5u, 0x3956C25Bu, 0x59F111F1u, 0x923F82A4u, 0xAB1C5ED5u,
+    0xD807AA98u, 0x12835B01u, 0x243185BEu, 0x550C7DC3u, 0x72BE5D74u, 0x80DEB1FEu, 0x9BDC06A7u, 0xC19BF174u,
+    0xE49B69C1u, 0xEFBE4786u, 0x0FC19DC6u, 0x240CA1CCu, 0x2DE92C6Fu, 0x4A7484AAu, 0x5CB0A9DCu, 0x76F988DAu,
+    0x983E5152u, 0xA831C66Du, 0xB00327C8u, 0xBF597FC7u, 0xC6E00BF3u, 0xD5A79147u, 0x06CA6351u, 0x14292967u,
+    0x27B70A85u, 0x2E1B2138u, 0x4D2C6DFCu, 0x53380D13u, 0x650A7354u, 0x766A0ABBu, 0x81C2C92Eu, 0x92722C85u,
+    0xA2BFE8A1u, 0xA81A664Bu, 0xC24B8B70u, 0xC76C51A3u, 0xD192E819u, 0xD6990624u, 0xF40E3585u, 0x106AA070u,
+    0x19A4C116u, 0x1E376C08u, 0x2748774Cu, 0x34B0BCB5u, 0x391C0CB3u, 0x4ED8AA4Au, 0x5B9CCA4Fu, 0x682E6FF3u,
+    0x748F82EEu, 0x78A5636Fu, 0x84C87814u, 0x8CC70208u, 0x90BEFFFAu, 0xA4506CEBu, 0xBEF9A3F7u, 0xC67178F2u,
+};
+
+static struct {
+#if PICOVD_MANIFEST_SHA256_HW
+    pico_sha256_state_t hw;
+    bool                on_hw;   ///< The accelerator is ours
+#endif
+    uint32_t h[8];
+    uint8_t  block[64];
+    uint64_t length;             ///< Bytes so far
+} sha;
+
+static inline uint32_t ror32(uint32_t x, uint32_t n) {
+    return (x >> n) | (x << (32u - n));
+}
+
+static void sha256_sw_block(const uint8_t block[64]) {
+    uint32_t w[64];
+    for (uint32_t i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16)
+             | ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+    for (uint32_t i = 16; i < 64; i++) {
+        const uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = sha.h[0], b = sha.h[1], c = sha.h[2], d = sha.h[3];
+    uint32_t e = sha.h[4], f = sha.h[5], g = sha.h[6], h = sha.h[7];
+    for (uint32_t i = 0; i < 64; i++) {
+        const uint32_t t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        const uint32_t t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    sha.h[0] += a; sha.h[1] += b; sha.h[2] += c; sha.h[3] += d;
+    sha.h[4] += e; sha.h[5] += f; sha.h[6] += g; sha.h[7] += h;
+}
+
+static void sha256_sw_update(const uint8_t *data, uint32_t len) {
+    while (len > 0) {
+        const uint32_t used = (uint32_t)(sha.length % 64u);
+        uint32_t n = 64u - used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(sha.block + used, data, n);
+        sha.length += n;
+        data += n;
+        len  -= n;
+        if (used + n == 64u) {
+            sha256_sw_block(sha.block);
+        }
+    }
+}
+
+static void sha_start(void) {
+#if PICOVD_MANIFEST_SHA256_HW
+    sha.on_hw = pico_sha256_try_start(&sha.hw, SHA256_BIG_ENDIAN, false) == PICO_OK;
+    if (sha.on_hw) {
+        return;
+    }
+#endif
+    static const uint32_t h0[8] = {
+        0x6A09E667u, 0xBB67AE85u, 0x3C6EF372u, 0xA54FF53Au, 0x510E527Fu, 0x9B05688Cu, 0x1F83D9ABu, 0x5BE0CD19u,
+    };
+    memcpy(sha.h, h0, sizeof(sha.h));
+    sha.length = 0;
+}
+
+static void sha_update(const uint8_t *data, uint32_t len) {
+#if PICOVD_MANIFEST_SHA256_HW
+    if (sha.on_hw) {
+        pico_sha256_update_blocking(&sha.hw, data, len);
+        return;
+    }
+#endif
+    sha256_sw_update(data, len);
+}
+
+// Also gives the accelerator back when abandoning a file
+static void sha_finish(uint8_t digest[SHA256_SIZE]) {
+#if PICOVD_MANIFEST_SHA256_HW
+    if (sha.on_hw) {
+        sha256_result_t result;
+        pico_sha256_finish(&sha.hw, &result);
+        memcpy(digest, result.bytes, SHA256_SIZE);
+        sha.on_hw = false;
+        return;
+    }
+#endif
+    // Padding: 0x80, zeros up to 56 mod 64, then the length in bits, big endian
+    const uint64_t bits = sha.length * 8u;
+    uint8_t pad[72] = { 0x80 };
+    const uint32_t pad_len = (uint32_t)((sha.length % 64u < 56u ? 56u : 120u) - sha.length % 64u);
+    for (uint32_t i = 0; i < 8; i++) {
+        pad[pad_len + i] = (uint8_t)(bits >> (56u - 8u * i));
+    }
+    sha256_sw_update(pad, pad_len + 8u);
+    for (uint32_t i = 0; i < 8; i++) {
+        digest[4 * i]     = (uint8_t)(sha.h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(sha.h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(sha.h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)sha.h[i];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Entries: the files listed, and their digests,
+// each published by setting its ENTRY_VALID flag last
+// ---------------------------------------------------------------------------
+
+#define ENTRY_HASHED 0x01u // Stable contents, to be hashed
+#define ENTRY_VALID  0x02u // The digest is computed
+
+typedef struct {
+    uint8_t  group_idx;     ///< Where exfat_root_dir_file_describe() finds the file
+    uint8_t  file_idx;
+    uint8_t  flags;
+    uint32_t first_cluster;
+    uint32_t data_length;
+    uint32_t generation;    ///< When listed, or when hashed
+    uint8_t  digest[SHA256_SIZE];
+} manifest_entry_t;
+
+static manifest_entry_t manifest_entries[PICOVD_MANIFEST_FILES_MAX];
+static uint32_t         manifest_generation;
+
+static struct {
+    uint32_t group_idx;     ///< Next file to list
+    uint32_t file_idx;
+    uint32_t count;         ///< Files listed
+    volatile bool listed;   ///< Set last, once all files are listed
+    uint32_t next;          ///< Entry being hashed
+    uint32_t pos;           ///< Bytes of it hashed, 0 if none
+} manifest_job;
+
+// True if the file reads the same until the contents change: the BootROM and the flash
+static bool manifest_file_is_stable(const exfat_dir_file_desc_t *desc) {
+    const uint32_t c = desc->first_cluster;
+#if PICOVD_BOOTROM_ENABLED
+    if (c >= PICOVD_BOOTROM_START_CLUSTER
+        && c < PICOVD_BOOTROM_START_CLUSTER + PICOVD_BOOTROM_SIZE_BYTES / (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER)) {
+        return true;
+    }
+#endif
+#if PICOVD_FLASH_ENABLED || PICOVD_BOOTROM_PARTITIONS_ENABLED
+    if (c >= PICOVD_FLASH_START_CLUSTER && c < PICOVD_FLASH_START_CLUSTER + VD_FLASH_PAGES) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+// Give up the file being hashed, if any
+static void manifest_hash_abandon(void) {
+    if (manifest_job.pos > 0) {
+        uint8_t digest[SHA256_SIZE];
+        sha_finish(digest);
+        manifest_job.pos = 0;
+    }
+}
+
+// List one more file, or move on to the next group
+static void manifest_list_step(void) {
+    exfat_dir_file_desc_t desc;
+    if (manifest_job.group_idx >= exfat_root_dir_group_count() || manifest_job.count >= PICOVD_MANIFEST_FILES_MAX) {
+        manifest_job.listed = true;
+        return;
+    }
+    if (!exfat_root_dir_file_describe(manifest_job.group_idx, manifest_job.file_idx, &desc)) {
+        manifest_job.group_idx++;
+        manifest_job.file_idx = 0;
+        return;
+    }
+    if (desc.attributes & EXFAT_FILE_ATTR_DIRECTORY) {
+        manifest_job.file_idx++; // Not a file to hash
+        return;
+    }
+    manifest_entry_t *e = &manifest_entries[manifest_job.count];
+    e->group_idx     = (uint8_t)manifest_job.group_idx;
+    e->file_idx      = (uint8_t)manifest_job.file_idx;
+    e->first_cluster = desc.first_cluster;
+    e->data_length   = desc.data_length;
+    e->generation    = manifest_generation;
+    e->flags         = manifest_file_is_stable(&desc) ? ENTRY_HASHED : 0;
+    __compiler_memory_barrier();
+    manifest_job.count++; // Published last
+    manifest_job.file_idx++;
+}
+
+// Hash one more sector of entry `e`, one slice at a time as the host would read it
+static void manifest_hash_step(manifest_entry_t *e) {
+    if (manifest_job.pos == 0) {
+        sha_start();
+    }
+    const uint32_t lba = EXFAT_CLUSTER_TO_LBA(e->first_cluster) + (manifest_job.pos >> EXFAT_BYTES_PER_SECTOR_SHIFT);
+    uint32_t len = e->data_length - manifest_job.pos;
+    if (len > EXFAT_BYTES_PER_SECTOR) {
+        len = EXFAT_BYTES_PER_SECTOR;
+    }
+    uint8_t slice[CFG_TUD_MSC_EP_BUFSIZE];
+    for (uint32_t offset = 0; offset < len; offset += sizeof(slice)) {
+        const uint32_t n = len - offset < sizeof(slice) ? len - offset : sizeof(slice);
+        vd_virtual_disk_generate(lba, offset, slice, sizeof(slice));
+        sha_update(slice, n);
+    }
+    manifest_job.pos += len;
+
+    if (manifest_job.pos >= e->data_length) {
+        sha_finish(e->digest);
+        manifest_job.pos = 0;
+        e->generation = manifest_generation;
+        __compiler_memory_barrier();
+        e->flags |= ENTRY_VALID;
+        manifest_job.next++;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Idle job: list the files, a file per step, then hash them, a sector per step
+// ---------------------------------------------------------------------------
+
+void vd_manifest_job_reset(void) {
+    manifest_job.listed = false;
+    __compiler_memory_barrier();
+    manifest_hash_abandon();
+    manifest_generation++;
+    manifest_job.group_idx = 0;
+    manifest_job.file_idx  = 0;
+    manifest_job.count     = 0;
+    manifest_job.next      = 0;
+}
+
+bool vd_manifest_job_step(void) {
+    if (!manifest_job.listed) {
+        manifest_list_step();
+        return false;
+    }
+    // Skip the entries not to hash, or hashed already, e.g. those left after an invalidation
+    while (manifest_job.next < manifest_job.count
+           && (manifest_entries[manifest_job.next].flags & (ENTRY_HASHED | ENTRY_VALID)) != ENTRY_HASHED) {
+        manifest_job.next++;
+    }
+    if (manifest_job.next >= manifest_job.count) {
+        return true;
+    }
+    manifest_hash_step(&manifest_entries[manifest_job.next]);
+    return false;
+}
+
+void vd_manifest_flash_invalidate(uint32_t first, uint32_t last) {
+    const uint32_t first_cluster = PICOVD_FLASH_START_CLUSTER + first;
+    const uint32_t last_cluster  = PICOVD_FLASH_START_CLUSTER + last;
+    uint32_t rehash = manifest_job.count;
+
+    manifest_generation++;
+    for (uint32_t i = 0; i < manifest_job.count; i++) {
+        manifest_entry_t *e = &manifest_entries[i];
+        const uint32_t clusters = (e->data_length + VD_FLASH_PAGE_SIZE - 1u) / VD_FLASH_PAGE_SIZE;
+        if ((e->flags & ENTRY_HASHED) && e->first_cluster <= last_cluster
+            && e->first_cluster + clusters > first_cluster) {
+            e->flags &= ~ENTRY_VALID;
+            if (i < rehash) {
+                rehash = i;
+            }
+        }
+    }
+    // Start over from the first file dropped, unless it comes after the one in progress
+    if (rehash <= manifest_job.next) {
+        manifest_hash_abandon();
+        manifest_job.next = rehash;
+    }
+    vd_idle_rerun(vd_manifest_job_step);
+}
+
+// ---------------------------------------------------------------------------
+// MANIFEST.TXT rendering, in fixed-width lines like STATS.TXT
+// ---------------------------------------------------------------------------
+
+enum {
+    MANIFEST_LINE_TITLE = 0,
+    MANIFEST_LINE_HEADER,
+    MANIFEST_LINE_FILES,
+};
+
+// Render line `n` into `line`, padded with spaces and terminated by a newline.
+// Only what the idle job has published so far is shown: the files listed,
+// and "-" for the digests not computed yet.
+static void manifest_render_line(uint32_t n, char line[VD_MANIFEST_LINE_LENGTH + 1]) {
+    int len = 0;
+
+    if (n == MANIFEST_LINE_TITLE) {
+        len = snprintf(line, VD_MANIFEST_LINE_LENGTH + 1, "PicoVD manifest v1, generation %lu, %lu files%s",
+                       (unsigned long)manifest_generation, (unsigned long)manifest_job.count,
+                       manifest_job.listed ? "" : " so far");
+    } else if (n == MANIFEST_LINE_HEADER) {
+        len = snprintf(line, VD_MANIFEST_LINE_LENGTH + 1, "%-64s %10s %8s %6s %s",
+                       "sha256", "size", "cluster", "gen", "name");
+    } else if (n - MANIFEST_LINE_FILES < manifest_job.count) {
+        const manifest_entry_t *e = &manifest_entries[n - MANIFEST_LINE_FILES];
+        exfat_dir_file_desc_t desc;
+        if (!exfat_root_dir_file_describe(e->group_idx, e->file_idx, &desc)) {
+            desc.name_length = 0; // Gone since listed; the contents changed
+        }
+        char digest[2 * SHA256_SIZE + 1] = "-";
+        if (e->flags & ENTRY_VALID) {
+            for (uint32_t i = 0; i < SHA256_SIZE; i++) {
+                snprintf(digest + 2 * i, 3, "%02x", e->digest[i]);
+            }
+        }
+        len = snprintf(line, VD_MANIFEST_LINE_LENGTH + 1, "%-64s %10lu %08lx %6lu %.*s",
+                       digest, (unsigned long)e->data_length, (unsigned long)e->first_cluster,
+                       (unsigned long)e->generation, (int)desc.name_length, (const char *)desc.name);
+    }
+
+    if (len < 0) {
+        len = 0;
+    } else if (len > VD_MANIFEST_LINE_LENGTH - 1) {
+        len = VD_MANIFEST_LINE_LENGTH - 1; // Truncated
+    }
+    memset(line + len, ' ', VD_MANIFEST_LINE_LENGTH - 1 - len);
+    line[VD_MANIFEST_LINE_LENGTH - 1] = '\n';
+}
+
+void vd_manifest_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_MANIFEST_START_LBA);
+
+    uint8_t *out = (uint8_t *)buffer;
+    uint32_t pos = ((lba - PICOVD_MANIFEST_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset;
+    char line[VD_MANIFEST_LINE_LENGTH + 1];
+
+    while (bufsize > 0) {
+        const uint32_t n    = pos / VD_MANIFEST_LINE_LENGTH;
+        const uint32_t skip = pos % VD_MANIFEST_LINE_LENGTH;
+        uint32_t       len  = VD_MANIFEST_LINE_LENGTH - skip;
+        if (len > bufsize) {
+            len = bufsize;
+        }
+        if (n < VD_MANIFEST_LINES) {
+            manifest_render_line(n, line);
+            memcpy(out, line + skip, len);
+        } else {
+            memset(out, 0, len); // Beyond the end of file
+        }
+        out     += len;
+        pos     += len;
+        bufsize -= len;
+    }
+}
+
+bool vd_manifest_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_MANIFEST_FILE_NAME;
+
+    desc->first_cluster = PICOVD_MANIFEST_START_CLUSTER;
+    desc->data_length   = VD_MANIFEST_FILE_SIZE_BYTES;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_MANIFEST_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_MANIFEST_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_MANIFEST_ENABLED
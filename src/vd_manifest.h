@@ -0,0 +1,45 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// File manifest, MANIFEST.TXT
+//
+// A line per file of the root directory, up to PICOVD_MANIFEST_FILES_MAX:
+// the SHA-256 of its contents, its size, first cluster, content generation
+// and name.  A host tool verifies a partition against a known image by
+// reading this one file, instead of the whole partition.
+//
+// Only files with stable contents are hashed: BOOTROM.BIN, FLASH.BIN
+// and the partition files.  The others, e.g. SRAM.BIN, change as they
+// are read, and have "-" as their digest.
+//
+// The digests are computed by an idle job, a sector per step, with the
+// RP2350 SHA-256 accelerator if enabled and free, else in software.
+// They are kept until vd_virtual_disk_contents_changed(), or until
+// vd_flash_map_invalidate() drops the files overlapping the pages.
+// The generation counts these changes; a file's generation is the one
+// its digest was computed at, or it was listed at.  Reading MANIFEST.TXT
+// never runs the job: it shows the files listed so far, with "-" as the
+// digest of those not hashed yet.
+//
+// The lines are fixed width, padded with spaces:
+//   <sha256 or -> <size> <first cluster, hex> <generation> <name>
+// ---------------------------------------------------------------
+
+#define VD_MANIFEST_LINE_LENGTH     256u
+#define VD_MANIFEST_LINES           (2u + PICOVD_MANIFEST_FILES_MAX) // Title, column names, files
+#define VD_MANIFEST_FILE_SIZE_BYTES (VD_MANIFEST_LINES * VD_MANIFEST_LINE_LENGTH)
+
+// Serve MANIFEST.TXT
+extern void vd_manifest_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe MANIFEST.TXT
+extern bool vd_manifest_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+// Drop the digests of the files overlapping flash pages `first` to `last`,
+// inclusive; called by vd_flash_map_invalidate()
+extern void vd_manifest_flash_invalidate(uint32_t first, uint32_t last);
@@ -0,0 +1,179 @@
+/**
+ * @file src/vd_mount_ready.c
+ * @brief Eager "mount-ready" precomputation and mount latency measurement.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <tusb.h>
+#include <pico/time.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_mount_ready.h"
+
+// ---------------------------------------------------------------------------
+// The sectors hosts read when mounting, in pinning priority order.
+// The root directory comes first, as its generation is the most expensive.
+// ---------------------------------------------------------------------------
+#define MOUNT_READY_ROOT_DIR_LBA(n) (EXFAT_ROOT_DIR_START_LBA + (n))
+
+static const uint32_t mount_ready_lbas[] = {
+    MOUNT_READY_ROOT_DIR_LBA(0),  MOUNT_READY_ROOT_DIR_LBA(1),  MOUNT_READY_ROOT_DIR_LBA(2),
+    MOUNT_READY_ROOT_DIR_LBA(3),  MOUNT_READY_ROOT_DIR_LBA(4),  MOUNT_READY_ROOT_DIR_LBA(5),
+    MOUNT_READY_ROOT_DIR_LBA(6),  MOUNT_READY_ROOT_DIR_LBA(7),  MOUNT_READY_ROOT_DIR_LBA(8),
+    MOUNT_READY_ROOT_DIR_LBA(9),  MOUNT_READY_ROOT_DIR_LBA(10), MOUNT_READY_ROOT_DIR_LBA(11),
+    MOUNT_READY_ROOT_DIR_LBA(12), MOUNT_READY_ROOT_DIR_LBA(13), MOUNT_READY_ROOT_DIR_LBA(14),
+    MOUNT_READY_ROOT_DIR_LBA(15), MOUNT_READY_ROOT_DIR_LBA(16), MOUNT_READY_ROOT_DIR_LBA(17),
+    MOUNT_READY_ROOT_DIR_LBA(18), MOUNT_READY_ROOT_DIR_LBA(19), MOUNT_READY_ROOT_DIR_LBA(20),
+    MOUNT_READY_ROOT_DIR_LBA(21), MOUNT_READY_ROOT_DIR_LBA(22), MOUNT_READY_ROOT_DIR_LBA(23),
+    11,                                // §3.4 Main Boot Checksum
+    0,                                 // §3.1 Boot Sector
+    EXFAT_FAT_REGION_START_LBA,        // §4 FAT head
+    EXFAT_ALLOCATION_BITMAP_START_LBA, // §7.1 Allocation Bitmap
+    EXFAT_UPCASE_TABLE_START_LBA,      // §7.2 Up-case Table
+};
+
+#define MOUNT_READY_LBA_COUNT (sizeof(mount_ready_lbas) / sizeof(mount_ready_lbas[0]))
+#define MOUNT_READY_ALL_READ  ((uint32_t)((1ull << MOUNT_READY_LBA_COUNT) - 1))
+
+_Static_assert(EXFAT_ROOT_DIR_LENGTH_SECTORS == 24, "Mount-burst list assumes a 24-sector root directory");
+_Static_assert(MOUNT_READY_LBA_COUNT <= 32, "Mount-burst reads are tracked in a 32-bit mask");
+
+static vd_mount_ready_stats_t mount_ready_stats;
+static uint32_t mount_ready_read_mask;
+
+// ---------------------------------------------------------------------------
+// Pinned sectors, eager mode only
+// ---------------------------------------------------------------------------
+#if PICOVD_MOUNT_READY_ENABLED
+
+#define MOUNT_READY_PIN_SLOTS (PICOVD_MOUNT_READY_RAM_BUDGET / MSC_BLOCK_SIZE)
+_Static_assert(MOUNT_READY_PIN_SLOTS > 0, "Mount-ready RAM budget must hold at least one sector");
+
+static uint8_t  mount_ready_pinned[MOUNT_READY_PIN_SLOTS][MSC_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint32_t mount_ready_pinned_lba[MOUNT_READY_PIN_SLOTS];
+static volatile uint32_t mount_ready_pinned_count; ///< Published after the slot is filled
+static uint32_t mount_ready_job_idx;
+
+// A uniformly filled sector (zeros, unused directory entries, ...) is
+// cheap to generate, so pinning it would waste the budget
+static bool sector_is_uniform(const uint8_t *sector) {
+    for (uint32_t i = 1; i < MSC_BLOCK_SIZE; i++) {
+        if (sector[i] != sector[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void vd_mount_ready_job_reset(void) {
+    mount_ready_pinned_count = 0;
+    mount_ready_stats.pinned_sectors = 0;
+    mount_ready_job_idx = 0;
+}
+
+bool vd_mount_ready_job_step(void) {
+    const uint32_t n = mount_ready_pinned_count;
+    if (mount_ready_job_idx >= MOUNT_READY_LBA_COUNT || n >= MOUNT_READY_PIN_SLOTS) {
+        return true;
+    }
+    const uint32_t lba = mount_ready_lbas[mount_ready_job_idx++];
+
+    if (lba >= EXFAT_ROOT_DIR_START_LBA && !exfat_root_dir_sector_is_stable(lba)) {
+        return false; // E.g. a file with changing timestamps
+    }
+    vd_virtual_disk_generate(lba, 0, mount_ready_pinned[n], MSC_BLOCK_SIZE);
+    if (!sector_is_uniform(mount_ready_pinned[n])) {
+        mount_ready_pinned_lba[n] = lba;
+        __compiler_memory_barrier();
+        mount_ready_pinned_count = n + 1;
+        mount_ready_stats.pinned_sectors = (uint8_t)(n + 1);
+    }
+    return false;
+}
+
+void vd_mount_ready_prepare(void) {
+    // Keep the USB stack serviced, so that enumeration proceeds meanwhile
+    do {
+        tud_task();
+        vd_mount_ready_task();
+    } while (!vd_idle_step());
+}
+
+#endif // PICOVD_MOUNT_READY_ENABLED
+
+// ---------------------------------------------------------------------------
+// Serving and tracking the mount-burst reads
+// ---------------------------------------------------------------------------
+bool vd_mount_ready_read(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+    // All mount-burst sectors are at or before the end of the root directory
+    if (lba >= EXFAT_ROOT_DIR_START_LBA + EXFAT_ROOT_DIR_LENGTH_SECTORS) {
+        return false;
+    }
+
+#if PICOVD_MOUNT_TIMING_ENABLED
+    if (mount_ready_read_mask != MOUNT_READY_ALL_READ) {
+        for (uint32_t i = 0; i < MOUNT_READY_LBA_COUNT; i++) {
+            if (mount_ready_lbas[i] == lba) {
+                if (mount_ready_read_mask == 0) {
+                    mount_ready_stats.first_read_us = time_us_32();
+                }
+                mount_ready_read_mask |= 1u << i;
+                if (mount_ready_read_mask == MOUNT_READY_ALL_READ) {
+                    mount_ready_stats.complete_us = time_us_32();
+                    mount_ready_stats.complete = true;
+                }
+                break;
+            }
+        }
+    }
+#endif
+
+#if PICOVD_MOUNT_READY_ENABLED
+    const uint32_t n = mount_ready_pinned_count;
+    for (uint32_t i = 0; i < n; i++) {
+        if (mount_ready_pinned_lba[i] == lba) {
+            memcpy(buffer, mount_ready_pinned[i] + offset, bufsize);
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+void vd_mount_ready_task(void) {
+#if PICOVD_MOUNT_TIMING_ENABLED
+    static bool mounted = false;
+    static bool reported = false;
+
+    // Restart the measurement on each (re)connection
+    const bool now_mounted = tud_mounted();
+    if (now_mounted && !mounted) {
+        mount_ready_stats.connect_us = time_us_32();
+        mount_ready_stats.complete = false;
+        mount_ready_read_mask = 0;
+        reported = false;
+    }
+    mounted = now_mounted;
+
+    if (mount_ready_stats.complete && !reported) {
+        reported = true;
+        printf("PicoVD: mount-burst read %lu us after connect (first read at %lu us, %u sectors pinned)\n",
+               (unsigned long)(mount_ready_stats.complete_us - mount_ready_stats.connect_us),
+               (unsigned long)(mount_ready_stats.first_read_us - mount_ready_stats.connect_us),
+               mount_ready_stats.pinned_sectors);
+    }
+#endif
+}
+
+const vd_mount_ready_stats_t *vd_mount_ready_stats(void) {
+    return &mount_ready_stats;
+}
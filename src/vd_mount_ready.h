@@ -0,0 +1,39 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// ---------------------------------------------------------------
+// Mount-ready mode and mount latency measurement
+//
+// Right after enumeration, hosts read a predictable burst of sectors:
+// the boot sector, the checksum sector, the FAT head, the allocation
+// bitmap, the up-case table and the whole root directory.  In the eager
+// mode (PICOVD_MOUNT_READY_ENABLED) those sectors are generated before
+// the host asks for them and pinned in RAM, within a RAM budget.
+// ---------------------------------------------------------------
+
+typedef struct {
+    uint32_t connect_us;     ///< time_us_32() when the host configured the device
+    uint32_t first_read_us;  ///< time_us_32() of the first mount-burst read
+    uint32_t complete_us;    ///< time_us_32() when all mount-burst sectors had been read
+    bool     complete;       ///< The fields above are valid
+    uint8_t  pinned_sectors; ///< Number of sectors pinned in RAM
+} vd_mount_ready_stats_t;
+
+// Eager mode: call between tusb_init() and the main loop.
+// Keeps USB serviced while precomputing and pinning the mount-burst sectors.
+extern void vd_mount_ready_prepare(void);
+
+// Call regularly from the main loop; tracks (re)connections and
+// reports the mount latency over stdio once the host has mounted the disk
+extern void vd_mount_ready_task(void);
+
+// Serve a pinned sector and track mount-burst reads.
+// Returns true if the slice was served from RAM.
+extern bool vd_mount_ready_read(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize);
+
+extern const vd_mount_ready_stats_t *vd_mount_ready_stats(void);
+
+// Idle job pinning the mount-burst sectors, see vd_idle.h
+extern void vd_mount_ready_job_reset(void);
+extern bool vd_mount_ready_job_step(void);
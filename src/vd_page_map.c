@@ -0,0 +1,286 @@
+/**
+ * @file src/vd_page_map.c
+ * @brief Per-page CRC32 maps of the flash and SRAM, for delta synchronisation by host tools.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#include <hardware/regs/addressmap.h>
+
+#include <picovd_config.h>
+#if PICOVD_PAGEMAP_CRC_DMA
+#include <hardware/dma.h>
+#endif
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_idle.h"
+#include "vd_flash_map.h"
+#include "vd_page_map.h"
+
+#if PICOVD_PAGEMAP_ENABLED
+
+_Static_assert(VD_PAGE_MAP_PAGE_SIZE == VD_FLASH_PAGE_SIZE, "Flash records are kept per erased-map page");
+_Static_assert(VD_PAGE_MAP_HEADER_SIZE + VD_FLASH_PAGES * VD_PAGE_MAP_RECORD_SIZE
+               <= VD_PAGE_MAP_FILE_CLUSTERS * EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER,
+               "FLASHMAP.BIN does not fit its clusters");
+
+#define CRC32_ERASED_PAGE 0xF154670Au // Of 4096 bytes of 0xFF
+#define CRC32_ZERO_PAGE   0xC71C0011u // Of 4096 bytes of 0x00
+
+#if PICOVD_SRAM_ENABLED
+#define SRAM_PAGES (PICOVD_SRAM_SIZE_BYTES / VD_PAGE_MAP_PAGE_SIZE)
+_Static_assert(PICOVD_SRAM_SIZE_BYTES % VD_PAGE_MAP_PAGE_SIZE == 0, "SRAM.BIN must be whole pages");
+#endif
+
+// ---------------------------------------------------------------------------
+// CRC32 of a page
+// ---------------------------------------------------------------------------
+
+// zlib's CRC32, a nibble at a time, for when no DMA channel is free
+static uint32_t crc32_sw(const volatile uint8_t *p, uint32_t len) {
+    static const uint32_t table[16] = {
+        0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu, 0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+        0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu, 0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu,
+    };
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 15u];
+        crc = (crc >> 4) ^ table[crc & 15u];
+    }
+    return ~crc;
+}
+
+static uint32_t page_crc32(uint32_t address) {
+#if PICOVD_PAGEMAP_CRC_DMA
+    // The DMA sniffer computes the CRC while copying the page into a single
+    // byte; bit-reversed data, output reversed and inverted give zlib's CRC32
+    const int ch = dma_claim_unused_channel(false);
+    if (ch >= 0) {
+        static uint8_t sink;
+        dma_channel_config c = dma_channel_get_default_config((uint)ch);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8); // Bytes in memory order
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_sniff_enable(&c, true);
+        dma_sniffer_enable((uint)ch, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+        dma_sniffer_set_output_reverse_enabled(true);
+        dma_sniffer_set_output_invert_enabled(true);
+        dma_sniffer_set_data_accumulator(0xFFFFFFFFu);
+        dma_channel_configure((uint)ch, &c, &sink, (const void *)address, VD_PAGE_MAP_PAGE_SIZE, true);
+        dma_channel_wait_for_finish_blocking((uint)ch);
+        const uint32_t crc = dma_sniffer_get_data_accumulator();
+        dma_sniffer_disable();
+        dma_channel_unclaim((uint)ch);
+        return crc;
+    }
+#endif
+    return crc32_sw((const volatile uint8_t *)address, VD_PAGE_MAP_PAGE_SIZE);
+}
+
+// True if all of the page is `word`; checked only when the CRC says so
+static bool page_is_all(uint32_t address, uint32_t word) {
+    const volatile uint32_t *p = (const volatile uint32_t *)address;
+    for (uint32_t i = 0; i < VD_PAGE_MAP_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (p[i] != word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// CRC32 and flags of the page at `address`
+static uint8_t page_record(uint32_t address, uint32_t *crc) {
+    *crc = page_crc32(address);
+    if (*crc == CRC32_ERASED_PAGE && page_is_all(address, 0xFFFFFFFFu)) {
+        return VD_PAGE_MAP_FLAG_ERASED;
+    }
+    if (*crc == CRC32_ZERO_PAGE && page_is_all(address, 0)) {
+        return VD_PAGE_MAP_FLAG_ZERO;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Flash records, cached; published by setting the valid flag last
+// ---------------------------------------------------------------------------
+
+#define FLASH_RECORD_VALID 0x80u
+
+static uint32_t flash_crc[VD_FLASH_PAGES];
+static uint8_t  flash_flags[VD_FLASH_PAGES];
+static uint32_t flash_next_page; ///< Where the job goes on
+
+static void flash_record_compute(uint32_t page) {
+    uint32_t crc;
+    uint8_t  flags;
+    if (vd_flash_page_erased(page)) {
+        crc   = CRC32_ERASED_PAGE; // Known without reading the page again
+        flags = VD_PAGE_MAP_FLAG_ERASED;
+    } else {
+        // Through the non-allocating XIP alias, to leave the XIP cache alone
+        flags = page_record(XIP_NOCACHE_NOALLOC_BASE + (page << VD_FLASH_PAGE_SHIFT), &crc);
+    }
+    flash_crc[page] = crc;
+    __compiler_memory_barrier();
+    flash_flags[page] = flags | FLASH_RECORD_VALID;
+}
+
+static uint8_t flash_record(uint32_t page, uint32_t *crc) {
+    // Compute it now, if the host came first
+    if (!(flash_flags[page] & FLASH_RECORD_VALID)) {
+        flash_record_compute(page);
+    }
+    *crc = flash_crc[page];
+    return flash_flags[page] & ~FLASH_RECORD_VALID;
+}
+
+void vd_page_map_flash_invalidate(uint32_t first, uint32_t last) {
+    assert(first <= last && last < VD_FLASH_PAGES);
+    for (uint32_t page = first; page <= last; page++) {
+        flash_flags[page] = 0;
+    }
+    if (first < flash_next_page) {
+        flash_next_page = first;
+    }
+    vd_idle_rerun(vd_page_map_job_step);
+}
+
+// ---------------------------------------------------------------------------
+// Idle job: compute the flash records, one page per step
+// ---------------------------------------------------------------------------
+
+void vd_page_map_job_reset(void) {
+    memset(flash_flags, 0, sizeof(flash_flags));
+    flash_next_page = 0;
+}
+
+bool vd_page_map_job_step(void) {
+    while (flash_next_page < VD_FLASH_PAGES && (flash_flags[flash_next_page] & FLASH_RECORD_VALID)) {
+        flash_next_page++;
+    }
+    if (flash_next_page >= VD_FLASH_PAGES) {
+        return true;
+    }
+    flash_record_compute(flash_next_page++);
+    return flash_next_page >= VD_FLASH_PAGES;
+}
+
+// ---------------------------------------------------------------------------
+// Map files
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    PAGE_MAP_FLASH,
+#if PICOVD_SRAM_ENABLED
+    PAGE_MAP_SRAM,
+#endif
+    PAGE_MAP_COUNT,
+} page_map_t;
+
+static const struct {
+    const char16_t *name;
+    uint8_t         name_length;
+    uint32_t        first_cluster;
+    uint32_t        pages;
+} page_maps[PAGE_MAP_COUNT] = {
+    [PAGE_MAP_FLASH] = { PICOVD_PAGEMAP_FLASH_FILE_NAME, PICOVD_PAGEMAP_FLASH_FILE_NAME_LEN,
+                         VD_PAGE_MAP_FLASH_CLUSTER, VD_FLASH_PAGES },
+#if PICOVD_SRAM_ENABLED
+    [PAGE_MAP_SRAM]  = { PICOVD_PAGEMAP_SRAM_FILE_NAME, PICOVD_PAGEMAP_SRAM_FILE_NAME_LEN,
+                         VD_PAGE_MAP_SRAM_CLUSTER, SRAM_PAGES },
+#endif
+};
+
+static inline uint32_t page_map_size(page_map_t map) {
+    return VD_PAGE_MAP_HEADER_SIZE + page_maps[map].pages * VD_PAGE_MAP_RECORD_SIZE;
+}
+
+static void page_map_header(page_map_t map, uint8_t header[VD_PAGE_MAP_HEADER_SIZE]) {
+    const uint16_t version = VD_PAGE_MAP_VERSION, record_size = VD_PAGE_MAP_RECORD_SIZE;
+    const uint32_t page_size = VD_PAGE_MAP_PAGE_SIZE, pages = page_maps[map].pages;
+    memcpy(header, "PVPM", 4);
+    memcpy(header + 4,  &version,     sizeof(version)); // Little endian, like the target
+    memcpy(header + 6,  &record_size, sizeof(record_size));
+    memcpy(header + 8,  &page_size,   sizeof(page_size));
+    memcpy(header + 12, &pages,       sizeof(pages));
+}
+
+static void page_map_record(page_map_t map, uint32_t page, uint8_t record[VD_PAGE_MAP_RECORD_SIZE]) {
+    uint32_t crc   = 0;
+    uint8_t  flags = 0;
+    if (map == PAGE_MAP_FLASH) {
+        flags = flash_record(page, &crc);
+    }
+#if PICOVD_SRAM_ENABLED
+    else {
+        flags = page_record(SRAM_BASE + page * VD_PAGE_MAP_PAGE_SIZE, &crc);
+    }
+#endif
+    memcpy(record, &crc, sizeof(crc));
+    record[4] = flags;
+    record[5] = record[6] = record[7] = 0;
+}
+
+// Bytes [pos, pos + len) of a map file; the records overlapping them are computed once each
+static void page_map_read(page_map_t map, uint32_t pos, uint8_t *buf, uint32_t len) {
+    const uint32_t size = page_map_size(map);
+    while (len > 0) {
+        uint8_t  chunk[VD_PAGE_MAP_HEADER_SIZE];
+        uint32_t from, n;
+        if (pos >= size) {
+            memset(buf, 0, len); // The rest of the cluster
+            return;
+        } else if (pos < VD_PAGE_MAP_HEADER_SIZE) {
+            page_map_header(map, chunk);
+            from = pos;
+            n    = VD_PAGE_MAP_HEADER_SIZE - pos;
+        } else {
+            const uint32_t r = (pos - VD_PAGE_MAP_HEADER_SIZE) / VD_PAGE_MAP_RECORD_SIZE;
+            page_map_record(map, r, chunk);
+            from = (pos - VD_PAGE_MAP_HEADER_SIZE) % VD_PAGE_MAP_RECORD_SIZE;
+            n    = VD_PAGE_MAP_RECORD_SIZE - from;
+        }
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf, chunk + from, n);
+        buf += n;
+        pos += n;
+        len -= n;
+    }
+}
+
+void vd_page_map_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_PAGEMAP_START_LBA);
+    assert(lba  < PICOVD_PAGEMAP_START_LBA + (VD_PAGE_MAP_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT));
+
+    const uint32_t file_sectors = VD_PAGE_MAP_FILE_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT;
+    const uint32_t map          = (lba - PICOVD_PAGEMAP_START_LBA) / file_sectors;
+    const uint32_t pos          = (((lba - PICOVD_PAGEMAP_START_LBA) % file_sectors) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset;
+    if (map >= PAGE_MAP_COUNT) {
+        memset(buffer, 0, bufsize);
+        return;
+    }
+    page_map_read((page_map_t)map, pos, buffer, bufsize);
+}
+
+bool vd_page_map_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx >= PAGE_MAP_COUNT) {
+        return false;
+    }
+    desc->first_cluster = page_maps[file_idx].first_cluster;
+    desc->data_length   = page_map_size((page_map_t)file_idx);
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = page_maps[file_idx].name_length;
+    for (size_t i = 0; i < desc->name_length; i++) {
+        desc->name[i] = (uint8_t)page_maps[file_idx].name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_PAGEMAP_ENABLED
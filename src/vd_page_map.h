@@ -0,0 +1,50 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// Page maps, FLASHMAP.BIN and SRAMMAP.BIN
+//
+// One record per 4 kB page of the flash and of SRAM.BIN, with the
+// CRC32 (as zlib's crc32()) of the page and whether it is erased or
+// zero, so that a host tool can read a map and then fetch only the
+// pages that changed since its last poll, e.g. from the flash LUN or
+// with O_DIRECT from SRAM.BIN.
+//
+// The flash records are computed by an idle job, a page per step,
+// and kept until vd_virtual_disk_contents_changed() or
+// vd_flash_map_invalidate().  The SRAM records are computed as the
+// host reads them, as SRAM changes all the time.
+//
+// Layout, little endian: a 16-byte header, then a record per page
+//   header: "PVPM", u16 version (1), u16 record size (8),
+//           u32 page size, u32 page count
+//   record: u32 CRC32, u8 VD_PAGE_MAP_FLAG_* flags, 3 zero bytes
+// ---------------------------------------------------------------
+
+#define VD_PAGE_MAP_PAGE_SIZE     4096u
+#define VD_PAGE_MAP_HEADER_SIZE   16u
+#define VD_PAGE_MAP_RECORD_SIZE   8u
+#define VD_PAGE_MAP_VERSION       1u
+
+#define VD_PAGE_MAP_FLAG_ERASED   0x01u // All 0xFF
+#define VD_PAGE_MAP_FLAG_ZERO     0x02u // All 0x00
+
+// Each map file has 16 clusters, enough for a 16 MB flash
+#define VD_PAGE_MAP_FILE_CLUSTERS 0x10u
+#define VD_PAGE_MAP_FLASH_CLUSTER (PICOVD_PAGEMAP_START_CLUSTER)
+#define VD_PAGE_MAP_SRAM_CLUSTER  (PICOVD_PAGEMAP_START_CLUSTER + VD_PAGE_MAP_FILE_CLUSTERS)
+#define VD_PAGE_MAP_LENGTH_CLUSTERS (2u * VD_PAGE_MAP_FILE_CLUSTERS)
+
+// Serve the map files' clusters
+extern void vd_page_map_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe FLASHMAP.BIN and SRAMMAP.BIN, sharing a root directory slot
+extern bool vd_page_map_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+// Forget the flash records of pages `first` to `last`, inclusive;
+// called by vd_flash_map_invalidate()
+extern void vd_page_map_flash_invalidate(uint32_t first, uint32_t last);
@@ -0,0 +1,254 @@
+/**
+ * @file src/vd_profile.c
+ * @brief PC-sampling profiler: a timer interrupt bins the interrupted PC, served as GMON.OUT.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+
+#include <hardware/irq.h>
+#include <hardware/timer.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_profile.h"
+
+#if PICOVD_PROFILE_ENABLED
+
+#define PROFILE_TIMER        PICO_DEFAULT_TIMER_INSTANCE()
+#define PROFILE_PERIOD_US    (1000000u / PICOVD_PROFILE_RATE_HZ)
+#define PROFILE_ARC_MASK     (PICOVD_PROFILE_ARCS - 1u)
+#define PROFILE_ARC_PROBES   8u
+#define PROFILE_FILE_SECTORS (VD_PROFILE_FILE_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT)
+
+_Static_assert(PICOVD_PROFILE_RATE_HZ >= 1 && PICOVD_PROFILE_RATE_HZ <= 100000, "Sample between 1 Hz and 100 kHz");
+_Static_assert((PICOVD_PROFILE_ARCS & PROFILE_ARC_MASK) == 0, "The arc table size must be a power of two");
+#if PICOVD_UF2_DROP_ENABLED
+_Static_assert(PICOVD_UF2_DROP_START_CLUSTER + PICOVD_UF2_DROP_LENGTH_CLUSTERS <= PICOVD_PROFILE_START_CLUSTER,
+               "The UF2 drop zone overlaps GMON.OUT");
+#endif
+#if PICOVD_CHANGING_FILE_ENABLED
+_Static_assert(PICOVD_PROFILE_START_CLUSTER + VD_PROFILE_FILE_CLUSTERS <= PICOVD_CHANGING_FILE_START_CLUSTER,
+               "GMON.OUT overlaps CHANGING.TXT");
+#endif
+
+// gmon.out, as in gmon_out.h of the GNU C library and binutils, for a
+// 32-bit little-endian target
+#define GMON_VERSION        1u
+#define GMON_TAG_TIME_HIST  0u
+#define GMON_TAG_CG_ARC     1u
+
+typedef struct __packed {
+    char     cookie[4];  ///< "gmon"
+    uint32_t version;
+    uint8_t  spare[12];
+} gmon_hdr_t;
+
+typedef struct __packed {
+    uint8_t  tag;        ///< GMON_TAG_TIME_HIST
+    uint32_t low_pc;
+    uint32_t high_pc;
+    uint32_t hist_size;  ///< Bins
+    uint32_t prof_rate;  ///< Samples per second
+    char     dimen[15];
+    char     dimen_abbrev;
+} gmon_hist_hdr_t;
+
+typedef struct __packed {
+    uint8_t  tag;        ///< GMON_TAG_CG_ARC
+    uint32_t from_pc;
+    uint32_t self_pc;
+    uint32_t count;
+} gmon_arc_t;
+
+typedef struct {
+    uint32_t from_pc;    ///< The key, the return address; 0 if the slot is free
+    uint32_t self_pc;    ///< The first PC sampled with it
+    uint32_t count;
+} profile_arc_t;
+
+// GMON.OUT, as of the last read of its start
+static struct __packed {
+    gmon_hdr_t      hdr;
+    gmon_hist_hdr_t hist;
+    uint16_t        bins[PICOVD_PROFILE_BINS];
+#if PICOVD_PROFILE_CALLERS
+    gmon_arc_t      arcs[PICOVD_PROFILE_ARCS];
+#endif
+} profile_file;
+_Static_assert(sizeof(profile_file) == VD_PROFILE_FILE_SIZE, "GMON.OUT layout");
+
+// Written only by the sampling interrupt
+static uint16_t      profile_bins[PICOVD_PROFILE_BINS];
+#if PICOVD_PROFILE_CALLERS
+static profile_arc_t profile_arcs[PICOVD_PROFILE_ARCS];
+#endif
+
+static uint32_t profile_low;   ///< Text start, at a bin boundary
+static uint32_t profile_size;  ///< Text covered by the bins
+static uint32_t profile_shift; ///< log2 of the bytes per bin
+static uint32_t profile_alarm;
+static uint32_t profile_next;  ///< Time of the next sample
+
+// The text of the binary, from the SDK linker scripts
+extern char __logical_binary_start[];
+extern char __etext[];
+
+// ---------------------------------------------------------------------------
+// Sampling
+// ---------------------------------------------------------------------------
+
+#if PICOVD_PROFILE_CALLERS
+static void __not_in_flash_func(profile_arc)(uint32_t from_pc, uint32_t self_pc) {
+    const uint32_t h = (from_pc * 2654435761u) >> (32u - __builtin_ctz(PICOVD_PROFILE_ARCS));
+    for (uint32_t i = 0; i < PROFILE_ARC_PROBES; i++) {
+        profile_arc_t *a = &profile_arcs[(h + i) & PROFILE_ARC_MASK];
+        if (a->from_pc == from_pc) {
+            if (a->count != UINT32_MAX) {
+                a->count++;
+            }
+            return;
+        }
+        if (a->from_pc == 0) {
+            a->self_pc = self_pc;
+            a->count   = 1;
+            __atomic_store_n(&a->from_pc, from_pc, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    // The table is full around this call site; the arc goes uncounted
+}
+#endif
+
+// Count a sample, from the exception frame of the interrupted code
+static void __used __not_in_flash_func(profile_sample)(const uint32_t *frame) {
+    timer_hw_t *timer = PROFILE_TIMER;
+    timer->intr = 1u << profile_alarm;
+    profile_next += PROFILE_PERIOD_US;
+    if ((int32_t)(profile_next - timer->timerawl) <= 0) {
+        profile_next = timer->timerawl + PROFILE_PERIOD_US; // Held off for a whole period, e.g. by a flash write
+    }
+    timer->alarm[profile_alarm] = profile_next;
+
+    // The frame holds r0-r3, r12, lr, pc and xpsr, with or without the FP registers after
+    const uint32_t pc = frame[6];
+    if (pc - profile_low >= profile_size) {
+        return;
+    }
+    uint16_t *bin = &profile_bins[(pc - profile_low) >> profile_shift];
+    if (*bin != UINT16_MAX) {
+        (*bin)++;
+    }
+#if PICOVD_PROFILE_CALLERS
+    const uint32_t lr = frame[5];
+    if ((lr & 1u) && (lr & ~1u) - profile_low < profile_size) {
+        profile_arc(lr & ~1u, pc);
+    }
+#endif
+}
+
+// Enters with the interrupted code's frame on the stack it used; passes
+// it on before pushing anything, and returns through profile_sample()
+static void __attribute__((naked)) __not_in_flash_func(profile_irq_handler)(void) {
+    __asm volatile(
+        "tst   lr, #4         \n"
+        "ite   eq             \n"
+        "mrseq r0, msp        \n"
+        "mrsne r0, psp        \n"
+        "b     profile_sample \n");
+}
+
+void vd_profile_init(void) {
+    // Bins of the fewest bytes that cover the text, at least an instruction
+    const uint32_t start = (uint32_t)__logical_binary_start & ~1u;
+    const uint32_t end   = (uint32_t)__etext;
+    profile_shift = 1;
+    while (((end - start + (1u << profile_shift) - 1u) >> profile_shift) > PICOVD_PROFILE_BINS) {
+        profile_shift++;
+    }
+    profile_low  = start & ~((1u << profile_shift) - 1u);
+    profile_size = PICOVD_PROFILE_BINS << profile_shift;
+
+    memcpy(profile_file.hdr.cookie, "gmon", 4);
+    profile_file.hdr.version        = GMON_VERSION;
+    profile_file.hist.tag           = GMON_TAG_TIME_HIST;
+    profile_file.hist.low_pc        = profile_low;
+    profile_file.hist.high_pc       = profile_low + profile_size;
+    profile_file.hist.hist_size     = PICOVD_PROFILE_BINS;
+    profile_file.hist.prof_rate     = PICOVD_PROFILE_RATE_HZ;
+    memcpy(profile_file.hist.dimen, "seconds", sizeof("seconds"));
+    profile_file.hist.dimen_abbrev  = 's';
+#if PICOVD_PROFILE_CALLERS
+    for (uint32_t i = 0; i < PICOVD_PROFILE_ARCS; i++) {
+        profile_file.arcs[i].tag = GMON_TAG_CG_ARC;
+    }
+#endif
+
+    timer_hw_t *timer = PROFILE_TIMER;
+    profile_alarm = (uint32_t)timer_hardware_alarm_claim_unused(timer, true);
+    const uint32_t irq = timer_hardware_alarm_get_irq_num(timer, profile_alarm);
+    irq_set_exclusive_handler(irq, profile_irq_handler);
+    irq_set_priority(irq, PICO_HIGHEST_IRQ_PRIORITY);
+    hw_set_bits(&timer->inte, 1u << profile_alarm);
+    irq_set_enabled(irq, true);
+    profile_next = timer->timerawl + PROFILE_PERIOD_US;
+    timer->alarm[profile_alarm] = profile_next;
+}
+
+// ---------------------------------------------------------------------------
+// Serve GMON.OUT
+// ---------------------------------------------------------------------------
+
+// Copy the counts into the file; each is copied whole, and only goes up
+static void profile_snapshot(void) {
+    memcpy(profile_file.bins, profile_bins, sizeof(profile_bins));
+#if PICOVD_PROFILE_CALLERS
+    for (uint32_t i = 0; i < PICOVD_PROFILE_ARCS; i++) {
+        const uint32_t from_pc = __atomic_load_n(&profile_arcs[i].from_pc, __ATOMIC_ACQUIRE);
+        profile_file.arcs[i].from_pc = from_pc;
+        profile_file.arcs[i].self_pc = from_pc ? profile_arcs[i].self_pc : 0;
+        profile_file.arcs[i].count   = from_pc ? profile_arcs[i].count : 0;
+    }
+#endif
+}
+
+void vd_profile_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_PROFILE_START_LBA);
+    assert(lba  < PICOVD_PROFILE_START_LBA + PROFILE_FILE_SECTORS);
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    const uint32_t pos = (lba - PICOVD_PROFILE_START_LBA) * EXFAT_BYTES_PER_SECTOR + offset;
+    if (pos == 0) {
+        profile_snapshot();
+    }
+    const uint32_t len = pos < VD_PROFILE_FILE_SIZE ? VD_PROFILE_FILE_SIZE - pos : 0;
+    const uint32_t n   = len < bufsize ? len : bufsize;
+    if (n) {
+        memcpy(buffer, (const uint8_t *)&profile_file + pos, n);
+    }
+    memset((uint8_t *)buffer + n, 0, bufsize - n);
+}
+
+bool vd_profile_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_PROFILE_FILE_NAME;
+
+    desc->first_cluster = PICOVD_PROFILE_START_CLUSTER;
+    desc->data_length   = VD_PROFILE_FILE_SIZE;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_PROFILE_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_PROFILE_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_PROFILE_ENABLED
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// PC-sampling profiler, served as GMON.OUT
+//
+// A hardware alarm interrupts the core that called vd_profile_init()
+// PICOVD_PROFILE_RATE_HZ times a second, at the highest priority, so
+// that the other interrupt handlers are sampled too.  The handler takes
+// the interrupted PC from the exception frame, and counts it in one of
+// PICOVD_PROFILE_BINS 16-bit bins over the text of the binary, each a
+// power of two bytes wide.  PCs outside it, e.g. in the boot ROM, or in
+// the RAM functions of a flash binary, are not counted.
+//
+// With PICOVD_PROFILE_CALLERS, the interrupted LR is also counted, as
+// a call arc from the caller, keyed by the call site, in a small hash
+// table.  LR holds the return address into the caller in leaf functions,
+// and in any function until it calls another; after that, it points
+// into the function itself, and gprof shows it calling itself.  A call
+// through a pointer is listed as calling the first function seen.  The
+// "calls" gprof lists are the samples seen with each caller.
+//
+// GMON.OUT is in the gmon.out format of the GNU toolchain, version 1:
+// the histogram, then one arc record per slot of the table, unused
+// ones with a count of 0.  Copy it next to the ELF file, and run
+//
+//     arm-none-eabi-gprof picovd-tool.elf GMON.OUT
+//
+// The counts are a snapshot, taken whenever the host reads the start
+// of the file, so that the file is consistent as the host copies it.
+// ---------------------------------------------------------------
+
+#if PICOVD_PROFILE_ENABLED
+
+#define VD_PROFILE_ARC_RECORDS   (PICOVD_PROFILE_CALLERS ? PICOVD_PROFILE_ARCS : 0)
+// gmon header, histogram record header and bins, and the arc records
+#define VD_PROFILE_FILE_SIZE     (20u + 33u + 2u * PICOVD_PROFILE_BINS + 13u * VD_PROFILE_ARC_RECORDS)
+#define VD_PROFILE_FILE_CLUSTERS ((VD_PROFILE_FILE_SIZE + EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER - 1u) \
+                                  / (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER))
+
+// Claim a hardware alarm, and start sampling the calling core
+extern void vd_profile_init(void);
+
+// Serve GMON.OUT
+extern void vd_profile_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe GMON.OUT; it never changes
+extern bool vd_profile_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+#else
+
+static inline void vd_profile_init(void) {}
+
+#endif // PICOVD_PROFILE_ENABLED
@@ -0,0 +1,244 @@
+/**
+ * @file src/vd_stats.c
+ * @brief Per-region read counters and latency histograms, served as STATS.TXT.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <pico/time.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_stats.h"
+#include "vd_usb_msc.h"
+#include "vd_flash_map.h"
+#include "vd_uf2_drop.h"
+
+#if PICOVD_STATS_ENABLED
+
+typedef struct {
+    uint32_t calls;
+    uint32_t max_latency;
+    uint64_t bytes;
+    uint64_t total_latency;
+    uint32_t hist[VD_STATS_HIST_BUCKETS];
+} vd_stats_counters_t;
+
+static vd_stats_counters_t vd_stats[VD_STATS_REGION_COUNT];
+
+void vd_stats_init(void) {
+#if PICOVD_STATS_USE_CYCLE_COUNTER
+    m33_hw->demcr     |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_cyccnt = 0;
+    m33_hw->dwt_ctrl  |= M33_DWT_CTRL_CYCCNTENA_BITS;
+#endif
+}
+
+void vd_stats_record(vd_stats_region_t region, uint32_t bytes, uint32_t start) {
+    const uint32_t latency = vd_stats_now() - start;
+    vd_stats_counters_t *s = &vd_stats[region];
+
+    s->calls++;
+    s->bytes += bytes;
+    s->total_latency += latency;
+    if (latency > s->max_latency) {
+        s->max_latency = latency;
+    }
+
+    // Bucket by the bit length of the scaled latency
+    const uint32_t scaled = latency >> VD_STATS_HIST_SHIFT;
+    uint32_t bucket = scaled ? 32u - (uint32_t)__builtin_clz(scaled) : 0;
+    if (bucket >= VD_STATS_HIST_BUCKETS) {
+        bucket = VD_STATS_HIST_BUCKETS - 1;
+    }
+    s->hist[bucket]++;
+}
+
+// ---------------------------------------------------------------------------
+// STATS.TXT rendering
+//
+// The file consists of fixed-width 64-byte lines, so that any slice can be
+// rendered on its own, without rendering the text before it.  With a 64-byte
+// MSC endpoint buffer, each slice is exactly one line.
+// ---------------------------------------------------------------------------
+#define STATS_LINE_LENGTH 64u
+
+static const char * const vd_stats_region_names[VD_STATS_REGION_COUNT] = {
+    [VD_STATS_BOOT]     = "boot",
+    [VD_STATS_FAT]      = "fat",
+    [VD_STATS_BITMAP]   = "bitmap",
+    [VD_STATS_UPCASE]   = "upcase",
+    [VD_STATS_ROOT_DIR] = "rootdir",
+    [VD_STATS_ZERO]     = "zero",
+    [VD_STATS_STATS]    = "stats",
+    [VD_STATS_TRACE]    = "trace",
+    [VD_STATS_PAGEMAP]  = "pagemap",
+    [VD_STATS_MANIFEST] = "manifest",
+    [VD_STATS_INBOX]    = "inbox",
+    [VD_STATS_STDIO]    = "stdio",
+    [VD_STATS_LOG]      = "log",
+    [VD_STATS_PROFILE]  = "profile",
+    [VD_STATS_GCOV]     = "gcov",
+    [VD_STATS_CHANGING] = "changing",
+    [VD_STATS_BOOTROM]  = "bootrom",
+    [VD_STATS_FLASH]    = "flash",
+    [VD_STATS_SRAM]     = "sram",
+    [VD_STATS_UF2]      = "uf2",
+    [VD_STATS_LZ4]      = "lz4",
+    [VD_STATS_TAR]      = "tar",
+    [VD_STATS_RAW_LUN]  = "rawlun",
+    [VD_STATS_PINNED]   = "pinned",
+};
+
+// Line layout: a title, a table of counters, two histogram lines per region,
+// the erased-page map and UF2 drop zone counters, and a table of SCSI commands,
+// padded with blank lines to a fixed length
+enum {
+    STATS_LINE_TITLE = 0,
+    STATS_LINE_COUNTERS_HEADER,
+    STATS_LINE_COUNTERS,
+    STATS_LINE_HIST_HEADER = STATS_LINE_COUNTERS + VD_STATS_REGION_COUNT,
+    STATS_LINE_HIST,
+    STATS_LINE_FLASH_MAP = STATS_LINE_HIST + 2 * VD_STATS_REGION_COUNT,
+    STATS_LINE_UF2_DROP,
+    STATS_LINE_SCSI_HEADER,
+    STATS_LINE_SCSI,
+    STATS_LINE_COUNT = STATS_LINE_SCSI + VD_MSC_COMMANDS_MAX,
+};
+
+#define STATS_FILE_SIZE_BYTES (STATS_LINE_COUNT * STATS_LINE_LENGTH)
+_Static_assert(STATS_FILE_SIZE_BYTES <= PICOVD_STATS_FILE_SIZE_BYTES, "STATS.TXT does not fit its region");
+
+#if PICOVD_STATS_USE_CYCLE_COUNTER
+#define STATS_UNIT "cycles"
+#else
+#define STATS_UNIT "us"
+#endif
+
+// Print a histogram count in five characters, scaling large counts
+static int stats_print_count(char *out, size_t size, uint32_t count) {
+    if (count < 100000u) {
+        return snprintf(out, size, " %5lu", (unsigned long)count);
+    } else if (count < 10000000u) {
+        return snprintf(out, size, " %4luk", (unsigned long)(count / 1000u));
+    }
+    return snprintf(out, size, " %4luM", (unsigned long)(count / 1000000u));
+}
+
+// Render line `n` into `line`, padded with spaces and terminated by a newline
+static void stats_render_line(uint32_t n, char line[STATS_LINE_LENGTH + 1]) {
+    int len = 0;
+
+    if (n == STATS_LINE_TITLE) {
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "PicoVD read statistics v1, uptime %lu ms",
+                       (unsigned long)(time_us_64() / 1000u));
+    } else if (n == STATS_LINE_COUNTERS_HEADER) {
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "%-8s %10s %14s %9s %9s",
+                       "region", "calls", "bytes", "avg", "max " STATS_UNIT);
+    } else if (n < STATS_LINE_HIST_HEADER) {
+        const uint32_t r = n - STATS_LINE_COUNTERS;
+        const vd_stats_counters_t *s = &vd_stats[r];
+        const uint32_t calls = s->calls;
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "%-8s %10lu %14llu %9lu %9lu",
+                       vd_stats_region_names[r], (unsigned long)calls, (unsigned long long)s->bytes,
+                       (unsigned long)(calls ? s->total_latency / calls : 0), (unsigned long)s->max_latency);
+    } else if (n == STATS_LINE_HIST_HEADER) {
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "histogram: bucket b counts latencies < 2^(b+%u) %s",
+                       VD_STATS_HIST_SHIFT, STATS_UNIT);
+    } else if (n < STATS_LINE_FLASH_MAP) {
+        const uint32_t r     = (n - STATS_LINE_HIST) / 2;
+        const uint32_t first = ((n - STATS_LINE_HIST) % 2) * (VD_STATS_HIST_BUCKETS / 2);
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "%-8s %2lu-%-2lu:", vd_stats_region_names[r],
+                       (unsigned long)first, (unsigned long)(first + VD_STATS_HIST_BUCKETS / 2 - 1));
+        for (uint32_t b = first; b < first + VD_STATS_HIST_BUCKETS / 2 && len < STATS_LINE_LENGTH; b++) {
+            len += stats_print_count(line + len, STATS_LINE_LENGTH + 1 - len, vd_stats[r].hist[b]);
+        }
+    } else if (n == STATS_LINE_FLASH_MAP) {
+#if PICOVD_FLASH_ERASED_MAP_ENABLED
+        // Pages erased of those checked, and bytes read through XIP or skipped
+        const vd_flash_map_counters_t *m = vd_flash_map_counters();
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "flashmap %4lu/%4lu erased, xip %10llu B, skip %10llu B",
+                       (unsigned long)m->pages_erased, (unsigned long)m->pages_checked,
+                       (unsigned long long)m->xip_bytes, (unsigned long long)m->skipped_bytes);
+#endif
+    } else if (n == STATS_LINE_UF2_DROP) {
+#if PICOVD_UF2_DROP_ENABLED
+        // Blocks staged and programmed, in how many operations, and slices refused meanwhile
+        const vd_uf2_drop_counters_t *d = vd_uf2_drop_counters();
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "uf2drop %6lu/%6lu blk, %5lu erase, %6lu prog, %5lu busy",
+                       (unsigned long)d->programmed, (unsigned long)d->blocks, (unsigned long)d->erases,
+                       (unsigned long)d->programs, (unsigned long)d->busy);
+#endif
+    } else if (n == STATS_LINE_SCSI_HEADER) {
+        len = snprintf(line, STATS_LINE_LENGTH + 1, "%-10s %10s %9s %9s",
+                       "command", "calls", "avg", "max " STATS_UNIT);
+    } else if (n < STATS_LINE_COUNT) {
+        const vd_stats_latency_t *s;
+        const char *name = vd_msc_command_stats(n - STATS_LINE_SCSI, &s);
+        if (name) {
+            const uint32_t calls = s->calls;
+            len = snprintf(line, STATS_LINE_LENGTH + 1, "%-10s %10lu %9lu %9lu",
+                           name, (unsigned long)calls,
+                           (unsigned long)(calls ? s->total_latency / calls : 0), (unsigned long)s->max_latency);
+        }
+    }
+
+    if (len < 0) {
+        len = 0;
+    } else if (len > STATS_LINE_LENGTH - 1) {
+        len = STATS_LINE_LENGTH - 1; // Truncated
+    }
+    memset(line + len, ' ', STATS_LINE_LENGTH - 1 - len);
+    line[STATS_LINE_LENGTH - 1] = '\n';
+}
+
+void vd_stats_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_STATS_START_LBA);
+
+    uint8_t *out = (uint8_t *)buffer;
+    uint32_t pos = ((lba - PICOVD_STATS_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset;
+    char line[STATS_LINE_LENGTH + 1];
+
+    while (bufsize > 0) {
+        const uint32_t n    = pos / STATS_LINE_LENGTH;
+        const uint32_t skip = pos % STATS_LINE_LENGTH;
+        uint32_t       len  = STATS_LINE_LENGTH - skip;
+        if (len > bufsize) {
+            len = bufsize;
+        }
+        if (n < STATS_LINE_COUNT) {
+            stats_render_line(n, line);
+            memcpy(out, line + skip, len);
+        } else {
+            memset(out, 0, len); // Beyond the end of file
+        }
+        out     += len;
+        pos     += len;
+        bufsize -= len;
+    }
+}
+
+bool vd_stats_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_STATS_FILE_NAME;
+
+    desc->first_cluster = PICOVD_STATS_START_CLUSTER;
+    desc->data_length   = STATS_FILE_SIZE_BYTES;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_STATS_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_STATS_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_STATS_ENABLED
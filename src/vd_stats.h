@@ -0,0 +1,110 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+#if PICOVD_STATS_ENABLED && PICOVD_STATS_USE_CYCLE_COUNTER
+#include <hardware/structs/m33.h>
+#else
+#include <pico/time.h>
+#endif
+
+// ---------------------------------------------------------------
+// Read statistics, rendered on demand as STATS.TXT
+//
+// Each read served by vd_virtual_disk_read() is counted against the
+// region class of its LBA: calls, bytes, total and maximum latency,
+// and a power-of-two latency histogram.  Recording is lock-free and
+// division-free; all counters are only written from the USB task.
+// With PICOVD_STATS_ENABLED 0, the recording compiles to nothing.
+// ---------------------------------------------------------------
+
+typedef enum {
+    VD_STATS_BOOT = 0,    ///< Main and backup boot regions
+    VD_STATS_FAT,         ///< FAT region
+    VD_STATS_BITMAP,      ///< Allocation bitmap
+    VD_STATS_UPCASE,      ///< Up-case table
+    VD_STATS_ROOT_DIR,    ///< Root directory
+    VD_STATS_ZERO,        ///< Unused sectors and file tails
+    VD_STATS_STATS,       ///< STATS.TXT itself
+    VD_STATS_TRACE,       ///< TRACE.BIN
+    VD_STATS_PAGEMAP,     ///< FLASHMAP.BIN and SRAMMAP.BIN
+    VD_STATS_MANIFEST,    ///< MANIFEST.TXT
+    VD_STATS_INBOX,       ///< Upload files
+    VD_STATS_STDIO,       ///< STDOUT.TXT and STDERR.TXT
+    VD_STATS_LOG,         ///< LOG.TXT
+    VD_STATS_PROFILE,     ///< GMON.OUT
+    VD_STATS_GCOV,        ///< GCOV and its .gcda files
+    VD_STATS_CHANGING,    ///< CHANGING.TXT
+    VD_STATS_BOOTROM,     ///< BOOTROM.BIN
+    VD_STATS_FLASH,       ///< FLASH.BIN and partitions
+    VD_STATS_SRAM,        ///< SRAM.BIN
+    VD_STATS_UF2,         ///< UF2 views
+    VD_STATS_LZ4,         ///< LZ4 views
+    VD_STATS_TAR,         ///< ALL.TAR
+    VD_STATS_RAW_LUN,     ///< Flash and partition LUNs
+    VD_STATS_PINNED,      ///< Served from the mount-ready RAM
+    VD_STATS_REGION_COUNT,
+} vd_stats_region_t;
+
+// Latency histogram: bucket b counts latencies below 2^(b + SHIFT),
+// the last bucket everything above
+#define VD_STATS_HIST_BUCKETS 16u
+#if PICOVD_STATS_USE_CYCLE_COUNTER
+#define VD_STATS_HIST_SHIFT   6u  // 64 cycles to ~8 ms at 150 MHz
+#else
+#define VD_STATS_HIST_SHIFT   0u  // 1 us to ~32 ms
+#endif
+
+// Count and latency of one kind of operation, e.g. a SCSI opcode
+typedef struct {
+    uint32_t calls;
+    uint32_t max_latency;
+    uint64_t total_latency;
+} vd_stats_latency_t;
+
+#if PICOVD_STATS_ENABLED
+
+// Call once at startup, to start the cycle counter if used
+extern void vd_stats_init(void);
+
+// Latency timestamp, in cycles or microseconds
+static inline uint32_t vd_stats_now(void) {
+#if PICOVD_STATS_USE_CYCLE_COUNTER
+    return m33_hw->dwt_cyccnt;
+#else
+    return time_us_32();
+#endif
+}
+
+// Count a read of `bytes` that started at vd_stats_now() == `start`
+extern void vd_stats_record(vd_stats_region_t region, uint32_t bytes, uint32_t start);
+
+// Count an operation that started at vd_stats_now() == `start`
+static inline void vd_stats_latency_record(vd_stats_latency_t *s, uint32_t start) {
+    const uint32_t latency = vd_stats_now() - start;
+    s->calls++;
+    s->total_latency += latency;
+    if (latency > s->max_latency) {
+        s->max_latency = latency;
+    }
+}
+
+// STATS.TXT contents and directory entry
+extern void vd_stats_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+extern bool vd_stats_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+#else
+
+static inline void     vd_stats_init(void) {}
+static inline uint32_t vd_stats_now(void) { return 0; }
+static inline void     vd_stats_record(vd_stats_region_t region, uint32_t bytes, uint32_t start) {
+    (void)region; (void)bytes; (void)start;
+}
+static inline void     vd_stats_latency_record(vd_stats_latency_t *s, uint32_t start) {
+    (void)s; (void)start;
+}
+
+#endif // PICOVD_STATS_ENABLED
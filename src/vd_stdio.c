@@ -0,0 +1,251 @@
+/**
+ * @file src/vd_stdio.c
+ * @brief Console output captured into rings, served as STDOUT.TXT and STDERR.TXT.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>          // STDERR_FILENO
+
+#include <pico/platform.h>   // get_core_num()
+#include <pico/stdio.h>
+#include <pico/stdio/driver.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_inbox.h"
+#include "vd_stdio.h"
+
+#if PICOVD_STDIO_ENABLED
+
+#define STDIO_MASK          (PICOVD_STDIO_RING_SIZE - 1u)
+#define STDIO_FILE_SECTORS  (VD_STDIO_FILE_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT)
+#define STDIO_MAGIC         (0x5644494Fu ^ PICOVD_STDIO_RING_SIZE) // "OIDV"
+// The state of a ring is its position, modulo 2^28, and the writers in flight
+#define STDIO_WRITERS_BITS  4u
+#define STDIO_WRITERS_MASK  ((1u << STDIO_WRITERS_BITS) - 1u)
+#define STDIO_POS_MASK      (UINT32_MAX >> STDIO_WRITERS_BITS)
+
+_Static_assert((PICOVD_STDIO_RING_SIZE & STDIO_MASK) == 0, "The stdio ring size must be a power of two");
+_Static_assert(PICOVD_STDIO_RING_SIZE % (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER) == 0,
+               "The stdio rings must be whole clusters");
+_Static_assert(PICOVD_STDIO_RING_SIZE <= STDIO_POS_MASK / 2u, "The stdio ring is too large for its positions");
+#if PICOVD_INBOX_ENABLED
+_Static_assert(PICOVD_INBOX_START_CLUSTER + VD_INBOX_LENGTH_CLUSTERS <= PICOVD_STDIO_START_CLUSTER,
+               "The upload files overlap STDOUT.TXT");
+#endif
+#if PICOVD_UF2_DROP_ENABLED
+_Static_assert(PICOVD_STDIO_START_CLUSTER + VD_STDIO_LENGTH_CLUSTERS <= PICOVD_UF2_DROP_START_CLUSTER,
+               "STDERR.TXT overlaps the UF2 drop zone");
+#endif
+#if PICOVD_CHANGING_FILE_ENABLED
+_Static_assert(PICOVD_STDIO_START_CLUSTER + VD_STDIO_LENGTH_CLUSTERS <= PICOVD_CHANGING_FILE_START_CLUSTER,
+               "STDERR.TXT overlaps CHANGING.TXT");
+#endif
+
+typedef struct {
+    uint32_t magic;     ///< STDIO_MAGIC once set up
+    uint32_t state;     ///< Bytes reserved << STDIO_WRITERS_BITS | writers in flight
+    uint32_t committed; ///< Position up to which all bytes are written, published by the last writer out
+    uint32_t wrapped;   ///< Set once the ring has been overwritten
+    char     ring[PICOVD_STDIO_RING_SIZE];
+} stdio_ring_t;
+
+#if PICOVD_STDIO_NOINIT
+static stdio_ring_t __uninitialized_ram(stdio_rings)[VD_STDIO_STREAM_COUNT];
+#else
+static stdio_ring_t stdio_rings[VD_STDIO_STREAM_COUNT];
+#endif
+
+// The part of each ring served as its file, taken when the host reads the directory
+static struct {
+    uint32_t start;  ///< Position of the first byte
+    uint32_t length;
+} stdio_windows[VD_STDIO_STREAM_COUNT];
+static bool stdio_windows_taken; ///< Else there has been no directory read yet
+
+// ---------------------------------------------------------------------------
+// Producers
+// ---------------------------------------------------------------------------
+
+// Advance the published position to `pos`, unless a later writer got there first
+static void stdio_publish(stdio_ring_t *r, uint32_t pos) {
+    uint32_t c = __atomic_load_n(&r->committed, __ATOMIC_RELAXED);
+    while (pos != c && ((pos - c) & STDIO_POS_MASK) <= STDIO_POS_MASK / 2u) {
+        if (pos >= PICOVD_STDIO_RING_SIZE || pos < c) {
+            r->wrapped = 1;
+        }
+        if (__atomic_compare_exchange_n(&r->committed, &c, pos, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+static void __not_in_flash_func(stdio_append)(stdio_ring_t *r, const char *buf, uint32_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (len > PICOVD_STDIO_RING_SIZE) {
+        buf += len - PICOVD_STDIO_RING_SIZE; // Only the last bytes would be kept
+        len  = PICOVD_STDIO_RING_SIZE;
+    }
+    // Reserve the bytes, counting ourselves in, with one exclusive store
+    const uint32_t s     = __atomic_fetch_add(&r->state, (len << STDIO_WRITERS_BITS) + 1u, __ATOMIC_ACQUIRE);
+    const uint32_t idx   = (s >> STDIO_WRITERS_BITS) & STDIO_MASK;
+    const uint32_t first = len < PICOVD_STDIO_RING_SIZE - idx ? len : PICOVD_STDIO_RING_SIZE - idx;
+    memcpy(r->ring + idx, buf, first);
+    memcpy(r->ring, buf + first, len - first);
+
+    // Count ourselves out; the last one out has all bytes reserved so far written
+    const uint32_t e = __atomic_sub_fetch(&r->state, 1u, __ATOMIC_ACQ_REL);
+    if ((e & STDIO_WRITERS_MASK) == 0) {
+        stdio_publish(r, e >> STDIO_WRITERS_BITS);
+    }
+}
+
+void vd_stdio_write(vd_stdio_stream_t stream, const char *buf, uint32_t len) {
+    assert(stream < VD_STDIO_STREAM_COUNT);
+    stdio_append(&stdio_rings[stream], buf, len);
+}
+
+// ---------------------------------------------------------------------------
+// The stdio driver, and stderr
+// ---------------------------------------------------------------------------
+
+// Set by __wrap__write() while it writes to stderr, one flag per core
+static volatile bool stdio_stderr_active[NUM_CORES];
+
+static void stdio_out_chars(const char *buf, int len) {
+    const vd_stdio_stream_t stream = stdio_stderr_active[get_core_num()] ? VD_STDIO_STDERR : VD_STDIO_STDOUT;
+    stdio_append(&stdio_rings[stream], buf, (uint32_t)len);
+}
+
+static stdio_driver_t stdio_vd_driver = {
+    .out_chars    = stdio_out_chars,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    .crlf_enabled = false,  // As printed
+#endif
+};
+
+void vd_stdio_init(void) {
+    for (uint32_t i = 0; i < VD_STDIO_STREAM_COUNT; i++) {
+        stdio_ring_t *r = &stdio_rings[i];
+        if (r->magic != STDIO_MAGIC) {
+            r->state     = 0;
+            r->committed = 0;
+            r->wrapped   = 0;
+            r->magic     = STDIO_MAGIC;
+        } else {
+            // Kept over a reboot; the writers cut short keep what they wrote
+            r->state    &= ~STDIO_WRITERS_MASK;
+            r->committed = r->state >> STDIO_WRITERS_BITS;
+        }
+    }
+    stdio_set_driver_enabled(&stdio_vd_driver, true);
+}
+
+#endif // PICOVD_STDIO_ENABLED
+
+// The C library writes stdout and stderr alike through _write(), and the
+// SDK passes both to the drivers; linked with --wrap=_write, see CMakeLists.txt
+extern int __real__write(int handle, char *buffer, int length);
+
+int __wrap__write(int handle, char *buffer, int length) {
+#if PICOVD_STDIO_ENABLED
+    if (handle == STDERR_FILENO) {
+        const uint32_t core = get_core_num();
+        stdio_stderr_active[core] = true;
+        const int written = __real__write(handle, buffer, length);
+        stdio_stderr_active[core] = false;
+        return written;
+    }
+#endif
+    return __real__write(handle, buffer, length);
+}
+
+#if PICOVD_STDIO_ENABLED
+
+// ---------------------------------------------------------------------------
+// Serve STDOUT.TXT and STDERR.TXT
+// ---------------------------------------------------------------------------
+
+void vd_stdio_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_STDIO_START_LBA);
+    assert(lba  < PICOVD_STDIO_START_LBA + VD_STDIO_STREAM_COUNT * STDIO_FILE_SECTORS);
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    const uint32_t      stream = (lba - PICOVD_STDIO_START_LBA) / STDIO_FILE_SECTORS;
+    const uint32_t      pos    = ((lba - PICOVD_STDIO_START_LBA) % STDIO_FILE_SECTORS) * EXFAT_BYTES_PER_SECTOR + offset;
+    const stdio_ring_t *r      = &stdio_rings[stream];
+    uint8_t            *buf    = buffer;
+    uint32_t            len    = 0;
+
+    if (pos < stdio_windows[stream].length) {
+        const uint32_t remaining = stdio_windows[stream].length - pos;
+        len = bufsize < remaining ? bufsize : remaining;
+
+        // The ring wraps around under the linear window
+        const uint32_t from  = (stdio_windows[stream].start + pos) & STDIO_POS_MASK;
+        const uint32_t idx   = from & STDIO_MASK;
+        const uint32_t first = len < PICOVD_STDIO_RING_SIZE - idx ? len : PICOVD_STDIO_RING_SIZE - idx;
+        memcpy(buf, r->ring + idx, first);
+        memcpy(buf + first, r->ring, len - first);
+
+        // The bytes the writers have reserved over since the window was taken, or while copying
+        const uint32_t reserved = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE) >> STDIO_WRITERS_BITS;
+        const uint32_t ahead    = (reserved - from) & STDIO_POS_MASK;
+        if (ahead > PICOVD_STDIO_RING_SIZE) {
+            const uint32_t lost = ahead - PICOVD_STDIO_RING_SIZE;
+            memset(buf, ' ', lost < len ? lost : len);
+        }
+    }
+    memset(buf + len, 0, bufsize - len);
+}
+
+void vd_stdio_refresh(uint32_t slot_idx __unused) {
+    // All of the ring once it has wrapped, ending at the last byte written
+    for (uint32_t i = 0; i < VD_STDIO_STREAM_COUNT; i++) {
+        const stdio_ring_t *r = &stdio_rings[i];
+        const uint32_t end    = __atomic_load_n(&r->committed, __ATOMIC_ACQUIRE);
+        const uint32_t length = (r->wrapped || end >= PICOVD_STDIO_RING_SIZE) ? PICOVD_STDIO_RING_SIZE : end;
+        stdio_windows[i].start  = (end - length) & STDIO_POS_MASK;
+        stdio_windows[i].length = length;
+    }
+    stdio_windows_taken = true;
+}
+
+bool vd_stdio_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    static const char16_t names[VD_STDIO_STREAM_COUNT][16] = {
+        [VD_STDIO_STDOUT] = PICOVD_STDIO_STDOUT_FILE_NAME,
+        [VD_STDIO_STDERR] = PICOVD_STDIO_STDERR_FILE_NAME,
+    };
+    static const uint8_t name_lengths[VD_STDIO_STREAM_COUNT] = {
+        [VD_STDIO_STDOUT] = PICOVD_STDIO_STDOUT_FILE_NAME_LEN,
+        [VD_STDIO_STDERR] = PICOVD_STDIO_STDERR_FILE_NAME_LEN,
+    };
+    if (file_idx >= VD_STDIO_STREAM_COUNT) {
+        return false;
+    }
+    // The window of the last directory read, the same for the sector path
+    if (!stdio_windows_taken) {
+        vd_stdio_refresh(slot_idx);
+    }
+    const uint32_t length = stdio_windows[file_idx].length;
+
+    desc->first_cluster = length ? PICOVD_STDIO_START_CLUSTER + file_idx * VD_STDIO_FILE_CLUSTERS : 0;
+    desc->data_length   = length;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = name_lengths[file_idx];
+    for (size_t i = 0; i < name_lengths[file_idx]; i++) {
+        desc->name[i] = (uint8_t)names[file_idx][i];
+    }
+    return true;
+}
+
+#endif // PICOVD_STDIO_ENABLED
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// STDOUT.TXT and STDERR.TXT, the application's console output
+//
+// A Pico SDK stdio driver appends everything printed into a ring in
+// SRAM, and a wrapper of _write() diverts what is written to stderr
+// into a second ring.  Appending to a ring never waits: the producers,
+// on either core or in interrupts, reserve their bytes by advancing a
+// position with one exclusive store, copy, and then count themselves
+// out; nothing the host reads holds them up.  printf() still takes the
+// SDK's stdio mutex, so it can wait for a printf() on the other core,
+// and for any other stdio driver enabled, e.g. stdio_usb, which blocks
+// while a terminal is open and not reading; vd_stdio_write() takes no
+// lock and goes to the ring only.  With PICOVD_STDIO_NOINIT,
+// the rings are not cleared at boot, so that the output before a
+// watchdog reboot is still there after it.
+//
+// Each file grows with its ring, and once the ring has wrapped, holds
+// the last PICOVD_STDIO_RING_SIZE bytes, from its oldest byte at offset
+// 0.  The window is taken once per read of the files' directory sector,
+// and the directory entries and the files' sectors are served from it
+// until the next one, so the host sees new output once it reads the
+// directory again.  Bytes overwritten since are served as spaces.
+// ---------------------------------------------------------------
+
+typedef enum {
+    VD_STDIO_STDOUT = 0,
+    VD_STDIO_STDERR,
+    VD_STDIO_STREAM_COUNT,
+} vd_stdio_stream_t;
+
+#if PICOVD_STDIO_ENABLED
+
+#define VD_STDIO_FILE_CLUSTERS   (PICOVD_STDIO_RING_SIZE / (EXFAT_BYTES_PER_SECTOR * EXFAT_SECTORS_PER_CLUSTER))
+#define VD_STDIO_LENGTH_CLUSTERS (VD_STDIO_STREAM_COUNT * VD_STDIO_FILE_CLUSTERS)
+
+// Keep the output from before a reboot if it is intact, and add the stdio driver.
+// Call first thing in main(), before anything is printed.
+extern void vd_stdio_init(void);
+
+// Append `len` bytes to a stream, from anywhere, without going through stdio
+extern void vd_stdio_write(vd_stdio_stream_t stream, const char *buf, uint32_t len);
+
+// Serve STDOUT.TXT and STDERR.TXT
+extern void vd_stdio_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe STDOUT.TXT and STDERR.TXT; only their sizes change
+extern bool vd_stdio_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+// Take the windows of STDOUT.TXT and STDERR.TXT, as the host reads their directory entries
+extern void vd_stdio_refresh(uint32_t slot_idx);
+
+#else
+
+static inline void vd_stdio_init(void) {}
+
+#endif // PICOVD_STDIO_ENABLED
@@ -0,0 +1,271 @@
+/**
+ * @file src/vd_tar.c
+ * @brief ALL.TAR, every other file in one ustar archive, generated per sector.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_lz4.h"
+#include "vd_tar.h"
+
+#if PICOVD_TAR_ENABLED
+
+#define TAR_BLOCK_SIZE      512u
+#define TAR_END_SECTORS     2u // Two zero blocks end the archive
+#define TAR_LENGTH_SECTORS  (PICOVD_TAR_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT)
+#define TAR_NAME_MAX        100u
+
+_Static_assert(TAR_BLOCK_SIZE == EXFAT_BYTES_PER_SECTOR, "A tar block is a sector");
+_Static_assert(PICOVD_TAR_FILES_MAX <= 255, "Files are indexed with a byte");
+_Static_assert(PICOVD_TAR_START_CLUSTER + PICOVD_TAR_LENGTH_CLUSTERS <= EXFAT_CLUSTER_HEAP_START_CLUSTER + EXFAT_CLUSTER_COUNT,
+               "ALL.TAR must be within the volume");
+#if PICOVD_LZ4_ENABLED
+_Static_assert(PICOVD_LZ4_START_CLUSTER + VD_LZ4_LENGTH_CLUSTERS <= PICOVD_TAR_START_CLUSTER, "ALL.TAR overlaps the LZ4 views");
+#endif
+
+// POSIX ustar header, IEEE Std 1003.1-2001 pax "ustar Interchange Format"
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tar_header_t;
+_Static_assert(sizeof(tar_header_t) == TAR_BLOCK_SIZE, "A tar header is a block");
+
+typedef struct {
+    uint32_t start;         ///< Sector of the header, within ALL.TAR
+    uint32_t first_cluster;
+    uint32_t data_length;
+    uint8_t  group_idx;     ///< Of the root directory, see exfat_root_dir_file_describe()
+    uint8_t  file_idx;
+} tar_entry_t;
+
+static tar_entry_t tar_entries[PICOVD_TAR_FILES_MAX];
+
+static struct {
+    uint32_t count;     ///< Files listed
+    uint32_t end;       ///< Sectors of the archive so far, without the end blocks
+    uint32_t group_idx; ///< Next file to list
+    uint32_t file_idx;
+    bool     listing;   ///< ALL.TAR describes itself as no file meanwhile
+    bool     listed;    ///< Published last
+    bool     missed;    ///< The host was shown the directory without ALL.TAR
+} tar_job;
+
+static inline uint32_t tar_data_sectors(uint32_t data_length) {
+    return (data_length + TAR_BLOCK_SIZE - 1u) / TAR_BLOCK_SIZE;
+}
+
+// ---------------------------------------------------------------------------
+// Idle job: list the files, one per step
+// ---------------------------------------------------------------------------
+
+void vd_tar_job_reset(void) {
+    tar_job.listed    = false;
+    tar_job.missed    = false;
+    tar_job.count     = 0;
+    tar_job.end       = 0;
+    tar_job.group_idx = 0;
+    tar_job.file_idx  = 0;
+}
+
+bool vd_tar_job_step(void) {
+    if (tar_job.listed) {
+        return true;
+    }
+    if (tar_job.group_idx >= exfat_root_dir_group_count() || tar_job.count >= PICOVD_TAR_FILES_MAX) {
+        __compiler_memory_barrier();
+        tar_job.listed = true;
+        // ALL.TAR was left out of the directory the host has seen; tell it
+        if (tar_job.missed) {
+            tar_job.missed = false;
+            vd_virtual_disk_estimate_changed(vd_tar_job_step);
+        }
+        return true;
+    }
+    exfat_dir_file_desc_t desc;
+    tar_job.listing = true;
+    const bool found = exfat_root_dir_file_describe(tar_job.group_idx, tar_job.file_idx, &desc);
+    tar_job.listing = false;
+    if (!found) {
+        tar_job.group_idx++;
+        tar_job.file_idx = 0;
+        return false;
+    }
+    tar_job.file_idx++;
+    if (desc.attributes & EXFAT_FILE_ATTR_DIRECTORY) {
+        return false; // Its files are not archived
+    }
+
+    // The file if it fits, else the files after it may
+    const uint32_t sectors = 1u + tar_data_sectors(desc.data_length);
+    if (tar_job.end + sectors + TAR_END_SECTORS <= TAR_LENGTH_SECTORS
+        && (desc.first_cluster != 0 || desc.data_length == 0)) {
+        tar_entry_t *e = &tar_entries[tar_job.count];
+        e->start         = tar_job.end;
+        e->first_cluster = desc.first_cluster;
+        e->data_length   = desc.data_length;
+        e->group_idx     = (uint8_t)tar_job.group_idx;
+        e->file_idx      = (uint8_t)(tar_job.file_idx - 1u);
+        tar_job.end += sectors;
+        tar_job.count++;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Headers
+// ---------------------------------------------------------------------------
+
+// `value` in octal, zero padded to fill `width` - 1 digits, NUL terminated
+static void tar_octal(char *field, uint32_t width, uint32_t value) {
+    field[width - 1u] = '\0';
+    for (uint32_t i = width - 1u; i > 0; i--) {
+        field[i - 1u] = (char)('0' + (value & 7u));
+        value >>= 3;
+    }
+}
+
+// Seconds since the epoch of an exFAT timestamp, §7.4.8; 0 for none
+static uint32_t tar_mtime(exfat_timestamp_t ts) {
+    if (ts == 0) {
+        return 0;
+    }
+    uint32_t       y = 1980u + (ts >> 25);
+    const uint32_t m = (ts >> 21) & 0x0Fu;
+    const uint32_t d = (ts >> 16) & 0x1Fu;
+    // Days from 1970-01-01, counting years from March, so that leap days come last
+    y -= m <= 2u;
+    const uint32_t era  = y / 400u;
+    const uint32_t yoe  = y - era * 400u;
+    const uint32_t doy  = (153u * (m > 2u ? m - 3u : m + 9u) + 2u) / 5u + d - 1u;
+    const uint32_t doe  = yoe * 365u + yoe / 4u - yoe / 100u + doy;
+    const uint32_t days = era * 146097u + doe - 719468u;
+    return days * 86400u + ((ts >> 11) & 0x1Fu) * 3600u + ((ts >> 5) & 0x3Fu) * 60u + (ts & 0x1Fu) * 2u;
+}
+
+static void tar_header(const tar_entry_t *e, tar_header_t *h) {
+    exfat_dir_file_desc_t desc;
+    memset(h, 0, sizeof(*h));
+    if (!exfat_root_dir_file_describe(e->group_idx, e->file_idx, &desc)) {
+        desc.name_length = 0; // Gone since the listing; the contents have changed
+        desc.attributes  = EXFAT_FILE_ATTR_READ_ONLY;
+        desc.timestamp   = 0;
+    }
+    const uint32_t name_length = desc.name_length < TAR_NAME_MAX ? desc.name_length : TAR_NAME_MAX;
+    memcpy(h->name, desc.name, name_length);
+
+    tar_octal(h->mode, sizeof(h->mode), (desc.attributes & EXFAT_FILE_ATTR_READ_ONLY) ? 0444u : 0644u);
+    tar_octal(h->uid, sizeof(h->uid), 0);
+    tar_octal(h->gid, sizeof(h->gid), 0);
+    tar_octal(h->size, sizeof(h->size), e->data_length);
+    tar_octal(h->mtime, sizeof(h->mtime), tar_mtime(desc.timestamp));
+    h->typeflag = '0';
+    memcpy(h->magic, "ustar", 6);
+    memcpy(h->version, "00", 2);
+    memcpy(h->uname, "picovd", 7);
+    memcpy(h->gname, "picovd", 7);
+
+    // The checksum is taken with its own field as spaces
+    memset(h->chksum, ' ', sizeof(h->chksum));
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < sizeof(*h); i++) {
+        sum += ((const uint8_t *)h)[i];
+    }
+    tar_octal(h->chksum, 7, sum); // Six digits, a NUL, then the space
+}
+
+// ---------------------------------------------------------------------------
+// Serve ALL.TAR
+// ---------------------------------------------------------------------------
+
+// The last file that starts at or before `sector`, or NULL if past all of them
+static const tar_entry_t *tar_find(uint32_t sector) {
+    if (sector >= tar_job.end) {
+        return NULL;
+    }
+    uint32_t lo = 0, hi = tar_job.count; // tar_entries[lo].start <= sector < tar_entries[hi].start
+    while (hi - lo > 1u) {
+        const uint32_t mid = lo + (hi - lo) / 2u;
+        if (tar_entries[mid].start <= sector) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &tar_entries[lo];
+}
+
+void vd_tar_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_TAR_START_LBA);
+    assert(lba  < PICOVD_TAR_START_LBA + TAR_LENGTH_SECTORS);
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    const uint32_t     sector = lba - PICOVD_TAR_START_LBA;
+    const tar_entry_t *e      = tar_job.listed ? tar_find(sector) : NULL; // Else not in the directory yet
+    if (e == NULL) {
+        memset(buffer, 0, bufsize); // The end blocks, or the rest of the last cluster
+        return;
+    }
+    if (sector == e->start) {
+        tar_header_t h;
+        tar_header(e, &h);
+        memcpy(buffer, (const uint8_t *)&h + offset, bufsize);
+        return;
+    }
+
+    // The file's own sector, through the region table, zeroed past the end of file
+    const uint32_t data_sector = sector - e->start - 1u;
+    vd_virtual_disk_generate(EXFAT_CLUSTER_TO_LBA(e->first_cluster) + data_sector, offset, buffer, bufsize);
+    const uint32_t pos = data_sector * EXFAT_BYTES_PER_SECTOR + offset;
+    if (pos + bufsize > e->data_length) {
+        const uint32_t keep = pos < e->data_length ? e->data_length - pos : 0;
+        memset((uint8_t *)buffer + keep, 0, bufsize - keep);
+    }
+}
+
+bool vd_tar_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0 || tar_job.listing) {
+        return false; // Not in the archive itself
+    }
+    if (!tar_job.listed) {
+        tar_job.missed = true; // Left out until the idle job has listed the files
+        return false;
+    }
+    const char16_t name[] = PICOVD_TAR_FILE_NAME;
+
+    desc->first_cluster = PICOVD_TAR_START_CLUSTER;
+    desc->data_length   = (tar_job.end + TAR_END_SECTORS) * TAR_BLOCK_SIZE;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_TAR_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_TAR_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_TAR_ENABLED
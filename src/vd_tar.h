@@ -0,0 +1,37 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// ALL.TAR, every other file of the root directory in one archive
+//
+// A host collects a complete diagnostic bundle with one sequential
+// read, instead of a directory lookup and a read pass per file.
+// The archive is a POSIX ustar file whose 512-byte headers and padded
+// payloads line up with the sectors: each file has a header sector,
+// then its data sectors, the tail of the last one zeroed; two zero
+// sectors end the archive.
+//
+// Nothing is stored but a table of the files, with the sector each
+// one starts at, listed by an idle job, up to PICOVD_TAR_FILES_MAX
+// files or PICOVD_TAR_LENGTH_CLUSTERS.  ALL.TAR is left out of the
+// directory until the files are listed, and if the host was shown the
+// directory without it, the directory is changed then.  A read of the archive finds
+// its file by binary search over the table, and either renders the
+// header or delegates to the file's own sectors, through the region
+// table.  Names longer than the 100 characters of a ustar name are
+// cut short.
+// ---------------------------------------------------------------
+
+#if PICOVD_TAR_ENABLED
+
+// Serve ALL.TAR
+extern void vd_tar_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Describe ALL.TAR
+extern bool vd_tar_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+#endif // PICOVD_TAR_ENABLED
@@ -0,0 +1,161 @@
+/**
+ * @file src/vd_text.c
+ * @brief Seekable generated text: measured once per content generation, rendered from checkpoints.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_idle.h"
+#include "vd_text.h"
+
+#define TEXT_INTERVAL_SHIFT_MIN  EXFAT_BYTES_PER_SECTOR_SHIFT // A checkpoint per sector at best
+#define TEXT_MEASURE_CHUNKS      16u                          // Per idle step
+
+_Static_assert(VD_TEXT_CHUNK_MAX < (1u << TEXT_INTERVAL_SHIFT_MIN), "A chunk must not span two checkpoints");
+
+static uint32_t        text_generation = 1; ///< Of the contents; 0 is never measured
+static vd_text_file_t *text_files;          ///< The files used so far, measured again in idle time
+
+// ---------------------------------------------------------------------------
+// Measuring, as an idle job
+// ---------------------------------------------------------------------------
+
+static void text_measure_begin(vd_text_file_t *f) {
+    f->measured         = false;
+    f->cursor_valid     = false;
+    f->generation       = text_generation;
+    f->length           = 0;
+    f->interval_shift   = TEXT_INTERVAL_SHIFT_MIN;
+    f->checkpoints_used = 0;
+    f->state            = (vd_text_state_t){ 0 };
+}
+
+// Twice the interval, keeping every other checkpoint
+static void text_thin(vd_text_file_t *f) {
+    for (uint32_t i = 1; 2u * i < f->checkpoints_used; i++) {
+        f->checkpoints[i] = f->checkpoints[2u * i];
+    }
+    f->checkpoints_used = (f->checkpoints_used + 1u) / 2u;
+    f->interval_shift++;
+}
+
+// Measure a few chunks more; true once measured
+static bool text_measure_step(vd_text_file_t *f) {
+    if (f->generation != text_generation) {
+        text_measure_begin(f);
+    }
+    if (f->measured) {
+        return true;
+    }
+    char chunk[VD_TEXT_CHUNK_MAX + 1];
+    for (uint32_t i = 0; i < TEXT_MEASURE_CHUNKS; i++) {
+        // A checkpoint at the first chunk of each interval
+        if (f->length >= (f->checkpoints_used << f->interval_shift)) {
+            if (f->checkpoints_used == f->checkpoint_count) {
+                text_thin(f);
+            }
+            if (f->length >= (f->checkpoints_used << f->interval_shift)) {
+                f->checkpoints[f->checkpoints_used++] = (vd_text_checkpoint_t){ f->length, f->state };
+            }
+        }
+        const uint32_t len = f->generate(&f->state, chunk);
+        if (len == 0) {
+            __compiler_memory_barrier();
+            f->measured = true;
+            return true;
+        }
+        f->length += len < VD_TEXT_CHUNK_MAX ? len : VD_TEXT_CHUNK_MAX;
+    }
+    return false;
+}
+
+void vd_text_job_reset(void) {
+    text_generation++;
+}
+
+bool vd_text_job_step(void) {
+    for (vd_text_file_t *f = text_files; f != NULL; f = f->next) {
+        if (!text_measure_step(f)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t vd_text_length(vd_text_file_t *f) {
+    if (!f->listed) {
+        f->next    = text_files;
+        f->listed  = true;
+        text_files = f;
+    }
+    // Finish the measurement if the host came first
+    while (!text_measure_step(f)) {
+        ;
+    }
+    return f->length;
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------------
+
+// Start the cursor at the last checkpoint at or before `at`
+static void text_seek(vd_text_file_t *f, uint32_t at) {
+    uint32_t k = at >> f->interval_shift;
+    if (k >= f->checkpoints_used) {
+        k = f->checkpoints_used - 1u;
+    }
+    while (f->checkpoints[k].offset > at) {
+        k--; // The interval's first chunk starts past its boundary
+    }
+    f->cursor_end   = k + 1u < f->checkpoints_used ? f->checkpoints[k + 1u].offset : f->length;
+    f->cursor_state = f->checkpoints[k].state;
+    f->cursor_ended = false;
+    f->chunk_offset = f->checkpoints[k].offset;
+    f->chunk_length = 0;
+    f->cursor_valid = true;
+}
+
+// Render the chunk after the current one, fitted to the measured interval
+static void text_advance(vd_text_file_t *f) {
+    f->chunk_offset += f->chunk_length;
+    const uint32_t room = f->cursor_end - f->chunk_offset;
+    uint32_t len = f->cursor_ended ? 0 : f->generate(&f->cursor_state, f->chunk);
+    if (len == 0) {
+        // The text has come out shorter than measured
+        f->cursor_ended = true;
+        len = room < VD_TEXT_CHUNK_MAX ? room : VD_TEXT_CHUNK_MAX;
+        memset(f->chunk, ' ', len);
+    }
+    if (len > VD_TEXT_CHUNK_MAX) {
+        len = VD_TEXT_CHUNK_MAX;
+    }
+    f->chunk_length = len < room ? len : room;
+}
+
+void vd_text_read(vd_text_file_t *f, uint32_t pos, void *buffer, uint32_t bufsize) {
+    const uint32_t length = vd_text_length(f);
+    uint8_t       *buf    = buffer;
+    uint32_t       done   = 0;
+
+    while (done < bufsize && pos + done < length) {
+        const uint32_t at = pos + done;
+        if (!f->cursor_valid || at < f->chunk_offset || at >= f->cursor_end) {
+            text_seek(f, at);
+        }
+        while (at >= f->chunk_offset + f->chunk_length) {
+            text_advance(f);
+        }
+        const uint32_t from  = at - f->chunk_offset;
+        const uint32_t count = f->chunk_length - from < bufsize - done ? f->chunk_length - from : bufsize - done;
+        memcpy(buf + done, f->chunk + from, count);
+        done += count;
+    }
+    memset(buf + done, 0, bufsize - done);
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// ---------------------------------------------------------------
+// Seekable text for generated files: status pages, tables, CSVs
+//
+// A file's text comes from a generator, called over and over from a
+// small state to render one chunk at a time, such as a line or a row,
+// and to advance the state past it.  The engine measures the text once
+// per content generation, that is, until the next
+// vd_virtual_disk_contents_changed(), and keeps a checkpoint, the byte
+// offset and the generator state, about every sector:
+//
+//     offset 0      512+      1024+     ...      length
+//            |  cp 0  |  cp 1   |  cp 2   | ...     |
+//
+// A read at any offset renders from the nearest checkpoint before it,
+// so that the last page of a long report costs about the same as the
+// first, and consecutive reads go on from the chunk the last one ended
+// in.  When there are more intervals than checkpoints, the interval
+// doubles, and every other checkpoint goes.
+//
+// The file length is fixed by the measurement: the text may change
+// between reads, e.g. with a clock, but each interval between two
+// checkpoints is served at its measured length, cut short or padded
+// with spaces, so that the bytes stay where the directory entry and
+// the other intervals expect them.  Generators whose chunks keep their
+// width, with fixed-width fields, are never cut.
+//
+// Measuring is done in idle time, for the files used once before, or
+// when the host reads the directory or the file first.
+// ---------------------------------------------------------------
+
+// Chunks are at most this long
+#define VD_TEXT_CHUNK_MAX 128u
+
+// Where a generator is in its text; starts as all zeros
+typedef struct {
+    uint32_t item; ///< E.g. a line, or a row of a table
+    uint32_t part; ///< E.g. a column, or a line within the item
+} vd_text_state_t;
+
+// Render the chunk at `*state` into `out`, which has room for
+// VD_TEXT_CHUNK_MAX bytes and a NUL, and advance `*state` past it.
+// Returns the length of the chunk, and 0 at the end of the text.
+typedef uint32_t (*vd_text_generate_fn_t)(vd_text_state_t *state, char *out);
+
+typedef struct {
+    uint32_t        offset; ///< Of the first chunk at or after the interval start
+    vd_text_state_t state;  ///< Rendering that chunk
+} vd_text_checkpoint_t;
+
+// A generated text file; declare with VD_TEXT_FILE(), the rest is the engine's
+typedef struct vd_text_file {
+    vd_text_generate_fn_t  generate;
+    vd_text_checkpoint_t  *checkpoints;
+    uint32_t               checkpoint_count;
+    struct vd_text_file   *next;            ///< Files measured in idle time
+    bool                   listed;          ///< Among them
+
+    // Measurement, for the content generation `generation`
+    uint32_t        generation;
+    bool            measured;       ///< Published last
+    uint32_t        length;
+    uint32_t        interval_shift; ///< Checkpoint i is at or after i << interval_shift
+    uint32_t        checkpoints_used;
+    vd_text_state_t state;          ///< Measuring: the state at `length`
+
+    // The chunk last served, within the interval of a checkpoint
+    bool            cursor_valid;
+    bool            cursor_ended;   ///< The generator ended within the interval
+    uint32_t        cursor_end;     ///< Measured end of the interval
+    vd_text_state_t cursor_state;   ///< After the chunk
+    uint32_t        chunk_offset;
+    uint32_t        chunk_length;
+    char            chunk[VD_TEXT_CHUNK_MAX + 1];
+} vd_text_file_t;
+
+// Declare the text file `name`, rendered by `generate_fn`, with `count`
+// checkpoints.  A file of N sectors needs N checkpoints for one per
+// sector; with fewer, each read renders more.
+#define VD_TEXT_FILE(name, generate_fn, count)                         \
+    _Static_assert((count) >= 2, "A text file needs two checkpoints"); \
+    static vd_text_checkpoint_t name##_checkpoints[count];             \
+    static vd_text_file_t name = {                                     \
+        .generate         = (generate_fn),                             \
+        .checkpoints      = name##_checkpoints,                        \
+        .checkpoint_count = (count),                                   \
+    }
+
+// The length of the text, measuring it first if not done yet
+extern uint32_t vd_text_length(vd_text_file_t *file);
+
+// `bufsize` bytes of the text from `pos`, as zeros past its end
+extern void vd_text_read(vd_text_file_t *file, uint32_t pos, void *buffer, uint32_t bufsize);
@@ -0,0 +1,142 @@
+/**
+ * @file src/vd_trace.c
+ * @brief SCSI command trace ring, served as TRACE.BIN.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#include <pico/time.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_exfat_dirs.h"
+#include "vd_trace.h"
+
+#if PICOVD_TRACE_ENABLED
+
+#define TRACE_MASK            (PICOVD_TRACE_RECORDS - 1u)
+#define TRACE_HEADER_SIZE     EXFAT_BYTES_PER_SECTOR
+#define TRACE_FILE_SIZE_BYTES (TRACE_HEADER_SIZE + PICOVD_TRACE_RECORDS * sizeof(vd_trace_record_t))
+#define TRACE_FILE_SECTORS    (TRACE_FILE_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR)
+
+_Static_assert(TRACE_FILE_SIZE_BYTES % EXFAT_BYTES_PER_SECTOR == 0, "TRACE.BIN must be whole sectors");
+_Static_assert(TRACE_FILE_SIZE_BYTES <= PICOVD_TRACE_FILE_SIZE_BYTES, "TRACE.BIN does not fit its region");
+
+static vd_trace_record_t vd_trace_ring[PICOVD_TRACE_RECORDS];
+static uint32_t          vd_trace_count;   ///< Records written; the next goes to count & mask
+static vd_trace_record_t *vd_trace_current; ///< Record of the command in progress, if any
+
+static inline uint32_t be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint16_t be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+void vd_trace_command(uint8_t lun, uint8_t const scsi_cmd[16]) {
+    uint32_t lba    = 0;
+    uint16_t blocks = 0;
+
+    // Transfer location and length, for the block commands; see SBC-3 §5
+    switch (scsi_cmd[0] >> 5) {
+    case 1: // 10-byte commands: READ/WRITE(10), VERIFY(10), ...
+    case 2:
+        lba    = be32(scsi_cmd + 2);
+        blocks = be16(scsi_cmd + 7);
+        break;
+    case 4: // 16-byte commands: low 32 bits of the 64-bit LBA
+        lba    = be32(scsi_cmd + 6);
+        blocks = be16(scsi_cmd + 12);
+        break;
+    case 5: // 12-byte commands
+        lba    = be32(scsi_cmd + 2);
+        blocks = be16(scsi_cmd + 8);
+        break;
+    }
+
+    // Don't record the reads of the trace itself
+    if (lun == 0 && lba - PICOVD_TRACE_START_LBA < TRACE_FILE_SECTORS && blocks) {
+        vd_trace_current = NULL;
+        return;
+    }
+
+    vd_trace_record_t *r = &vd_trace_ring[vd_trace_count++ & TRACE_MASK];
+    r->start_us  = time_us_32();
+    r->lba       = lba;
+    r->blocks    = blocks;
+    r->duration  = 0xFFFF;
+    r->opcode    = scsi_cmd[0];
+    r->sense_key = 0;
+    r->asc       = 0;
+    r->ascq      = 0;
+    vd_trace_current = r;
+}
+
+void vd_trace_sense(uint8_t sense_key, uint8_t asc, uint8_t ascq) {
+    vd_trace_record_t *r = vd_trace_current;
+    if (r) {
+        r->sense_key = sense_key;
+        r->asc       = asc;
+        r->ascq      = ascq;
+    }
+}
+
+void vd_trace_complete(void) {
+    vd_trace_record_t *r = vd_trace_current;
+    if (r) {
+        const uint32_t duration = time_us_32() - r->start_us;
+        r->duration = duration < 0xFFFFu ? (uint16_t)duration : 0xFFFFu;
+        vd_trace_current = NULL;
+    }
+}
+
+void vd_trace_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_TRACE_START_LBA);
+    const uint32_t sector = lba - PICOVD_TRACE_START_LBA;
+
+    if (sector == 0) {
+        const vd_trace_header_t header = {
+            .magic       = { 'P', 'V', 'D', 'T', 'R', 'A', 'C', 'E' },
+            .version     = VD_TRACE_VERSION,
+            .header_size = TRACE_HEADER_SIZE,
+            .record_size = sizeof(vd_trace_record_t),
+            .capacity    = PICOVD_TRACE_RECORDS,
+            .count       = vd_trace_count,
+            .now_us      = time_us_32(),
+        };
+        memset(buffer, 0, bufsize);
+        if (offset < sizeof(header)) {
+            const uint32_t n = sizeof(header) - offset;
+            memcpy(buffer, (const uint8_t *)&header + offset, n < bufsize ? n : bufsize);
+        }
+    } else if (sector < TRACE_FILE_SECTORS) {
+        const uint32_t pos = ((sector - 1) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset;
+        memcpy(buffer, (const uint8_t *)vd_trace_ring + pos, bufsize);
+    } else {
+        memset(buffer, 0, bufsize);
+    }
+}
+
+bool vd_trace_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    if (file_idx != 0) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_TRACE_FILE_NAME;
+
+    desc->first_cluster = PICOVD_TRACE_START_CLUSTER;
+    desc->data_length   = TRACE_FILE_SIZE_BYTES;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_TRACE_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_TRACE_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+
+#endif // PICOVD_TRACE_ENABLED
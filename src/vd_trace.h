@@ -0,0 +1,75 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+
+// ---------------------------------------------------------------
+// SCSI command trace, exported as TRACE.BIN
+//
+// Each command block is recorded into a fixed-size ring when it
+// arrives, and its record is completed with the duration and the
+// sense data when the command completes.  The ring has a single
+// writer, the USB task, so it needs no locks; a record costs a
+// handful of stores.  Reads of TRACE.BIN itself are not recorded,
+// so that the ring stays still while the host reads it.
+//
+// TRACE.BIN layout, version 1, all little-endian:
+//   sector 0:  vd_trace_header_t, zero padded to 512 bytes
+//   sector 1-: the ring, capacity records of vd_trace_record_t;
+//              record n (counting from 0) is at slot n % capacity
+// Decode with tools/trace_decode.py.
+// ---------------------------------------------------------------
+
+#define VD_TRACE_VERSION 1u
+
+typedef struct __packed {
+    uint32_t start_us;  ///< time_us_32() when the command arrived
+    uint32_t lba;       ///< LBA, low 32 bits; 0 for commands without one
+    uint16_t blocks;    ///< Transfer length in blocks, low 16 bits
+    uint16_t duration;  ///< Microseconds to completion, saturated; 0xFFFF also if not completed
+    uint8_t  opcode;    ///< SCSI operation code
+    uint8_t  sense_key; ///< Sense set by PicoVD for this command, 0 if none
+    uint8_t  asc;       ///< Additional sense code
+    uint8_t  ascq;      ///< Additional sense code qualifier
+} vd_trace_record_t;
+_Static_assert(sizeof(vd_trace_record_t) == 16, "Trace records must be 16 bytes");
+
+typedef struct __packed {
+    char     magic[8];      ///< "PVDTRACE"
+    uint16_t version;       ///< VD_TRACE_VERSION
+    uint16_t header_size;   ///< Offset of the ring in the file
+    uint16_t record_size;   ///< sizeof(vd_trace_record_t)
+    uint16_t reserved;
+    uint32_t capacity;      ///< Records in the ring
+    uint32_t count;         ///< Records written since boot
+    uint32_t now_us;        ///< time_us_32() when the header was read
+} vd_trace_header_t;
+
+#if PICOVD_TRACE_ENABLED
+
+_Static_assert((PICOVD_TRACE_RECORDS & (PICOVD_TRACE_RECORDS - 1)) == 0, "Trace ring size must be a power of two");
+
+// Record a command block, from tud_msc_scsi_pre_cb()
+extern void vd_trace_command(uint8_t lun, uint8_t const scsi_cmd[16]);
+
+// Record the sense of the current command
+extern void vd_trace_sense(uint8_t sense_key, uint8_t asc, uint8_t ascq);
+
+// Complete the current command, from tud_msc_scsi_complete_cb()
+extern void vd_trace_complete(void);
+
+// TRACE.BIN contents and directory entry
+extern void vd_trace_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+extern bool vd_trace_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
+
+#else
+
+static inline void vd_trace_command(uint8_t lun, uint8_t const scsi_cmd[16]) { (void)lun; (void)scsi_cmd; }
+static inline void vd_trace_sense(uint8_t sense_key, uint8_t asc, uint8_t ascq) {
+    (void)sense_key; (void)asc; (void)ascq;
+}
+static inline void vd_trace_complete(void) {}
+
+#endif // PICOVD_TRACE_ENABLED
@@ -0,0 +1,248 @@
+/**
+ * @file src/vd_uf2.c
+ * @brief UF2 views of the flash and its partitions, synthesised sector by sector.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+
+#include <boot/picobin.h>
+#include <boot/uf2.h>
+#include <hardware/regs/addressmap.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_exfat.h"
+#include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_flash_map.h"
+#include "vd_uf2.h"
+
+#if PICOVD_UF2_ENABLED
+
+// Views: one per partition slot of the directory, then FLASH.BIN
+#define UF2_VIEW_PARTITIONS    (PICOVD_BOOTROM_PARTITIONS_ENABLED ? 8u : 0u)
+#define UF2_VIEW_FLASH         UF2_VIEW_PARTITIONS
+#define UF2_VIEW_COUNT         (UF2_VIEW_PARTITIONS + (PICOVD_FLASH_ENABLED ? 1u : 0u))
+
+#define UF2_HEADER_SIZE        offsetof(struct uf2_block, data)
+#define UF2_MAGIC_END_OFFSET   offsetof(struct uf2_block, magic_end)
+
+_Static_assert(UF2_VIEW_COUNT > 0, "UF2 views need the partition files or FLASH.BIN");
+_Static_assert(sizeof(struct uf2_block) == EXFAT_BYTES_PER_SECTOR, "A UF2 block is a sector");
+_Static_assert(VD_UF2_BLOCKS_PER_PAGE == 2u * EXFAT_SECTORS_PER_CLUSTER, "Two clusters per flash page");
+#if PICOVD_LZ4_ENABLED
+_Static_assert(PICOVD_UF2_START_CLUSTER + VD_UF2_LENGTH_CLUSTERS <= PICOVD_LZ4_START_CLUSTER, "UF2 views overlap the LZ4 views");
+#endif
+
+typedef struct {
+    uint32_t first_page;  ///< Source, in flash pages
+    uint32_t blocks;      ///< 0 if there is no view
+    uint32_t family_id;
+    uint32_t target_addr; ///< Of the first block
+} uf2_view_t;
+
+static uf2_view_t uf2_views[UF2_VIEW_COUNT];
+static uint32_t   uf2_views_known;  ///< Bit set: the view is published
+static uint32_t   uf2_views_missed; ///< Bit set: the view was left out before it was published
+static uint32_t   uf2_job_view;     ///< Next view to locate
+
+#if PICOVD_BOOTROM_PARTITIONS_ENABLED
+// The family of a partition's image: the first of the default families it accepts
+static uint32_t uf2_partition_family(uint32_t flags) {
+    if (flags & PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_S_BITS) {
+        return RP2350_ARM_S_FAMILY_ID;
+    } else if (flags & PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_RISCV_BITS) {
+        return RP2350_RISCV_FAMILY_ID;
+    } else if (flags & PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_NS_BITS) {
+        return RP2350_ARM_NS_FAMILY_ID;
+    } else if (flags & PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_DATA_BITS) {
+        return DATA_FAMILY_ID;
+    }
+    return ABSOLUTE_FAMILY_ID; // Written where it was read from
+}
+#endif
+
+static void uf2_view_locate(uint32_t v, uf2_view_t *view) {
+    view->first_page  = 0;
+    view->blocks      = 0;
+    view->family_id   = ABSOLUTE_FAMILY_ID;
+    view->target_addr = XIP_BASE;
+#if PICOVD_FLASH_ENABLED
+    if (v == UF2_VIEW_FLASH) {
+        view->blocks = VD_FLASH_PAGES * VD_UF2_BLOCKS_PER_PAGE;
+        return;
+    }
+#endif
+#if PICOVD_BOOTROM_PARTITIONS_ENABLED
+    uint32_t first_sector, sectors, flags;
+    if (!vd_partition_location(v, &first_sector, &sectors) || !vd_partition_flags(v, &flags)
+        || first_sector >= VD_FLASH_PAGES) {
+        return;
+    }
+    if (sectors > VD_FLASH_PAGES - first_sector) {
+        sectors = VD_FLASH_PAGES - first_sector;
+    }
+    uint32_t length = sectors << VD_FLASH_PAGE_SHIFT;
+#if PICOVD_BOOTROM_PARTITIONS_TRIM
+    // The same bytes as the partition file, in whole blocks
+    const uint32_t image_length = vd_partition_image_length(v);
+    if (image_length < length) {
+        length = image_length;
+    }
+#endif
+    view->first_page = first_sector;
+    view->blocks     = (length + VD_UF2_PAYLOAD_SIZE - 1u) / VD_UF2_PAYLOAD_SIZE;
+    view->family_id  = uf2_partition_family(flags);
+    if (view->family_id == ABSOLUTE_FAMILY_ID) {
+        view->target_addr += first_sector << VD_FLASH_PAGE_SHIFT;
+    }
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Idle job: locate the views, one per step
+// ---------------------------------------------------------------------------
+
+void vd_uf2_views_job_reset(void) {
+    uf2_views_known  = 0;
+    uf2_views_missed = 0;
+    uf2_job_view     = 0;
+}
+
+bool vd_uf2_views_job_step(void) {
+    if (uf2_job_view >= UF2_VIEW_COUNT) {
+        return true;
+    }
+    uf2_view_locate(uf2_job_view, &uf2_views[uf2_job_view]);
+    __compiler_memory_barrier();
+    uf2_views_known |= 1u << uf2_job_view; // Published last
+    uf2_job_view++;
+    if (uf2_job_view < UF2_VIEW_COUNT) {
+        return false;
+    }
+    // The directory the host has seen lacks views; tell it
+    if (uf2_views_missed) {
+        uf2_views_missed = 0;
+        vd_virtual_disk_estimate_changed(vd_uf2_views_job_step);
+    }
+    return true;
+}
+
+// View `v`, or NULL if the job has not published it yet: the host came
+// first, and the view is left out until it is
+static const uf2_view_t *uf2_view(uint32_t v) {
+    if (!(uf2_views_known & (1u << v))) {
+        uf2_views_missed |= 1u << v;
+        return NULL;
+    }
+    return &uf2_views[v];
+}
+
+// First block of view `v`, relative to PICOVD_UF2_START_LBA
+static inline uint32_t uf2_view_sector(uint32_t v, const uf2_view_t *view) {
+    const uint32_t page = v == UF2_VIEW_FLASH ? VD_FLASH_PAGES : view->first_page;
+    return page * VD_UF2_BLOCKS_PER_PAGE;
+}
+
+// ---------------------------------------------------------------------------
+// Serve a block, copying the parts of it that overlap the slice
+// ---------------------------------------------------------------------------
+
+static void uf2_copy_overlap(uint8_t *buf, uint32_t offset, uint32_t len,
+                             const void *src, uint32_t at, uint32_t size) {
+    const uint32_t from = offset > at ? offset : at;
+    const uint32_t to   = offset + len < at + size ? offset + len : at + size;
+    if (from < to) {
+        memcpy(buf + (from - offset), (const uint8_t *)src + (from - at), to - from);
+    }
+}
+
+static void uf2_block_read(const uf2_view_t *view, uint32_t block, uint32_t offset, uint8_t *buf, uint32_t len) {
+    memset(buf, 0, len);
+
+    if (offset < UF2_HEADER_SIZE) {
+        const uint32_t header[UF2_HEADER_SIZE / sizeof(uint32_t)] = {
+            UF2_MAGIC_START0,
+            UF2_MAGIC_START1,
+            UF2_FLAG_FAMILY_ID_PRESENT,
+            view->target_addr + block * VD_UF2_PAYLOAD_SIZE,
+            VD_UF2_PAYLOAD_SIZE,
+            block,
+            view->blocks,
+            view->family_id,
+        };
+        uf2_copy_overlap(buf, offset, len, header, 0, UF2_HEADER_SIZE); // Little endian, like the target
+    }
+
+    // The payload, straight from flash
+    const uint32_t from = offset > UF2_HEADER_SIZE ? offset : UF2_HEADER_SIZE;
+    const uint32_t to   = offset + len < UF2_HEADER_SIZE + VD_UF2_PAYLOAD_SIZE ? offset + len : UF2_HEADER_SIZE + VD_UF2_PAYLOAD_SIZE;
+    if (from < to) {
+        const uint32_t flash_offset = (view->first_page << VD_FLASH_PAGE_SHIFT) + block * VD_UF2_PAYLOAD_SIZE;
+        vd_read_flash(flash_offset + (from - UF2_HEADER_SIZE), buf + (from - offset), to - from);
+    }
+
+    if (offset + len > UF2_MAGIC_END_OFFSET) {
+        const uint32_t magic_end = UF2_MAGIC_END;
+        uf2_copy_overlap(buf, offset, len, &magic_end, UF2_MAGIC_END_OFFSET, sizeof(magic_end));
+    }
+}
+
+void vd_uf2_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    assert(lba >= PICOVD_UF2_START_LBA);
+    assert(lba  < PICOVD_UF2_START_LBA + (VD_UF2_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT));
+    assert(offset + bufsize <= EXFAT_BYTES_PER_SECTOR);
+
+    // Each sector is a block of the view it falls in
+    const uint32_t sector = lba - PICOVD_UF2_START_LBA;
+    for (uint32_t v = 0; v < UF2_VIEW_COUNT; v++) {
+        if (!(uf2_views_known & (1u << v))) {
+            continue; // Not in the directory yet
+        }
+        const uf2_view_t *view  = &uf2_views[v];
+        const uint32_t    first = uf2_view_sector(v, view);
+        if (sector >= first && sector - first < view->blocks) {
+            uf2_block_read(view, sector - first, offset, buffer, bufsize);
+            return;
+        }
+    }
+    memset(buffer, 0, bufsize); // No file, or the rest of its last cluster
+}
+
+uint32_t vd_uf2_partition_view(uint32_t part_idx, uint32_t *first_cluster) {
+    if (part_idx >= UF2_VIEW_PARTITIONS) {
+        return 0;
+    }
+    const uf2_view_t *view = uf2_view(part_idx);
+    if (view == NULL) {
+        return 0;
+    }
+    *first_cluster = PICOVD_UF2_START_CLUSTER + VD_UF2_VIEW_CLUSTERS(view->first_page);
+    return view->blocks * EXFAT_BYTES_PER_SECTOR;
+}
+
+#if PICOVD_FLASH_ENABLED
+bool vd_uf2_describe(uint32_t slot_idx __unused, uint32_t file_idx, exfat_dir_file_desc_t *desc) {
+    const uf2_view_t *view = uf2_view(UF2_VIEW_FLASH);
+    if (file_idx != 0 || view == NULL) {
+        return false;
+    }
+    const char16_t name[] = PICOVD_UF2_FLASH_FILE_NAME;
+
+    desc->first_cluster = VD_UF2_FLASH_VIEW_CLUSTER;
+    desc->data_length   = view->blocks * EXFAT_BYTES_PER_SECTOR;
+    desc->timestamp     = 0;
+    desc->attributes    = EXFAT_FILE_ATTR_READ_ONLY;
+    desc->name_length   = PICOVD_UF2_FLASH_FILE_NAME_LEN;
+    for (size_t i = 0; i < PICOVD_UF2_FLASH_FILE_NAME_LEN; i++) {
+        desc->name[i] = (uint8_t)name[i];
+    }
+    return true;
+}
+#endif
+
+#endif // PICOVD_UF2_ENABLED
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_dirs.h"
+#include "vd_flash_map.h"
+
+// ---------------------------------------------------------------
+// UF2 views of the flash, <partition>.uf2 and FLASH.UF2
+//
+// Each view is a UF2 file of the same bytes as its source, ready to
+// be dropped onto another board in BOOTSEL mode.  A UF2 block is
+// exactly one sector carrying 256 bytes of flash, so each sector is
+// synthesised from its LBA alone: the header, the payload read
+// straight from flash, and the end magic.
+//
+// A partition view has the family of the partition, from the default
+// families it accepts, and addresses relative to the partition, as the
+// BootROM translates them into the partition it picks.  FLASH.UF2 has
+// the absolute family and addresses.  The partitions' views are located
+// by an idle job, and dropped with it on vd_virtual_disk_contents_changed().
+// A view is left out of the directory until it is located, and if the
+// host was shown the directory without it, the directory is changed then.
+// ---------------------------------------------------------------
+
+#define VD_UF2_PAYLOAD_SIZE    256u
+#define VD_UF2_BLOCKS_PER_PAGE (VD_FLASH_PAGE_SIZE / VD_UF2_PAYLOAD_SIZE)
+
+// Each view has two clusters per flash page of its source, a block per sector:
+// partition views start at the cluster of their first page, FLASH.UF2 after all of them
+#define VD_UF2_VIEW_CLUSTERS(pages) (2u * (pages))
+#define VD_UF2_FLASH_VIEW_CLUSTER   (PICOVD_UF2_START_CLUSTER + VD_UF2_VIEW_CLUSTERS(VD_FLASH_PAGES))
+#define VD_UF2_LENGTH_CLUSTERS      (2u * VD_UF2_VIEW_CLUSTERS(VD_FLASH_PAGES))
+
+// Serve the UF2 views' clusters
+extern void vd_uf2_file_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+
+// Size of the UF2 view of partition `part_idx`, 0 if none or not located yet,
+// and its first cluster
+extern uint32_t vd_uf2_partition_view(uint32_t part_idx, uint32_t *first_cluster);
+
+// Describe FLASH.UF2, for its own root directory slot, once it is located
+extern bool vd_uf2_describe(uint32_t slot_idx, uint32_t file_idx, exfat_dir_file_desc_t *desc);
@@ -0,0 +1,397 @@
+/**
+ * @file src/vd_uf2_drop.c
+ * @brief Writable UF2 drop zone: a streaming UF2 parser and flash programming pipeline.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+
+#include <boot/picobin.h>
+#include <boot/uf2.h>
+#include <hardware/regs/addressmap.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_virtual_disk.h"
+#include "vd_flash_map.h"
+#include "vd_uf2_drop.h"
+
+#if PICOVD_UF2_DROP_ENABLED
+
+#define DROP_BLOCK_SIZE       sizeof(struct uf2_block)
+#define DROP_HEADER_SIZE      offsetof(struct uf2_block, data)
+#define DROP_MAGIC_END_OFFSET offsetof(struct uf2_block, magic_end)
+#define DROP_PAYLOAD_SIZE     256u
+#define DROP_BLOCKS_PER_PAGE  (VD_FLASH_PAGE_SIZE / DROP_PAYLOAD_SIZE)
+#define DROP_PAGE_FULL        ((1u << DROP_BLOCKS_PER_PAGE) - 1u)
+#define DROP_PARTITIONS       16u // PARTITION_TABLE_MAX_PARTITIONS
+#define DROP_NO_PAGE          UINT32_MAX
+
+// RP2350-E10: UF2 files for the RP2350 start with a block of the absolute
+// family for this address, which the BootROM ignores
+#define DROP_E10_TARGET_ADDR  0x10FFFF00u
+
+_Static_assert(DROP_BLOCK_SIZE == MSC_BLOCK_SIZE, "A UF2 block is a sector");
+_Static_assert(DROP_BLOCK_SIZE % CFG_TUD_MSC_EP_BUFSIZE == 0 && CFG_TUD_MSC_EP_BUFSIZE >= DROP_HEADER_SIZE,
+               "Slices must not straddle sectors, and the first one must hold the header");
+_Static_assert(DROP_BLOCKS_PER_PAGE <= 16, "Staged blocks are kept in 16-bit masks");
+_Static_assert(PICOVD_UF2_DROP_BUFFERS >= 2, "The stream needs a staging page while another one is programmed");
+_Static_assert(PICOVD_UF2_DROP_START_CLUSTER + PICOVD_UF2_DROP_LENGTH_CLUSTERS <= PICOVD_FLASH_START_CLUSTER,
+               "The drop zone must be within the free cluster range");
+#if PICOVD_CHANGING_FILE_ENABLED
+_Static_assert(PICOVD_UF2_DROP_START_CLUSTER + PICOVD_UF2_DROP_LENGTH_CLUSTERS <= PICOVD_CHANGING_FILE_START_CLUSTER,
+               "The drop zone overlaps CHANGING.TXT");
+#endif
+
+typedef struct {
+    uint32_t page;   ///< Flash page of the data, DROP_NO_PAGE if none
+    uint16_t staged; ///< Blocks received and not programmed yet
+    uint8_t  data[VD_FLASH_PAGE_SIZE];
+} drop_buffer_t;
+
+static drop_buffer_t drop_buffers[PICOVD_UF2_DROP_BUFFERS];
+static uint32_t      drop_erased[(VD_FLASH_PAGES + 31u) / 32u]; ///< Pages erased for the file
+static uint16_t      drop_received[VD_FLASH_PAGES];             ///< Blocks of each page received for the file
+
+// The block being received
+static struct {
+    drop_buffer_t *buffer;    ///< NULL if the sector is no block to program
+    uint32_t       block;     ///< Within the page
+    uint32_t       magic_end;
+} drop_rx;
+
+// The file being received, told apart by its family and number of blocks
+static struct {
+    bool     active;
+    bool     targeted;    ///< There is somewhere to write its blocks
+    bool     erase_ahead; ///< Pages may be erased before their blocks come, up to `end`
+    uint32_t family_id;
+    uint32_t num_blocks;
+    uint32_t blocks;      ///< Received so far, each once
+    uint32_t base;        ///< Flash offset of the blocks' XIP_BASE
+    uint32_t size;        ///< Bytes the blocks may write from `base` on
+    uint32_t end;         ///< Flash offset past the file, if its blocks are contiguous
+    uint32_t last_page;   ///< Page of the last block staged
+} drop_file;
+
+static vd_uf2_drop_counters_t drop_counters;
+
+static inline bool drop_page_erased(uint32_t page) {
+    return drop_erased[page / 32u] & (1u << (page % 32u));
+}
+
+static bool drop_pipeline_idle(void) {
+    for (uint32_t i = 0; i < PICOVD_UF2_DROP_BUFFERS; i++) {
+        if (drop_buffers[i].staged) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Where the blocks of a file go
+// ---------------------------------------------------------------------------
+
+static uint32_t drop_family_accepts(uint32_t family_id) {
+    switch (family_id) {
+    case RP2040_FAMILY_ID:        return PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2040_BITS;
+    case DATA_FAMILY_ID:          return PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_DATA_BITS;
+    case RP2350_ARM_S_FAMILY_ID:  return PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_S_BITS;
+    case RP2350_RISCV_FAMILY_ID:  return PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_RISCV_BITS;
+    case RP2350_ARM_NS_FAMILY_ID: return PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_NS_BITS;
+    default:                      return 0; // E.g. a family of the partition table's own
+    }
+}
+
+// The absolute family, and any family without a partition table, at the
+// blocks' address; else the first partition that accepts the family and
+// does not hold the running binary.  False if there is no such partition.
+static bool drop_file_target(uint32_t family_id) {
+    drop_file.base        = 0;
+    drop_file.size        = PICOVD_FLASH_SIZE_BYTES;
+    drop_file.erase_ahead = false;
+    if (family_id == ABSOLUTE_FAMILY_ID) {
+        return true;
+    }
+    const uint32_t accepts = drop_family_accepts(family_id);
+    if (accepts == 0) {
+        return false;
+    }
+    uint32_t p;
+    for (p = 0; p < DROP_PARTITIONS; p++) {
+        uint32_t first_sector, sectors, flags;
+        if (!vd_partition_location(p, &first_sector, &sectors) || !vd_partition_flags(p, &flags)) {
+            break;
+        }
+        if (!(flags & accepts) || first_sector >= VD_FLASH_PAGES || sectors == 0) {
+            continue;
+        }
+        if (sectors > VD_FLASH_PAGES - first_sector) {
+            sectors = VD_FLASH_PAGES - first_sector;
+        }
+        if (vd_flash_is_writable(first_sector << VD_FLASH_PAGE_SHIFT, sectors << VD_FLASH_PAGE_SHIFT)) {
+            drop_file.base        = first_sector << VD_FLASH_PAGE_SHIFT;
+            drop_file.size        = sectors << VD_FLASH_PAGE_SHIFT;
+            drop_file.erase_ahead = true; // The whole partition is the new image's
+            return true;
+        }
+    }
+    return p == 0;
+}
+
+static void drop_file_start(uint32_t family_id, uint32_t num_blocks) {
+    memset(drop_erased, 0, sizeof(drop_erased));
+    memset(drop_received, 0, sizeof(drop_received));
+    drop_file.active     = true;
+    drop_file.family_id  = family_id;
+    drop_file.num_blocks = num_blocks;
+    drop_file.blocks     = 0;
+    drop_file.end        = 0;
+    drop_file.last_page  = DROP_NO_PAGE;
+    drop_file.targeted   = drop_file_target(family_id);
+}
+
+// ---------------------------------------------------------------------------
+// Stream parser, fed by tud_msc_write10_cb() in 64-byte slices
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    DROP_ACCEPT, // Stage the block
+    DROP_IGNORE, // Not a block to program, skip the sector
+} drop_verdict_t;
+
+static bool drop_step(bool flush);
+
+// The staging page of `page`, or else one with nothing staged
+static drop_buffer_t *drop_buffer_for(uint32_t page) {
+    drop_buffer_t *spare = NULL;
+    for (uint32_t i = 0; i < PICOVD_UF2_DROP_BUFFERS; i++) {
+        drop_buffer_t *b = &drop_buffers[i];
+        if (b->page == page) {
+            return b;
+        }
+        if (spare == NULL && b->staged == 0) {
+            spare = b;
+        }
+    }
+    return spare;
+}
+
+static drop_verdict_t drop_block_start(const uint8_t *header) {
+    enum { MAGIC0, MAGIC1, FLAGS, TARGET_ADDR, PAYLOAD_SIZE, BLOCK_NO, NUM_BLOCKS, FAMILY_ID };
+    uint32_t h[DROP_HEADER_SIZE / sizeof(uint32_t)];
+    memcpy(h, header, sizeof(h)); // Little endian, like the target; the slice need not be aligned
+
+    if (h[MAGIC0] != UF2_MAGIC_START0 || h[MAGIC1] != UF2_MAGIC_START1 || (h[FLAGS] & UF2_FLAG_NOT_MAIN_FLASH)
+        || h[PAYLOAD_SIZE] != DROP_PAYLOAD_SIZE || h[TARGET_ADDR] % DROP_PAYLOAD_SIZE != 0
+        || h[TARGET_ADDR] < XIP_BASE || h[BLOCK_NO] >= h[NUM_BLOCKS]) {
+        return DROP_IGNORE;
+    }
+    const uint32_t family_id = (h[FLAGS] & UF2_FLAG_FAMILY_ID_PRESENT) ? h[FAMILY_ID] : ABSOLUTE_FAMILY_ID;
+    if (family_id == ABSOLUTE_FAMILY_ID && h[TARGET_ADDR] == DROP_E10_TARGET_ADDR) {
+        return DROP_IGNORE;
+    }
+
+    // A new file starts once the previous one is programmed
+    if (!drop_file.active || family_id != drop_file.family_id || h[NUM_BLOCKS] != drop_file.num_blocks) {
+        if (!drop_pipeline_idle()) {
+            drop_counters.busy++;
+            while (drop_step(true)) {
+            }
+        }
+        drop_file_start(family_id, h[NUM_BLOCKS]);
+    }
+    const uint32_t rel = h[TARGET_ADDR] - XIP_BASE;
+    if (!drop_file.targeted || rel >= drop_file.size) {
+        return DROP_IGNORE;
+    }
+    const uint32_t flash_offset = drop_file.base + rel;
+    const uint32_t page         = flash_offset >> VD_FLASH_PAGE_SHIFT;
+    if (!vd_flash_is_writable(page << VD_FLASH_PAGE_SHIFT, VD_FLASH_PAGE_SIZE)) {
+        return DROP_IGNORE; // The page is erased as a whole
+    }
+
+    const uint32_t block = (flash_offset % VD_FLASH_PAGE_SIZE) / DROP_PAYLOAD_SIZE;
+    if (drop_received[page] & (1u << block)) {
+        return DROP_IGNORE; // Sent again, staged or programmed already
+    }
+    // With all staging pages taken, program one in the callback: a slice
+    // left unconsumed comes straight back within the same tud_task()
+    drop_buffer_t *buffer = drop_buffer_for(page);
+    if (buffer == NULL) {
+        drop_counters.busy++;
+        while ((buffer = drop_buffer_for(page)) == NULL && drop_step(true)) {
+        }
+        assert(buffer != NULL);
+    }
+    if (drop_file.end == 0) {
+        drop_file.end = flash_offset + (h[NUM_BLOCKS] - h[BLOCK_NO]) * DROP_PAYLOAD_SIZE;
+    }
+    buffer->page      = page;
+    drop_rx.buffer    = buffer;
+    drop_rx.block     = block;
+    drop_rx.magic_end = 0;
+    return DROP_ACCEPT;
+}
+
+// Copy the part of the slice at `offset` that overlaps the field at `at`, `size` bytes, to `dst`
+static void drop_copy_overlap(void *dst, uint32_t at, uint32_t size,
+                              const uint8_t *in, uint32_t offset, uint32_t len) {
+    const uint32_t from = offset > at ? offset : at;
+    const uint32_t to   = offset + len < at + size ? offset + len : at + size;
+    if (from < to) {
+        memcpy((uint8_t *)dst + (from - at), in + (from - offset), to - from);
+    }
+}
+
+int32_t vd_uf2_drop_write(uint32_t lba, uint32_t offset, const void *buffer, uint32_t bufsize) {
+    (void)lba; // Blocks go where their header says, wherever the host puts them
+    const uint8_t *in = (const uint8_t *)buffer;
+    assert(offset + bufsize <= DROP_BLOCK_SIZE);
+
+    if (offset == 0) {
+        drop_rx.buffer = NULL;
+        if (drop_block_start(in) == DROP_IGNORE) {
+            drop_counters.ignored++;
+        }
+    }
+    drop_buffer_t *b = drop_rx.buffer;
+    if (b == NULL) {
+        return (int32_t)bufsize;
+    }
+
+    // The payload goes straight into the staging page
+    drop_copy_overlap(b->data + drop_rx.block * DROP_PAYLOAD_SIZE, DROP_HEADER_SIZE, DROP_PAYLOAD_SIZE,
+                      in, offset, bufsize);
+    drop_copy_overlap(&drop_rx.magic_end, DROP_MAGIC_END_OFFSET, sizeof(drop_rx.magic_end),
+                      in, offset, bufsize);
+
+    if (offset + bufsize == DROP_BLOCK_SIZE) {
+        if (drop_rx.magic_end == UF2_MAGIC_END) {
+            b->staged |= 1u << drop_rx.block;
+            drop_received[b->page] |= 1u << drop_rx.block;
+            drop_file.blocks++; // Once, as blocks received are ignored when sent again
+            drop_file.last_page = b->page;
+            drop_counters.blocks++;
+        } else {
+            drop_counters.ignored++;
+        }
+        drop_rx.buffer = NULL;
+    }
+    return (int32_t)bufsize;
+}
+
+// ---------------------------------------------------------------------------
+// Flash programming pipeline, one operation per step
+// ---------------------------------------------------------------------------
+
+static bool drop_erase(uint32_t page) {
+    const uint32_t flash_offset = page << VD_FLASH_PAGE_SHIFT;
+    const bool ok = vd_flash_erase(flash_offset, VD_FLASH_PAGE_SIZE);
+    vd_flash_map_invalidate(flash_offset, VD_FLASH_PAGE_SIZE);
+    if (ok) {
+        drop_erased[page / 32u] |= 1u << (page % 32u);
+        drop_counters.erases++;
+    }
+    return ok;
+}
+
+// The staging page to program: a complete one, one the stream has left,
+// or with no staging page to spare, the one the stream is filling
+static drop_buffer_t *drop_ready(bool flush) {
+    drop_buffer_t *filling = NULL;
+    bool           spare   = false;
+    for (uint32_t i = 0; i < PICOVD_UF2_DROP_BUFFERS; i++) {
+        drop_buffer_t *b = &drop_buffers[i];
+        if (b->staged == 0) {
+            spare |= b != drop_rx.buffer;
+        } else if (flush || b->staged == DROP_PAGE_FULL || b->page != drop_file.last_page) {
+            return b;
+        } else {
+            filling = b;
+        }
+    }
+    return spare ? NULL : filling;
+}
+
+// Program the first run of staged blocks of `b`, erasing the page first
+static void drop_program(drop_buffer_t *b) {
+    if (!drop_page_erased(b->page)) {
+        if (!drop_erase(b->page)) {
+            drop_counters.ignored += (uint32_t)__builtin_popcount(b->staged);
+            b->staged = 0;
+        }
+        return;
+    }
+    const uint32_t first = (uint32_t)__builtin_ctz(b->staged);
+    uint32_t       n     = 1;
+    while (first + n < DROP_BLOCKS_PER_PAGE && (b->staged & (1u << (first + n)))) {
+        n++;
+    }
+    const uint32_t flash_offset = (b->page << VD_FLASH_PAGE_SHIFT) + first * DROP_PAYLOAD_SIZE;
+    if (vd_flash_program(flash_offset, b->data + first * DROP_PAYLOAD_SIZE, n * DROP_PAYLOAD_SIZE)) {
+        drop_counters.programs++;
+        drop_counters.programmed += n;
+    }
+    vd_flash_map_invalidate(flash_offset, n * DROP_PAYLOAD_SIZE);
+    b->staged &= (uint16_t)~(((1u << n) - 1u) << first);
+}
+
+// Erase the page after the last one staged, if the file reaches it
+static bool drop_erase_ahead(void) {
+    if (!drop_file.active || !drop_file.erase_ahead || drop_file.last_page == DROP_NO_PAGE
+        || drop_file.blocks >= drop_file.num_blocks) {
+        return false;
+    }
+    const uint32_t next = drop_file.last_page + 1u;
+    if ((next << VD_FLASH_PAGE_SHIFT) >= drop_file.end
+        || (next << VD_FLASH_PAGE_SHIFT) >= drop_file.base + drop_file.size || drop_page_erased(next)) {
+        return false;
+    }
+    drop_erase(next);
+    return true;
+}
+
+// Once all blocks of the file are programmed, tell the host
+static void drop_file_finish(void) {
+    if (!drop_file.active || drop_file.blocks < drop_file.num_blocks
+        || drop_rx.buffer != NULL || !drop_pipeline_idle()) {
+        return;
+    }
+    drop_file.active = false;
+    drop_counters.files++;
+    vd_virtual_disk_contents_changed(false);
+}
+
+// Do one flash operation, if one is due; false if there was none
+static bool drop_step(bool flush) {
+    drop_buffer_t *b = drop_ready(flush);
+    if (b != NULL) {
+        drop_program(b);
+        return true;
+    }
+    if (!flush && drop_erase_ahead()) {
+        return true;
+    }
+    drop_file_finish();
+    return false;
+}
+
+void vd_uf2_drop_task(void) {
+    drop_step(false);
+}
+
+void vd_uf2_drop_flush(void) {
+    while (drop_step(true)) {
+    }
+}
+
+const vd_uf2_drop_counters_t *vd_uf2_drop_counters(void) {
+    return &drop_counters;
+}
+
+#endif // PICOVD_UF2_DROP_ENABLED
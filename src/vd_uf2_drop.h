@@ -0,0 +1,55 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+
+// ---------------------------------------------------------------
+// Writable UF2 drop zone
+//
+// The allocation bitmap leaves PICOVD_UF2_DROP_LENGTH_CLUSTERS free, so
+// that the host can copy a .uf2 file onto the volume.  Every sector the
+// host writes is parsed as a UF2 block while it streams in, wherever it
+// lands: the host's bitmap, FAT and directory writes are no UF2 blocks
+// and are dropped, and nothing waits for them.
+//
+// The write callback only copies a block's payload into a 4 kB staging
+// page in SRAM, so the bulk OUT endpoint keeps flowing until all staging
+// pages are taken; then it programs one before it takes the slice, as a
+// slice left unconsumed would come straight back.  vd_uf2_drop_task() does at most one flash operation
+// per call: it programs the staged 256-byte blocks of a page in one batch,
+// once the page is complete or the stream has moved on, erasing the page
+// first if needed; with nothing to program, it erases the page the stream
+// reaches next, so that its blocks can be programmed as soon as they are in.
+//
+// Blocks of the absolute family are written at their address.  Those of
+// the other families go into the first partition that accepts the family
+// and does not hold the running binary, at their address relative to
+// XIP_BASE, as in the UF2 views of vd_uf2.h; without a partition table,
+// at their address.  A block sent again within a file, e.g. when the host
+// retries a write, is ignored, so that each block counts once towards the
+// file's number of blocks.  Once all blocks of the file are programmed, the
+// contents have changed, see vd_virtual_disk_contents_changed().
+// ---------------------------------------------------------------
+
+typedef struct {
+    uint32_t blocks;     ///< UF2 blocks staged
+    uint32_t ignored;    ///< Written sectors that were no blocks to program
+    uint32_t erases;     ///< 4 kB pages erased
+    uint32_t programs;   ///< Program operations, each a run of blocks of a page
+    uint32_t programmed; ///< Blocks programmed
+    uint32_t busy;       ///< Blocks that waited in the callback for a staging page
+    uint32_t files;      ///< Files completed
+} vd_uf2_drop_counters_t;
+
+// Consume a slice of a written sector, as tud_msc_write10_cb(): returns the
+// bytes consumed, always the whole slice
+extern int32_t vd_uf2_drop_write(uint32_t lba, uint32_t offset, const void *buffer, uint32_t bufsize);
+
+// Call regularly from the main loop, right after tud_task()
+extern void vd_uf2_drop_task(void);
+
+// Program everything staged, e.g. on SYNCHRONIZE CACHE
+extern void vd_uf2_drop_flush(void);
+
+extern const vd_uf2_drop_counters_t *vd_uf2_drop_counters(void);
@@ -0,0 +1,79 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <picovd_config.h>
+#include "vd_stats.h"
+
+// ---------------------------------------------------------------
+// SCSI command dispatch, in vd_usb_msc_cb.c
+//
+// tud_msc_scsi_pre_cb() looks up each command block in a constant
+// opcode table and calls the handler of its entry.  A handler returns
+// the length of its response in `buffer`, TUD_MSC_RET_ERROR after
+// setting the sense data, or TUD_MSC_RET_CALL_DEFAULT to let TinyUSB's
+// built-in handling run, e.g. for the READ(10) data stage.
+// Opcodes missing from the table are rejected as ILLEGAL REQUEST.
+// ---------------------------------------------------------------
+
+typedef int32_t (*vd_msc_handler_t)(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize);
+
+typedef struct {
+    uint8_t          opcode;
+    uint8_t          flags;   ///< VD_MSC_CMD_*
+    vd_msc_handler_t handler;
+    const char      *name;    ///< Short name, for STATS.TXT
+} vd_msc_command_t;
+
+// Fail with NOT READY while the disk is becoming ready
+#define VD_MSC_CMD_NEEDS_READY  0x01u
+// Report a pending UNIT ATTENTION, medium may have changed
+#define VD_MSC_CMD_ATTENTION    0x02u
+
+// Upper bound of the table entries, plus one for the unknown opcodes
+#define VD_MSC_COMMANDS_MAX     32u
+
+// Per-opcode counts and latencies, from the command block to the status,
+// with the entry past the table counting the unknown opcodes.
+// Returns the name of entry `i`, or NULL past the end.
+extern const char *vd_msc_command_stats(uint32_t i, const vd_stats_latency_t **stats);
+
+// ---------------------------------------------------------------
+// Logical units, in vd_usb_msc_cb.c
+//
+// LUN 0 is the exFAT volume.  With PICOVD_MSC_FLASH_LUN_ENABLED, the
+// next LUN is the whole flash, and with PICOVD_MSC_PARTITION_LUNS, the
+// LUNs after it are the BootROM partitions, as raw block devices.
+// Each LUN has a context with its operations and its medium state;
+// the commands are dispatched through the context of the addressed LUN.
+// ---------------------------------------------------------------
+
+typedef struct vd_msc_lun vd_msc_lun_t;
+
+typedef struct {
+    const char *product_id;  ///< INQUIRY product identification, up to 16 characters
+    // Read part of block `lba`, as tud_msc_read10_cb()
+    int32_t  (*read)(const vd_msc_lun_t *lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize);
+    // Locate the medium: set `base` and `blocks`, the latter 0 if there is none
+    void     (*locate)(vd_msc_lun_t *lun);
+    // Number of blocks from `lba` on with the same provisioning status;
+    // NULL if the medium is fully provisioned
+    uint32_t (*lba_status)(const vd_msc_lun_t *lun, uint32_t lba, bool *deallocated);
+} vd_msc_lun_ops_t;
+
+struct vd_msc_lun {
+    const vd_msc_lun_ops_t *ops;
+    bool     located;    ///< `base` and `blocks` are valid
+    bool     attention;  ///< UNIT ATTENTION pending, medium may have changed
+    uint32_t base;       ///< Flash offset of a raw LUN
+    uint32_t blocks;     ///< Capacity in blocks, 0 without a medium
+};
+
+#define VD_MSC_LUN_EXFAT           0u
+#define VD_MSC_LUN_FLASH           1u // With PICOVD_MSC_FLASH_LUN_ENABLED
+#define VD_MSC_LUN_FIRST_PARTITION (1u + PICOVD_MSC_FLASH_LUN_ENABLED)
+#define VD_MSC_LUN_COUNT           (VD_MSC_LUN_FIRST_PARTITION + PICOVD_MSC_PARTITION_LUNS)
+
+_Static_assert(VD_MSC_LUN_COUNT <= 16, "Bulk-Only Transport allows at most 16 LUNs");
+_Static_assert(PICOVD_MSC_PARTITION_LUNS == 0 || PICOVD_BOOTROM_PARTITIONS_ENABLED,
+               "Partition LUNs need the BootROM partitions");
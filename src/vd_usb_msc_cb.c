@@ -10,57 +10,156 @@
 
 #include <tusb.h>
 #include <class/msc/msc.h>
+#include <pico/unique_id.h>
 
 #include <picovd_config.h>
 #include "vd_exfat_params.h"
 #include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_trace.h"
+#include "vd_uf2_drop.h"
+#include "vd_inbox.h"
+#include "vd_usb_msc.h"
 
-// Additional Sense Code and Qualifier for Write Protected (per SPC-4 §6.7)
+// Additional Sense Codes and Qualifiers (per SPC-4 §4.5.6)
 
+#ifndef SCSI_ASC_LOGICAL_UNIT_NOT_READY
+#define SCSI_ASC_LOGICAL_UNIT_NOT_READY  0x04
+#endif
+#ifndef SCSI_ASCQ_BECOMING_READY
+#define SCSI_ASCQ_BECOMING_READY         0x01
+#endif
+#ifndef SCSI_ASC_INVALID_COMMAND_OPERATION_CODE
+#define SCSI_ASC_INVALID_COMMAND_OPERATION_CODE 0x20
+#endif
+#ifndef SCSI_ASC_LBA_OUT_OF_RANGE
+#define SCSI_ASC_LBA_OUT_OF_RANGE        0x21
+#endif
+#ifndef SCSI_ASC_INVALID_FIELD_IN_CDB
+#define SCSI_ASC_INVALID_FIELD_IN_CDB    0x24
+#endif
+#ifndef SCSI_ASC_LOGICAL_UNIT_NOT_SUPPORTED
+#define SCSI_ASC_LOGICAL_UNIT_NOT_SUPPORTED 0x25
+#endif
 #ifndef SCSI_ASC_WRITE_PROTECTED
 #define SCSI_ASC_WRITE_PROTECTED  0x27
 #endif
+#ifndef SCSI_ASCQ_WRITE_PROTECTED
+#define SCSI_ASCQ_WRITE_PROTECTED 0x00
+#endif
 #ifndef SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED
 #define SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED 0x28
 #endif
-#ifndef SCSI_ASCQ_WRITE_PROTECTED
-#define SCSI_ASCQ_WRITE_PROTECTED 0x00
+#ifndef SCSI_ASC_MEDIUM_NOT_PRESENT
+#define SCSI_ASC_MEDIUM_NOT_PRESENT      0x3A
 #endif
 
+// Operation codes not in TinyUSB's scsi_cmd_type_t (per SPC-4 and SBC-3)
+
 #ifndef SCSI_CMD_FORMAT_UNIT
 #define SCSI_CMD_FORMAT_UNIT      0x04
 #endif
+#ifndef SCSI_CMD_WRITE6
+#define SCSI_CMD_WRITE6           0x0A
+#endif
 #ifndef SCSI_CMD_BLANK
 #define SCSI_CMD_BLANK            0x19
 #endif
+#ifndef SCSI_CMD_WRITE_AND_VERIFY10
+#define SCSI_CMD_WRITE_AND_VERIFY10 0x2E
+#endif
+#ifndef SCSI_CMD_SYNCHRONIZE_CACHE10
+#define SCSI_CMD_SYNCHRONIZE_CACHE10 0x35
+#endif
 #ifndef SCSI_CMD_UNMAP
 #define SCSI_CMD_UNMAP            0x42
 #endif
 #ifndef SCSI_CMD_MODE_SELECT_10
 #define SCSI_CMD_MODE_SELECT_10   0x55
 #endif
-#ifndef SCSI_CMD_WRITE12
-#define SCSI_CMD_WRITE12          0xAA
+#ifndef SCSI_CMD_MODE_SENSE_10
+#define SCSI_CMD_MODE_SENSE_10    0x5A
+#endif
+#ifndef SCSI_CMD_READ16
+#define SCSI_CMD_READ16           0x88
 #endif
 #ifndef SCSI_CMD_WRITE16
 #define SCSI_CMD_WRITE16          0x8A
 #endif
+#ifndef SCSI_CMD_SYNCHRONIZE_CACHE16
+#define SCSI_CMD_SYNCHRONIZE_CACHE16 0x91
+#endif
+#ifndef SCSI_CMD_SERVICE_ACTION_IN16
+#define SCSI_CMD_SERVICE_ACTION_IN16 0x9E
+#endif
+#ifndef SCSI_CMD_READ12
+#define SCSI_CMD_READ12           0xA8
+#endif
+#ifndef SCSI_CMD_WRITE12
+#define SCSI_CMD_WRITE12          0xAA
+#endif
 
-#ifndef SCSI_CMD_MODE_SENSE_10
-#define SCSI_CMD_MODE_SENSE_10    0x5A
+// SERVICE ACTION IN (16) service actions, SBC-3 §5.16 and §5.6
+#define SCSI_SA_READ_CAPACITY16   0x10
+#define SCSI_SA_GET_LBA_STATUS    0x12
 
-// Mode Parameter Header (10) for MODE SENSE (10) – SPC-4 §5.5.4
+// READ CAPACITY (16) logical block provisioning bits, SBC-3 §5.16.2
+#define SCSI_RC16_LBPME           0x8000 // Provisioning management enabled
+#define SCSI_RC16_LBPRZ           0x4000 // Deallocated blocks read as zeros
+
+// GET LBA STATUS provisioning status, SBC-3 §5.6.3
+#define SCSI_LBA_STATUS_MAPPED      0x0
+#define SCSI_LBA_STATUS_DEALLOCATED 0x1
+
+#define SCSI_LBA_STATUS_HEADER_LEN     8u
+#define SCSI_LBA_STATUS_DESCRIPTOR_LEN 16u
+
+// Vital Product Data pages, SPC-4 §7.8 and SBC-3 §6.5
+#define SCSI_VPD_SUPPORTED_PAGES  0x00
+#define SCSI_VPD_UNIT_SERIAL      0x80
+#define SCSI_VPD_DEVICE_ID        0x83
+#define SCSI_VPD_BLOCK_LIMITS     0xB0
+#define SCSI_VPD_BLOCK_DEVICE_CHARACTERISTICS 0xB1
+#define SCSI_VPD_LOGICAL_BLOCK_PROVISIONING   0xB2
+
+#define SCSI_VPD_HEADER_LEN       4u
+#define SCSI_VPD_SBC_PAGE_LEN     0x3Cu // Block Limits etc.
+
+// Transfer lengths in blocks, and the physical block as a cluster
+#define VD_MSC_OPTIMAL_TRANSFER_BLOCKS (PICOVD_MSC_OPTIMAL_TRANSFER_BYTES / MSC_BLOCK_SIZE)
+#define VD_MSC_MAX_TRANSFER_BLOCKS     (PICOVD_MSC_MAX_TRANSFER_BYTES / MSC_BLOCK_SIZE)
+#define VD_MSC_LOWEST_ALIGNED_LBA      (EXFAT_CLUSTER_HEAP_START_LBA % EXFAT_SECTORS_PER_CLUSTER)
+
+// Flash erase sector, the unit of the partition locations
+#define VD_MSC_FLASH_SECTOR_SIZE       4096u
+
+_Static_assert(VD_MSC_OPTIMAL_TRANSFER_BLOCKS % EXFAT_SECTORS_PER_CLUSTER == 0,
+               "Optimal transfer length must be whole clusters");
+_Static_assert(VD_MSC_MAX_TRANSFER_BLOCKS >= VD_MSC_OPTIMAL_TRANSFER_BLOCKS,
+               "Maximum transfer length below the optimal one");
+
+// Mode Parameter Header (10) for MODE SENSE (10) – SPC-4 §7.5.5
 typedef struct TU_ATTR_PACKED {
   uint16_t data_len;        // Mode Data Length (big-endian)
   uint8_t  medium_type;     // 0 = direct-access
   uint8_t  dev_spec_params; // bit7 = WP
   uint8_t  reserved;
-  uint16_t blk_desc_len;    // Block-Descriptor Length (big-endian)
   uint8_t  reserved2;
+  uint16_t blk_desc_len;    // Block-Descriptor Length (big-endian)
 } scsi_mode_sense10_resp_t;
 _Static_assert(sizeof(scsi_mode_sense10_resp_t) == 8, "SCSI Mode Sense (10) response size mismatch");
 
-#endif
+// READ CAPACITY (16) parameter data – SBC-3 §5.16.2
+typedef struct TU_ATTR_PACKED {
+  uint32_t last_lba_hi;     // Returned Logical Block Address (big-endian)
+  uint32_t last_lba_lo;
+  uint32_t block_size;      // Logical Block Length In Bytes (big-endian)
+  uint8_t  prot;            // P_TYPE, PROT_EN
+  uint8_t  exponents;       // P_I_EXPONENT, LOGICAL BLOCKS PER PHYSICAL BLOCK EXPONENT
+  uint16_t lowest_aligned;  // LBPME, LBPRZ, LOWEST ALIGNED LOGICAL BLOCK ADDRESS
+  uint8_t  reserved[16];
+} scsi_read_capacity16_resp_t;
+_Static_assert(sizeof(scsi_read_capacity16_resp_t) == 32, "SCSI Read Capacity (16) response size mismatch");
 
 /**
  * @brief Notify the host that the virtual disk contents have changed.
@@ -73,10 +172,144 @@ _Static_assert(sizeof(scsi_mode_sense10_resp_t) == 8, "SCSI Mode Sense (10) resp
  * re-read the entire disk, so it should be used sparingly.
  */
 
-static bool vd_virtual_disk_contents_changed_flag = false;
+// Not ready until the partition table has been loaded in the background
+static volatile bool vd_virtual_disk_ready_flag = !PICOVD_BOOTROM_PARTITIONS_LOAD;
+
+void vd_virtual_disk_set_ready(bool ready) {
+    vd_virtual_disk_ready_flag = ready;
+}
+
+bool vd_virtual_disk_is_ready(void) {
+    return vd_virtual_disk_ready_flag;
+}
+
+// Queue sense data for the current command, recording it in the trace
+static void vd_msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t asc, uint8_t ascq) {
+    vd_trace_sense(sense_key, asc, ascq);
+    tud_msc_set_sense(lun, sense_key, asc, ascq);
+}
+
+// Queue the "not ready, becoming ready" sense, per SPC-4 §4.5.6
+static void vd_msc_set_sense_becoming_ready(uint8_t lun) {
+    vd_msc_set_sense(lun,
+                      SCSI_SENSE_NOT_READY,
+                      SCSI_ASC_LOGICAL_UNIT_NOT_READY,
+                      SCSI_ASCQ_BECOMING_READY);
+}
+
+// ---------------------------------------------------------------------------
+// Logical units, see vd_usb_msc.h
+// ---------------------------------------------------------------------------
+
+static vd_msc_lun_t vd_msc_luns[VD_MSC_LUN_COUNT];
+
+static int32_t vd_msc_exfat_read(const vd_msc_lun_t *lun __unused, uint32_t lba, uint32_t offset,
+                                 void *buffer, uint32_t bufsize) {
+    return vd_virtual_disk_read(lba, offset, buffer, bufsize);
+}
+
+static void vd_msc_exfat_locate(vd_msc_lun_t *lun) {
+    lun->base   = 0;
+    lun->blocks = MSC_TOTAL_BLOCKS;
+}
+
+static uint32_t vd_msc_exfat_lba_status(const vd_msc_lun_t *lun __unused, uint32_t lba, bool *deallocated) {
+    return vd_virtual_disk_lba_status(lba, deallocated);
+}
+
+static const vd_msc_lun_ops_t vd_msc_exfat_ops = {
+    .product_id = "Pico MSC Disk",
+    .read       = vd_msc_exfat_read,
+    .locate     = vd_msc_exfat_locate,
+    .lba_status = vd_msc_exfat_lba_status,
+};
+
+#if VD_MSC_LUN_COUNT > 1
+// The raw LUNs read the flash directly, from the base of the LUN on
+static int32_t vd_msc_raw_read(const vd_msc_lun_t *lun, uint32_t lba, uint32_t offset,
+                               void *buffer, uint32_t bufsize) {
+    const uint32_t start = vd_stats_now();
+    vd_read_flash(lun->base + lba * MSC_BLOCK_SIZE + offset, buffer, bufsize);
+    vd_stats_record(VD_STATS_RAW_LUN, bufsize, start);
+    return (int32_t)bufsize;
+}
+#endif
+
+#if PICOVD_MSC_FLASH_LUN_ENABLED
+static void vd_msc_flash_locate(vd_msc_lun_t *lun) {
+    lun->base   = 0;
+    lun->blocks = PICOVD_FLASH_SIZE_BYTES / MSC_BLOCK_SIZE;
+}
+
+static const vd_msc_lun_ops_t vd_msc_flash_ops = {
+    .product_id = "Pico Flash",
+    .read       = vd_msc_raw_read,
+    .locate     = vd_msc_flash_locate,
+};
+#endif
+
+#if PICOVD_MSC_PARTITION_LUNS
+// Partition n on LUN VD_MSC_LUN_FIRST_PARTITION + n, clipped to the flash
+static void vd_msc_partition_locate(vd_msc_lun_t *lun) {
+    const uint32_t part = (uint32_t)(lun - vd_msc_luns) - VD_MSC_LUN_FIRST_PARTITION;
+    uint32_t first_sector, sectors;
+
+    lun->base   = 0;
+    lun->blocks = 0;
+    if (!vd_partition_location(part, &first_sector, &sectors)) {
+        return; // No such partition: no medium
+    }
+    const uint32_t base = first_sector * VD_MSC_FLASH_SECTOR_SIZE;
+    if (base >= PICOVD_FLASH_SIZE_BYTES) {
+        return;
+    }
+    uint32_t size = sectors * VD_MSC_FLASH_SECTOR_SIZE;
+    if (size > PICOVD_FLASH_SIZE_BYTES - base) {
+        size = PICOVD_FLASH_SIZE_BYTES - base;
+    }
+    lun->base   = base;
+    lun->blocks = size / MSC_BLOCK_SIZE;
+}
+
+// The partition number goes into the last character, see tud_msc_inquiry_cb()
+static const vd_msc_lun_ops_t vd_msc_partition_ops = {
+    .product_id = "Pico Partition",
+    .read       = vd_msc_raw_read,
+    .locate     = vd_msc_partition_locate,
+};
+#endif
+
+static vd_msc_lun_t vd_msc_luns[VD_MSC_LUN_COUNT] = {
+    [VD_MSC_LUN_EXFAT] = { .ops = &vd_msc_exfat_ops },
+#if PICOVD_MSC_FLASH_LUN_ENABLED
+    [VD_MSC_LUN_FLASH] = { .ops = &vd_msc_flash_ops },
+#endif
+#if PICOVD_MSC_PARTITION_LUNS
+    [VD_MSC_LUN_FIRST_PARTITION ... VD_MSC_LUN_COUNT - 1] = { .ops = &vd_msc_partition_ops },
+#endif
+};
+
+// The context of `lun`, locating its medium on first use after a change.
+// Out-of-range LUNs are rejected in tud_msc_scsi_pre_cb().
+static vd_msc_lun_t *vd_msc_lun(uint8_t lun) {
+    assert(lun < VD_MSC_LUN_COUNT);
+    vd_msc_lun_t *l = &vd_msc_luns[lun];
+    if (!l->located) {
+        l->ops->locate(l);
+        l->located = true;
+    }
+    return l;
+}
 
 void vd_virtual_disk_contents_changed(bool hard_reset) {
-    vd_virtual_disk_contents_changed_flag = true;
+    // Every LUN may have changed, e.g. with a new partition table
+    for (uint32_t i = 0; i < VD_MSC_LUN_COUNT; i++) {
+        vd_msc_luns[i].located   = false;
+        vd_msc_luns[i].attention = true;
+    }
+
+    // Recompute the cached checksums etc. in the background
+    vd_idle_restart();
 
     // Drop the USB connection to notify the host
     // that the disk contents have changed.
@@ -93,6 +326,14 @@ void vd_virtual_disk_contents_changed(bool hard_reset) {
     }
 }
 
+void vd_virtual_disk_estimate_changed(bool (*step)(void)) {
+    // The media stay where they are; only what the host has cached is stale
+    for (uint32_t i = 0; i < VD_MSC_LUN_COUNT; i++) {
+        vd_msc_luns[i].attention = true;
+    }
+    vd_idle_restart_after(step);
+}
+
 
 /*
  * --------------------------------------------------------------------------
@@ -106,22 +347,28 @@ void vd_virtual_disk_contents_changed(bool hard_reset) {
  *    https://www.usb.org/sites/default/files/usbmassbulk_10.pdf
  *  - SCSI Primary Commands - 4 (SPC-4), T10/1731-D:
  *    https://www.t10.org/members/w_spc4.htm
+ *  - SCSI Block Commands - 3 (SBC-3), T10/1799-D
  * --------------------------------------------------------------------------
  */
 
  #if CFG_TUD_MSC
 
-// Read10 callback: serve LBA regions defined in the lba_regions table
-int32_t tud_msc_read10_cb(uint8_t lun         __unused,
+// Number of LUNs, for the Get Max LUN request of BOT §3.2
+uint8_t tud_msc_get_maxlun_cb(void)
+{
+    return VD_MSC_LUN_COUNT;
+}
+
+// Read10 callback: serve the blocks of the LUN, e.g. the lba_regions table
+int32_t tud_msc_read10_cb(uint8_t lun,
                           uint32_t lba,
                           uint32_t offset,
                           void*    buffer,
                           uint32_t bufsize)
 {
-    // Enforce single LUN, full-sector, offset-zero semantics
-    assert(lun == 0);
-
-    return vd_virtual_disk_read(lba, offset, buffer, bufsize);
+    // The readiness and the range have been checked in tud_msc_scsi_pre_cb()
+    const vd_msc_lun_t *l = vd_msc_lun(lun);
+    return l->ops->read(l, lba, offset, buffer, bufsize);
 }
 
 // SCSI Inquiry: return manufacturer, product, revision strings
@@ -132,22 +379,38 @@ void tud_msc_inquiry_cb(uint8_t lun,
 {
     // XXX FIXME: Replace with configuration strings
     memcpy(vendor_id,  "Raspberry",    8);
-    memcpy(product_id, "Pico MSC Disk\0\0\0",16);
     memcpy(product_rev,"1.0 ",         4);
+
+    const char *name = vd_msc_lun(lun)->ops->product_id;
+    const size_t len = strlen(name);
+    memcpy(product_id, name, len);
+    memset(product_id + len, 0, 16 - len);
+#if PICOVD_MSC_PARTITION_LUNS
+    if (lun >= VD_MSC_LUN_FIRST_PARTITION) {
+        product_id[len]     = ' ';
+        product_id[len + 1] = "0123456789ABCDEF"[lun - VD_MSC_LUN_FIRST_PARTITION];
+    }
+#endif
 }
 
-// Capacity callback: return block count and block size
+// Capacity callback: return block count and block size.
+// Required by TinyUSB, but READ CAPACITY is answered from the command table.
 void tud_msc_capacity_cb(uint8_t lun,
                          uint32_t* block_count,
                          uint16_t* block_size)
 {
-    *block_count = MSC_TOTAL_BLOCKS;
+    *block_count = vd_msc_lun(lun)->blocks;
     *block_size  = MSC_BLOCK_SIZE;
 }
 
-// Ready callback: always ready
+// Ready callback: ready once the background startup work is done.
+// Required by TinyUSB, but TEST UNIT READY is answered from the command table.
 bool tud_msc_test_unit_ready_cb(uint8_t lun)
 {
+    if (!vd_virtual_disk_ready_flag) {
+        vd_msc_set_sense_becoming_ready(lun);
+        return false;
+    }
     return true;
 }
 
@@ -166,8 +429,11 @@ bool tud_msc_start_stop_cb(uint8_t lun,
 /**
  * @brief SCSI WRITE10 command callback, enforcing read-only medium.
  *
- * Always fails write attempts by returning an error and reporting
- * write-protected sense, conforming to SPC-4 §6.7 and USB MSC BOT spec §6.4.
+ * Fails write attempts by returning an error and reporting write-protected
+ * sense, conforming to SPC-4 §6.7 and USB MSC BOT spec §6.4; but the
+ * exFAT LUN takes them with PICOVD_INBOX_ENABLED, for the upload files,
+ * and with PICOVD_UF2_DROP_ENABLED, streams the rest to the UF2 drop zone.
+ * Whatever neither takes, e.g. the host's FAT and bitmap, is dropped.
  */
 int32_t tud_msc_write10_cb(uint8_t lun,
                            uint32_t lba,
@@ -175,12 +441,26 @@ int32_t tud_msc_write10_cb(uint8_t lun,
                            uint8_t* buffer,
                            uint32_t bufsize)
 {
+#if PICOVD_UF2_DROP_ENABLED || PICOVD_INBOX_ENABLED
+    if (lun == VD_MSC_LUN_EXFAT) {
+#if PICOVD_INBOX_ENABLED
+        if (vd_inbox_write(lba, offset, buffer, bufsize)) {
+            return (int32_t) bufsize;
+        }
+#endif
+#if PICOVD_UF2_DROP_ENABLED
+        return vd_uf2_drop_write(lba, offset, buffer, bufsize);
+#else
+        return (int32_t) bufsize;
+#endif
+    }
+#endif
     (void) lba;
     (void) offset;
     (void) buffer;
 
     // Queue sense data: Data Protect (0x07), Write Protected (0x27, 0x00)
-    tud_msc_set_sense(lun,
+    vd_msc_set_sense(lun,
                       SCSI_SENSE_DATA_PROTECT,
                       SCSI_ASC_WRITE_PROTECTED,
                       SCSI_ASCQ_WRITE_PROTECTED);
@@ -189,120 +469,512 @@ int32_t tud_msc_write10_cb(uint8_t lun,
     return TUD_MSC_RET_ERROR;
 }
 
-/**
- * @brief SCSI transparent command callbacks.
- *
- * XXX UPDATE the documentation!
+bool tud_msc_is_writable_cb(uint8_t lun) {
+    // Read-only, but for the UF2 drop zone and the upload files of the exFAT LUN
+    return (PICOVD_UF2_DROP_ENABLED || PICOVD_INBOX_ENABLED) && lun == VD_MSC_LUN_EXFAT;
+}
+
+// ---------------------------------------------------------------------------
+// Command handlers, see vd_usb_msc.h
+// ---------------------------------------------------------------------------
+
+static inline uint32_t vd_msc_get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint16_t vd_msc_get_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void vd_msc_put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline void vd_msc_put_be16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+// Truncate a response to the allocation length of the command, SPC-4 §4.2.5.6
+static inline int32_t vd_msc_response(uint32_t len, uint32_t allocation_length) {
+    return (int32_t)(len < allocation_length ? len : allocation_length);
+}
+
+static int32_t vd_msc_fail(uint8_t lun, uint8_t sense_key, uint8_t asc) {
+    vd_msc_set_sense(lun, sense_key, asc, 0x00);
+    return TUD_MSC_RET_ERROR;
+}
+
+// Success without data, e.g. PREVENT ALLOW MEDIUM REMOVAL
+static int32_t vd_msc_no_op(uint8_t lun __unused, uint8_t const cmd[16] __unused,
+                            void *buffer __unused, uint16_t bufsize __unused) {
+    return 0;
+}
+
+// TinyUSB's built-in handling, e.g. the READ(10) data stage
+static int32_t vd_msc_default(uint8_t lun __unused, uint8_t const cmd[16] __unused,
+                              void *buffer __unused, uint16_t bufsize __unused) {
+    return TUD_MSC_RET_CALL_DEFAULT;
+}
+
+// Reject any command that would alter the medium, per SPC-4 §6.7
+static int32_t vd_msc_write_protected(uint8_t lun, uint8_t const cmd[16] __unused,
+                                      void *buffer __unused, uint16_t bufsize __unused) {
+    return vd_msc_fail(lun, SCSI_SENSE_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED);
+}
+
+// ---------------------------------------------------------------------------
+// Vital Product Data pages, for INQUIRY with EVPD set.
+//
+// Each page function fills in the page after its 4-byte header, and
+// returns the page length.  The pages fit the 64-byte endpoint buffer.
+// ---------------------------------------------------------------------------
+typedef uint32_t (*vd_msc_vpd_fn_t)(uint8_t lun, uint8_t *page);
+
+typedef struct {
+    uint8_t         code;
+    vd_msc_vpd_fn_t fill;
+} vd_msc_vpd_page_t;
+
+// The board ID as 16 hex digits, as in the USB serial number string
+static const char *vd_msc_serial_number(void) {
+    static char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    if (!serial[0]) {
+        pico_get_unique_board_id_string(serial, sizeof(serial));
+    }
+    return serial;
+}
+
+#define VD_MSC_SERIAL_LEN (2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES)
+
+// The serial number of `lun`: the board ID, with "-<lun>" for LUNs past 0,
+// so that each LUN has an identifier of its own.  Returns the length.
+static uint32_t vd_msc_lun_serial(uint8_t lun, uint8_t *out) {
+    memcpy(out, vd_msc_serial_number(), VD_MSC_SERIAL_LEN);
+    if (lun == VD_MSC_LUN_EXFAT) {
+        return VD_MSC_SERIAL_LEN;
+    }
+    out[VD_MSC_SERIAL_LEN]     = '-';
+    out[VD_MSC_SERIAL_LEN + 1] = "0123456789ABCDEF"[lun & 0x0F];
+    return VD_MSC_SERIAL_LEN + 2;
+}
+
+static uint32_t vd_msc_vpd_supported_pages(uint8_t lun, uint8_t *page);
+
+// Unit Serial Number, SPC-4 §7.8.15
+static uint32_t vd_msc_vpd_unit_serial(uint8_t lun, uint8_t *page) {
+    return vd_msc_lun_serial(lun, page + SCSI_VPD_HEADER_LEN);
+}
+
+// Device Identification, SPC-4 §7.8.6: a T10 vendor ID based designator,
+// the INQUIRY vendor followed by the serial number
+static uint32_t vd_msc_vpd_device_id(uint8_t lun, uint8_t *page) {
+    uint8_t *d = page + SCSI_VPD_HEADER_LEN;
+    uint8_t product_id[16], product_rev[4];
+
+    d[0] = 0x02; // Code set: ASCII
+    d[1] = 0x01; // Association: logical unit, designator type: T10 vendor ID
+    d[2] = 0x00;
+    tud_msc_inquiry_cb(lun, d + 4, product_id, product_rev);
+    const uint32_t len = 8 + vd_msc_lun_serial(lun, d + 4 + 8);
+    d[3] = (uint8_t)len;
+    return 4 + len;
+}
+
+// Block Limits, SBC-3 §6.5.3: cluster granularity and our transfer lengths
+static uint32_t vd_msc_vpd_block_limits(uint8_t lun __unused, uint8_t *page) {
+    vd_msc_put_be16(page + 6,  EXFAT_SECTORS_PER_CLUSTER);      // Optimal transfer length granularity
+    vd_msc_put_be32(page + 8,  VD_MSC_MAX_TRANSFER_BLOCKS);     // Maximum transfer length
+    vd_msc_put_be32(page + 12, VD_MSC_OPTIMAL_TRANSFER_BLOCKS); // Optimal transfer length
+    return SCSI_VPD_SBC_PAGE_LEN;
+}
+
+// Block Device Characteristics, SBC-3 §6.5.2: a non-rotating medium
+static uint32_t vd_msc_vpd_characteristics(uint8_t lun __unused, uint8_t *page) {
+    vd_msc_put_be16(page + 4, 0x0001); // Medium rotation rate: non-rotating
+    return SCSI_VPD_SBC_PAGE_LEN;
+}
+
+// Logical Block Provisioning, SBC-3 §6.5.4: thin provisioned, see GET LBA STATUS;
+// the raw LUNs are fully provisioned
+static uint32_t vd_msc_vpd_provisioning(uint8_t lun, uint8_t *page) {
+    if (vd_msc_lun(lun)->ops->lba_status) {
+        page[5] = 0x04; // LBPRZ: deallocated blocks read as zeros
+        page[6] = 0x02; // Provisioning type: thin provisioned
+    }
+    return 4;
+}
+
+// In ascending page code order, as listed in the Supported VPD Pages page
+static const vd_msc_vpd_page_t vd_msc_vpd_pages[] = {
+    { SCSI_VPD_SUPPORTED_PAGES,              vd_msc_vpd_supported_pages },
+    { SCSI_VPD_UNIT_SERIAL,                  vd_msc_vpd_unit_serial     },
+    { SCSI_VPD_DEVICE_ID,                    vd_msc_vpd_device_id       },
+    { SCSI_VPD_BLOCK_LIMITS,                 vd_msc_vpd_block_limits    },
+    { SCSI_VPD_BLOCK_DEVICE_CHARACTERISTICS, vd_msc_vpd_characteristics },
+    { SCSI_VPD_LOGICAL_BLOCK_PROVISIONING,   vd_msc_vpd_provisioning    },
+};
+
+#define VD_MSC_VPD_PAGE_COUNT (sizeof(vd_msc_vpd_pages) / sizeof(vd_msc_vpd_pages[0]))
+
+// Supported VPD Pages, SPC-4 §7.8.14
+static uint32_t vd_msc_vpd_supported_pages(uint8_t lun __unused, uint8_t *page) {
+    for (uint32_t i = 0; i < VD_MSC_VPD_PAGE_COUNT; i++) {
+        page[SCSI_VPD_HEADER_LEN + i] = vd_msc_vpd_pages[i].code;
+    }
+    return VD_MSC_VPD_PAGE_COUNT;
+}
+
+static int32_t vd_msc_inquiry_vpd(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    for (uint32_t i = 0; i < VD_MSC_VPD_PAGE_COUNT; i++) {
+        if (vd_msc_vpd_pages[i].code == cmd[2]) {
+            uint8_t *page = (uint8_t *)buffer;
+            assert(bufsize >= SCSI_VPD_HEADER_LEN + SCSI_VPD_SBC_PAGE_LEN);
+            memset(page, 0, SCSI_VPD_HEADER_LEN + SCSI_VPD_SBC_PAGE_LEN);
+            page[1] = cmd[2];
+            const uint32_t len = vd_msc_vpd_pages[i].fill(lun, page);
+            vd_msc_put_be16(page + 2, (uint16_t)len);
+            return vd_msc_response(SCSI_VPD_HEADER_LEN + len, vd_msc_get_be16(&cmd[3]));
+        }
+    }
+    return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+}
+
+// INQUIRY, SPC-4 §6.4: standard data, reporting write-protected media
+static int32_t vd_msc_inquiry(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    if (cmd[1] & 0x01) {
+        return vd_msc_inquiry_vpd(lun, cmd, buffer, bufsize);
+    }
+    if (cmd[2] != 0) {
+        // A page code without EVPD
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+    }
+
+    scsi_inquiry_resp_t* resp = (scsi_inquiry_resp_t*)buffer;
+    assert(bufsize >= sizeof(*resp));
+    memset(resp, 0, sizeof(*resp));
+
+    // resp->peripheral_device_type = 0; // Already zeroed
+    // resp->peripheral_qualifier   = 0; // Already zeroed
+    resp->is_removable           = 1;
+    resp->version                = 5; // SPC-3, so that hosts read the VPD pages
+    resp->response_data_format   = 2;
+    resp->additional_length      = sizeof(scsi_inquiry_resp_t) - 5;
+
+    // Set Write Protect flag (bit in byte 5)
+    resp->protect                = 1;
+
+    // Fill in vendor, product and revision strings, using TinyUSB's callback
+    tud_msc_inquiry_cb(lun,
+                      resp->vendor_id,
+                      resp->product_id,
+                      resp->product_rev);
+
+    return vd_msc_response(sizeof(*resp), vd_msc_get_be16(&cmd[3]));
+}
+
+// MODE SENSE (6), SPC-4 §6.11: header only, with the WP bit set for read-only LUNs
+static int32_t vd_msc_mode_sense_6(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    scsi_mode_sense6_resp_t* resp = (scsi_mode_sense6_resp_t*)buffer;
+    assert(bufsize >= sizeof(*resp));
+    memset(resp, 0, sizeof(*resp));
+    // Mode Data Length = bytes following the data_len field
+    resp->data_len        = sizeof(*resp) - 1;
+    resp->write_protected = !tud_msc_is_writable_cb(lun);
+    return vd_msc_response(sizeof(*resp), cmd[4]);
+}
+
+// MODE SENSE (10), SPC-4 §6.12: header only, with the WP bit set for read-only LUNs
+static int32_t vd_msc_mode_sense_10(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    scsi_mode_sense10_resp_t* resp = (scsi_mode_sense10_resp_t*)buffer;
+    assert(bufsize >= sizeof(*resp));
+    memset(resp, 0, sizeof(*resp));
+    resp->data_len        = tu_htons(sizeof(*resp) - 2);
+    resp->dev_spec_params = tud_msc_is_writable_cb(lun) ? 0x00 : 0x80;
+    return vd_msc_response(sizeof(*resp), vd_msc_get_be16(&cmd[7]));
+}
+
+// READ CAPACITY (10), SBC-3 §5.15
+static int32_t vd_msc_read_capacity_10(uint8_t lun, uint8_t const cmd[16] __unused,
+                                       void *buffer, uint16_t bufsize) {
+    scsi_read_capacity10_resp_t* resp = (scsi_read_capacity10_resp_t*)buffer;
+    assert(bufsize >= sizeof(*resp));
+    resp->last_lba   = tu_htonl(vd_msc_lun(lun)->blocks - 1);
+    resp->block_size = tu_htonl(MSC_BLOCK_SIZE);
+    return sizeof(*resp);
+}
+
+// READ CAPACITY (16), SBC-3 §5.16
+static int32_t vd_msc_read_capacity_16(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    const vd_msc_lun_t *l = vd_msc_lun(lun);
+    scsi_read_capacity16_resp_t* resp = (scsi_read_capacity16_resp_t*)buffer;
+    assert(bufsize >= sizeof(*resp));
+    memset(resp, 0, sizeof(*resp));
+    resp->last_lba_hi = 0;
+    resp->last_lba_lo = tu_htonl(l->blocks - 1);
+    resp->block_size  = tu_htonl(MSC_BLOCK_SIZE);
+    // A cluster, or a flash sector, per physical block, so that hosts align their I/O
+    resp->exponents      = EXFAT_SECTORS_PER_CLUSTER_SHIFT;
+    if (l->ops->lba_status) {
+        // Thin provisioned, so that imaging tools can skip the zero-filled regions
+        resp->lowest_aligned = tu_htons(SCSI_RC16_LBPME | SCSI_RC16_LBPRZ | VD_MSC_LOWEST_ALIGNED_LBA);
+    }
+    return vd_msc_response(sizeof(*resp), vd_msc_get_be32(&cmd[10]));
+}
+
+// GET LBA STATUS, SBC-3 §5.6: as many descriptors as fit the endpoint
+// buffer, each a run of mapped or deallocated blocks from the region table;
+// a fully provisioned LUN is a single mapped run
+static int32_t vd_msc_get_lba_status(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    const vd_msc_lun_t *l = vd_msc_lun(lun);
+    const uint64_t start = ((uint64_t)vd_msc_get_be32(&cmd[2]) << 32) | vd_msc_get_be32(&cmd[6]);
+    if (start >= l->blocks) {
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+    }
+    assert(bufsize >= SCSI_LBA_STATUS_HEADER_LEN + SCSI_LBA_STATUS_DESCRIPTOR_LEN);
+
+    uint8_t *resp = (uint8_t *)buffer;
+    uint32_t len  = SCSI_LBA_STATUS_HEADER_LEN;
+    uint32_t lba  = (uint32_t)start;
+    memset(resp, 0, bufsize);
+
+    while (lba < l->blocks && len + SCSI_LBA_STATUS_DESCRIPTOR_LEN <= bufsize) {
+        bool deallocated = false;
+        const uint32_t blocks = l->ops->lba_status ? l->ops->lba_status(l, lba, &deallocated) : l->blocks - lba;
+        uint8_t *d = resp + len;
+        vd_msc_put_be32(d + 4, lba); // LBA, upper 32 bits zero
+        vd_msc_put_be32(d + 8, blocks);
+        d[12] = deallocated ? SCSI_LBA_STATUS_DEALLOCATED : SCSI_LBA_STATUS_MAPPED;
+        len += SCSI_LBA_STATUS_DESCRIPTOR_LEN;
+        lba += blocks;
+    }
+    vd_msc_put_be32(resp, len - 4); // Parameter data length
+    return vd_msc_response(len, vd_msc_get_be32(&cmd[10]));
+}
+
+// SERVICE ACTION IN (16), SBC-3 §5.16 and §5.6
+static int32_t vd_msc_service_action_in_16(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    switch (cmd[1] & 0x1F) {
+    case SCSI_SA_READ_CAPACITY16:
+        return vd_msc_read_capacity_16(lun, cmd, buffer, bufsize);
+    case SCSI_SA_GET_LBA_STATUS:
+        return vd_msc_get_lba_status(lun, cmd, buffer, bufsize);
+    default:
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+    }
+}
+
+// READ (10), SBC-3 §5.11: check the range, and let TinyUSB stream the data
+static int32_t vd_msc_read_10(uint8_t lun, uint8_t const cmd[16], void *buffer __unused, uint16_t bufsize __unused) {
+    const uint32_t capacity = vd_msc_lun(lun)->blocks;
+    const uint32_t lba      = vd_msc_get_be32(&cmd[2]);
+    const uint32_t blocks   = vd_msc_get_be16(&cmd[7]);
+    if (lba > capacity || blocks > capacity - lba) {
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+    }
+    return TUD_MSC_RET_CALL_DEFAULT;
+}
+
+/*
+ * READ (12) and READ (16), SBC-3 §5.12-5.13.
  *
- * Handles MODE SENSE (6) to report a write-protected medium.
- * Other SCSI commands use TinyUSB's default handling.
+ * TinyUSB streams only READ (10) through tud_msc_read10_cb(), and any
+ * other response must fit the endpoint buffer, smaller than a block.
+ * So check the range, and then ask the host to use READ (10) instead;
+ * hosts fall back to it on INVALID COMMAND OPERATION CODE.
+ */
+static int32_t vd_msc_read_long(uint8_t lun, uint64_t lba, uint32_t blocks) {
+    const uint32_t capacity = vd_msc_lun(lun)->blocks;
+    if (lba > capacity || blocks > capacity - lba) {
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+    }
+    if (blocks == 0) {
+        return 0; // Nothing to transfer, not an error
+    }
+    return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND_OPERATION_CODE);
+}
+
+static int32_t vd_msc_read_12(uint8_t lun, uint8_t const cmd[16], void *buffer __unused, uint16_t bufsize __unused) {
+    return vd_msc_read_long(lun, vd_msc_get_be32(&cmd[2]), vd_msc_get_be32(&cmd[6]));
+}
+
+static int32_t vd_msc_read_16(uint8_t lun, uint8_t const cmd[16], void *buffer __unused, uint16_t bufsize __unused) {
+    const uint64_t lba = ((uint64_t)vd_msc_get_be32(&cmd[2]) << 32) | vd_msc_get_be32(&cmd[6]);
+    return vd_msc_read_long(lun, lba, vd_msc_get_be32(&cmd[10]));
+}
+
+// WRITE (10), SBC-3 §5.32: refuse read-only LUNs, check the range,
+// and let TinyUSB stream the data to tud_msc_write10_cb()
+static int32_t vd_msc_write_10(uint8_t lun, uint8_t const cmd[16], void *buffer, uint16_t bufsize) {
+    if (!tud_msc_is_writable_cb(lun)) {
+        return vd_msc_write_protected(lun, cmd, buffer, bufsize);
+    }
+    const uint32_t capacity = vd_msc_lun(lun)->blocks;
+    const uint32_t lba      = vd_msc_get_be32(&cmd[2]);
+    const uint32_t blocks   = vd_msc_get_be16(&cmd[7]);
+    if (lba > capacity || blocks > capacity - lba) {
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+    }
+    return TUD_MSC_RET_CALL_DEFAULT;
+}
+
+// SYNCHRONIZE CACHE (10) and (16), SBC-3 §5.22-5.23: program
+// what the UF2 drop zone has staged; the upload files are in RAM already
+static int32_t vd_msc_synchronize_cache(uint8_t lun, uint8_t const cmd[16] __unused,
+                                        void *buffer __unused, uint16_t bufsize __unused) {
+#if PICOVD_UF2_DROP_ENABLED
+    if (lun == VD_MSC_LUN_EXFAT) {
+        vd_uf2_drop_flush();
+    }
+#else
+    (void) lun;
+#endif
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Command table, in ascending opcode order for the binary search.
+//
+// Covers the commands Linux, macOS and Windows send to a USB disk.  The
+// commands left to TinyUSB are REQUEST SENSE, which reports the sense data
+// queued here, the READ (10) and WRITE (10) data stages, and the commands
+// answered entirely from its callbacks above.
+// ---------------------------------------------------------------------------
+#define READY     VD_MSC_CMD_NEEDS_READY
+#define ATTENTION VD_MSC_CMD_ATTENTION
+
+static const vd_msc_command_t vd_msc_commands[] = {
+    { SCSI_CMD_TEST_UNIT_READY,              READY | ATTENTION, vd_msc_no_op,                "tur"        },
+    { SCSI_CMD_REQUEST_SENSE,                0,                 vd_msc_default,              "reqsense"   },
+    { SCSI_CMD_FORMAT_UNIT,                  0,                 vd_msc_write_protected,      "format"     },
+    { SCSI_CMD_WRITE6,                       0,                 vd_msc_write_protected,      "write6"     },
+    { SCSI_CMD_INQUIRY,                      0,                 vd_msc_inquiry,              "inquiry"    },
+    { SCSI_CMD_MODE_SELECT_6,                0,                 vd_msc_write_protected,      "modesel6"   },
+    { SCSI_CMD_BLANK,                        0,                 vd_msc_write_protected,      "blank"      },
+    { SCSI_CMD_MODE_SENSE_6,                 0,                 vd_msc_mode_sense_6,         "modesns6"   },
+    { SCSI_CMD_START_STOP_UNIT,              0,                 vd_msc_default,              "startstop"  },
+    { SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL, 0,                 vd_msc_no_op,                "prevent"    },
+    { SCSI_CMD_READ_FORMAT_CAPACITY,         0,                 vd_msc_default,              "readfmtcap" },
+    { SCSI_CMD_READ_CAPACITY_10,             READY | ATTENTION, vd_msc_read_capacity_10,     "readcap10"  },
+    { SCSI_CMD_READ_10,                      READY,             vd_msc_read_10,              "read10"     },
+    { SCSI_CMD_WRITE_10,                     READY,             vd_msc_write_10,             "write10"    },
+    { SCSI_CMD_WRITE_AND_VERIFY10,           0,                 vd_msc_write_protected,      "writevfy10" },
+    { SCSI_CMD_SYNCHRONIZE_CACHE10,          0,                 vd_msc_synchronize_cache,    "sync10"     },
+    { SCSI_CMD_UNMAP,                        0,                 vd_msc_write_protected,      "unmap"      },
+    { SCSI_CMD_MODE_SELECT_10,               0,                 vd_msc_write_protected,      "modesel10"  },
+    { SCSI_CMD_MODE_SENSE_10,                0,                 vd_msc_mode_sense_10,        "modesns10"  },
+    { SCSI_CMD_READ16,                       READY,             vd_msc_read_16,              "read16"     },
+    { SCSI_CMD_WRITE16,                      0,                 vd_msc_write_protected,      "write16"    },
+    { SCSI_CMD_SYNCHRONIZE_CACHE16,          0,                 vd_msc_synchronize_cache,    "sync16"     },
+    { SCSI_CMD_SERVICE_ACTION_IN16,          READY | ATTENTION, vd_msc_service_action_in_16, "svcact16"   },
+    { SCSI_CMD_READ12,                       READY,             vd_msc_read_12,              "read12"     },
+    { SCSI_CMD_WRITE12,                      0,                 vd_msc_write_protected,      "write12"    },
+};
+
+#undef READY
+#undef ATTENTION
+
+#define VD_MSC_COMMAND_COUNT (sizeof(vd_msc_commands) / sizeof(vd_msc_commands[0]))
+_Static_assert(VD_MSC_COMMAND_COUNT < VD_MSC_COMMANDS_MAX, "Too many SCSI commands for STATS.TXT");
+
+#if PICOVD_STATS_ENABLED
+// Indexed as the table, plus the unknown opcodes at VD_MSC_COMMAND_COUNT
+static vd_stats_latency_t vd_msc_latency[VD_MSC_COMMAND_COUNT + 1];
+static uint32_t vd_msc_current_idx;
+static uint32_t vd_msc_current_start;
+
+const char *vd_msc_command_stats(uint32_t i, const vd_stats_latency_t **stats) {
+    if (i > VD_MSC_COMMAND_COUNT) {
+        return NULL;
+    }
+    *stats = &vd_msc_latency[i];
+    return i < VD_MSC_COMMAND_COUNT ? vd_msc_commands[i].name : "other";
+}
+#endif
+
+// Index of the table entry for `opcode`, or VD_MSC_COMMAND_COUNT if none
+static uint32_t vd_msc_command_find(uint8_t opcode) {
+    uint32_t lo = 0, hi = VD_MSC_COMMAND_COUNT;
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) / 2;
+        if (vd_msc_commands[mid].opcode < opcode) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < VD_MSC_COMMAND_COUNT && vd_msc_commands[lo].opcode == opcode) ? lo : VD_MSC_COMMAND_COUNT;
+}
+
+/**
+ * @brief SCSI command dispatch, called by TinyUSB for every command block.
  *
- * SPC-4 §5.5.3: Mode Sense (6) returns a 4-byte Mode Parameter Header.
- *  - Byte 0: Mode Data Length (n-1 bytes following)
- *  - Byte 1: Medium Type (0 = direct-access)
- *  - Byte 2: Device-Specific Parameter (bit7 = WP)
- *  - Byte 3: Block Descriptor Length (0)
+ * Checks the LUN, and the readiness, the contents-changed Unit Attention
+ * and the presence of the medium of the LUN for the medium access commands,
+ * and then calls the handler from the table.
  */
 int32_t tud_msc_scsi_pre_cb(uint8_t lun,
                            uint8_t const scsi_cmd[16],
                            void* buffer,
                            uint16_t bufsize)
 {
-    switch (scsi_cmd[0]) {
-    /*
-     * Implement fully read-only disk semantics.
-     */
-    case SCSI_CMD_INQUIRY:
-    {
-        // Build Inquiry response, reporting write-protected media
-        scsi_inquiry_resp_t* resp = (scsi_inquiry_resp_t*)buffer;
-        memset(resp, 0, sizeof(*resp));
-
-        // resp->peripheral_device_type = 0; // Already zeroed
-        // resp->peripheral_qualifier   = 0; // Already zeroed
-        resp->is_removable           = 1;
-        resp->version                = 2;
-        resp->response_data_format   = 2;
-        resp->additional_length      = sizeof(scsi_inquiry_resp_t) - 5;
-
-        // Set Write Protect flag (bit in byte 5)
-        resp->protect                = 1;
-
-        // Fill in vendor, product and revision strings, using TinyUSB's callback
-        tud_msc_inquiry_cb(lun,
-                          resp->vendor_id,
-                          resp->product_id,
-                          resp->product_rev);
-
-        // Return entire inquiry response size
-        return sizeof(*resp);
-    }
-    /*
-    * Implement virtual-disk contents change notification.
-    */
-    case SCSI_CMD_TEST_UNIT_READY:
-    case SCSI_CMD_READ_CAPACITY_10:
-        if (vd_virtual_disk_contents_changed_flag) {
-            // If the virtual disk contents have changed, notify the host
-            // that it should re-read the disk.
-            // This is done by setting a Unit Attention sense code.
-            // See SPC-4 §6.7.1 for details on Unit Attention conditions.
-            tud_msc_set_sense(0,
-                SCSI_SENSE_UNIT_ATTENTION,
-                SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED,
-                0x00);
-            vd_virtual_disk_contents_changed_flag = false;  // Only once
-            return TUD_MSC_RET_ERROR;      // Signal CHECK CONDITION
-        }
-        // Fallback to the default handler
-        break;
+    vd_idle_msc_activity();
+    vd_trace_command(lun, scsi_cmd);
+
+    const uint32_t i = vd_msc_command_find(scsi_cmd[0]);
+#if PICOVD_STATS_ENABLED
+    vd_msc_current_idx   = i;
+    vd_msc_current_start = vd_stats_now();
+#endif
+    if (lun >= VD_MSC_LUN_COUNT) {
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LOGICAL_UNIT_NOT_SUPPORTED);
     }
-    return TUD_MSC_RET_CALL_DEFAULT; // Fallback to default handling
-}
+    if (i == VD_MSC_COMMAND_COUNT) {
+        return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND_OPERATION_CODE);
+    }
+    const vd_msc_command_t *entry = &vd_msc_commands[i];
+    vd_msc_lun_t *l = vd_msc_lun(lun);
 
-int32_t tud_msc_scsi_cb(uint8_t lun,
-                        uint8_t const scsi_cmd[16],
-                        void* buffer,
-                        uint16_t bufsize)
-{
-    switch (scsi_cmd[0]) {
-    /*
-     * Reject any SCSI commands that would alter the medium on a read-only device.
-     * These include MODE SELECT, UNMAP, FORMAT UNIT, and BLANK. Always report
-     * Data Protect (Write Protected) sense per SPC-4 §6.7.
-     */
-    case SCSI_CMD_MODE_SELECT_6:
-    case SCSI_CMD_MODE_SELECT_10:
-    case SCSI_CMD_UNMAP:
-    case SCSI_CMD_FORMAT_UNIT:
-    case SCSI_CMD_BLANK:
-    case SCSI_CMD_WRITE12:
-    case SCSI_CMD_WRITE16:
-        tud_msc_set_sense(lun,
-                    SCSI_SENSE_DATA_PROTECT,
-                    SCSI_ASC_WRITE_PROTECTED,
-                    SCSI_ASCQ_WRITE_PROTECTED);
+    if ((entry->flags & VD_MSC_CMD_NEEDS_READY) && !vd_virtual_disk_ready_flag) {
+        // Still loading the partition table; the host will retry
+        vd_msc_set_sense_becoming_ready(lun);
         return TUD_MSC_RET_ERROR;
-
-    case SCSI_CMD_MODE_SENSE_10:
-    {
-        scsi_mode_sense10_resp_t* resp = (scsi_mode_sense10_resp_t*)buffer;
-        memset(resp, 0, sizeof(*resp));
-        // Mode Data Length = total bytes following data_len field (sizeof(header)-2)
-        resp->data_len = __builtin_bswap16(sizeof(*resp) - 2); // XXX FIXME: use a TinyUSB macro for this
-        // Byte-3 (Device-Specific Parameter): set Write-Protect bit (0x80)
-        resp->dev_spec_params = 0x80;
-        // Block Descriptor Length = 0 (bytes 4-5 already zeroed)
-        return sizeof(*resp);
     }
-    default:
-        // For all other commands, fallback to default (unrecognized command)
-        return -1;
+    if ((entry->flags & VD_MSC_CMD_ATTENTION) && l->attention) {
+        // If the virtual disk contents have changed, notify the host
+        // that it should re-read the disk.
+        // This is done by setting a Unit Attention sense code.
+        // See SPC-4 §6.7.1 for details on Unit Attention conditions.
+        l->attention = false;  // Only once per LUN
+        return vd_msc_fail(lun, SCSI_SENSE_UNIT_ATTENTION, SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED);
+    }
+    if ((entry->flags & VD_MSC_CMD_NEEDS_READY) && l->blocks == 0) {
+        // A partition LUN without its partition
+        return vd_msc_fail(lun, SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
     }
+    return entry->handler(lun, scsi_cmd, buffer, bufsize);
 }
 
-bool tud_msc_is_writable_cb(uint8_t lun) {
-    return false; // Always read-only
+// Only reached for a command not built into TinyUSB that the table leaves
+// to the default handling, i.e. never; reject it rather than guess
+int32_t tud_msc_scsi_cb(uint8_t lun,
+                        uint8_t const scsi_cmd[16] __unused,
+                        void* buffer __unused,
+                        uint16_t bufsize __unused)
+{
+    return vd_msc_fail(lun, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND_OPERATION_CODE);
+}
+
+// Called once the status of a command has been sent to the host
+void tud_msc_scsi_complete_cb(uint8_t lun __unused, uint8_t const scsi_cmd[16] __unused)
+{
+#if PICOVD_STATS_ENABLED
+    vd_stats_latency_record(&vd_msc_latency[vd_msc_current_idx], vd_msc_current_start);
+#endif
+    vd_trace_complete();
 }
 
 #endif // CFG_TUD_MSC
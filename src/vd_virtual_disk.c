@@ -13,6 +13,21 @@
 #include "vd_exfat_params.h"
 #include "vd_exfat.h"
 #include "vd_virtual_disk.h"
+#include "vd_idle.h"
+#include "vd_mount_ready.h"
+#include "vd_arena.h"
+#include "vd_stats.h"
+#include "vd_trace.h"
+#include "vd_lz4.h"
+#include "vd_uf2.h"
+#include "vd_page_map.h"
+#include "vd_manifest.h"
+#include "vd_inbox.h"
+#include "vd_tar.h"
+#include "vd_stdio.h"
+#include "vd_log.h"
+#include "vd_profile.h"
+#include "vd_gcov.h"
 
 #include <pico/unique_id.h>
 
@@ -32,6 +47,7 @@
 typedef struct {
     usb_msc_lba_read10_fn_t handler;
     uint32_t        next_lba; // Next LBA after this region
+    vd_stats_region_t stats;  // Read statistics class, see vd_stats.h
 } lba_region_t;
 
 static void gen_boot_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
@@ -40,68 +56,148 @@ static void gen_zero_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_
 static void gen_cksm_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
 static void gen_fat0_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
 static void gen_ones_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+#if PICOVD_UF2_DROP_ENABLED
+static void gen_bitmap_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
+#endif
 static void gen_upcs_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
 static void gen_dirs_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
 
 // Region table: each entry defines a region of the virtual disk
 static const lba_region_t lba_regions[] = {
     // §2 Volume Structure
-    { gen_boot_sector, 1 },  // LBA 0, §3.1 Boot Sector
-    { gen_extb_sector, 9 },  // §3.2 Extended Boot Sectors
-    { gen_zero_sector, 11 }, // §3.3 Main and Backup OEM Parameters
-    { gen_cksm_sector, 12 }, // §3.4 Main Boot Checksum Sub-region
-    { gen_boot_sector, 13 }, // §3.1 Backup Boot Sector
-    { gen_extb_sector, 21 }, // §3.2 Extended Boot Sectors (backup)
-    { gen_zero_sector, 23 }, // §3.3 Main and Backup OEM Parameters (backup)
-    { gen_cksm_sector, 24 }, // §3.4 Backup Boot Checksum Sub-region
+    { gen_boot_sector, 1, VD_STATS_BOOT },  // LBA 0, §3.1 Boot Sector
+    { gen_extb_sector, 9, VD_STATS_BOOT },  // §3.2 Extended Boot Sectors
+    { gen_zero_sector, 11, VD_STATS_BOOT }, // §3.3 Main and Backup OEM Parameters
+    { gen_cksm_sector, 12, VD_STATS_BOOT }, // §3.4 Main Boot Checksum Sub-region
+    { gen_boot_sector, 13, VD_STATS_BOOT }, // §3.1 Backup Boot Sector
+    { gen_extb_sector, 21, VD_STATS_BOOT }, // §3.2 Extended Boot Sectors (backup)
+    { gen_zero_sector, 23, VD_STATS_BOOT }, // §3.3 Main and Backup OEM Parameters (backup)
+    { gen_cksm_sector, 24, VD_STATS_BOOT }, // §3.4 Backup Boot Checksum Sub-region
 #if EXFAT_FAT_REGION_START_LBA > 24
     // Space between Backup Boot Checksum Sub-region and FAT region, if any
     // This is not used in our exFAT, but we reserve it for future use.
     // It is zero-filled.
-   { gen_zero_sector, EXFAT_FAT_REGION_START_LBA },
+   { gen_zero_sector, EXFAT_FAT_REGION_START_LBA, VD_STATS_ZERO },
 #endif
 
     // §4   FAT region, first sector
-    { gen_fat0_sector, EXFAT_FAT_REGION_START_LBA + 1 },
+    { gen_fat0_sector, EXFAT_FAT_REGION_START_LBA + 1, VD_STATS_FAT },
     // §4 Rest of FAT region and unused sectors
-    { gen_zero_sector, EXFAT_CLUSTER_HEAP_START_LBA, },
+    { gen_zero_sector, EXFAT_CLUSTER_HEAP_START_LBA, VD_STATS_FAT },
 #if EXFAT_ALLOCATION_BITMAP_START_LBA > EXFAT_CLUSTER_HEAP_START_LBA
     // Space between FAT and Allocation Bitmap regions, if any
-    { gen_zero_sector,  EXFAT_ALLOCATION_BITMAP_START_LBA, },
+    { gen_zero_sector,  EXFAT_ALLOCATION_BITMAP_START_LBA, VD_STATS_ZERO },
 #endif
 
+#if PICOVD_UF2_DROP_ENABLED
+    // §7.1 Allocation Bitmap region, with the UF2 drop zone free
+    { gen_bitmap_sector, EXFAT_ALLOCATION_BITMAP_START_LBA + EXFAT_ALLOCATION_BITMAP_LENGTH_SECTORS, VD_STATS_BITMAP },
+#else
     // §7.1 Allocation Bitmap region (not used in our exFAT)
-    { gen_ones_sector, EXFAT_ALLOCATION_BITMAP_START_LBA + EXFAT_ALLOCATION_BITMAP_LENGTH_SECTORS, },
+    { gen_ones_sector, EXFAT_ALLOCATION_BITMAP_START_LBA + EXFAT_ALLOCATION_BITMAP_LENGTH_SECTORS, VD_STATS_BITMAP },
+#endif
     // §7.2 Up-case Table first sector
-    { gen_upcs_sector, EXFAT_UPCASE_TABLE_START_LBA + EXFAT_UPCASE_TABLE_LENGTH_SECTORS, },
+    { gen_upcs_sector, EXFAT_UPCASE_TABLE_START_LBA + EXFAT_UPCASE_TABLE_LENGTH_SECTORS, VD_STATS_UPCASE },
     // §7.2 Zero sectors before the root directory
-    { gen_zero_sector, EXFAT_ROOT_DIR_START_LBA, },
+    { gen_zero_sector, EXFAT_ROOT_DIR_START_LBA, VD_STATS_ZERO },
     // §7.4 Root Directory sectors, from vd_exfat_directory.c
-    { exfat_generate_root_dir_fixed_sector,   EXFAT_ROOT_DIR_START_LBA + 1, },
-    { exfat_generate_root_dir_dynamic_sector, EXFAT_ROOT_DIR_START_LBA + EXFAT_ROOT_DIR_LENGTH_SECTORS },
+    { exfat_generate_root_dir_fixed_sector,   EXFAT_ROOT_DIR_START_LBA + 1, VD_STATS_ROOT_DIR },
+    { exfat_generate_root_dir_dynamic_sector, EXFAT_ROOT_DIR_START_LBA + EXFAT_ROOT_DIR_LENGTH_SECTORS, VD_STATS_ROOT_DIR },
+
+#if PICOVD_STATS_ENABLED
+    // STATS.TXT file, from vd_stats.c
+    { gen_zero_sector, PICOVD_STATS_START_LBA, VD_STATS_ZERO },
+    { vd_stats_file_sector, PICOVD_STATS_START_LBA + PICOVD_STATS_FILE_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, VD_STATS_STATS },
+#endif
+
+#if PICOVD_TRACE_ENABLED
+    // TRACE.BIN file, from vd_trace.c
+    { gen_zero_sector, PICOVD_TRACE_START_LBA, VD_STATS_ZERO },
+    { vd_trace_file_sector, PICOVD_TRACE_START_LBA + PICOVD_TRACE_FILE_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, VD_STATS_TRACE },
+#endif
+
+#if PICOVD_PAGEMAP_ENABLED
+    // FLASHMAP.BIN and SRAMMAP.BIN, from vd_page_map.c
+    { gen_zero_sector, PICOVD_PAGEMAP_START_LBA, VD_STATS_ZERO },
+    { vd_page_map_file_sector, PICOVD_PAGEMAP_START_LBA + (VD_PAGE_MAP_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_PAGEMAP },
+#endif
+
+#if PICOVD_MANIFEST_ENABLED
+    // MANIFEST.TXT file, from vd_manifest.c
+    { gen_zero_sector, PICOVD_MANIFEST_START_LBA, VD_STATS_ZERO },
+    { vd_manifest_file_sector, PICOVD_MANIFEST_START_LBA + VD_MANIFEST_FILE_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, VD_STATS_MANIFEST },
+#endif
+
+#if PICOVD_INBOX_ENABLED
+    // Upload files, from vd_inbox.c
+    { gen_zero_sector, PICOVD_INBOX_START_LBA, VD_STATS_ZERO },
+    { vd_inbox_file_sector, PICOVD_INBOX_START_LBA + (VD_INBOX_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_INBOX },
+#endif
+
+#if PICOVD_STDIO_ENABLED
+    // STDOUT.TXT and STDERR.TXT, from vd_stdio.c
+    { gen_zero_sector, PICOVD_STDIO_START_LBA, VD_STATS_ZERO },
+    { vd_stdio_file_sector, PICOVD_STDIO_START_LBA + (VD_STDIO_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_STDIO },
+#endif
+
+#if PICOVD_LOG_ENABLED
+    // LOG.TXT, from vd_log.c
+    { gen_zero_sector, PICOVD_LOG_START_LBA, VD_STATS_ZERO },
+    { vd_log_file_sector, PICOVD_LOG_START_LBA + (VD_LOG_FILE_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_LOG },
+#endif
+
+#if PICOVD_PROFILE_ENABLED
+    // GMON.OUT, from vd_profile.c
+    { gen_zero_sector, PICOVD_PROFILE_START_LBA, VD_STATS_ZERO },
+    { vd_profile_file_sector, PICOVD_PROFILE_START_LBA + (VD_PROFILE_FILE_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_PROFILE },
+#endif
+
+#if PICOVD_GCOV_ENABLED
+    // GCOV and its .gcda files, from vd_gcov.c
+    { gen_zero_sector, PICOVD_GCOV_START_LBA, VD_STATS_ZERO },
+    { vd_gcov_sector, PICOVD_GCOV_START_LBA + (VD_GCOV_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_GCOV },
+#endif
 
 #if PICOVD_CHANGING_FILE_ENABLED
     // Changing File contents
-    { gen_zero_sector, PICOVD_CHANGING_FILE_START_LBA, },
-    { vd_return_changing_file_sector, PICOVD_CHANGING_FILE_START_LBA + 1, },
+    { gen_zero_sector, PICOVD_CHANGING_FILE_START_LBA, VD_STATS_ZERO },
+    { vd_return_changing_file_sector, PICOVD_CHANGING_FILE_START_LBA + EXFAT_SECTORS_PER_CLUSTER, VD_STATS_CHANGING },
 #endif
 
 #if PICOVD_BOOTROM_ENABLED
     // BOOTROM.BIN file, from vd_rp2350.c
-    { gen_zero_sector, PICOVD_BOOTROM_START_LBA, },
-    { vd_return_bootrom_sector, PICOVD_BOOTROM_START_LBA + PICOVD_BOOTROM_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, },
+    { gen_zero_sector, PICOVD_BOOTROM_START_LBA, VD_STATS_ZERO },
+    { vd_return_bootrom_sector, PICOVD_BOOTROM_START_LBA + PICOVD_BOOTROM_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, VD_STATS_BOOTROM },
 #endif
 
-#if PICOVD_FLASH_ENABLED
-    // FLASH.BIN file, from vd_rp2350.c
-    { gen_zero_sector, PICOVD_FLASH_START_LBA, },
-    { vd_return_flash_sector, PICOVD_FLASH_START_LBA + PICOVD_FLASH_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, },
+#if PICOVD_FLASH_ENABLED || PICOVD_BOOTROM_PARTITIONS_ENABLED
+    // FLASH.BIN and partition files, from vd_rp2350.c
+    { gen_zero_sector, PICOVD_FLASH_START_LBA, VD_STATS_ZERO },
+    { vd_return_flash_sector, PICOVD_FLASH_START_LBA + PICOVD_FLASH_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, VD_STATS_FLASH },
 #endif
 
 #if PICOVD_SRAM_ENABLED
     // SRAM.BIN file, from vd_rp2350.c
-    { gen_zero_sector, PICOVD_SRAM_START_LBA, },
-    { vd_return_sram_sector, PICOVD_SRAM_START_LBA + PICOVD_SRAM_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, },
+    { gen_zero_sector, PICOVD_SRAM_START_LBA, VD_STATS_ZERO },
+    { vd_return_sram_sector, PICOVD_SRAM_START_LBA + PICOVD_SRAM_SIZE_BYTES / EXFAT_BYTES_PER_SECTOR, VD_STATS_SRAM },
+#endif
+
+#if PICOVD_UF2_ENABLED
+    // UF2 views of the partition files and FLASH.BIN, from vd_uf2.c
+    { gen_zero_sector, PICOVD_UF2_START_LBA, VD_STATS_ZERO },
+    { vd_uf2_file_sector, PICOVD_UF2_START_LBA + (VD_UF2_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_UF2 },
+#endif
+
+#if PICOVD_LZ4_ENABLED
+    // LZ4 views of the partition files and FLASH.BIN, from vd_lz4.c
+    { gen_zero_sector, PICOVD_LZ4_START_LBA, VD_STATS_ZERO },
+    { vd_lz4_file_sector, PICOVD_LZ4_START_LBA + (VD_LZ4_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_LZ4 },
+#endif
+
+#if PICOVD_TAR_ENABLED
+    // ALL.TAR, from vd_tar.c
+    { gen_zero_sector, PICOVD_TAR_START_LBA, VD_STATS_ZERO },
+    { vd_tar_file_sector, PICOVD_TAR_START_LBA + (PICOVD_TAR_LENGTH_CLUSTERS << EXFAT_SECTORS_PER_CLUSTER_SHIFT), VD_STATS_TAR },
 #endif
 
 };
@@ -133,6 +229,28 @@ static void gen_zero_sector(uint32_t lba __unused, void* buffer, uint32_t offset
 static void gen_ones_sector(uint32_t lba __unused, void* buffer, uint32_t offset __unused, uint32_t bufsize) {
     memset(buffer, 0xff, bufsize);
 }
+
+#if PICOVD_UF2_DROP_ENABLED
+// Every cluster in use, but for the UF2 drop zone, see vd_uf2_drop.h
+static void gen_bitmap_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize) {
+    memset(buffer, 0xff, bufsize);
+
+    // Bit n of the bitmap is cluster n + 2
+    const uint32_t first = PICOVD_UF2_DROP_START_CLUSTER - EXFAT_CLUSTER_HEAP_START_CLUSTER;
+    const uint32_t end   = first + PICOVD_UF2_DROP_LENGTH_CLUSTERS;
+    const uint32_t bit0  = (((lba - EXFAT_ALLOCATION_BITMAP_START_LBA) << EXFAT_BYTES_PER_SECTOR_SHIFT) + offset) * 8u;
+    uint8_t *buf = (uint8_t *)buffer;
+
+    for (uint32_t i = 0; i < bufsize; i++) {
+        for (uint32_t b = 0; b < 8u; b++) {
+            const uint32_t bit = bit0 + 8u * i + b;
+            if (bit >= first && bit < end) {
+                buf[i] &= (uint8_t)~(1u << b);
+            }
+        }
+    }
+}
+#endif
 static void gen_extb_sector_signature(void* buffer, uint32_t offset, uint32_t bufsize) {
     // Generate an extended boot sector with the signature bytes 0x55 and 0xAA
     // at the end of the sector, if they fall within the requested offset and size.
@@ -195,27 +313,26 @@ static void gen_boot_sector(uint32_t lba, void* buffer  __unused, uint32_t offse
 }
 
 /**
- * Compute the VBR checksum at runtime over sectors 0–10.
+ * Fold one sector into the VBR checksum over sectors 0–10.
  * Skips offsets 106, 107 and 112 in sector 0.
  */
-static uint32_t compute_vbr_checksum_runtime_simple(void) {
-    uint32_t sum = 0;
-    uint8_t sector[MSC_BLOCK_SIZE];
-    // Iterate each sector
-    for (uint32_t lba = 0; lba < 11; ++lba) {
-        // Generate sector data into 'sector' buffer via the MSC callback
-        tud_msc_read10_cb(0, lba, 0, sector, MSC_BLOCK_SIZE);
-
-        // Walk bytes
-        for (uint32_t off = 0; off < MSC_BLOCK_SIZE; ++off) {
-            if (lba == 0 && (off == 106 || off == 107 || off == 112)) {
-                continue;
-            }
-            // Rotate right by one: ROR32(sum)
-            sum = (sum >> 1) | (sum << 31);
-            sum = (sum + sector[off]) & 0xFFFFFFFFu;
+static uint32_t vbr_checksum_add_sector(uint32_t sum, uint32_t lba) {
+    _Static_assert(VD_ARENA_VBR_SECTOR_SIZE == MSC_BLOCK_SIZE, "VBR lease must hold a sector");
+    uint8_t *sector = vd_arena_lease(VD_ARENA_VBR_SECTOR);
+    assert(sector != NULL);
+    // Generate sector data into 'sector' buffer via the region table
+    vd_virtual_disk_generate(lba, 0, sector, MSC_BLOCK_SIZE);
+
+    // Walk bytes
+    for (uint32_t off = 0; off < MSC_BLOCK_SIZE; ++off) {
+        if (lba == 0 && (off == 106 || off == 107 || off == 112)) {
+            continue;
         }
+        // Rotate right by one: ROR32(sum)
+        sum = (sum >> 1) | (sum << 31);
+        sum = (sum + sector[off]) & 0xFFFFFFFFu;
     }
+    vd_arena_release(VD_ARENA_VBR_SECTOR);
     return sum;
 }
 
@@ -254,13 +371,38 @@ static uint32_t compute_vbr_checksum_runtime_optimised(void) {
     sum = (sum + EXFAT_VBR_CHECKSUM_SUFFIX) & 0xFFFFFFFFu;
 }
 
-static uint32_t compute_vbr_checksum_runtime(void) {
-    // This is the main entry point for computing the VBR checksum at runtime.
-    // XXX FIXME: switch over to the optimized version of the checksum computation,
-    // once we have verified that it works correctly.
-    return compute_vbr_checksum_runtime_simple();
+// VBR checksum, computed at runtime one sector at a time,
+// either by the idle job or on demand by gen_cksm_sector().
+// XXX FIXME: switch over to the optimized version of the checksum computation,
+// once we have verified that it works correctly.
+static struct {
+    uint32_t lba;        ///< Next sector to fold into the sum
+    uint32_t sum;        ///< Running sum over sectors [0, lba)
+    uint32_t value;      ///< Published checksum
+    volatile bool valid; ///< Set last, once value is complete
+} vbr_checksum;
+
+void vd_vbr_checksum_job_reset(void) {
+    vbr_checksum.valid = false;
+    __compiler_memory_barrier();
+    vbr_checksum.lba = 0;
+    vbr_checksum.sum = 0;
 }
 
+bool vd_vbr_checksum_job_step(void) {
+    if (vbr_checksum.valid) {
+        return true;
+    }
+    vbr_checksum.sum = vbr_checksum_add_sector(vbr_checksum.sum, vbr_checksum.lba++);
+    if (vbr_checksum.lba < 11) {
+        return false;
+    }
+    // Publish
+    vbr_checksum.value = vbr_checksum.sum;
+    __compiler_memory_barrier();
+    vbr_checksum.valid = true;
+    return true;
+}
 
 static void gen_cksm_sector(uint32_t lba __unused, void* buffer, uint32_t offset, uint32_t bufsize) {
     // For the math, see the C++ source file vd_exfat.cpp
@@ -269,14 +411,11 @@ static void gen_cksm_sector(uint32_t lba __unused, void* buffer, uint32_t offset
     assert(offset < MSC_BLOCK_SIZE);
     assert(bufsize <= MSC_BLOCK_SIZE - offset);
 
-    static bool checksum_cached = false;
-    static uint32_t checksum_value = 0;
-
-    if (!checksum_cached) {
-        // Cache the result for future calls
-        checksum_cached = true;
-        checksum_value = compute_vbr_checksum_runtime();
+    // Normally precomputed in idle time; if not, finish the job now
+    while (!vd_vbr_checksum_job_step()) {
+        ;
     }
+    const uint32_t checksum_value = vbr_checksum.value;
 
     // Fill requested slice of sector 11 with the 32-bit checksum pattern
     uint8_t  *base8  = ((uint8_t *)buffer);
@@ -339,6 +478,56 @@ static void gen_upcs_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_
     }
 }
 
+// Find the region of an LBA, or NULL if it is beyond the region table
+static const lba_region_t *lba_region_find(uint32_t lba) {
+    for (size_t i = 0; i < sizeof(lba_regions) / sizeof(lba_region_t); i++) {
+        if (lba < lba_regions[i].next_lba) {
+            return &lba_regions[i];
+        }
+    }
+    return NULL;
+}
+
+// Provisioning status of the blocks from `lba` on, for GET LBA STATUS.
+// Zero-filled regions, and the LBAs past the table, read as zeros without
+// being backed by anything, so they are reported as deallocated.
+// Returns the number of blocks up to the next change of status.
+uint32_t vd_virtual_disk_lba_status(uint32_t lba, bool *deallocated) {
+    const size_t count = sizeof(lba_regions) / sizeof(lba_region_t);
+
+    size_t i = 0;
+    while (i < count && lba >= lba_regions[i].next_lba) {
+        i++;
+    }
+    const bool zero = (i == count) || lba_regions[i].handler == gen_zero_sector;
+
+    // Coalesce the following regions with the same status
+    size_t j = i;
+    while (j < count && (lba_regions[j].handler == gen_zero_sector) == zero) {
+        j++;
+    }
+    const uint32_t end = (j == count && zero) ? MSC_TOTAL_BLOCKS : lba_regions[j - 1].next_lba;
+
+    *deallocated = zero;
+    return end - lba;
+}
+
+// Generate a slice of any sector, by dispatching it through the lba_regions table
+int32_t vd_virtual_disk_generate(uint32_t lba,
+                                 uint32_t offset,
+                                 void*    buffer,
+                                 uint32_t bufsize)
+{
+    const lba_region_t *region = lba_region_find(lba);
+    if (region) {
+        region->handler(lba, buffer, offset, bufsize);
+    } else {
+        // Fallback for other LBAs: zero-filled
+        memset(buffer, 0, bufsize);
+    }
+    return bufsize; // Return full sector size
+}
+
 // Read10 callback: serve LBA regions defined in the lba_regions table
 // Called from the TinyUSB MSC stack when a READ10 command is issued.
 int32_t vd_virtual_disk_read(uint32_t lba,
@@ -346,14 +535,20 @@ int32_t vd_virtual_disk_read(uint32_t lba,
                              void*    buffer,
                              uint32_t bufsize)
 {
-    // Check LBA against the region table
-    for (size_t i = 0; i < sizeof(lba_regions) / sizeof(lba_region_t); i++) {
-        if (lba < lba_regions[i].next_lba) {
-            lba_regions[i].handler(lba, buffer, offset, bufsize);
-            return bufsize; // Return full sector size
-        }
+    const uint32_t start = vd_stats_now();
+
+    // Sectors pinned in RAM by the mount-ready mode, if any
+    if (vd_mount_ready_read(lba, offset, buffer, bufsize)) {
+        vd_stats_record(VD_STATS_PINNED, bufsize, start);
+        return bufsize;
     }
-    // Fallback for other LBAs: zero-filled
-    memset(buffer, 0, bufsize);
+
+    const lba_region_t *region = lba_region_find(lba);
+    if (region) {
+        region->handler(lba, buffer, offset, bufsize);
+    } else {
+        memset(buffer, 0, bufsize);
+    }
+    vd_stats_record(region ? region->stats : VD_STATS_ZERO, bufsize, start);
     return bufsize;
 }
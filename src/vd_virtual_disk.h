@@ -1,12 +1,23 @@
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include <boot/picobin.h>
+
 // ---------------------------------------------------------------
 // Virtual Disk Read Callback
 // ---------------------------------------------------------------
 
 extern int32_t vd_virtual_disk_read(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize);
 
+// Generate sector contents directly from the region table, bypassing
+// the RAM-pinned sectors; for internal use, e.g. by checksum computations
+extern int32_t vd_virtual_disk_generate(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize);
+
+// Number of blocks from `lba` on with the same provisioning status,
+// i.e. all zero-filled (deallocated) or all generated (mapped)
+extern uint32_t vd_virtual_disk_lba_status(uint32_t lba, bool *deallocated);
+
 // ---------------------------------------------------------------
 // Functions to provide RP2350 memory files
 // XXX FIXME: Move to rp2350.h
@@ -16,6 +27,37 @@ extern void vd_return_bootrom_sector(uint32_t lba, void* buffer, uint32_t offset
 extern void vd_return_sram_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
 extern void vd_return_flash_sector(uint32_t lba, void* buffer, uint32_t offset, uint32_t bufsize);
 
+// Copy `bufsize` bytes of flash from `flash_offset` on, through the XIP window
+extern void vd_read_flash(uint32_t flash_offset, void* buffer, uint32_t bufsize);
+
+// Erase whole 4 kB pages, or program whole 256-byte blocks, of the flash,
+// for the UF2 drop zone; false if the flash refused.  Both keep off the
+// pages that vd_flash_is_writable() refuses, those of the running binary.
+extern bool vd_flash_is_writable(uint32_t flash_offset, uint32_t len);
+extern bool vd_flash_erase(uint32_t flash_offset, uint32_t len);
+extern bool vd_flash_program(uint32_t flash_offset, const void *data, uint32_t len);
+
+// Decode a partition's permissions_and_location word, per §5.9.4.2 of the
+// RP2350 datasheet: the first and the last (inclusive) 4 kB flash sector
+static inline void vd_partition_location_decode(uint32_t loc, uint32_t *first_sector, uint32_t *sectors) {
+    const uint32_t first = (loc & PICOBIN_PARTITION_LOCATION_FIRST_SECTOR_BITS) >> PICOBIN_PARTITION_LOCATION_FIRST_SECTOR_LSB;
+    const uint32_t last  = (loc & PICOBIN_PARTITION_LOCATION_LAST_SECTOR_BITS)  >> PICOBIN_PARTITION_LOCATION_LAST_SECTOR_LSB;
+    *first_sector = first;
+    *sectors      = last >= first ? last - first + 1 : 0;
+}
+
+// Location of partition `part_idx` in flash, in 4 kB sectors;
+// false if the BootROM does not know the partition
+extern bool vd_partition_location(uint32_t part_idx, uint32_t *first_sector, uint32_t *sectors);
+
+// The permissions_and_flags word of partition `part_idx`, e.g. the families
+// it accepts; false if the BootROM does not know the partition
+extern bool vd_partition_flags(uint32_t part_idx, uint32_t *flags);
+
+// Length of the image in partition `part_idx`, 0 if none, for trimming its file;
+// see PICOVD_BOOTROM_PARTITIONS_TRIM
+extern uint32_t vd_partition_image_length(uint32_t part_idx);
+
 // ---------------------------------------------------------------
 // Function to provide the changing file contents sector
 // ---------------------------------------------------------------
@@ -26,3 +68,17 @@ extern void vd_return_changing_file_sector(uint32_t lba, void* buffer, uint32_t
 // forcing the host to re-read the disk.
 // ---------------------------------------------------------------
 extern void vd_virtual_disk_contents_changed(bool hard_reset);
+
+// ---------------------------------------------------------------
+// Indicate that the directory has changed after all, as the idle job
+// with the given step function has published a result that the host
+// was given an estimate of; the jobs after it are restarted
+// ---------------------------------------------------------------
+extern void vd_virtual_disk_estimate_changed(bool (*step)(void));
+
+// ---------------------------------------------------------------
+// Report the medium as (not) ready to the host, e.g. while
+// the partition table is being loaded at startup
+// ---------------------------------------------------------------
+extern void vd_virtual_disk_set_ready(bool ready);
+extern bool vd_virtual_disk_is_ready(void);
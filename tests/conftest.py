@@ -6,13 +6,30 @@ USB_MSC_IFACE    = 3
 
 import os
 import sys
+import mmap
 import pytest
 import platform
 import subprocess
 import usb.core, usb.util
 
 from device_finder import find_msc_disk
-from exfat_utils import raw_sector_reader, find_directory_entry
+from exfat_utils import raw_sector_reader, find_directory_entry, list_file_entries
+
+# The option that adds each optional file or directory of the root directory
+ROOT_FILE_OPTIONS = {
+    "STATS.TXT":    "PICOVD_STATS_ENABLED",
+    "CHANGING.TXT": "PICOVD_CHANGING_FILE_ENABLED",
+    "MANIFEST.TXT": "PICOVD_MANIFEST_ENABLED",
+    "FLASHMAP.BIN": "PICOVD_PAGEMAP_ENABLED",
+    "SRAMMAP.BIN":  "PICOVD_PAGEMAP_ENABLED",
+    "ALL.TAR":      "PICOVD_TAR_ENABLED",
+    "STDOUT.TXT":   "PICOVD_STDIO_ENABLED",
+    "STDERR.TXT":   "PICOVD_STDIO_ENABLED",
+    "LOG.TXT":      "PICOVD_LOG_ENABLED",
+    "GMON.OUT":     "PICOVD_PROFILE_ENABLED",
+    "GCOV":         "PICOVD_GCOV",
+    "INBOX.BIN":    "PICOVD_INBOX_ENABLED",
+}
 
 def pytest_addoption(parser):
     """
@@ -38,7 +55,7 @@ def msc_usb_dev_device():
     dev = find_msc_usb_device()
 
     # On Linux, this also unmounts the FS
-    if platform.system() == "Linux" and dev.is_kernel_driver_active(MSC_IFACE):
+    if platform.system() == "Linux" and dev.is_kernel_driver_active(USB_MSC_IFACE):
         dev.detach_kernel_driver(USB_MSC_IFACE)
 
     return dev
@@ -78,6 +95,25 @@ def read_raw_sector(device):
             pytest.skip(str(e))
     return _read
 
+@pytest.fixture
+def read_uncached_sector(device):
+    """
+    Fixture: like read_raw_sector, but past the host's block cache, for what
+    PicoVD changes between two reads of the same sector.
+    """
+    def _read(lba):
+        buf = mmap.mmap(-1, 512)  # Page aligned, as O_DIRECT needs
+        try:
+            fd = os.open(device, os.O_RDONLY | getattr(os, "O_DIRECT", 0))
+        except OSError as e:
+            pytest.skip(f"Cannot read {device} uncached: {e}")
+        try:
+            os.preadv(fd, [buf], lba * 512)
+        finally:
+            os.close(fd)
+        return bytes(buf)
+    return _read
+
 @pytest.fixture
 def bootsector_data(device, read_raw_sector):
     """Fixture: 512 bytes of exFAT boot sector (LBA 0)."""
@@ -137,3 +173,17 @@ def cluster_chain_reader(read_raw_sector, bootsector_data):
     def _reader(start_cluster):
         return _ccr(read_raw_sector, bootsector_data, start_cluster)
     return _reader
+
+@pytest.fixture
+def root_file(read_raw_sector, bootsector_data):
+    """
+    Returns a function that looks up a file or directory of the root directory by name,
+    as (first_cluster, data_length).  Skips the test if it is not there, i.e. the option that adds it is off.
+    """
+    def _lookup(name):
+        for entry_name, cluster, length in list_file_entries(read_raw_sector, bootsector_data,
+                                                             directories=True):
+            if entry_name == name:
+                return cluster, length
+        pytest.skip(f"{name} not found; {ROOT_FILE_OPTIONS.get(name, 'its option')} is off")
+    return _lookup
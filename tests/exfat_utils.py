@@ -103,3 +103,52 @@ def cluster_chain_reader(read_sector, bootsector_data, start_cluster):
         return bytes(result[:data_length])
 
     return _read_chain
+
+def parse_file_entries(data, directories=False):
+    """
+    List the files of the directory contents `data`, as (name, first_cluster, data_length);
+    the subdirectories too, if `directories`.
+    """
+    files = []
+    for offset in range(0, len(data), 32):
+        if data[offset] != 0x85:
+            continue
+        attributes = struct.unpack_from('<H', data, offset + 4)[0]
+        if attributes & 0x10 and not directories:
+            continue
+        secondary_count = data[offset + 1]
+        stream = offset + 32
+        name_length = data[stream + 3]
+        first_cluster, data_length = struct.unpack_from('<IQ', data, stream + 20)
+        chars = bytearray()
+        for n in range(2, secondary_count + 1):
+            chars += data[offset + 32 * n + 2 : offset + 32 * n + 32]
+        files.append((chars.decode('utf-16-le')[:name_length], first_cluster, data_length))
+    return files
+
+def list_file_entries(read_raw_sector, bootsector_data, root_dir_clusters=3, directories=False):
+    """
+    List the files in the root directory, which PicoVD makes
+    `root_dir_clusters` long, as (name, first_cluster, data_length);
+    the subdirectories too, if `directories`.
+    """
+    cluster_heap_offset = struct.unpack_from('<I', bootsector_data, 88)[0]
+    root_dir_cluster    = struct.unpack_from('<I', bootsector_data, 0x60)[0]
+    sectors_per_cluster = 1 << struct.unpack_from('<B', bootsector_data, 0x6D)[0]
+    root_lba = cluster_heap_offset + (root_dir_cluster - 2) * sectors_per_cluster
+
+    data = bytearray()
+    for i in range(root_dir_clusters * sectors_per_cluster):
+        data.extend(read_raw_sector(root_lba + i))
+    return parse_file_entries(data, directories)
+
+def find_file_entry(read_raw_sector, bootsector_data, name, root_dir_clusters=3):
+    """
+    Locate a file by name in the root directory.  Returns (first_cluster, data_length),
+    or None if not found.
+    """
+    for file_name, first_cluster, data_length in list_file_entries(read_raw_sector, bootsector_data,
+                                                                   root_dir_clusters):
+        if file_name == name:
+            return first_cluster, data_length
+    return None
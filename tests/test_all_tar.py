@@ -0,0 +1,48 @@
+"""
+tests/test_all_tar.py
+
+Validate ALL.TAR (PICOVD_TAR_ENABLED):
+  - It is a ustar archive whose members are the other files of the root directory,
+    in directory order, each with its size.
+  - The headers and payloads line up with sectors.
+  - The files with stable contents read the same in the archive as on their own.
+"""
+
+import io
+import tarfile
+
+import pytest
+
+from exfat_utils import list_file_entries
+
+# Files whose contents change between two reads
+VOLATILE = {"SRAM.BIN", "STATS.TXT", "TRACE.BIN", "CHANGING.TXT", "SRAMMAP.BIN", "FLASHMAP.BIN", "MANIFEST.TXT",
+            "STDOUT.TXT", "STDERR.TXT", "LOG.TXT", "GMON.OUT"}
+
+
+@pytest.fixture
+def all_tar(root_file, read_raw_sector, bootsector_data, cluster_chain_reader):
+    cluster, length = root_file("ALL.TAR")
+    files = list_file_entries(read_raw_sector, bootsector_data)
+    assert length % 512 == 0, "ALL.TAR is not whole sectors"
+    data = cluster_chain_reader(cluster)(length)
+    return files, tarfile.open(fileobj=io.BytesIO(data), format=tarfile.USTAR_FORMAT)
+
+
+def test_all_tar_members_are_the_files(all_tar):
+    files, tar = all_tar
+    members = tar.getmembers()
+    expected = [(name[:100], length) for name, _, length in files if name != "ALL.TAR"]
+    assert [(m.name, m.size) for m in members] == expected[:len(members)]
+    for m in members:
+        assert m.offset % 512 == 0 and m.offset_data % 512 == 0, f"{m.name} is not sector aligned"
+
+
+def test_all_tar_stable_contents(all_tar, cluster_chain_reader):
+    files, tar = all_tar
+    clusters = {name[:100]: (cluster, length) for name, cluster, length in files}
+    for m in tar.getmembers():
+        if m.name in VOLATILE or m.size == 0:
+            continue
+        cluster, length = clusters[m.name]
+        assert tar.extractfile(m).read() == cluster_chain_reader(cluster)(length), m.name
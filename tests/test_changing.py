@@ -0,0 +1,44 @@
+"""
+tests/test_changing.py
+
+Validate CHANGING.TXT (PICOVD_CHANGING_FILE_ENABLED), rendered through the text engine:
+  - It has the size of its directory entry, in numbered 14-character lines.
+  - A sector read on its own matches the same sector read within the whole file,
+    but for the uptime, which changes.
+"""
+
+import re
+import struct
+
+import pytest
+
+LINE = re.compile(rb"^ *(\d+) \d{2,}:\d{2}:\d{2}\n$")
+LINE_LENGTH = 14
+
+
+@pytest.fixture
+def changing_file(root_file, cluster_chain_reader):
+    first_cluster, data_length = root_file("CHANGING.TXT")
+    return first_cluster, data_length, cluster_chain_reader(first_cluster)(data_length)
+
+
+def test_changing_numbered_lines(changing_file):
+    _, data_length, data = changing_file
+    assert len(data) == data_length
+    assert data_length % LINE_LENGTH == 0
+    for i in range(0, data_length, LINE_LENGTH):
+        m = LINE.match(data[i:i + LINE_LENGTH])
+        assert m, f"Bad line at {i}: {data[i:i + LINE_LENGTH]!r}"
+        assert int(m.group(1)) == i // LINE_LENGTH
+
+
+def test_changing_sector_alone(changing_file, read_raw_sector, bootsector_data):
+    first_cluster, data_length, data = changing_file
+    heap = struct.unpack_from("<I", bootsector_data, 88)[0]
+    spc = 1 << bootsector_data[109]
+    sector = (data_length - 1) // 512  # The last, rendered from the last checkpoint
+    alone = read_raw_sector(heap + (first_cluster - 2) * spc + sector)
+    within = data[sector * 512:(sector + 1) * 512]
+    numbers = re.compile(rb"^ *\d+ ", re.M)
+    assert numbers.findall(alone[:len(within)]) == numbers.findall(within)
+    assert alone[len(within):] == bytes(512 - len(within))
@@ -0,0 +1,73 @@
+"""
+tests/test_gcov.py
+
+Validate the GCOV directory (configured with -DPICOVD_GCOV=ON):
+  - Each file in it is a .gcda file: the header, then whole records, with
+    the counters that are all zero written out, then a zero tag.
+  - gcov reads the files back with the .gcno files of the build, when the
+    build tree is at the paths compiled in, i.e. on the build host.
+    Set GCOV to the gcov of the toolchain, else arm-none-eabi-gcov is used.
+"""
+
+import os
+import shutil
+import struct
+import subprocess
+
+import pytest
+
+from exfat_utils import parse_file_entries
+
+GCDA_MAGIC = 0x67636461  # "gcda"
+GCDA_HEADER = 16         # Magic, version, stamp and checksum
+GCOV_TAG_FUNCTION = 0x01000000
+
+
+@pytest.fixture
+def gcda_files(root_file, cluster_chain_reader):
+    cluster, length = root_file("GCOV")
+    files = parse_file_entries(cluster_chain_reader(cluster)(length))
+    assert files, "No .gcda files in GCOV"
+    return {name: cluster_chain_reader(cluster)(length) for name, cluster, length in files}
+
+
+def test_gcov_records(gcda_files):
+    for name, data in gcda_files.items():
+        assert name.endswith(".gcda"), name
+        assert struct.unpack_from("<I", data, 0)[0] == GCDA_MAGIC, name
+        pos, functions = GCDA_HEADER, 0
+        while pos < len(data):
+            tag = struct.unpack_from("<I", data, pos)[0]
+            if tag == 0:
+                pos += 4  # The end
+                break
+            length = struct.unpack_from("<I", data, pos + 4)[0]
+            assert length < 0x80000000, f"{name}: record {tag:#x} at {pos} has a negative length"
+            functions += tag == GCOV_TAG_FUNCTION
+            pos += 8 + length
+        assert pos == len(data), f"{name}: not ended where the directory says"
+        assert functions > 0, f"{name}: no functions"
+
+
+def test_gcov_reads_back(gcda_files, tmp_path):
+    tool = os.environ.get("GCOV") or shutil.which("arm-none-eabi-gcov")
+    if tool is None:
+        pytest.skip("No gcov; set GCOV")
+    checked = 0
+    for i, (name, data) in enumerate(sorted(gcda_files.items())):
+        # Unmangled, the path of the .gcda file, next to the .gcno file of the build
+        path = name.replace("#", "/")
+        notes = path[:-len(".gcda")] + ".gcno"
+        if not os.path.isfile(notes):
+            continue
+        shutil.copyfile(notes, tmp_path / f"{i}.gcno")
+        (tmp_path / f"{i}.gcda").write_bytes(data)
+        result = subprocess.run([tool, "-n", "-o", str(tmp_path), f"{i}.gcda"],
+                                cwd=tmp_path, capture_output=True, text=True)
+        assert result.returncode == 0, f"{name}: {result.stderr}"
+        for complaint in ("corrupt", "mismatch", "version", "cannot open"):
+            assert complaint not in result.stderr.lower(), f"{name}: {result.stderr}"
+        assert "Lines executed" in result.stdout, f"{name}: {result.stdout}"
+        checked += 1
+    if checked == 0:
+        pytest.skip("No .gcno files at the paths compiled in; run on the build host")
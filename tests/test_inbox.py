@@ -0,0 +1,95 @@
+"""
+tests/test_inbox.py
+
+Validate the RAM-backed upload files (PICOVD_INBOX_ENABLED), e.g. INBOX.BIN:
+  - Data written to the file's clusters on the raw device reads back the same,
+    from the application buffer; nothing is written to the flash.
+  - The write, followed by an update of the file's directory entry, completes
+    exactly once, with the size in the entry, as the PicoVD tool logs in LOG.TXT.
+Both go around the host's cache: O_DIRECT on Linux, a raw /dev/rdisk on macOS.
+"""
+
+import mmap
+import os
+import re
+import struct
+import time
+
+import pytest
+
+from exfat_utils import find_file_entry, cluster_chain_reader
+
+INBOX_NAME = "INBOX.BIN"
+INBOX_IDLE_TIMEOUT = 1.0  # PICOVD_INBOX_IDLE_TIMEOUT_MS, in seconds
+COMPLETED = re.compile(r"^\[ *\d+\.\d{6}\] INBOX\.BIN: (\d+) bytes received$", re.M)
+
+
+@pytest.fixture
+def inbox(root_file):
+    cluster, length = root_file(INBOX_NAME)
+    return INBOX_NAME, cluster, length
+
+
+def raw_sector_io(device, lba, data=None):
+    """Write `data` to sector `lba`, or read it, uncached"""
+    buf = mmap.mmap(-1, 512)  # Page aligned, as O_DIRECT needs
+    try:
+        fd = os.open(device, os.O_RDWR | getattr(os, "O_DIRECT", 0))
+    except OSError as e:
+        pytest.skip(f"Cannot write to {device}: {e}")
+    try:
+        if data is None:
+            os.preadv(fd, [buf], lba * 512)
+            return bytes(buf)
+        buf.write(data)
+        os.pwritev(fd, [buf], lba * 512)
+        os.fsync(fd)
+    finally:
+        os.close(fd)
+
+
+def logged_completions(read_sector, bootsector_data):
+    """The lengths of the completions in LOG.TXT, oldest first, or None without LOG.TXT"""
+    entry = find_file_entry(read_sector, bootsector_data, "LOG.TXT")
+    if entry is None:
+        return None
+    cluster, length = entry
+    text = cluster_chain_reader(read_sector, bootsector_data, cluster)(length).decode("ascii") if length else ""
+    return [int(m.group(1)) for m in COMPLETED.finditer(text)]
+
+
+def announce_length(device, bootsector_data, cluster, length):
+    """Update the size in the stream extension entry of the file at `cluster`, as the host does"""
+    heap = int.from_bytes(bootsector_data[88:92], "little")
+    sectors_per_cluster = 1 << bootsector_data[0x6D]
+    root_lba = heap + (int.from_bytes(bootsector_data[0x60:0x64], "little") - 2) * sectors_per_cluster
+    for lba in range(root_lba, root_lba + 3 * sectors_per_cluster):
+        sector = bytearray(raw_sector_io(device, lba))
+        for at in range(0, 512, 32):
+            if sector[at] == 0xC0 and struct.unpack_from("<I", sector, at + 20)[0] == cluster:
+                struct.pack_into("<Q", sector, at + 8, length)   # ValidDataLength
+                struct.pack_into("<Q", sector, at + 24, length)  # DataLength
+                raw_sector_io(device, lba, bytes(sector))
+                return
+    pytest.fail(f"No stream extension entry for cluster 0x{cluster:x}")
+
+
+def test_inbox_round_trip(inbox, device, bootsector_data, read_uncached_sector):
+    name, cluster, length = inbox
+    heap = int.from_bytes(bootsector_data[88:92], "little")
+    sectors_per_cluster = 1 << bootsector_data[0x6D]
+    lba = heap + (cluster - 2) * sectors_per_cluster
+    before = logged_completions(read_uncached_sector, bootsector_data)
+
+    pattern = bytes((i * 7 + 3) & 0xFF for i in range(512))
+    raw_sector_io(device, lba, pattern)
+    assert raw_sector_io(device, lba) == pattern, f"{name} does not read back what was written"
+    print(f"\n{name}: {length} bytes at cluster 0x{cluster:x}")
+
+    announced = 500  # Covered by the sector written
+    announce_length(device, bootsector_data, cluster, announced)
+    time.sleep(INBOX_IDLE_TIMEOUT + 0.5)  # Long enough for a second completion, on the timeout
+    after = logged_completions(read_uncached_sector, bootsector_data)
+    if before is None:
+        pytest.skip("LOG.TXT not found; PICOVD_LOG_ENABLED is off, so the completion cannot be checked")
+    assert after[len(before):] == [announced], f"{name} completed {after[len(before):]} after its entry was updated"
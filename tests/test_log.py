@@ -0,0 +1,38 @@
+"""
+tests/test_log.py
+
+Validate the deferred-format log (PICOVD_LOG_ENABLED), LOG.TXT:
+  - Every line starts with a timestamp, and the timestamps do not go backwards.
+  - The PicoVD tool logs "USB mounted" when the host configures it.
+"""
+
+import re
+
+import pytest
+
+LINE = re.compile(r"^\[ *(\d+)\.(\d{6})\] ")
+
+
+@pytest.fixture
+def log_text(root_file, cluster_chain_reader):
+    cluster, length = root_file("LOG.TXT")
+    if length == 0:
+        pytest.skip("Nothing logged yet")
+    return cluster_chain_reader(cluster)(length).decode("ascii")
+
+
+def test_log_lines(log_text):
+    assert log_text.endswith("\n"), "LOG.TXT does not end with a whole line"
+    last = 0
+    for line in log_text.splitlines():
+        if not line.strip():
+            continue  # Overwritten since the directory was read
+        m = LINE.match(line)
+        assert m, f"No timestamp: {line!r}"
+        t = int(m.group(1)) * 1000000 + int(m.group(2))
+        assert t >= last or last - t > 2**31, f"Timestamp goes backwards: {line!r}"
+        last = t
+
+
+def test_log_mounted(log_text):
+    assert "] USB mounted" in log_text
@@ -0,0 +1,94 @@
+"""
+tests/test_lz4_views.py
+
+Validate the LZ4 views of the flash (PICOVD_LZ4_ENABLED), "<partition>.lz4"
+next to each partition file, and FLASH.BIN.LZ4 next to FLASH.BIN:
+  - Each is a single LZ4 frame of independent blocks, with the content size.
+  - The directory entry advertises the exact size of the frame.
+  - It decompresses to the file it is a view of.
+The decoder below is a minimal one, so that the test needs no LZ4 package.
+"""
+
+import struct
+
+import pytest
+
+from exfat_utils import list_file_entries
+
+LZ4_FRAME_MAGIC = 0x184D2204
+LZ4_BLOCK_STORED = 0x80000000
+
+
+def lz4_block_decompress(src):
+    out = bytearray()
+    i = 0
+    while True:
+        token = src[i]
+        i += 1
+        literals = token >> 4
+        if literals == 15:
+            while True:
+                b = src[i]
+                i += 1
+                literals += b
+                if b != 255:
+                    break
+        out += src[i:i + literals]
+        i += literals
+        if i == len(src):
+            return bytes(out)  # The last sequence has no match
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        assert 0 < offset <= len(out), "Match offset out of range"
+        match = (token & 15) + 4
+        if token & 15 == 15:
+            while True:
+                b = src[i]
+                i += 1
+                match += b
+                if b != 255:
+                    break
+        for _ in range(match):  # Byte by byte, as matches may overlap
+            out.append(out[-offset])
+
+
+def lz4_frame_decompress(frame):
+    magic, flg, bd = struct.unpack_from("<IBB", frame, 0)
+    assert magic == LZ4_FRAME_MAGIC
+    assert flg & 0xC0 == 0x40, "Frame version"
+    assert flg & 0x20, "Blocks must be independent"
+    assert flg & 0x08, "Content size must be present"
+    content_size = struct.unpack_from("<Q", frame, 6)[0]
+    pos = 15
+    out = bytearray()
+    while True:
+        size = struct.unpack_from("<I", frame, pos)[0]
+        pos += 4
+        if size == 0:
+            break
+        data = frame[pos:pos + (size & ~LZ4_BLOCK_STORED)]
+        pos += len(data)
+        out += data if size & LZ4_BLOCK_STORED else lz4_block_decompress(data)
+    assert pos == len(frame), "Trailing bytes after the end mark"
+    assert len(out) == content_size
+    return bytes(out)
+
+
+@pytest.fixture
+def lz4_views(read_raw_sector, bootsector_data):
+    files = {name: (cluster, length) for name, cluster, length
+             in list_file_entries(read_raw_sector, bootsector_data)}
+    views = [(name, name[:-4]) for name in files if name.lower().endswith(".lz4")]
+    if not views:
+        pytest.skip("No LZ4 views; PICOVD_LZ4_ENABLED is off, or no partitions")
+    return files, views
+
+
+def test_lz4_views_decompress_to_their_files(lz4_views, cluster_chain_reader):
+    files, views = lz4_views
+    for view, source in views:
+        assert source in files, f"{view} without {source}"
+        frame = cluster_chain_reader(files[view][0])(files[view][1])
+        data = cluster_chain_reader(files[source][0])(files[source][1])
+        assert lz4_frame_decompress(frame) == data, f"{view} does not match {source}"
+        print(f"\n{source}: {len(data)} B, {view}: {len(frame)} B")
@@ -0,0 +1,46 @@
+"""
+tests/test_manifest.py
+
+Validate MANIFEST.TXT (PICOVD_MANIFEST_ENABLED):
+  - It lists the files of the root directory, with their sizes and first clusters.
+  - Each SHA-256 it gives is the digest of the file's contents.
+"""
+
+import hashlib
+
+import pytest
+
+from exfat_utils import list_file_entries
+
+
+@pytest.fixture
+def manifest(root_file, read_raw_sector, bootsector_data, cluster_chain_reader):
+    cluster, length = root_file("MANIFEST.TXT")
+    files = {name: (cluster, length) for name, cluster, length
+             in list_file_entries(read_raw_sector, bootsector_data)}
+    lines = cluster_chain_reader(cluster)(length).decode("ascii").split("\n")
+    assert lines[0].startswith("PicoVD manifest v1")
+    assert lines[1].split() == ["sha256", "size", "cluster", "gen", "name"]
+    entries = []
+    for line in lines[2:]:
+        if line.strip():
+            digest, size, first_cluster, _, name = line.split(None, 4)
+            entries.append((name.rstrip(), digest, int(size), int(first_cluster, 16)))
+    return files, entries
+
+
+def test_manifest_lists_root_dir_files(manifest):
+    files, entries = manifest
+    assert {name for name, *_ in entries} <= set(files)
+    for name, _, size, first_cluster in entries:
+        assert files[name] == (first_cluster, size), name
+
+
+def test_manifest_digests_match_contents(manifest, cluster_chain_reader):
+    _, entries = manifest
+    hashed = [(name, digest, size, cluster) for name, digest, size, cluster in entries if digest != "-"]
+    if not hashed:
+        pytest.skip("No files with stable contents")
+    for name, digest, size, cluster in hashed:
+        data = cluster_chain_reader(cluster)(size) if size else b""
+        assert hashlib.sha256(data).hexdigest() == digest, name
@@ -0,0 +1,183 @@
+"""
+tests/test_msc_luns.py
+
+The raw logical units next to the exFAT volume on LUN 0 (see
+PICOVD_MSC_FLASH_LUN_ENABLED and PICOVD_MSC_PARTITION_LUNS):
+  - GET MAX LUN reports them, and INQUIRY names each of them.
+  - Each LUN has a serial number of its own.
+  - A LUN either has a medium with a capacity, or reports NOT READY,
+    MEDIUM NOT PRESENT, as a partition LUN without its partition.
+  - Reads are checked against the capacity of the addressed LUN.
+  - A full dump of the flash LUN serves the erased pages without XIP
+    (PICOVD_FLASH_ERASED_MAP_ENABLED), as counted in STATS.TXT; run with
+    -s to see the XIP bytes avoided.
+"""
+
+import os
+import re
+import struct
+import time
+
+import pytest
+
+import conftest
+import exfat_params
+from test_msc_scsi_read_only import send_scsi, parse_sense
+
+BLOCK_SIZE = 512
+DATA_IN, NO_DATA = 1, 2
+
+SENSE_MEDIUM_NOT_PRESENT = (2, 0x3A, 0)
+SENSE_LBA_OUT_OF_RANGE   = (5, 0x21, 0)
+
+FLASH_LUN = 1
+FLASH_PAGE_SIZE = 4096
+STATS_START_CLUSTER = 0x1000  # PICOVD_STATS_START_CLUSTER
+STATS_SECTORS = 16
+
+
+def get_max_lun(dev):
+    """Bulk-Only Transport Get Max LUN, BOT §3.2: the highest LUN number."""
+    data = dev.ctrl_transfer(0xA1, 0xFE, 0, conftest.USB_MSC_IFACE, 1)
+    return data[0]
+
+
+def command(dev, lun, cdb, data_len=0):
+    cdb = bytes(cdb).ljust(16, b"\x00")
+    status, _, data = send_scsi(dev, lun=lun, scsi_cmd=cdb,
+                                data_dir=DATA_IN if data_len else NO_DATA, data_len=data_len)
+    return status, bytes(data or b"")
+
+
+def inquiry_product(dev, lun):
+    status, data = command(dev, lun, [0x12, 0, 0, 0, 36, 0], 36)
+    assert status == 0
+    return data[16:32].decode("ascii", "replace")
+
+
+def request_sense(dev, lun):
+    status, data = command(dev, lun, [0x03, 0, 0, 0, 18, 0], 18)
+    assert status == 0, "REQUEST SENSE failed"
+    return parse_sense(data)
+
+
+def settle(dev, lun, tries=5):
+    """Consume any pending Unit Attention; return the sense of a LUN that stays not ready."""
+    for _ in range(tries):
+        status, _ = command(dev, lun, [0x00])
+        if status == 0:
+            return None
+        sense = request_sense(dev, lun)
+        if sense[0] != 6:
+            return sense
+    pytest.fail(f"LUN {lun} did not settle")
+
+
+@pytest.fixture
+def luns(msc_usb_dev_device):
+    count = get_max_lun(msc_usb_dev_device) + 1
+    if count < 2:
+        pytest.skip("Built without the raw LUNs")
+    return range(count)
+
+
+def test_luns_are_named(msc_usb_dev_device, luns):
+    products = []
+    for lun in luns:
+        status, data = command(msc_usb_dev_device, lun, [0x12, 0, 0, 0, 36, 0], 36)
+        assert status == 0
+        products.append(data[16:32].rstrip(b"\x00 ").decode("ascii"))
+    assert products[0] == "Pico MSC Disk"
+    assert len(set(products)) == len(products), f"Duplicate product names: {products}"
+
+
+def test_luns_have_distinct_serials(msc_usb_dev_device, luns):
+    serials = []
+    for lun in luns:
+        status, data = command(msc_usb_dev_device, lun, [0x12, 1, 0x80, 0, 64, 0], 64)
+        assert status == 0
+        serials.append(data[4:4 + struct.unpack(">H", data[2:4])[0]])
+    assert len(set(serials)) == len(serials), f"Duplicate serial numbers: {serials}"
+
+
+def test_raw_lun_capacity_and_range(msc_usb_dev_device, luns):
+    dev = msc_usb_dev_device
+    for lun in luns[1:]:
+        sense = settle(dev, lun)
+        if sense is not None:
+            assert sense == SENSE_MEDIUM_NOT_PRESENT, f"LUN {lun}: sense {sense}"
+            continue
+
+        status, data = command(dev, lun, [0x25] + [0] * 9, 8)
+        assert status == 0
+        last_lba, block_size = struct.unpack(">II", data)
+        assert block_size == BLOCK_SIZE
+
+        # The last block reads, the one past it does not
+        status, data = command(dev, lun, [0x28, 0] + list(last_lba.to_bytes(4, "big")) + [0, 0, 1, 0],
+                               BLOCK_SIZE)
+        assert status == 0 and len(data) == BLOCK_SIZE, f"LUN {lun}: last block"
+        status, _ = command(dev, lun, [0x28, 0] + list((last_lba + 1).to_bytes(4, "big")) + [0, 0, 1, 0])
+        assert status == 1
+        assert request_sense(dev, lun) == SENSE_LBA_OUT_OF_RANGE
+
+
+def test_unsupported_lun_is_rejected(msc_usb_dev_device, luns):
+    # Past GET MAX LUN, with the LUN field of the CBW in range
+    if len(luns) == 16:
+        pytest.skip("All LUNs in use")
+    status, _ = command(msc_usb_dev_device, len(luns), [0x00])
+    assert status == 1
+
+
+def read_blocks(dev, lun, lba, blocks):
+    status, data = command(dev, lun, [0x28, 0] + list(lba.to_bytes(4, "big")) + [0]
+                           + list(blocks.to_bytes(2, "big")) + [0], blocks * BLOCK_SIZE)
+    assert status == 0, f"LUN {lun}: READ(10) at {lba} failed"
+    return data
+
+
+def config_enabled(name):
+    """True if picovd_config.h defines `name` as nonzero."""
+    path = os.path.join(os.path.dirname(__file__), os.pardir, "picovd_config.h")
+    with open(path) as f:
+        m = re.search(rf"^\s*#define\s+{name}\s+\(?(\d+)\)?", f.read(), re.MULTILINE)
+    return bool(m and int(m.group(1)))
+
+
+def flash_map_counters(dev):
+    """(erased, checked, xip bytes, skipped bytes) from STATS.TXT, or None."""
+    shift = int(exfat_params.EXFAT_SECTORS_PER_CLUSTER_SHIFT.strip("()uU"), 0)
+    heap = int(exfat_params.EXFAT_CLUSTER_HEAP_START_LBA.strip("()uU"), 0)
+    lba = heap + ((STATS_START_CLUSTER - 2) << shift)
+    text = read_blocks(dev, 0, lba, STATS_SECTORS).decode("ascii", "replace")
+    m = re.search(r"flashmap +(\d+)/ *(\d+) erased, xip +(\d+) B, skip +(\d+) B", text)
+    return tuple(int(g) for g in m.groups()) if m else None
+
+
+def test_flash_dump_skips_erased_pages(msc_usb_dev_device, luns):
+    dev = msc_usb_dev_device
+    if settle(dev, FLASH_LUN) is not None or "Flash" not in inquiry_product(dev, FLASH_LUN):
+        pytest.skip("No flash LUN")
+    settle(dev, 0)
+    time.sleep(2)  # Let the idle job map the flash
+    before = flash_map_counters(dev)
+    if not (config_enabled("PICOVD_STATS_ENABLED") and config_enabled("PICOVD_FLASH_ERASED_MAP_ENABLED")):
+        pytest.skip("STATS.TXT without the erased-page map")
+    assert before is not None, "STATS.TXT has no flashmap line"
+
+    status, data = command(dev, FLASH_LUN, [0x25] + [0] * 9, 8)
+    blocks = struct.unpack(">I", data[:4])[0] + 1
+    chunk = 128  # 64 KiB per READ(10)
+    dump = b"".join(read_blocks(dev, FLASH_LUN, lba, min(chunk, blocks - lba))
+                    for lba in range(0, blocks, chunk))
+    after = flash_map_counters(dev)
+
+    erased_pages = sum(1 for p in range(0, len(dump), FLASH_PAGE_SIZE)
+                       if dump[p:p + FLASH_PAGE_SIZE].count(0xFF) == FLASH_PAGE_SIZE)
+    xip, skipped = after[2] - before[2], after[3] - before[3]
+    print(f"\nflash dump: {len(dump)} B, {erased_pages} erased pages, "
+          f"{skipped} B served without XIP, {xip} B through XIP")
+    # Every byte is counted once, and only erased pages are skipped
+    assert xip + skipped >= len(dump)
+    assert skipped <= erased_pages * FLASH_PAGE_SIZE
@@ -0,0 +1,111 @@
+"""
+tests/test_msc_scsi_replay.py
+
+Replay the SCSI command sequences that Linux, macOS and Windows send when a
+USB disk is attached (see test_msc_scsi_replay.json) against the live device,
+over raw USB MSC Bulk-Only Transport:
+  - Each command completes with the expected status, and a failed command
+    leaves the expected sense data.
+  - Each response has the expected length and leading bytes.
+  - The cost of each command, as seen by the host, is reported; run with -s
+    to see it.  The device side view is in the command table of STATS.TXT.
+"""
+
+import json
+import os
+import time
+from collections import defaultdict
+
+import pytest
+
+import exfat_params
+from test_msc_scsi_read_only import send_scsi, parse_sense
+
+BLOCK_SIZE = 512
+LAST_LBA = int(exfat_params.VIRTUAL_DISK_SIZE.strip("()"), 0) // BLOCK_SIZE - 1
+
+SCSI_CMD_TEST_UNIT_READY = 0x00
+SCSI_CMD_REQUEST_SENSE   = 0x03
+
+DATA_IN, NO_DATA = 1, 2
+
+with open(os.path.join(os.path.dirname(__file__), "test_msc_scsi_replay.json")) as f:
+    SEQUENCES = {host: seq for host, seq in json.load(f).items() if not host.startswith("_")}
+
+PLACEHOLDERS = {
+    "LAST_LBA32":   (LAST_LBA).to_bytes(4, "big").hex(" "),
+    "BLOCKS32":     (LAST_LBA + 1).to_bytes(4, "big").hex(" "),
+    "BLOCK_SIZE32": BLOCK_SIZE.to_bytes(4, "big").hex(" "),
+}
+
+
+def cdb_bytes(text):
+    return bytes.fromhex(text).ljust(16, b"\x00")
+
+
+def request_sense(dev):
+    cdb = bytes([SCSI_CMD_REQUEST_SENSE, 0, 0, 0, 18, 0]).ljust(16, b"\x00")
+    status, _, data = send_scsi(dev, lun=0, scsi_cmd=cdb, data_dir=DATA_IN, data_len=18)
+    assert status == 0, "REQUEST SENSE failed"
+    return parse_sense(bytes(data))
+
+
+def settle(dev, tries=50):
+    """Wait until the device is ready, consuming any pending Unit Attention."""
+    tur = bytes(16)
+    for _ in range(tries):
+        status, _, _ = send_scsi(dev, lun=0, scsi_cmd=tur, data_dir=NO_DATA, data_len=0)
+        if status == 0:
+            return
+        request_sense(dev)
+        time.sleep(0.1)
+    pytest.fail("Device did not become ready")
+
+
+def match(data, pattern):
+    """True if `data` starts with the hex `pattern`, where ?? matches any byte."""
+    expected = pattern.format(**PLACEHOLDERS).split()
+    if len(data) < len(expected):
+        return False
+    return all(e == "??" or int(e, 16) == d for e, d in zip(expected, data))
+
+
+def replay(dev, step):
+    cdb = cdb_bytes(step["cdb"])
+    data_len = step["in"]
+    start = time.perf_counter()
+    status, _, data = send_scsi(dev, lun=0, scsi_cmd=cdb,
+                                data_dir=DATA_IN if data_len else NO_DATA, data_len=data_len)
+    elapsed = time.perf_counter() - start
+    data = bytes(data or b"")
+    label = step["cdb"]
+
+    assert status == step["status"], f"{label}: status {status}"
+    if "sense" in step:
+        assert list(request_sense(dev)) == step["sense"], f"{label}: sense"
+    if "length" in step:
+        assert len(data) == step["length"], f"{label}: response length {len(data)}"
+    if "data" in step:
+        assert match(data, step["data"]), f"{label}: response {data[:32].hex(' ')}"
+    if "ascii" in step:
+        offset, text = step["ascii"]
+        assert data[offset:offset + len(text)] == text.encode("ascii"), f"{label}: response text"
+    return cdb[0], elapsed
+
+
+@pytest.mark.parametrize("host", sorted(SEQUENCES))
+def test_replay_enumeration(msc_usb_dev_device, host, record_property):
+    dev = msc_usb_dev_device
+    settle(dev)
+
+    costs = defaultdict(list)
+    for step in SEQUENCES[host]:
+        opcode, elapsed = replay(dev, step)
+        costs[opcode].append(elapsed)
+
+    print(f"\n{host}: cost per command, host round trip")
+    print(f"  {'opcode':>6} {'count':>5} {'mean us':>9} {'max us':>9}")
+    for opcode, times in sorted(costs.items()):
+        mean_us = 1e6 * sum(times) / len(times)
+        print(f"  {opcode:#06x} {len(times):5} {mean_us:9.0f} {1e6 * max(times):9.0f}")
+        record_property(f"cost_us_{opcode:02x}", round(mean_us))
@@ -0,0 +1,65 @@
+"""
+tests/test_page_maps.py
+
+Validate the page maps (PICOVD_PAGEMAP_ENABLED), FLASHMAP.BIN and SRAMMAP.BIN:
+  - Each has a "PVPM" header and a record per 4 kB page.
+  - SRAMMAP.BIN has a record per page of SRAM.BIN.
+  - The FLASHMAP.BIN records of the pages of each partition file match
+    the CRC32 and the erased/zero flags of the file's whole pages.
+"""
+
+import struct
+import zlib
+
+import pytest
+
+from exfat_utils import list_file_entries
+
+FLASH_START_CLUSTER = 0xF000  # PICOVD_FLASH_START_CLUSTER, also the partition files'
+HEADER = struct.Struct("<4sHHII")
+RECORD = struct.Struct("<IB3x")
+FLAG_ERASED, FLAG_ZERO = 0x01, 0x02
+
+
+@pytest.fixture
+def files(read_raw_sector, bootsector_data):
+    return {name: (cluster, length) for name, cluster, length
+            in list_file_entries(read_raw_sector, bootsector_data)}
+
+
+def read_map(root_file, cluster_chain_reader, name):
+    cluster, length = root_file(name)
+    data = cluster_chain_reader(cluster)(length)
+    magic, version, record_size, page_size, pages = HEADER.unpack_from(data)
+    assert magic == b"PVPM" and version == 1
+    assert record_size == RECORD.size
+    assert len(data) == HEADER.size + pages * record_size
+    return page_size, [RECORD.unpack_from(data, HEADER.size + i * record_size) for i in range(pages)]
+
+
+def test_sram_map_covers_sram_file(files, root_file, cluster_chain_reader):
+    page_size, records = read_map(root_file, cluster_chain_reader, "SRAMMAP.BIN")
+    if "SRAM.BIN" in files:
+        assert len(records) * page_size == files["SRAM.BIN"][1]
+    for _, flags in records:
+        assert flags in (0, FLAG_ERASED, FLAG_ZERO)
+
+
+def test_flash_map_matches_partition_files(files, root_file, cluster_chain_reader):
+    page_size, records = read_map(root_file, cluster_chain_reader, "FLASHMAP.BIN")
+    checked = 0
+    for name, (cluster, length) in files.items():
+        if not FLASH_START_CLUSTER <= cluster < FLASH_START_CLUSTER + len(records) or name == "FLASHMAP.BIN":
+            continue
+        data = cluster_chain_reader(cluster)(length)
+        first_page = cluster - FLASH_START_CLUSTER
+        for i in range(length // page_size):
+            page = data[i * page_size:(i + 1) * page_size]
+            crc, flags = records[first_page + i]
+            assert crc == zlib.crc32(page), f"{name}: page {i}"
+            expected = (FLAG_ERASED if page == b"\xff" * page_size else 0) \
+                     | (FLAG_ZERO if page == bytes(page_size) else 0)
+            assert flags == expected, f"{name}: page {i} flags"
+            checked += 1
+    if checked == 0:
+        pytest.skip("No flash files with whole pages to compare with")
@@ -0,0 +1,49 @@
+"""
+tests/test_profile.py
+
+Validate the PC-sampling profile (PICOVD_PROFILE_ENABLED), GMON.OUT:
+  - It is a gmon.out file, version 1, for a 32-bit target: a histogram
+    record, then call arc records, and nothing else.
+  - The histogram covers the RP2350 flash or SRAM, and has samples.
+"""
+
+import struct
+
+import pytest
+
+GMON_TAG_TIME_HIST = 0
+GMON_TAG_CG_ARC = 1
+
+
+@pytest.fixture
+def gmon(root_file, cluster_chain_reader):
+    first_cluster, data_length = root_file("GMON.OUT")
+    return cluster_chain_reader(first_cluster)(data_length)
+
+
+def test_profile_records(gmon):
+    assert gmon[:4] == b"gmon"
+    assert struct.unpack_from("<I", gmon, 4)[0] == 1
+    pos, hists, arcs = 20, 0, 0
+    while pos < len(gmon):
+        tag = gmon[pos]
+        if tag == GMON_TAG_TIME_HIST:
+            low, high, size, rate = struct.unpack_from("<IIII", gmon, pos + 1)
+            assert gmon[pos + 17:pos + 24] == b"seconds"
+            assert low < high and rate > 0
+            pos += 33 + 2 * size
+            hists += 1
+        elif tag == GMON_TAG_CG_ARC:
+            pos += 13
+            arcs += 1
+        else:
+            pytest.fail(f"Unknown record tag {tag} at {pos}")
+    assert pos == len(gmon)
+    assert hists == 1
+
+
+def test_profile_samples(gmon):
+    low, high, size, rate = struct.unpack_from("<IIII", gmon, 21)
+    assert low >> 28 in (0x1, 0x2), f"Text at {low:#x}, neither flash nor SRAM"
+    counts = struct.unpack_from(f"<{size}H", gmon, 53)
+    assert sum(counts) > 0, "No samples"
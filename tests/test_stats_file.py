@@ -0,0 +1,44 @@
+"""
+tests/test_stats_file.py
+
+Validate the live STATS.TXT file (PICOVD_STATS_ENABLED):
+  - It consists of fixed-width 64-byte lines, each ending in a newline.
+  - It has a row per region, and the root directory row counts the
+    directory reads done by this very test.
+  - It has a row per SCSI command, and the host has sent an INQUIRY.
+"""
+
+import pytest
+
+LINE_LENGTH = 64
+
+
+@pytest.fixture
+def stats_lines(root_file, cluster_chain_reader):
+    first_cluster, data_length = root_file("STATS.TXT")
+    data = cluster_chain_reader(first_cluster)(data_length)
+    assert data_length % LINE_LENGTH == 0
+    return [data[i:i + LINE_LENGTH] for i in range(0, data_length, LINE_LENGTH)]
+
+
+def test_stats_fixed_width_lines(stats_lines):
+    for line in stats_lines:
+        assert line.endswith(b"\n")
+        assert b"\n" not in line[:-1]
+        line.decode("ascii")
+
+
+def test_stats_counts_root_dir_reads(stats_lines):
+    assert stats_lines[0].startswith(b"PicoVD read statistics v1")
+    # The counters table comes first; the histogram rows repeat the region names
+    row = next((line for line in stats_lines[2:] if line.startswith(b"rootdir ")), None)
+    assert row is not None, "No root directory row"
+    calls = int(row.split()[1])
+    assert calls > 0
+
+
+def test_stats_counts_scsi_commands(stats_lines):
+    row = next((line for line in stats_lines if line.startswith(b"inquiry ")), None)
+    assert row is not None, "No INQUIRY row"
+    calls = int(row.split()[1])
+    assert calls > 0
@@ -0,0 +1,54 @@
+"""
+tests/test_stdio.py
+
+Validate the console output files (PICOVD_STDIO_ENABLED), STDOUT.TXT and STDERR.TXT:
+  - Each is no longer than its ring, and an empty one has no cluster.
+  - STDOUT.TXT is text, e.g. the boot phases the PicoVD tool prints once mounted.
+  - Read again after the directory, STDOUT.TXT keeps what it held and only grows,
+    and once its ring has wrapped, still starts with the oldest byte.
+"""
+
+import pytest
+
+from exfat_utils import find_file_entry, cluster_chain_reader
+
+RING_SIZE = 0x2000  # PICOVD_STDIO_RING_SIZE
+
+
+def read_stdout(read_sector, bootsector_data):
+    """Read the directory, which takes the window of the ring, then the file within it"""
+    cluster, length = find_file_entry(read_sector, bootsector_data, "STDOUT.TXT")
+    return cluster_chain_reader(read_sector, bootsector_data, cluster)(length) if length else b""
+
+
+@pytest.mark.parametrize("name", ["STDOUT.TXT", "STDERR.TXT"])
+def test_stdio_file_size(root_file, name):
+    cluster, length = root_file(name)
+    assert length <= RING_SIZE, f"{name} is longer than its ring"
+    assert (cluster == 0) == (length == 0), f"{name} has {length} bytes at cluster 0x{cluster:x}"
+
+
+def test_stdout_is_text(root_file, cluster_chain_reader):
+    cluster, length = root_file("STDOUT.TXT")
+    if length == 0:
+        pytest.skip("Nothing printed yet")
+    data = cluster_chain_reader(cluster)(length)
+    text = data.decode("ascii", errors="replace")
+    assert "\0" not in text, "STDOUT.TXT has NUL bytes within its length"
+    print(f"\nSTDOUT.TXT, {length} bytes, ends with:\n{text[-200:]}")
+
+
+def test_stdout_appends(root_file, read_uncached_sector, bootsector_data):
+    root_file("STDOUT.TXT")
+    before = read_stdout(read_uncached_sector, bootsector_data)
+    if not before:
+        pytest.skip("Nothing printed yet")
+    after = read_stdout(read_uncached_sector, bootsector_data)
+    assert len(after) >= len(before), "STDOUT.TXT shrank"
+    if len(after) < RING_SIZE:
+        assert after.startswith(before), "STDOUT.TXT changed what it held"
+    else:
+        # Wrapped: the newest bytes of the first read are still there, followed by
+        # anything printed since, unless a whole ring was printed in between
+        tail = before[-64:]
+        assert tail in after, "STDOUT.TXT lost the end of what it held"
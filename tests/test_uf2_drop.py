@@ -0,0 +1,45 @@
+"""
+tests/test_uf2_drop.py
+
+Validate the free clusters of the UF2 drop zone (PICOVD_UF2_DROP_ENABLED):
+  - The allocation bitmap marks one run of clusters free, and no other.
+  - No file of the root directory has a cluster in that run.
+Writing a .uf2 file into it reprograms the flash, so that is left to tools/uf2_drop_sim.c.
+"""
+
+import struct
+
+import pytest
+
+from exfat_utils import list_file_entries
+
+
+def free_runs(bitmap):
+    runs, start = [], None
+    for i in range(len(bitmap) * 8):
+        free = not (bitmap[i // 8] >> (i % 8)) & 1
+        if free and start is None:
+            start = i
+        elif not free and start is not None:
+            runs.append((start + 2, i - start))
+            start = None
+    if start is not None:
+        runs.append((start + 2, len(bitmap) * 8 - start))
+    return runs
+
+
+def test_uf2_drop_zone_is_free(allocation_bitmap_entry, cluster_chain_reader, read_raw_sector, bootsector_data):
+    first_cluster, data_length = struct.unpack_from('<IQ', allocation_bitmap_entry, 20)
+    cluster_count = struct.unpack_from('<I', bootsector_data, 92)[0]
+    bitmap = cluster_chain_reader(first_cluster)(data_length)
+    runs = free_runs(bitmap[:(cluster_count + 7) // 8])
+    if not runs:
+        pytest.skip("No free clusters; PICOVD_UF2_DROP_ENABLED is off")
+    assert len(runs) == 1, f"Free clusters in more than one run: {runs}"
+
+    start, length = runs[0]
+    cluster_bytes = 512 << struct.unpack_from('<B', bootsector_data, 0x6D)[0]
+    for name, cluster, size in list_file_entries(read_raw_sector, bootsector_data):
+        clusters = (size + cluster_bytes - 1) // cluster_bytes
+        assert cluster + clusters <= start or cluster >= start + length, f"{name} is in the drop zone"
+    print(f"\nUF2 drop zone: {length} clusters from 0x{start:x}")
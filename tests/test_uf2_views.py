@@ -0,0 +1,65 @@
+"""
+tests/test_uf2_views.py
+
+Validate the UF2 views of the flash (PICOVD_UF2_ENABLED), "<partition>.uf2"
+next to each partition file, and FLASH.UF2 next to FLASH.BIN:
+  - Each sector is a UF2 block with both magics and the family ID flag.
+  - Blocks are numbered in order, with the same total and family throughout,
+    and carry 256 bytes each at consecutive target addresses.
+  - The payloads, concatenated, are the file the view is of.
+"""
+
+import struct
+
+import pytest
+
+from exfat_utils import list_file_entries
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_FAMILY_ID_PRESENT = 0x00002000
+UF2_BLOCK_SIZE = 512
+UF2_PAYLOAD_SIZE = 256
+
+
+def uf2_payload(data):
+    assert len(data) % UF2_BLOCK_SIZE == 0, "Not whole blocks"
+    blocks = len(data) // UF2_BLOCK_SIZE
+    out = bytearray()
+    first = None
+    for i in range(blocks):
+        block = data[i * UF2_BLOCK_SIZE:(i + 1) * UF2_BLOCK_SIZE]
+        m0, m1, flags, addr, size, block_no, num_blocks, family = struct.unpack_from("<8I", block, 0)
+        assert (m0, m1) == (UF2_MAGIC_START0, UF2_MAGIC_START1), f"Block {i}: start magics"
+        assert struct.unpack_from("<I", block, UF2_BLOCK_SIZE - 4)[0] == UF2_MAGIC_END, f"Block {i}: end magic"
+        assert flags == UF2_FLAG_FAMILY_ID_PRESENT
+        assert size == UF2_PAYLOAD_SIZE
+        assert (block_no, num_blocks) == (i, blocks)
+        if first is None:
+            first = (addr, family)
+        assert (addr, family) == (first[0] + i * UF2_PAYLOAD_SIZE, first[1]), f"Block {i}: address or family"
+        out += block[32:32 + size]
+    return bytes(out), first
+
+
+@pytest.fixture
+def uf2_views(read_raw_sector, bootsector_data):
+    files = {name: (cluster, length) for name, cluster, length
+             in list_file_entries(read_raw_sector, bootsector_data)}
+    views = [(name, "FLASH.BIN" if name == "FLASH.UF2" else name[:-4])
+             for name in files if name.lower().endswith(".uf2")]
+    if not views:
+        pytest.skip("No UF2 views; PICOVD_UF2_ENABLED is off, or no partitions")
+    return files, views
+
+
+def test_uf2_views_hold_their_files(uf2_views, cluster_chain_reader):
+    files, views = uf2_views
+    for view, source in views:
+        assert source in files, f"{view} without {source}"
+        payload, (addr, family) = uf2_payload(cluster_chain_reader(files[view][0])(files[view][1]))
+        data = cluster_chain_reader(files[source][0])(files[source][1])
+        assert len(payload) - len(data) < UF2_PAYLOAD_SIZE, f"{view} is not the size of {source}"
+        assert payload[:len(data)] == data, f"{view} does not match {source}"
+        print(f"\n{view}: {len(payload) // UF2_PAYLOAD_SIZE} blocks at 0x{addr:08x}, family 0x{family:08x}")
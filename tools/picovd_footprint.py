@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""
+PicoVD SRAM/flash footprint report.
+
+Attributes the symbols of the PicoVD object files to the compile time
+feature flags in picovd_config.h, and sums their sizes per section class:
+
+  flash  code and read-only data (.text, .rodata), plus .data initialisers
+  data   initialised SRAM (.data)
+  bss    zero-initialised SRAM (.bss, COMMON)
+
+Also reports the largest stack frames (from the GCC -fstack-usage .su files)
+and a worst-case stack depth estimate for the PicoVD entry points (from the
+-fcallgraph-info=su .ci files; direct calls only, so calls through
+the idle job and region tables are not followed).  Configure with -DPICOVD_FOOTPRINT_REPORT=ON
+and build the <target>_footprint target, or run by hand:
+
+  tools/picovd_footprint.py --build-dir build --config picovd_config.h
+"""
+
+import argparse
+import pathlib
+import re
+import subprocess
+import sys
+from collections import defaultdict
+
+# Object files that belong to PicoVD, by source file name
+PICOVD_SOURCES = re.compile(r"^(picovd|vd_[a-z0-9_]+)\.(c|cpp)$")
+
+# Symbol name patterns per feature flag, first match wins.
+# Symbols matching none of these are counted as the always-present core.
+FEATURES = [
+    ("PICOVD_MOUNT_READY_ENABLED",        r"mount_ready"),
+    ("PICOVD_BOOTROM_PARTITIONS_LOAD",    r"partition_table"),
+    ("PICOVD_BOOTROM_PARTITIONS_ENABLED", r"partition"),
+    ("PICOVD_CHANGING_FILE_ENABLED",      r"changing"),
+    ("PICOVD_SRAM_ENABLED",               r"sram"),
+    ("PICOVD_BOOTROM_ENABLED",            r"bootrom"),
+    ("PICOVD_FLASH_ENABLED",              r"flash"),
+]
+
+# Where PicoVD code is entered from, for the stack depth estimate
+STACK_ROOTS = [
+    "main",
+    "tud_msc_read10_cb",
+    "tud_msc_scsi_cb",
+    "tud_msc_scsi_pre_cb",
+    "vd_idle_task",
+    "vd_mount_ready_task",
+]
+
+SECTION_CLASS = {
+    "T": "flash", "t": "flash", "R": "flash", "r": "flash",
+    "D": "data",  "d": "data",
+    "B": "bss",   "b": "bss",   "C": "bss",
+}
+
+
+def source_name(path):
+    """vd_arena.c.obj -> vd_arena.c"""
+    name = path.name
+    for suffix in (".obj", ".o", ".su", ".ci"):
+        if name.endswith(suffix):
+            return name[: -len(suffix)]
+    return name
+
+
+def picovd_files(build_dir, suffixes):
+    for path in sorted(build_dir.rglob("*")):
+        if path.suffix in suffixes and PICOVD_SOURCES.match(source_name(path)):
+            yield path
+
+
+def feature_of(symbol):
+    for flag, pattern in FEATURES:
+        if re.search(pattern, symbol, re.IGNORECASE):
+            return flag
+    return "core"
+
+
+def read_config(config):
+    flags = {}
+    if config:
+        for m in re.finditer(r"#define\s+(PICOVD_\w+)\s+\(?(\d+)\)?", config.read_text()):
+            flags[m.group(1)] = int(m.group(2))
+    return flags
+
+
+def symbol_sizes(nm, objects):
+    """Yield (object, symbol, class, size) for all sized symbols."""
+    for obj in objects:
+        out = subprocess.run([nm, "-S", "-t", "d", "--defined-only", str(obj)],
+                             check=True, capture_output=True, text=True).stdout
+        for line in out.splitlines():
+            parts = line.split()
+            if len(parts) != 4:
+                continue  # No size, e.g. a section or file symbol
+            _, size, kind, name = parts
+            cls = SECTION_CLASS.get(kind)
+            if cls:
+                yield obj, name, cls, int(size)
+
+
+def stack_frames(su_files):
+    """Return {function: (bytes, qualifier)} from the .su files."""
+    frames = {}
+    for su in su_files:
+        for line in su.read_text().splitlines():
+            location, size, qualifier = line.split("\t")
+            function = location.rsplit(":", 1)[-1]
+            frames[function] = (int(size), qualifier)
+    return frames
+
+
+def call_graph(ci_files):
+    """Return ({function: bytes}, {function: set(callees)}) from the .ci files."""
+    sizes, edges = {}, defaultdict(set)
+    node = re.compile(r'node: \{ title: "([^"]+)" label: "[^"]*\\n(\d+) bytes')
+    edge = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+    for ci in ci_files:
+        text = ci.read_text()
+        for m in node.finditer(text):
+            sizes[m.group(1).rsplit(":", 1)[-1]] = int(m.group(2))
+        for m in edge.finditer(text):
+            edges[m.group(1).rsplit(":", 1)[-1]].add(m.group(2).rsplit(":", 1)[-1])
+    return sizes, edges
+
+
+def worst_depth(function, sizes, edges, memo, active):
+    """Deepest stack below `function`; recursion is reported, not followed."""
+    if function in memo:
+        return memo[function]
+    if function in active:
+        return 0, [function + " (recursion)"]
+    active.add(function)
+    best, path = 0, []
+    for callee in edges.get(function, ()):
+        depth, callee_path = worst_depth(callee, sizes, edges, memo, active)
+        if depth > best:
+            best, path = depth, callee_path
+    active.discard(function)
+    memo[function] = (sizes.get(function, 0) + best, [function] + path)
+    return memo[function]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--build-dir", type=pathlib.Path, required=True)
+    ap.add_argument("--config", type=pathlib.Path, help="picovd_config.h, to show the flag values")
+    ap.add_argument("--nm", default="arm-none-eabi-nm")
+    ap.add_argument("--top", type=int, default=10, help="number of largest symbols and frames to list")
+    args = ap.parse_args()
+
+    objects = list(picovd_files(args.build_dir, {".o", ".obj"}))
+    if not objects:
+        sys.exit(f"No PicoVD object files under {args.build_dir}")
+
+    flags = read_config(args.config)
+    totals = defaultdict(lambda: defaultdict(int))
+    symbols = []
+    for obj, name, cls, size in symbol_sizes(args.nm, objects):
+        feature = feature_of(name)
+        totals[feature][cls] += size
+        if cls == "data":
+            totals[feature]["flash"] += size  # Initialiser, copied at startup
+        symbols.append((size, cls, name, source_name(obj)))
+
+    print("PicoVD footprint, in bytes")
+    print()
+    print(f"{'feature':36} {'value':>5} {'flash':>8} {'data':>8} {'bss':>8}")
+    for feature in ["core"] + [flag for flag, _ in FEATURES]:
+        if feature not in totals:
+            continue
+        t = totals[feature]
+        value = "" if feature == "core" else str(flags.get(feature, "?"))
+        print(f"{feature:36} {value:>5} {t['flash']:8} {t['data']:8} {t['bss']:8}")
+    total = {cls: sum(t[cls] for t in totals.values()) for cls in ("flash", "data", "bss")}
+    print(f"{'total':36} {'':>5} {total['flash']:8} {total['data']:8} {total['bss']:8}")
+
+    print()
+    print("Largest SRAM symbols:")
+    for size, cls, name, src in sorted((s for s in symbols if s[1] != "flash"), reverse=True)[: args.top]:
+        print(f"  {size:8} {cls:5} {name} ({src})")
+
+    su_files = list(picovd_files(args.build_dir, {".su"}))
+    if su_files:
+        frames = stack_frames(su_files)
+        print()
+        print("Largest stack frames:")
+        for function, (size, qualifier) in sorted(frames.items(), key=lambda f: -f[1][0])[: args.top]:
+            print(f"  {size:8} {function} ({qualifier})")
+
+    ci_files = list(picovd_files(args.build_dir, {".ci"}))
+    if ci_files:
+        sizes, edges = call_graph(ci_files)
+        memo = {}
+        print()
+        print("Stack high-water estimate, PicoVD frames only:")
+        for root in STACK_ROOTS:
+            if root in sizes:
+                depth, path = worst_depth(root, sizes, edges, memo, set())
+                print(f"  {depth:8} {' > '.join(path)}")
+
+    if not su_files:
+        print()
+        print("No .su files; configure with -DPICOVD_FOOTPRINT_REPORT=ON for stack usage")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""
+Decode a PicoVD TRACE.BIN SCSI command trace (see src/vd_trace.h).
+
+Prints the commands in order, or with --summary, per-trace histograms of
+the host's access pattern: opcodes, READ transfer lengths, sequential
+read-ahead runs, TEST UNIT READY polling intervals, and latencies.
+Give several traces, e.g. one per host OS, to compare them side by side:
+
+  tools/trace_decode.py --summary linux=trace-linux.bin macos=trace-macos.bin
+
+The host caches file contents, so copy TRACE.BIN bypassing the cache,
+e.g. `dd if=/media/PicoVD/TRACE.BIN of=trace.bin iflag=direct` on Linux.
+"""
+
+import argparse
+import collections
+import struct
+import sys
+
+HEADER = struct.Struct("<8sHHHHIII")
+RECORD = struct.Struct("<IIHHBBBB")
+MAGIC = b"PVDTRACE"
+VERSION = 1
+
+OPCODES = {
+    0x00: "TEST UNIT READY",
+    0x03: "REQUEST SENSE",
+    0x12: "INQUIRY",
+    0x1A: "MODE SENSE(6)",
+    0x1B: "START STOP UNIT",
+    0x1E: "PREVENT ALLOW MEDIUM REMOVAL",
+    0x23: "READ FORMAT CAPACITIES",
+    0x25: "READ CAPACITY(10)",
+    0x28: "READ(10)",
+    0x2A: "WRITE(10)",
+    0x2F: "VERIFY(10)",
+    0x35: "SYNCHRONIZE CACHE(10)",
+    0x4A: "GET EVENT STATUS NOTIFICATION",
+    0x5A: "MODE SENSE(10)",
+    0x88: "READ(16)",
+    0x8A: "WRITE(16)",
+    0x9E: "SERVICE ACTION IN(16)",
+    0xA0: "REPORT LUNS",
+    0xA8: "READ(12)",
+    0xAA: "WRITE(12)",
+}
+READS = {0x28, 0x88, 0xA8}
+TEST_UNIT_READY = 0x00
+
+Record = collections.namedtuple("Record", "start_us lba blocks duration opcode sense_key asc ascq")
+
+
+def load(path):
+    """Return the records of a trace, oldest first."""
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, header_size, record_size, _, capacity, count, _ = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        sys.exit(f"{path}: not a PicoVD trace")
+    if version != VERSION or record_size != RECORD.size:
+        sys.exit(f"{path}: unsupported trace version {version}, record size {record_size}")
+    first = max(0, count - capacity)
+    records = []
+    for n in range(first, count):
+        offset = header_size + (n % capacity) * record_size
+        records.append(Record(*RECORD.unpack_from(data, offset)))
+    return records
+
+
+def name(opcode):
+    return OPCODES.get(opcode, f"0x{opcode:02X}")
+
+
+def log2_bucket(value):
+    """Power-of-two bucket label: 0, 1, 2-3, 4-7, ..."""
+    if value < 2:
+        return value, str(value)
+    b = value.bit_length() - 1
+    return 1 << b, f"{1 << b}-{(2 << b) - 1}"
+
+
+def histogram(values):
+    buckets = collections.Counter()
+    labels = {}
+    for v in values:
+        key, label = log2_bucket(v)
+        buckets[key] += 1
+        labels[key] = label
+    return [(labels[k], buckets[k]) for k in sorted(buckets)]
+
+
+def summarise(records):
+    """Return {section: [(label, count)]} for one trace."""
+    reads = [r for r in records if r.opcode in READS]
+
+    # Sequential runs: a read continuing where the previous one ended
+    runs, run, next_lba = [], 0, None
+    for r in reads:
+        if r.lba == next_lba:
+            run += r.blocks
+        else:
+            if run:
+                runs.append(run)
+            run = r.blocks
+        next_lba = r.lba + r.blocks
+    if run:
+        runs.append(run)
+
+    turs = [r.start_us for r in records if r.opcode == TEST_UNIT_READY]
+    tur_intervals = [(b - a) & 0xFFFFFFFF for a, b in zip(turs, turs[1:])]
+
+    completed = [r.duration for r in records if r.duration != 0xFFFF]
+    senses = collections.Counter(f"{r.sense_key:X}/{r.asc:02X}/{r.ascq:02X}"
+                                 for r in records if r.sense_key)
+
+    return {
+        "opcodes": collections.Counter(name(r.opcode) for r in records).most_common(),
+        "read length, blocks": histogram(r.blocks for r in reads),
+        "sequential run, blocks": histogram(runs),
+        "TUR interval, us": histogram(tur_intervals),
+        "latency, us": histogram(completed),
+        "sense key/asc/ascq": senses.most_common(),
+    }
+
+
+def print_summary(traces):
+    summaries = {label: summarise(records) for label, records in traces}
+    labels = [label for label, _ in traces]
+    width = max(12, *(len(l) for l in labels))
+    for section in next(iter(summaries.values())):
+        rows = collections.OrderedDict()
+        for label in labels:
+            for key, count in summaries[label][section]:
+                rows.setdefault(key, {})[label] = count
+        print(f"\n{section}")
+        print(f"  {'':30}" + "".join(f"{l:>{width}}" for l in labels))
+        for key, counts in rows.items():
+            print(f"  {key:30}" + "".join(f"{counts.get(l, 0):>{width}}" for l in labels))
+
+
+def print_records(records):
+    t0 = records[0].start_us if records else 0
+    for r in records:
+        t = ((r.start_us - t0) & 0xFFFFFFFF) / 1000.0
+        duration = "-" if r.duration == 0xFFFF else f"{r.duration}"
+        sense = f" sense {r.sense_key:X}/{r.asc:02X}/{r.ascq:02X}" if r.sense_key else ""
+        print(f"{t:12.3f} ms {name(r.opcode):30} lba {r.lba:8} blocks {r.blocks:5} {duration:>6} us{sense}")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("traces", nargs="+", metavar="[LABEL=]TRACE.BIN")
+    ap.add_argument("--summary", action="store_true", help="print histograms instead of the records")
+    args = ap.parse_args()
+
+    traces = []
+    for arg in args.traces:
+        label, _, path = arg.rpartition("=")
+        traces.append((label or path, load(path)))
+
+    if args.summary:
+        print_summary(traces)
+    else:
+        for label, records in traces:
+            if len(traces) > 1:
+                print(f"== {label}")
+            print_records(records)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,373 @@
+// uf2_drop_sim.c
+//
+// Host-side simulation of the UF2 drop zone, see src/vd_uf2_drop.h.
+//
+// Streams a UF2 file through vd_uf2_drop_write() in 64-byte slices, as
+// TinyUSB does, and runs vd_uf2_drop_task() from a simulated main loop,
+// against a simulated flash with the timings of a typical QSPI NOR part.
+// As on the RP2350, a flash operation stalls the CPU, while the USB
+// controller takes in at most one more packet.  Reports the sustained
+// write throughput, and checks the flash against the file: the pages it
+// targets hold its payload, erased around it, and nothing else changed.
+//
+// Build with PICOVD_UF2_DROP_ENABLED set in picovd_config.h:
+//
+//   SDK=$PICO_SDK_PATH/src
+//   cc -O2 -I. -Isrc -I$SDK/common/boot_uf2_headers/include
+//      -I$SDK/common/boot_picobin_headers/include -I$SDK/rp2350/hardware_regs/include
+//      -o uf2_drop_sim tools/uf2_drop_sim.c src/vd_uf2_drop.c
+//
+//   ./uf2_drop_sim [-e erase_us] [-p program_us] [-u packet_us] [file.uf2]
+//
+// Without a file, a generated 384 kB image for the ARM_S partition, with
+// the RP2350-E10 block, a block sent twice, and the host's metadata writes.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <boot/picobin.h>
+#include <boot/uf2.h>
+#include <hardware/regs/addressmap.h>
+
+#include <picovd_config.h>
+#include "vd_exfat_params.h"
+#include "vd_virtual_disk.h"
+#include "vd_flash_map.h"
+#include "vd_uf2_drop.h"
+
+#define SIM_PACKET            CFG_TUD_MSC_EP_BUFSIZE
+#define SIM_SECTOR            MSC_BLOCK_SIZE
+#define SIM_COMMAND_SECTORS   128u   // 64 kB WRITE10s, as hosts issue them
+#define SIM_BINARY_PAGES      0x20u  // The running binary, write protected
+#define SIM_RETRIES           1000u  // Calls with the same slice before it counts as a livelock
+
+// Microseconds, see -e, -p and -u
+static uint32_t sim_erase_us   = 45000; // 4 kB sector erase, typical
+static uint32_t sim_program_us = 400;   // 256-byte page program, typical
+static uint32_t sim_packet_us  = 53;    // 64-byte bulk OUT packet at full speed
+static uint32_t sim_command_us = 1000;  // CBW and CSW of a WRITE10
+static uint32_t sim_flash_call_us = 20; // Leaving and re-entering XIP
+static uint32_t sim_slice_us   = 2;     // CPU time per write callback
+
+// The partition table: PicoVD, then one partition each for ARM_S and data
+static const struct {
+    uint32_t first_sector, sectors, flags;
+} sim_partitions[] = {
+    { 0x000, SIM_BINARY_PAGES, PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_S_BITS },
+    { 0x020, 0x0E0, PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_S_BITS
+                  | PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_RISCV_BITS },
+    { 0x100, 0x100, PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_DATA_BITS },
+};
+#define SIM_PARTITIONS (sizeof(sim_partitions) / sizeof(sim_partitions[0]))
+
+static uint8_t  sim_flash[PICOVD_FLASH_SIZE_BYTES];
+static uint64_t sim_now;          // Microseconds
+static uint64_t sim_flash_busy;   // Microseconds the CPU stalled in flash operations
+static uint32_t sim_errors;
+static bool     sim_stalled;      // The write callback kept refusing a slice
+static bool     sim_changed;
+
+// ---------------------------------------------------------------------------
+// What the firmware links against
+// ---------------------------------------------------------------------------
+
+bool vd_flash_is_writable(uint32_t flash_offset, uint32_t len) {
+    return len != 0 && flash_offset < PICOVD_FLASH_SIZE_BYTES && len <= PICOVD_FLASH_SIZE_BYTES - flash_offset
+        && flash_offset >= (SIM_BINARY_PAGES << VD_FLASH_PAGE_SHIFT);
+}
+
+static void sim_flash_stall(uint64_t us) {
+    sim_now        += us;
+    sim_flash_busy += us;
+}
+
+bool vd_flash_erase(uint32_t flash_offset, uint32_t len) {
+    if (flash_offset % VD_FLASH_PAGE_SIZE || len % VD_FLASH_PAGE_SIZE || !vd_flash_is_writable(flash_offset, len)) {
+        fprintf(stderr, "erase of %u bytes at 0x%06x refused\n", len, flash_offset);
+        sim_errors++;
+        return false;
+    }
+    memset(sim_flash + flash_offset, 0xFF, len);
+    sim_flash_stall(sim_flash_call_us + (uint64_t)sim_erase_us * (len / VD_FLASH_PAGE_SIZE));
+    return true;
+}
+
+bool vd_flash_program(uint32_t flash_offset, const void *data, uint32_t len) {
+    if (flash_offset % 256u || len % 256u || !vd_flash_is_writable(flash_offset, len)) {
+        fprintf(stderr, "program of %u bytes at 0x%06x refused\n", len, flash_offset);
+        sim_errors++;
+        return false;
+    }
+    const uint8_t *d = data;
+    for (uint32_t i = 0; i < len; i++) {
+        if ((sim_flash[flash_offset + i] & d[i]) != d[i]) {
+            fprintf(stderr, "program at 0x%06x over bits not erased\n", flash_offset + i);
+            sim_errors++;
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        sim_flash[flash_offset + i] &= d[i]; // NOR flash only clears bits
+    }
+    sim_flash_stall(sim_flash_call_us + (uint64_t)sim_program_us * (len / 256u));
+    return true;
+}
+
+bool vd_partition_location(uint32_t part_idx, uint32_t *first_sector, uint32_t *sectors) {
+    if (part_idx >= SIM_PARTITIONS) {
+        return false;
+    }
+    *first_sector = sim_partitions[part_idx].first_sector;
+    *sectors      = sim_partitions[part_idx].sectors;
+    return true;
+}
+
+bool vd_partition_flags(uint32_t part_idx, uint32_t *flags) {
+    if (part_idx >= SIM_PARTITIONS) {
+        return false;
+    }
+    *flags = sim_partitions[part_idx].flags;
+    return true;
+}
+
+void vd_flash_map_invalidate(uint32_t flash_offset, uint32_t len) {
+    (void)flash_offset;
+    (void)len;
+}
+
+void vd_virtual_disk_contents_changed(bool hard_reset) {
+    (void)hard_reset;
+    sim_changed = true;
+}
+
+// ---------------------------------------------------------------------------
+// The file
+// ---------------------------------------------------------------------------
+
+static void sim_block(struct uf2_block *b, uint32_t family_id, uint32_t addr, uint32_t block_no, uint32_t num_blocks) {
+    memset(b, 0, sizeof(*b));
+    b->magic_start0 = UF2_MAGIC_START0;
+    b->magic_start1 = UF2_MAGIC_START1;
+    b->flags        = UF2_FLAG_FAMILY_ID_PRESENT;
+    b->target_addr  = addr;
+    b->payload_size = 256;
+    b->block_no     = block_no;
+    b->num_blocks   = num_blocks;
+    b->file_size    = family_id;
+    b->magic_end    = UF2_MAGIC_END;
+}
+
+// An image for the ARM_S partition, with an erased stretch in the middle,
+// as elf2uf2 writes it for the RP2350; then the blocks the host writes in
+// that order: the E10 block and the image, with a block sent twice and
+// the host's bitmap and directory sectors in between
+static uint8_t *sim_generate(size_t *size) {
+    const uint32_t image_blocks = 384u * 1024u / 256u;
+    struct uf2_block *file = calloc(image_blocks + 4u, sizeof(*file));
+    uint32_t n = 0;
+
+    sim_block(&file[n++], ABSOLUTE_FAMILY_ID, 0x10FFFF00u, 0, 2);
+    memset(file[0].data, 0xEF, 256);
+
+    srand(42);
+    for (uint32_t i = 0; i < image_blocks; i++) {
+        struct uf2_block *b = &file[n++];
+        sim_block(b, RP2350_ARM_S_FAMILY_ID, XIP_BASE + i * 256u, i, image_blocks);
+        for (uint32_t j = 0; j < 256; j++) {
+            b->data[j] = (i >= 512 && i < 576) ? 0xFF : (uint8_t)rand();
+        }
+        if (i == 100) {
+            file[n] = *b;  // Sent twice
+            n++;
+        }
+        if (i == 700) {
+            memset(&file[n++], 0xA5, sizeof(*file)); // A bitmap or directory sector
+        }
+    }
+    memset(&file[n++], 0, sizeof(*file));
+    *size = n * sizeof(*file);
+    return (uint8_t *)file;
+}
+
+static uint8_t *sim_read(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size + SIM_SECTOR);
+    if (fread(data, 1, *size, f) != *size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+    memset(data + *size, 0, SIM_SECTOR);
+    *size = (*size + SIM_SECTOR - 1u) / SIM_SECTOR * SIM_SECTOR;
+    return data;
+}
+
+// ---------------------------------------------------------------------------
+// The expected flash, worked out independently of the firmware
+// ---------------------------------------------------------------------------
+
+static int64_t sim_expected_offset(const struct uf2_block *b) {
+    if (b->magic_start0 != UF2_MAGIC_START0 || b->magic_start1 != UF2_MAGIC_START1 || b->magic_end != UF2_MAGIC_END
+        || (b->flags & UF2_FLAG_NOT_MAIN_FLASH) || b->payload_size != 256 || b->target_addr % 256u
+        || b->target_addr < XIP_BASE || b->block_no >= b->num_blocks) {
+        return -1;
+    }
+    const uint32_t family_id = (b->flags & UF2_FLAG_FAMILY_ID_PRESENT) ? b->file_size : ABSOLUTE_FAMILY_ID;
+    const uint32_t rel       = b->target_addr - XIP_BASE;
+    uint32_t       base      = 0;
+    uint32_t       size      = PICOVD_FLASH_SIZE_BYTES;
+    if (family_id == ABSOLUTE_FAMILY_ID && b->target_addr == 0x10FFFF00u) {
+        return -1;
+    }
+    if (family_id != ABSOLUTE_FAMILY_ID) {
+        const uint32_t accepts =
+            family_id == RP2350_ARM_S_FAMILY_ID  ? PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_S_BITS  :
+            family_id == RP2350_RISCV_FAMILY_ID  ? PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_RISCV_BITS  :
+            family_id == RP2350_ARM_NS_FAMILY_ID ? PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2350_ARM_NS_BITS :
+            family_id == DATA_FAMILY_ID          ? PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_DATA_BITS          :
+            family_id == RP2040_FAMILY_ID        ? PICOBIN_PARTITION_FLAGS_ACCEPTS_DEFAULT_FAMILY_RP2040_BITS        : 0;
+        size_t p = 0;
+        while (p < SIM_PARTITIONS && (!(sim_partitions[p].flags & accepts) || sim_partitions[p].first_sector < SIM_BINARY_PAGES)) {
+            p++;
+        }
+        if (p == SIM_PARTITIONS) {
+            return -1;
+        }
+        base = sim_partitions[p].first_sector << VD_FLASH_PAGE_SHIFT;
+        size = sim_partitions[p].sectors << VD_FLASH_PAGE_SHIFT;
+    }
+    if (rel >= size || base + rel < (SIM_BINARY_PAGES << VD_FLASH_PAGE_SHIFT)) {
+        return -1;
+    }
+    return base + rel;
+}
+
+// The blocks to program, each counted once
+static uint32_t sim_expect(const uint8_t *file, size_t size, uint8_t *expected) {
+    static bool touched[VD_FLASH_PAGES];
+    static bool written[PICOVD_FLASH_SIZE_BYTES / 256u];
+    uint32_t blocks = 0;
+    for (size_t at = 0; at < size; at += SIM_SECTOR) {
+        const int64_t offset = sim_expected_offset((const struct uf2_block *)(file + at));
+        if (offset >= 0 && !touched[offset >> VD_FLASH_PAGE_SHIFT]) {
+            touched[offset >> VD_FLASH_PAGE_SHIFT] = true;
+            memset(expected + (offset & ~(int64_t)(VD_FLASH_PAGE_SIZE - 1u)), 0xFF, VD_FLASH_PAGE_SIZE);
+        }
+    }
+    for (size_t at = 0; at < size; at += SIM_SECTOR) {
+        const struct uf2_block *b = (const struct uf2_block *)(file + at);
+        const int64_t offset = sim_expected_offset(b);
+        if (offset >= 0) {
+            memcpy(expected + offset, b->data, 256);
+            blocks += !written[offset / 256u];
+            written[offset / 256u] = true;
+        }
+    }
+    return blocks;
+}
+
+// ---------------------------------------------------------------------------
+// The bus and the main loop
+// ---------------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "e:p:u:")) != -1) {
+        switch (opt) {
+        case 'e': sim_erase_us   = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'p': sim_program_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'u': sim_packet_us  = (uint32_t)strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-e erase_us] [-p program_us] [-u packet_us] [file.uf2]\n", argv[0]);
+            return 1;
+        }
+    }
+    size_t   size;
+    uint8_t *file = optind < argc ? sim_read(argv[optind], &size) : sim_generate(&size);
+
+    // A flash with an old image everywhere
+    for (size_t i = 0; i < sizeof(sim_flash); i++) {
+        sim_flash[i] = (uint8_t)(i * 7u + (i >> 12));
+    }
+    static uint8_t expected[PICOVD_FLASH_SIZE_BYTES];
+    memcpy(expected, sim_flash, sizeof(expected));
+    const uint32_t expected_blocks = sim_expect(file, size, expected);
+
+    // The host writes the file into the drop zone, a WRITE10 at a time.
+    // `ready` is when the next packet is in the endpoint buffer: the host
+    // keeps sending while the CPU is in a flash operation, one packet ahead.
+    const uint32_t packets = (uint32_t)(size / SIM_PACKET);
+    uint32_t       sent    = 0;
+    uint64_t       ready   = sim_command_us + sim_packet_us;
+    while (sent < packets) {
+        if (sim_now >= ready) {
+            // A slice left unconsumed comes straight back, within the same
+            // tud_task(): the main loop gets no turn in between
+            const uint32_t at    = sent * SIM_PACKET;
+            uint32_t       tries = 0;
+            int32_t        ret;
+            do {
+                ret = vd_uf2_drop_write(at / SIM_SECTOR, at % SIM_SECTOR, file + at, SIM_PACKET);
+                sim_now += sim_slice_us;
+            } while (ret == 0 && ++tries < SIM_RETRIES);
+            if (ret != SIM_PACKET) {
+                fprintf(stderr, "slice at 0x%06x not consumed after %u tries\n", at, SIM_RETRIES);
+                sim_stalled = true;
+                break;
+            }
+            sent++;
+            ready = (ready > sim_now ? ready : sim_now) + sim_packet_us;
+            if (sent % (SIM_COMMAND_SECTORS * SIM_SECTOR / SIM_PACKET) == 0) {
+                ready += sim_command_us;
+            }
+        }
+        const uint64_t before = sim_now;
+        vd_uf2_drop_task();
+        if (sim_now == before && sim_now < ready) {
+            sim_now = ready; // Waiting for the bus
+        }
+    }
+    const uint64_t streamed = sim_now;
+
+    // Then the host waits for its SYNCHRONIZE CACHE
+    vd_uf2_drop_flush();
+    vd_uf2_drop_task();
+    const uint64_t done = sim_now;
+
+    const vd_uf2_drop_counters_t *c = vd_uf2_drop_counters();
+    uint32_t wrong = 0;
+    for (size_t i = 0; i < sizeof(sim_flash); i++) {
+        if (sim_flash[i] != expected[i]) {
+            if (wrong++ < 8) {
+                fprintf(stderr, "flash 0x%06zx is 0x%02x, expected 0x%02x\n", i, sim_flash[i], expected[i]);
+            }
+        }
+    }
+
+    printf("file            %8zu bytes, %u blocks to program\n", size, expected_blocks);
+    printf("blocks          %8u staged, %u ignored, %u programmed\n", c->blocks, c->ignored, c->programmed);
+    printf("flash           %8u erases, %u programs, %.1f blocks per program\n",
+           c->erases, c->programs, c->programs ? (double)c->programmed / c->programs : 0.0);
+    printf("busy            %8u blocks waited for a staging page\n", c->busy);
+    printf("time            %8.1f ms streaming, %.1f ms to sync, %.1f ms in flash operations\n",
+           streamed / 1e3, (done - streamed) / 1e3, sim_flash_busy / 1e3);
+    printf("throughput      %8.1f kB/s of file, %.1f kB/s programmed\n",
+           size / (done / 1e6) / 1e3, c->programmed * 256.0 / (done / 1e6) / 1e3);
+    printf("files           %8u completed%s\n", c->files, sim_changed ? ", host told" : "");
+
+    const bool ok = !sim_stalled && wrong == 0 && sim_errors == 0 && c->programmed == expected_blocks && c->files >= 1;
+    printf("%s: %u bytes differ, %u flash errors\n", ok ? "PASS" : "FAIL", wrong, sim_errors);
+    free(file);
+    return ok ? 0 : 1;
+}